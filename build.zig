@@ -124,9 +124,12 @@ pub fn build(b: *std.Build) !void {
                 "hydra/camera.cpp",
                 "hydra/instancer.cpp",
                 "hydra/material.cpp",
+                "hydra/textureCache.cpp",
+                "hydra/texels.cpp",
             },
         });
         lib.linkLibrary(zig_lib);
+        if (engine_options.tracing) lib.defineCMacro("MOONSHINE_TRACING", null);
 
         // options
         const usd_dir = b.option([]const u8, "usd-path", "Where your USD SDK is installed.") orelse "../USD";
@@ -141,6 +144,7 @@ pub fn build(b: *std.Build) !void {
             lib.linkSystemLibrary("usd_hd");
             lib.linkSystemLibrary("usd_sdr");
             lib.linkSystemLibrary("usd_hio");
+            lib.linkSystemLibrary("usd_work");
         }
         
         // include headers necessary for usd
@@ -291,6 +295,7 @@ const ShaderSource = enum {
 pub const EngineOptions = struct {
     vk_validation: bool = false,
     vk_metrics: bool = false,
+    tracing: bool = false, // CPU tracing spans, compiled out entirely when disabled
     shader_source: ShaderSource = .embed,
     rt_shader_compile_cmd: []const []const u8 = &(rt_shader_compile_cmd ++ [_][]const u8{ "-Fo", "/dev/stdout" }), // TODO: windows
     compute_shader_compile_cmd: []const []const u8 = &(compute_shader_compile_cmd ++ [_][]const u8{ "-Fo", "/dev/stdout" }), // TODO: windows
@@ -307,6 +312,10 @@ pub const EngineOptions = struct {
             options.vk_validation = vk_validation;
         }
 
+        if (b.option(bool, "tracing", "Record CPU tracing spans and write them out as a Chrome trace")) |tracing| {
+            options.tracing = tracing;
+        }
+
         return options;
     }
 };
@@ -319,6 +328,7 @@ fn makeEngineModule(b: *std.Build, vk: *std.Build.Module, options: EngineOptions
     const build_options = b.addOptions();
     build_options.addOption(bool, "vk_validation", options.vk_validation);
     build_options.addOption(bool, "vk_metrics", options.vk_metrics);
+    build_options.addOption(bool, "tracing", options.tracing);
     build_options.addOption(ShaderSource, "shader_source", if (target.result.os.tag == .linux) options.shader_source else .embed); // hot reload currently only supported on linux
     build_options.addOption([]const []const u8, "rt_shader_compile_cmd", options.rt_shader_compile_cmd);  // shader compilation command to use if shaders are to be loaded at runtime
     build_options.addOption([]const []const u8, "compute_shader_compile_cmd", options.compute_shader_compile_cmd);  // shader compilation command to use if shaders are to be loaded at runtime
@@ -389,6 +399,11 @@ fn makeEngineModule(b: *std.Build, vk: *std.Build.Module, options: EngineOptions
             "shaders/utils/helpers.hlsl",
         },
     });
+    compute_shader_comp.add("@\"output/convert.hlsl\"", "shaders/output/convert.hlsl", .{
+        .watched_files = &.{
+            "shaders/utils/helpers.hlsl",
+        },
+    });
 
     imports.appendSlice(&.{
         .{
@@ -1,6 +1,13 @@
 // vulkan allocator
-// currently essentially just a passthrough allocator
-// functions here are just utilites that help with stuff
+//
+// sub-allocates buffers and images from large per-memory-type blocks,
+// with anything too big for a block getting a dedicated allocation
+//
+// allocations know where they came from, so resources can be freed
+// through their own `destroy` without the allocator on hand
+//
+// what's allocated is accounted for by category, which is picked by
+// allocating through a copy made with `withCategory`
 
 const vk = @import("vulkan");
 const std = @import("std");
@@ -8,10 +15,299 @@ const VulkanContext = @import("../engine.zig").core.VulkanContext;
 
 const Self = @This();
 
-const MemoryStorage = std.ArrayListUnmanaged(vk.DeviceMemory);
+// heap allocated so allocations can point back to it
+// regardless of where this struct gets copied to
+state: *State,
+
+// what allocations made through this copy are accounted as
+category: Category = .other,
+
+// what allocations are for, so usage can be broken down
+pub const Category = enum {
+    mesh,
+    accel, // acceleration structures, along with what they're built from and with
+    texture,
+    sensor,
+    staging, // host memory for getting data to and from the GPU
+    other,
+};
+
+pub const Usage = struct {
+    allocation_count: u32 = 0,
+    bytes: vk.DeviceSize = 0,
+
+    fn add(self: *Usage, bytes: vk.DeviceSize) void {
+        self.allocation_count += 1;
+        self.bytes += bytes;
+    }
+
+    fn remove(self: *Usage, bytes: vk.DeviceSize) void {
+        self.allocation_count -= 1;
+        self.bytes -= bytes;
+    }
+};
+
+pub const Statistics = struct {
+    // what has been handed out
+    categories: std.EnumArray(Category, Usage) = std.EnumArray(Category, Usage).initFill(.{}),
+
+    // device memory actually allocated from vulkan, including unused space in blocks
+    reserved: Usage = .{},
+};
+
+// of device local memory, i.e. VRAM on discrete GPUs
+pub const Budget = struct {
+    budget: vk.DeviceSize, // how much this process can use before things start going wrong
+    usage: vk.DeviceSize, // how much it does use, including what was allocated elsewhere
+
+    // how far usage would be over budget if bytes more were allocated
+    pub fn excess(self: Budget, bytes: vk.DeviceSize) vk.DeviceSize {
+        return (self.usage + bytes) -| self.budget;
+    }
+};
 
-memory_type_properties: []vk.MemoryPropertyFlags,
-memory: MemoryStorage,
+// without VK_EXT_memory_budget, the driver gives no idea of what else is
+// using memory, so assume what we allocate can have most of the heap
+const fallback_budget_percent = 80;
+
+const default_block_size = 64 * 1024 * 1024;
+const min_map_alignment = 64; // what vkMapMemory guarantees
+
+const Range = struct {
+    offset: vk.DeviceSize,
+    size: vk.DeviceSize,
+};
+
+const Block = struct {
+    pool: *Pool,
+    memory: vk.DeviceMemory,
+    size: vk.DeviceSize,
+    mapped: ?[*]u8, // whole block is mapped for its lifetime if host visible
+
+    // sorted by offset, never adjacent to each other
+    //
+    // always has capacity for allocation_count + 1 ranges, which is the most
+    // it can ever hold, so freeing never needs to allocate
+    free_ranges: std.ArrayListUnmanaged(Range),
+    allocation_count: u32,
+
+    // first fit
+    fn allocate(self: *Block, allocator: std.mem.Allocator, size: vk.DeviceSize, alignment: vk.DeviceSize) !?vk.DeviceSize {
+        try self.free_ranges.ensureTotalCapacity(allocator, self.allocation_count + 2);
+
+        for (self.free_ranges.items, 0..) |*range, i| {
+            const offset = std.mem.alignForward(vk.DeviceSize, range.offset, alignment);
+            const range_end = range.offset + range.size;
+            if (offset + size > range_end) continue;
+
+            const end = offset + size;
+            if (offset == range.offset and end == range_end) {
+                _ = self.free_ranges.orderedRemove(i);
+            } else if (offset == range.offset) {
+                range.* = .{ .offset = end, .size = range_end - end };
+            } else if (end == range_end) {
+                range.size = offset - range.offset;
+            } else {
+                range.size = offset - range.offset;
+                self.free_ranges.insertAssumeCapacity(i + 1, .{ .offset = end, .size = range_end - end });
+            }
+            self.allocation_count += 1;
+            return offset;
+        }
+
+        return null;
+    }
+
+    fn free(self: *Block, offset: vk.DeviceSize, size: vk.DeviceSize) void {
+        const ranges = self.free_ranges.items;
+
+        // index of first range after the freed one
+        var low: usize = 0;
+        var high: usize = ranges.len;
+        while (low < high) {
+            const mid = low + (high - low) / 2;
+            if (ranges[mid].offset < offset) low = mid + 1 else high = mid;
+        }
+        const i = low;
+
+        const merges_prev = i > 0 and ranges[i - 1].offset + ranges[i - 1].size == offset;
+        const merges_next = i < ranges.len and offset + size == ranges[i].offset;
+
+        if (merges_prev and merges_next) {
+            ranges[i - 1].size += size + ranges[i].size;
+            _ = self.free_ranges.orderedRemove(i);
+        } else if (merges_prev) {
+            ranges[i - 1].size += size;
+        } else if (merges_next) {
+            ranges[i].offset = offset;
+            ranges[i].size += size;
+        } else {
+            self.free_ranges.insertAssumeCapacity(i, .{ .offset = offset, .size = size });
+        }
+        self.allocation_count -= 1;
+    }
+};
+
+const Pool = struct {
+    memory_type: u5,
+    block_size: vk.DeviceSize,
+    device_address: bool,
+    blocks: std.ArrayListUnmanaged(*Block) = .{},
+};
+
+const State = struct {
+    mutex: std.Thread.Mutex,
+    allocator: std.mem.Allocator,
+    memory_type_properties: []vk.MemoryPropertyFlags,
+    memory_properties: vk.PhysicalDeviceMemoryProperties,
+    heap_reserved: [vk.MAX_MEMORY_HEAPS]vk.DeviceSize, // for the fallback budget
+
+    // two per memory type, one for buffers and one for images, as keeping
+    // them apart means never having to care about buffer-image granularity
+    pools: []Pool,
+
+    dedicated: std.ArrayListUnmanaged(vk.DeviceMemory),
+    statistics: Statistics,
+
+    fn allocateMemory(self: *State, vc: *const VulkanContext, memory_type: u5, size: vk.DeviceSize, device_address: bool) !vk.DeviceMemory {
+        const memory = try vc.device.allocateMemory(&.{
+            .allocation_size = size,
+            .memory_type_index = memory_type,
+            .p_next = if (device_address) &vk.MemoryAllocateFlagsInfo {
+                .device_mask = 0,
+                .flags = .{ .device_address_bit = true },
+            } else null,
+        }, null);
+        self.statistics.reserved.add(size);
+        self.heap_reserved[self.memory_properties.memory_types[memory_type].heap_index] += size;
+        return memory;
+    }
+
+    fn freeMemory(self: *State, vc: *const VulkanContext, memory: vk.DeviceMemory, memory_type: u5, size: vk.DeviceSize) void {
+        vc.device.freeMemory(memory, null);
+        self.statistics.reserved.remove(size);
+        self.heap_reserved[self.memory_properties.memory_types[memory_type].heap_index] -= size;
+    }
+
+    fn mapIfHostVisible(self: *State, vc: *const VulkanContext, memory_type: u5, memory: vk.DeviceMemory) !?[*]u8 {
+        if (!self.memory_type_properties[memory_type].contains(.{ .host_visible_bit = true })) return null;
+        return @ptrCast((try vc.device.mapMemory(memory, 0, vk.WHOLE_SIZE, .{})).?);
+    }
+
+    fn allocate(self: *State, vc: *const VulkanContext, requirements: vk.MemoryRequirements, properties: vk.MemoryPropertyFlags, kind: enum { buffer, image }, category: Category) !Allocation {
+        const memory_type = try findMemoryTypeIn(self.memory_type_properties, requirements.memory_type_bits, properties);
+        const pool = &self.pools[@as(usize, memory_type) * 2 + @intFromEnum(kind)];
+
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        var allocation = Allocation {
+            .state = self,
+            .size = requirements.size,
+            .memory_type = memory_type,
+            .category = category,
+        };
+
+        if (requirements.size > pool.block_size / 2) {
+            allocation.memory = try self.allocateMemory(vc, memory_type, requirements.size, pool.device_address);
+            errdefer self.freeMemory(vc, allocation.memory, memory_type, requirements.size);
+            allocation.mapped = try self.mapIfHostVisible(vc, memory_type, allocation.memory);
+            try self.dedicated.append(self.allocator, allocation.memory);
+        } else {
+            // mapped pointers into the block should be as aligned as if they were mapped on their own
+            const host_visible = self.memory_type_properties[memory_type].contains(.{ .host_visible_bit = true });
+            const alignment = if (host_visible) @max(requirements.alignment, min_map_alignment) else requirements.alignment;
+
+            for (pool.blocks.items) |block| {
+                if (try block.allocate(self.allocator, requirements.size, alignment)) |offset| {
+                    allocation.block = block;
+                    allocation.offset = offset;
+                    break;
+                }
+            } else {
+                const block = try self.createBlock(vc, pool);
+                errdefer self.destroyBlock(vc, block);
+                allocation.offset = (try block.allocate(self.allocator, requirements.size, alignment)).?;
+                try pool.blocks.append(self.allocator, block);
+                allocation.block = block;
+            }
+
+            const block = allocation.block.?;
+            allocation.memory = block.memory;
+            allocation.mapped = if (block.mapped) |mapped| mapped + allocation.offset else null;
+        }
+
+        self.statistics.categories.getPtr(category).add(requirements.size);
+        return allocation;
+    }
+
+    fn free(self: *State, vc: *const VulkanContext, allocation: Allocation) void {
+        self.mutex.lock();
+        defer self.mutex.unlock();
+
+        self.statistics.categories.getPtr(allocation.category).remove(allocation.size);
+
+        if (allocation.block) |block| {
+            block.free(allocation.offset, allocation.size);
+
+            // keep the last block of each pool around, so that something
+            // repeatedly created and destroyed doesn't hit vulkan every time
+            const pool = block.pool;
+            if (block.allocation_count == 0 and pool.blocks.items.len > 1) {
+                const index = std.mem.indexOfScalar(*Block, pool.blocks.items, block).?;
+                _ = pool.blocks.swapRemove(index);
+                self.destroyBlock(vc, block);
+            }
+        } else {
+            const index = std.mem.indexOfScalar(vk.DeviceMemory, self.dedicated.items, allocation.memory).?;
+            _ = self.dedicated.swapRemove(index);
+            self.freeMemory(vc, allocation.memory, allocation.memory_type, allocation.size);
+        }
+    }
+
+    fn createBlock(self: *State, vc: *const VulkanContext, pool: *Pool) !*Block {
+        const block = try self.allocator.create(Block);
+        errdefer self.allocator.destroy(block);
+
+        const memory = try self.allocateMemory(vc, pool.memory_type, pool.block_size, pool.device_address);
+        errdefer self.freeMemory(vc, memory, pool.memory_type, pool.block_size);
+
+        var free_ranges = std.ArrayListUnmanaged(Range) {};
+        try free_ranges.append(self.allocator, .{ .offset = 0, .size = pool.block_size });
+
+        block.* = Block {
+            .pool = pool,
+            .memory = memory,
+            .size = pool.block_size,
+            .mapped = try self.mapIfHostVisible(vc, pool.memory_type, memory),
+            .free_ranges = free_ranges,
+            .allocation_count = 0,
+        };
+        return block;
+    }
+
+    fn destroyBlock(self: *State, vc: *const VulkanContext, block: *Block) void {
+        self.freeMemory(vc, block.memory, block.pool.memory_type, block.size); // implicitly unmaps
+        block.free_ranges.deinit(self.allocator);
+        self.allocator.destroy(block);
+    }
+};
+
+pub const Allocation = struct {
+    state: ?*State = null,
+    block: ?*Block = null, // null if dedicated
+    memory: vk.DeviceMemory = .null_handle,
+    offset: vk.DeviceSize = 0,
+    size: vk.DeviceSize = 0,
+    mapped: ?[*]u8 = null,
+    memory_type: u5 = 0,
+    category: Category = .other,
+
+    // whatever is bound to this must already have been destroyed
+    pub fn free(self: Allocation, vc: *const VulkanContext) void {
+        if (self.state) |state| state.free(vc, self);
+    }
+};
 
 pub fn create(vc: *const VulkanContext, allocator: std.mem.Allocator) !Self {
     const properties = vc.instance.getPhysicalDeviceMemoryProperties(vc.physical_device.handle);
@@ -19,34 +315,134 @@ pub fn create(vc: *const VulkanContext, allocator: std.mem.Allocator) !Self {
     const memory_type_properties = try allocator.alloc(vk.MemoryPropertyFlags, properties.memory_type_count);
     errdefer allocator.free(memory_type_properties);
 
-    for (properties.memory_types[0..properties.memory_type_count], memory_type_properties) |memory_type, *memory_type_property| {
+    const pools = try allocator.alloc(Pool, properties.memory_type_count * 2);
+    errdefer allocator.free(pools);
+
+    for (properties.memory_types[0..properties.memory_type_count], memory_type_properties, 0..) |memory_type, *memory_type_property, i| {
         memory_type_property.* = memory_type.property_flags;
+
+        // small heaps, e.g. device local host visible ones, shouldn't be eaten up by a few blocks
+        const heap_size = properties.memory_heaps[memory_type.heap_index].size;
+        const block_size = @min(default_block_size, heap_size / 8);
+
+        pools[i * 2 + 0] = Pool {
+            .memory_type = @intCast(i),
+            .block_size = block_size,
+            .device_address = true, // any buffer in the block may need it
+        };
+        pools[i * 2 + 1] = Pool {
+            .memory_type = @intCast(i),
+            .block_size = block_size,
+            .device_address = false,
+        };
     }
 
-    return Self {
+    const state = try allocator.create(State);
+    state.* = State {
+        .mutex = .{},
+        .allocator = allocator,
         .memory_type_properties = memory_type_properties,
-        .memory = MemoryStorage {},
+        .memory_properties = properties,
+        .heap_reserved = [_]vk.DeviceSize { 0 } ** vk.MAX_MEMORY_HEAPS,
+        .pools = pools,
+        .dedicated = .{},
+        .statistics = .{},
+    };
+
+    return Self {
+        .state = state,
     };
 }
 
+// frees anything still allocated
 pub fn destroy(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
-    for (self.memory.items) |memory| {
-        vc.device.freeMemory(memory, null);
+    for (self.state.pools) |*pool| {
+        for (pool.blocks.items) |block| self.state.destroyBlock(vc, block);
+        pool.blocks.deinit(allocator);
     }
-    self.memory.deinit(allocator);
-    allocator.free(self.memory_type_properties);
+    for (self.state.dedicated.items) |memory| vc.device.freeMemory(memory, null);
+    self.state.dedicated.deinit(allocator);
+    allocator.free(self.state.pools);
+    allocator.free(self.state.memory_type_properties);
+    allocator.destroy(self.state);
 }
 
+// a copy that accounts what it allocates as category, sharing
+// everything else with self
+pub fn withCategory(self: *const Self, category: Category) Self {
+    return Self {
+        .state = self.state,
+        .category = category,
+    };
+}
 
-pub fn findMemoryType(self: *const Self, type_filter: u32, properties: vk.MemoryPropertyFlags) !u5 {
-    return for (0..self.memory_type_properties.len) |i| {
-        if (type_filter & (@as(u32, 1) << @intCast(i)) != 0 and self.memory_type_properties[i].contains(properties)) {
+pub fn getStatistics(self: *const Self) Statistics {
+    self.state.mutex.lock();
+    defer self.state.mutex.unlock();
+    return self.state.statistics;
+}
+
+pub fn getBudget(self: *const Self, vc: *const VulkanContext) Budget {
+    const heaps = self.state.memory_properties.memory_heaps[0..self.state.memory_properties.memory_heap_count];
+
+    var budget = Budget {
+        .budget = 0,
+        .usage = 0,
+    };
+
+    if (vc.physical_device.memory_budget) {
+        var budget_properties = vk.PhysicalDeviceMemoryBudgetPropertiesEXT {
+            .heap_budget = undefined,
+            .heap_usage = undefined,
+        };
+        var properties = vk.PhysicalDeviceMemoryProperties2 {
+            .p_next = &budget_properties,
+            .memory_properties = undefined,
+        };
+        vc.instance.getPhysicalDeviceMemoryProperties2(vc.physical_device.handle, &properties);
+
+        for (heaps, 0..) |heap, i| {
+            if (!heap.flags.device_local_bit) continue;
+            budget.budget += budget_properties.heap_budget[i];
+            budget.usage += budget_properties.heap_usage[i];
+        }
+    } else {
+        self.state.mutex.lock();
+        defer self.state.mutex.unlock();
+
+        for (heaps, 0..) |heap, i| {
+            if (!heap.flags.device_local_bit) continue;
+            budget.budget += heap.size / 100 * fallback_budget_percent;
+            budget.usage += self.state.heap_reserved[i];
+        }
+    }
+
+    return budget;
+}
+
+fn findMemoryTypeIn(memory_type_properties: []const vk.MemoryPropertyFlags, type_filter: u32, properties: vk.MemoryPropertyFlags) !u5 {
+    return for (0..memory_type_properties.len) |i| {
+        if (type_filter & (@as(u32, 1) << @intCast(i)) != 0 and memory_type_properties[i].contains(properties)) {
             break @intCast(i);
         }
     } else error.UnavailbleMemoryType;
 }
 
-fn createRawBuffer(self: *Self, vc: *const VulkanContext, size: vk.DeviceSize, usage: vk.BufferUsageFlags, properties: vk.MemoryPropertyFlags, buffer: *vk.Buffer, buffer_memory: *vk.DeviceMemory) !void {
+pub fn findMemoryType(self: *const Self, type_filter: u32, properties: vk.MemoryPropertyFlags) !u5 {
+    return findMemoryTypeIn(self.state.memory_type_properties, type_filter, properties);
+}
+
+// allocates and binds device local memory for image
+pub fn allocateImage(self: *Self, vc: *const VulkanContext, image: vk.Image) !Allocation {
+    const allocation = try self.state.allocate(vc, vc.device.getImageMemoryRequirements(image), .{ .device_local_bit = true }, .image, self.category);
+    errdefer allocation.free(vc);
+
+    try vc.device.bindImageMemory(image, allocation.memory, allocation.offset);
+
+    return allocation;
+}
+
+fn createRawBuffer(self: *Self, vc: *const VulkanContext, size: vk.DeviceSize, usage: vk.BufferUsageFlags, properties: vk.MemoryPropertyFlags, buffer: *vk.Buffer, allocation: *Allocation) !void {
     buffer.* = try vc.device.createBuffer(&.{
             .size = size,
             .usage = usage,
@@ -54,21 +450,10 @@ fn createRawBuffer(self: *Self, vc: *const VulkanContext, size: vk.DeviceSize, u
     }, null);
     errdefer vc.device.destroyBuffer(buffer.*, null);
 
-    const mem_requirements = vc.device.getBufferMemoryRequirements(buffer.*);
+    allocation.* = try self.state.allocate(vc, vc.device.getBufferMemoryRequirements(buffer.*), properties, .buffer, self.category);
+    errdefer allocation.free(vc);
 
-    const allocate_info = vk.MemoryAllocateInfo {
-        .allocation_size = mem_requirements.size,
-        .memory_type_index = try self.findMemoryType(mem_requirements.memory_type_bits, properties),
-        .p_next = if (usage.contains(.{ .shader_device_address_bit = true })) &vk.MemoryAllocateFlagsInfo {
-            .device_mask = 0,
-            .flags = .{ .device_address_bit = true },
-            } else null,
-    };
-
-    buffer_memory.* = try vc.device.allocateMemory(&allocate_info, null);
-    errdefer vc.device.freeMemory(buffer_memory.*, null);
-
-    try vc.device.bindBufferMemory(buffer.*, buffer_memory.*, 0);
+    try vc.device.bindBufferMemory(buffer.*, allocation.memory, allocation.offset);
 }
 
 pub fn DeviceBuffer(comptime T: type) type {
@@ -76,11 +461,13 @@ pub fn DeviceBuffer(comptime T: type) type {
     if (type_info == .Struct and type_info.Struct.layout == .auto) @compileError("Struct layout of " ++ @typeName(T) ++ " must be specified explicitly, but is not");
     return struct {
         handle: vk.Buffer = .null_handle,
+        allocation: Allocation = .{},
 
         const BufferSelf = @This();
 
         pub fn destroy(self: BufferSelf, vc: *const VulkanContext) void {
             vc.device.destroyBuffer(self.handle, null);
+            self.allocation.free(vc);
         }
 
         // must've been created with shader device address bit enabled
@@ -100,28 +487,27 @@ pub fn DeviceBuffer(comptime T: type) type {
     };
 }
 
-pub fn createDeviceBuffer(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator, comptime T: type, count: vk.DeviceSize, usage: vk.BufferUsageFlags) !DeviceBuffer(T) {
+pub fn createDeviceBuffer(self: *Self, vc: *const VulkanContext, comptime T: type, count: vk.DeviceSize, usage: vk.BufferUsageFlags) !DeviceBuffer(T) {
     if (count == 0) return DeviceBuffer(T) {};
 
     var buffer: vk.Buffer = undefined;
-    var memory: vk.DeviceMemory = undefined;
-    try self.createRawBuffer(vc, @sizeOf(T) * count, usage, .{ .device_local_bit = true }, &buffer, &memory);
-
-    try self.memory.append(allocator, memory);
+    var allocation: Allocation = undefined;
+    try self.createRawBuffer(vc, @sizeOf(T) * count, usage, .{ .device_local_bit = true }, &buffer, &allocation);
 
     return DeviceBuffer(T) {
         .handle = buffer,
+        .allocation = allocation,
     };
 }
 
-// buffer that owns it's own memory; good for temp buffers which will quickly be destroyed
+// untyped buffer; good for temp buffers which will quickly be destroyed
 pub const OwnedDeviceBuffer = struct {
-    handle: vk.Buffer,
-    memory: vk.DeviceMemory,
+    handle: vk.Buffer = .null_handle,
+    allocation: Allocation = .{},
 
     pub fn destroy(self: OwnedDeviceBuffer, vc: *const VulkanContext) void {
         vc.device.destroyBuffer(self.handle, null);
-        vc.device.freeMemory(self.memory, null);
+        self.allocation.free(vc);
     }
 
     // must've been created with shader device address bit enabled
@@ -134,19 +520,19 @@ pub const OwnedDeviceBuffer = struct {
 
 pub fn createOwnedDeviceBuffer(self: *Self, vc: *const VulkanContext, size: vk.DeviceSize, usage: vk.BufferUsageFlags) !OwnedDeviceBuffer {
     var buffer: vk.Buffer = undefined;
-    var memory: vk.DeviceMemory = undefined;
-    try self.createRawBuffer(vc, size, usage, .{ .device_local_bit = true }, &buffer, &memory);
+    var allocation: Allocation = undefined;
+    try self.createRawBuffer(vc, size, usage, .{ .device_local_bit = true }, &buffer, &allocation);
 
     return OwnedDeviceBuffer {
         .handle = buffer,
-        .memory = memory,
+        .allocation = allocation,
     };
 }
 
 pub fn HostBuffer(comptime T: type) type {
     return struct {
         handle: vk.Buffer = .null_handle,
-        memory: vk.DeviceMemory = .null_handle,
+        allocation: Allocation = .{},
         data: []T = &.{},
 
         const BufferSelf = @This();
@@ -154,8 +540,7 @@ pub fn HostBuffer(comptime T: type) type {
         pub fn destroy(self: BufferSelf, vc: *const VulkanContext) void {
             if (self.handle != .null_handle) {
                 vc.device.destroyBuffer(self.handle, null);
-                vc.device.unmapMemory(self.memory);
-                vc.device.freeMemory(self.memory, null);
+                self.allocation.free(vc);
             }
         }
 
@@ -169,7 +554,7 @@ pub fn HostBuffer(comptime T: type) type {
         pub fn toBytes(self: BufferSelf) HostBuffer(u8) {
             return HostBuffer(u8) {
                 .handle = self.handle,
-                .memory = self.memory,
+                .allocation = self.allocation,
                 .data = @as([*]u8, @ptrCast(self.data))[0..self.data.len * @sizeOf(T)],
             };
         }
@@ -185,21 +570,20 @@ pub fn createHostBuffer(self: *Self, vc: *const VulkanContext, comptime T: type,
     if (count == 0) {
         return HostBuffer(T) {
             .handle = .null_handle,
-            .memory = .null_handle,
+            .allocation = .{},
             .data = &.{},
         };
     }
 
     var buffer: vk.Buffer = undefined;
-    var memory: vk.DeviceMemory = undefined;
-    const size = @sizeOf(T) * count;
-    try self.createRawBuffer(vc, size, usage, .{ .host_visible_bit = true, .host_coherent_bit = true }, &buffer, &memory);
+    var allocation: Allocation = undefined;
+    try self.createRawBuffer(vc, @sizeOf(T) * count, usage, .{ .host_visible_bit = true, .host_coherent_bit = true }, &buffer, &allocation);
 
-    const data = @as([*]T, @ptrCast(@alignCast((try vc.device.mapMemory(memory, 0, size, .{})).?)))[0..count];
+    const data = @as([*]T, @ptrCast(@alignCast(allocation.mapped.?)))[0..count];
 
     return HostBuffer(T) {
         .handle = buffer,
-        .memory = memory,
+        .allocation = allocation,
         .data = data,
     };
 }
@@ -6,43 +6,153 @@ const vk = @import("vulkan");
 const core = @import("./core.zig");
 const VulkanContext = core.VulkanContext;
 const VkAllocator = core.Allocator;
+const StagingRing = core.StagingRing;
+const Profiler = core.Profiler;
 const vk_helpers = core.vk_helpers;
 
-pool: vk.CommandPool,
+// recorded into and submitted in turn, so that recording can go on
+// while earlier submissions are still executing
+frames: [frames_in_flight]Frame,
+frame_index: u8,
+
+// of the current frame
 buffer: vk.CommandBuffer,
 
+queue: vk.Queue,
+queue_family_index: u32,
+
+// what the next submission waits on, e.g. uploads made on another queue
+waits: std.BoundedArray(vk.SemaphoreSubmitInfo, max_waits),
+
+// timeline, signaled by each submission with its ticket
+semaphore: vk.Semaphore,
+last_ticket: Ticket,
+
+// what uploads recorded into these commands are staged through
+staging: StagingRing,
+
+// for timing work submitted to this queue family, whether
+// recorded into these command buffers or others
+profiler: Profiler,
+
 const Self = @This();
 
-pub fn create(vc: *const VulkanContext) !Self {
-    const pool = try vc.device.createCommandPool(&.{
-        .queue_family_index = vc.physical_device.queue_family_index,
-        .flags = .{
-            .transient_bit = true,
+pub const frames_in_flight = 3;
+
+const max_waits = 8;
+
+const initial_staging_size = 16 * 1024 * 1024;
+
+// identifies a submission, which is done once the semaphore reaches it
+//
+// later submissions have higher tickets, and 0 is always done
+pub const Ticket = u64;
+
+const Frame = struct {
+    pool: vk.CommandPool,
+    buffer: vk.CommandBuffer,
+    ticket: Ticket, // of the last submission recorded here
+
+    fn create(vc: *const VulkanContext, queue_family_index: u32) !Frame {
+        const pool = try vc.device.createCommandPool(&.{
+            .queue_family_index = queue_family_index,
+            .flags = .{
+                .transient_bit = true,
+            },
+        }, null);
+        errdefer vc.device.destroyCommandPool(pool, null);
+
+        var buffer: vk.CommandBuffer = undefined;
+        try vc.device.allocateCommandBuffers(&.{
+            .level = vk.CommandBufferLevel.primary,
+            .command_pool = pool,
+            .command_buffer_count = 1,
+        }, @ptrCast(&buffer));
+
+        return Frame {
+            .pool = pool,
+            .buffer = buffer,
+            .ticket = 0,
+        };
+    }
+
+    fn destroy(self: Frame, vc: *const VulkanContext) void {
+        vc.device.destroyCommandPool(self.pool, null);
+    }
+};
+
+pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator) !Self {
+    return createOnQueue(vc, vk_allocator, vc.queue, vc.physical_device.queue_family_index, "commands");
+}
+
+// for uploads that can overlap work on the main queue -- on the same queue
+// as `create` if the device doesn't have a dedicated transfer one
+//
+// only transfer commands may be recorded
+pub fn createTransfer(vc: *const VulkanContext, vk_allocator: *VkAllocator) !Self {
+    return createOnQueue(vc, vk_allocator, vc.transfer_queue, vc.physical_device.transfer_queue_family_index, "transfer commands");
+}
+
+fn createOnQueue(vc: *const VulkanContext, vk_allocator: *VkAllocator, queue: vk.Queue, queue_family_index: u32, comptime name: []const u8) !Self {
+    const semaphore = try vc.device.createSemaphore(&.{
+        .p_next = &vk.SemaphoreTypeCreateInfo {
+            .semaphore_type = .timeline,
+            .initial_value = 0,
         },
     }, null);
-    errdefer vc.device.destroyCommandPool(pool, null);
+    errdefer vc.device.destroySemaphore(semaphore, null);
+
+    var frames: [frames_in_flight]Frame = undefined;
+    var frame_count: usize = 0;
+    errdefer for (frames[0..frame_count]) |frame| frame.destroy(vc);
+    for (&frames, 0..) |*frame, i| {
+        frame.* = try Frame.create(vc, queue_family_index);
+        frame_count += 1;
 
-    var buffer: vk.CommandBuffer = undefined;
-    try vc.device.allocateCommandBuffers(&.{
-        .level = vk.CommandBufferLevel.primary,
-        .command_pool = pool,
-        .command_buffer_count = 1,
-    }, @ptrCast(&buffer));
+        var name_buffer: [32]u8 = undefined;
+        try vk_helpers.setDebugName(vc, frame.buffer, try std.fmt.bufPrintZ(&name_buffer, name ++ " {}", .{ i }));
+    }
+
+    var staging = try StagingRing.create(vc, vk_allocator, initial_staging_size, semaphore);
+    errdefer staging.destroy(vc);
 
-    try vk_helpers.setDebugName(vc, buffer, "commands");
+    var profiler = try Profiler.create(vc, queue_family_index);
+    errdefer profiler.destroy(vc);
 
     return Self {
-        .pool = pool,
-        .buffer = buffer,
+        .frames = frames,
+        .frame_index = 0,
+        .buffer = frames[0].buffer,
+        .queue = queue,
+        .queue_family_index = queue_family_index,
+        .waits = .{},
+        .semaphore = semaphore,
+        .last_ticket = 0,
+        .staging = staging,
+        .profiler = profiler,
     };
 }
 
+// nothing submitted may still be executing
 pub fn destroy(self: *Self, vc: *const VulkanContext) void {
-    vc.device.destroyCommandPool(self.pool, null);
+    self.profiler.destroy(vc);
+    self.staging.destroy(vc);
+    for (self.frames) |frame| frame.destroy(vc);
+    vc.device.destroySemaphore(self.semaphore, null);
 }
 
 // start recording work
+//
+// waits for the last submission recorded in the next frame, if it's still executing
 pub fn startRecording(self: *Self, vc: *const VulkanContext) !void {
+    self.frame_index = (self.frame_index + 1) % frames_in_flight;
+    const frame = self.frames[self.frame_index];
+
+    try self.wait(vc, frame.ticket);
+    try vc.device.resetCommandPool(frame.pool, .{});
+    try self.profiler.collect(vc, try self.completed(vc));
+
+    self.buffer = frame.buffer;
     try vc.device.beginCommandBuffer(self.buffer, &.{
         .flags = .{
             .one_time_submit_bit = true,
@@ -50,41 +160,114 @@ pub fn startRecording(self: *Self, vc: *const VulkanContext) !void {
     });
 }
 
-// submit recorded work
-pub fn submit(self: *Self, vc: *const VulkanContext) !void {
+// submit recorded work, returning a ticket that can be used to wait for it
+pub fn submit(self: *Self, vc: *const VulkanContext) !Ticket {
     try vc.device.endCommandBuffer(self.buffer);
 
+    // only claimed once submitted, so a failed submit doesn't leave a ticket nothing will signal
+    const ticket = self.pendingTicket();
+    const signal_info = self.signalInfo(ticket);
     const submit_info = vk.SubmitInfo2 {
         .command_buffer_info_count = 1,
         .p_command_buffer_infos = @ptrCast(&vk.CommandBufferSubmitInfo {
             .command_buffer = self.buffer,
             .device_mask = 0,
         }),
-        .wait_semaphore_info_count = 0,
-        .p_wait_semaphore_infos = undefined,
-        .signal_semaphore_info_count = 0,
-        .p_signal_semaphore_infos = undefined,
+        .wait_semaphore_info_count = @intCast(self.waits.len),
+        .p_wait_semaphore_infos = &self.waits.buffer,
+        .signal_semaphore_info_count = 1,
+        .p_signal_semaphore_infos = @ptrCast(&signal_info),
     };
 
-    try vc.device.queueSubmit2(vc.queue, 1, @ptrCast(&submit_info), .null_handle);
+    try vc.device.queueSubmit2(self.queue, 1, @ptrCast(&submit_info), .null_handle);
+    const claimed = self.claimTicket();
+    std.debug.assert(claimed == ticket);
+    self.waits.len = 0;
+    self.frames[self.frame_index].ticket = ticket;
+    try self.staging.markSubmitted(vc, ticket);
+
+    return ticket;
 }
 
 pub fn submitAndIdleUntilDone(self: *Self, vc: *const VulkanContext) !void {
-    try self.submit(vc);
-    try self.idleUntilDone(vc);
+    try self.wait(vc, try self.submit(vc));
+}
+
+// lets submissions made elsewhere on the same queue, e.g. presentation, be waited on
+// with a ticket as well -- such a submission signals pendingTicket, and claims it only
+// once it has been submitted, so that a failed submit leaves no unsignaled ticket behind
+pub fn claimTicket(self: *Self) Ticket {
+    self.last_ticket += 1;
+    return self.last_ticket;
+}
+
+// ticket of the next submission, i.e. the one what is being recorded will be part of
+pub fn pendingTicket(self: *const Self) Ticket {
+    return self.last_ticket + 1;
+}
+
+// commands must be in recording state
+// times what is recorded until endScope under name, see Profiler.begin
+pub fn beginScope(self: *Self, vc: *const VulkanContext, name: [:0]const u8) Profiler.Scope {
+    return self.profiler.begin(vc, self.buffer, self.pendingTicket(), name);
+}
+
+pub fn endScope(self: *Self, vc: *const VulkanContext, scope: Profiler.Scope) void {
+    self.profiler.end(vc, self.buffer, scope);
+}
+
+pub fn signalInfo(self: *const Self, ticket: Ticket) vk.SemaphoreSubmitInfo {
+    return vk.SemaphoreSubmitInfo {
+        .semaphore = self.semaphore,
+        .value = ticket,
+        .stage_mask = .{ .all_commands_bit = true },
+        .device_index = 0,
+    };
+}
+
+// makes the next submission wait on the GPU for other's submission with ticket,
+// rather than the CPU waiting for it
+pub fn waitForOther(self: *Self, other: *const Self, ticket: Ticket) !void {
+    try self.waits.append(vk.SemaphoreSubmitInfo {
+        .semaphore = other.semaphore,
+        .value = ticket,
+        .stage_mask = .{ .all_commands_bit = true },
+        .device_index = 0,
+    });
+}
+
+pub fn wait(self: *const Self, vc: *const VulkanContext, ticket: Ticket) !void {
+    _ = try vc.device.waitSemaphores(&.{
+        .semaphore_count = 1,
+        .p_semaphores = @ptrCast(&self.semaphore),
+        .p_values = @ptrCast(&ticket),
+    }, std.math.maxInt(u64));
+}
+
+// latest ticket the GPU is done with, everything before it is done as well
+pub fn completed(self: *const Self, vc: *const VulkanContext) !Ticket {
+    return try vc.device.getSemaphoreCounterValue(self.semaphore);
+}
+
+pub fn isDone(self: *const Self, vc: *const VulkanContext, ticket: Ticket) !bool {
+    return ticket <= try self.completed(vc);
 }
 
 // must be called at some point if you want a guarantee your work is actually done
+//
+// only waits for what was given a ticket by these commands, not the whole queue
 pub fn idleUntilDone(self: *Self, vc: *const VulkanContext) !void {
-    try vc.device.queueWaitIdle(vc.queue);
-    try vc.device.resetCommandPool(self.pool, .{});
+    try self.wait(vc, self.last_ticket);
+    try self.staging.retire(vc);
 }
 
 pub fn copyAccelStructs(self: *Self, vc: *const VulkanContext, infos: []const vk.CopyAccelerationStructureInfoKHR) !void {
     try self.startRecording(vc);
+    const scope = self.beginScope(vc, "copy acceleration structures");
     for (infos) |info| {
         vc.device.cmdCopyAccelerationStructureKHR(self.buffer, &info);
     }
+    self.endScope(vc, scope);
     try self.submitAndIdleUntilDone(vc);
 }
 
@@ -111,7 +294,9 @@ pub fn createAccelStructsAndGetCompactedSizes(self: *Self, vc: *const VulkanCont
 
     try self.startRecording(vc);
 
+    const scope = self.beginScope(vc, "build acceleration structures");
     vc.device.cmdBuildAccelerationStructuresKHR(self.buffer, size, geometry_infos.ptr, build_infos.ptr);
+    self.endScope(vc, scope);
 
     const barriers = [_]vk.MemoryBarrier2 {
         .{
@@ -193,11 +378,27 @@ pub fn transitionImageLayout(self: *Self, vc: *const VulkanContext, allocator: s
 }
 
 pub fn uploadDataToImage(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, dst_image: vk.Image, src_data: []const u8, extent: vk.Extent2D, dst_layout: vk.ImageLayout) !void {
-    const staging_buffer = try vk_allocator.createHostBuffer(vc, u8, @intCast(src_data.len), .{ .transfer_src_bit = true });
-    defer staging_buffer.destroy(vc);
-    @memcpy(staging_buffer.data, src_data);
-
     try self.startRecording(vc);
+    try self.recordStageDataToImage(vc, vk_allocator, dst_image, src_data, extent, dst_layout, self.queue_family_index);
+    try self.submitAndIdleUntilDone(vc);
+}
+
+// commands must be in recording state
+// stages src_data through the staging ring, so nothing needs to be kept alive
+// transitions whole image from undefined to dst_layout
+// if dst_queue_family_index is another family, image is released to it and must be acquired there
+pub fn recordStageDataToImage(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, dst_image: vk.Image, src_data: []const u8, extent: vk.Extent2D, dst_layout: vk.ImageLayout, dst_queue_family_index: u32) !void {
+    const region = try self.staging.stage(u8, vc, vk_allocator, src_data);
+    self.recordUploadDataToImage(vc, dst_image, region.buffer, region.offset, extent, dst_layout, dst_queue_family_index);
+}
+
+// commands must be in recording state
+// src must have transfer src flag and stay alive until command is completed
+// transitions whole image from undefined to dst_layout
+// if dst_queue_family_index is another family, image is released to it and must be acquired there
+pub fn recordUploadDataToImage(self: *Self, vc: *const VulkanContext, dst_image: vk.Image, src: vk.Buffer, src_offset: vk.DeviceSize, extent: vk.Extent2D, dst_layout: vk.ImageLayout, dst_queue_family_index: u32) void {
+    const transfer_ownership = dst_queue_family_index != self.queue_family_index;
+
     vc.device.cmdPipelineBarrier2(self.buffer, &vk.DependencyInfo {
         .image_memory_barrier_count = 1,
         .p_image_memory_barriers = @ptrCast(&vk.ImageMemoryBarrier2 {
@@ -217,8 +418,8 @@ pub fn uploadDataToImage(self: *Self, vc: *const VulkanContext, vk_allocator: *V
             },
         }),
     });
-    vc.device.cmdCopyBufferToImage(self.buffer, staging_buffer.handle, dst_image, .transfer_dst_optimal, 1, @ptrCast(&vk.BufferImageCopy {
-        .buffer_offset = 0,
+    vc.device.cmdCopyBufferToImage(self.buffer, src, dst_image, .transfer_dst_optimal, 1, @ptrCast(&vk.BufferImageCopy {
+        .buffer_offset = src_offset,
         .buffer_row_length = 0,
         .buffer_image_height = 0,
         .image_subresource = .{
@@ -245,8 +446,8 @@ pub fn uploadDataToImage(self: *Self, vc: *const VulkanContext, vk_allocator: *V
             .src_access_mask = .{ .transfer_write_bit = true },
             .old_layout = .transfer_dst_optimal,
             .new_layout = dst_layout,
-            .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-            .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+            .src_queue_family_index = if (transfer_ownership) self.queue_family_index else vk.QUEUE_FAMILY_IGNORED,
+            .dst_queue_family_index = if (transfer_ownership) dst_queue_family_index else vk.QUEUE_FAMILY_IGNORED,
             .image = dst_image,
             .subresource_range = .{
                 .aspect_mask = .{ .color_bit = true },
@@ -257,7 +458,6 @@ pub fn uploadDataToImage(self: *Self, vc: *const VulkanContext, vk_allocator: *V
             },
         }),
     });
-    try self.submitAndIdleUntilDone(vc);
 }
 
 // buffers must have appropriate flags
@@ -277,18 +477,118 @@ pub fn recordUploadBuffer(self: *Self, comptime T: type, vc: *const VulkanContex
     vc.device.cmdCopyBuffer(self.buffer, src.handle, dst.handle, 1, @ptrCast(&region));
 }
 
+// commands must be in recording state
+// stages src through the staging ring, so nothing needs to be kept alive
+// dst_offset is in units of T
+pub fn recordStageBuffer(self: *Self, comptime T: type, vc: *const VulkanContext, vk_allocator: *VkAllocator, dst: VkAllocator.DeviceBuffer(T), src: []const T, dst_offset: vk.DeviceSize) !void {
+    if (src.len == 0) return;
+
+    const region = try self.staging.stage(T, vc, vk_allocator, src);
+    const copy = vk.BufferCopy {
+        .src_offset = region.offset,
+        .dst_offset = dst_offset * @sizeOf(T),
+        .size = src.len * @sizeOf(T),
+    };
+
+    vc.device.cmdCopyBuffer(self.buffer, region.buffer, dst.handle, 1, @ptrCast(&copy));
+}
+
+// queue family ownership transfer of exclusive buffers written by copies on these commands,
+// to be matched by recordAcquireBuffers on the other family's commands, which must wait for this submission
+//
+// null handles are skipped, nothing is recorded if the families are the same
+pub fn recordReleaseBuffers(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator, buffers: []const vk.Buffer, dst_queue_family_index: u32) !void {
+    if (dst_queue_family_index == self.queue_family_index) return;
+
+    var barriers = std.ArrayListUnmanaged(vk.BufferMemoryBarrier2) {};
+    defer barriers.deinit(allocator);
+
+    for (buffers) |buffer| {
+        if (buffer == .null_handle) continue;
+        try barriers.append(allocator, vk.BufferMemoryBarrier2 {
+            .src_stage_mask = .{ .copy_bit = true },
+            .src_access_mask = .{ .transfer_write_bit = true },
+            .src_queue_family_index = self.queue_family_index,
+            .dst_queue_family_index = dst_queue_family_index,
+            .buffer = buffer,
+            .offset = 0,
+            .size = vk.WHOLE_SIZE,
+        });
+    }
+
+    vc.device.cmdPipelineBarrier2(self.buffer, &vk.DependencyInfo {
+        .buffer_memory_barrier_count = @intCast(barriers.items.len),
+        .p_buffer_memory_barriers = barriers.items.ptr,
+    });
+}
+
+// acquire half of recordReleaseBuffers
+pub fn recordAcquireBuffers(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator, buffers: []const vk.Buffer, src_queue_family_index: u32, dst_stage_mask: vk.PipelineStageFlags2, dst_access_mask: vk.AccessFlags2) !void {
+    if (src_queue_family_index == self.queue_family_index) return;
+
+    var barriers = std.ArrayListUnmanaged(vk.BufferMemoryBarrier2) {};
+    defer barriers.deinit(allocator);
+
+    for (buffers) |buffer| {
+        if (buffer == .null_handle) continue;
+        try barriers.append(allocator, vk.BufferMemoryBarrier2 {
+            .dst_stage_mask = dst_stage_mask,
+            .dst_access_mask = dst_access_mask,
+            .src_queue_family_index = src_queue_family_index,
+            .dst_queue_family_index = self.queue_family_index,
+            .buffer = buffer,
+            .offset = 0,
+            .size = vk.WHOLE_SIZE,
+        });
+    }
+
+    vc.device.cmdPipelineBarrier2(self.buffer, &vk.DependencyInfo {
+        .buffer_memory_barrier_count = @intCast(barriers.items.len),
+        .p_buffer_memory_barriers = barriers.items.ptr,
+    });
+}
+
+// acquire half of the release recordUploadDataToImage does when given another family
+// layouts must be the same as the release's, so for recordUploadDataToImage
+// old_layout is transfer_dst_optimal and new_layout is the dst_layout it was given
+pub fn recordAcquireImages(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator, images: []const vk.Image, src_queue_family_index: u32, old_layout: vk.ImageLayout, new_layout: vk.ImageLayout, dst_stage_mask: vk.PipelineStageFlags2, dst_access_mask: vk.AccessFlags2) !void {
+    if (src_queue_family_index == self.queue_family_index) return;
+
+    const barriers = try allocator.alloc(vk.ImageMemoryBarrier2, images.len);
+    defer allocator.free(barriers);
+
+    for (images, barriers) |image, *barrier| {
+        barrier.* = vk.ImageMemoryBarrier2 {
+            .dst_stage_mask = dst_stage_mask,
+            .dst_access_mask = dst_access_mask,
+            .old_layout = old_layout,
+            .new_layout = new_layout,
+            .src_queue_family_index = src_queue_family_index,
+            .dst_queue_family_index = self.queue_family_index,
+            .image = image,
+            .subresource_range = .{
+                .aspect_mask = .{ .color_bit = true },
+                .base_mip_level = 0,
+                .level_count = 1,
+                .base_array_layer = 0,
+                .layer_count = vk.REMAINING_ARRAY_LAYERS,
+            },
+        };
+    }
+
+    vc.device.cmdPipelineBarrier2(self.buffer, &vk.DependencyInfo {
+        .image_memory_barrier_count = @intCast(barriers.len),
+        .p_image_memory_barriers = barriers.ptr,
+    });
+}
+
 pub fn recordUpdateBuffer(self: *Self, comptime T: type, vc: *const VulkanContext, dst: VkAllocator.DeviceBuffer(T), src: []const T, offset: vk.DeviceSize) void {
     const bytes = std.mem.sliceAsBytes(src);
     vc.device.cmdUpdateBuffer(self.buffer, dst.handle, offset * @sizeOf(T), bytes.len, src.ptr);
 }
 
 pub fn uploadData(self: *Self, comptime T: type, vc: *const VulkanContext, vk_allocator: *VkAllocator, dst: VkAllocator.DeviceBuffer(T), src: []const T) !void {
-    const staging_buffer = try vk_allocator.createHostBuffer(vc, T, src.len, .{ .transfer_src_bit = true });
-    defer staging_buffer.destroy(vc);
-
-    @memcpy(staging_buffer.data, src);
-
     try self.startRecording(vc);
-    self.recordUploadBuffer(T, vc, dst, staging_buffer);
+    try self.recordStageBuffer(T, vc, vk_allocator, dst, src, 0);
     try self.submitAndIdleUntilDone(vc);
 }
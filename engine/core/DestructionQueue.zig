@@ -3,15 +3,19 @@ const vk = @import("vulkan");
 
 const core = @import("./core.zig");
 const VulkanContext = core.VulkanContext;
-const DeviceBuffer = core.Allocator.DeviceBuffer;
+const OwnedDeviceBuffer = core.Allocator.OwnedDeviceBuffer;
+const Image = core.Image;
+const Ticket = core.Commands.Ticket;
 
-// TODO: how to make this use some sort of duck typing and take in any 
+// TODO: how to make this use some sort of duck typing and take in any
 // type with a `destroy` function
 const Item = union(enum) {
     swapchain: vk.SwapchainKHR,
     pipeline_layout: vk.PipelineLayout,
     pipeline: vk.Pipeline,
     buffer: vk.Buffer,
+    owned_device_buffer: OwnedDeviceBuffer,
+    image: Image,
 
     fn destroy(self: *Item, vc: *const VulkanContext) void {
         switch (self.*) {
@@ -19,11 +23,18 @@ const Item = union(enum) {
             .pipeline_layout => |pipeline_layout| vc.device.destroyPipelineLayout(pipeline_layout, null),
             .pipeline => |pipeline| vc.device.destroyPipeline(pipeline, null),
             .buffer => |buffer| vc.device.destroyBuffer(buffer, null),
+            .owned_device_buffer => |buffer| buffer.destroy(vc),
+            .image => |image| image.destroy(vc),
         }
     }
 };
 
-const Queue = std.ArrayListUnmanaged(Item);
+const Entry = struct {
+    item: Item,
+    ticket: Ticket, // last submission that may use item
+};
+
+const Queue = std.ArrayListUnmanaged(Entry);
 
 queue: Queue,
 
@@ -35,19 +46,44 @@ pub fn create() Self {
     };
 }
 
-pub fn add(self: *Self, allocator: std.mem.Allocator, item: anytype) !void {
-    if (@TypeOf(item) == vk.SwapchainKHR) {
-        try self.queue.append(allocator, .{ .swapchain = item });
-    } else if (@TypeOf(item) == vk.PipelineLayout) {
-        try self.queue.append(allocator, .{ .pipeline_layout = item });
-    } else if (@TypeOf(item) == vk.Pipeline) {
-        try self.queue.append(allocator, .{ .pipeline = item });
-    } else if (@TypeOf(item) == vk.Buffer) {
-        try self.queue.append(allocator, .{ .buffer = item });
-    } else @compileError("Unknown destruction type: " ++ @typeName(@TypeOf(item)));
+// item is destroyed once the submission with ticket is done
+pub fn add(self: *Self, allocator: std.mem.Allocator, ticket: Ticket, item: anytype) !void {
+    const queue_item: Item = if (@TypeOf(item) == vk.SwapchainKHR)
+        .{ .swapchain = item }
+    else if (@TypeOf(item) == vk.PipelineLayout)
+        .{ .pipeline_layout = item }
+    else if (@TypeOf(item) == vk.Pipeline)
+        .{ .pipeline = item }
+    else if (@TypeOf(item) == vk.Buffer)
+        .{ .buffer = item }
+    else if (@TypeOf(item) == OwnedDeviceBuffer)
+        .{ .owned_device_buffer = item }
+    else if (@TypeOf(item) == Image)
+        .{ .image = item }
+    else @compileError("Unknown destruction type: " ++ @typeName(@TypeOf(item)));
+
+    try self.queue.append(allocator, .{
+        .item = queue_item,
+        .ticket = ticket,
+    });
+}
+
+// destroys everything whose ticket is at most `completed`
+pub fn collect(self: *Self, vc: *const VulkanContext, completed: Ticket) void {
+    var kept: usize = 0;
+    for (self.queue.items) |*entry| {
+        if (entry.ticket <= completed) {
+            entry.item.destroy(vc);
+        } else {
+            self.queue.items[kept] = entry.*;
+            kept += 1;
+        }
+    }
+    self.queue.shrinkRetainingCapacity(kept);
 }
 
+// destroys everything, so nothing may still be in use
 pub fn destroy(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
-    for (self.queue.items) |*item| item.destroy(vc);
+    for (self.queue.items) |*entry| entry.item.destroy(vc);
     self.queue.deinit(allocator);
 }
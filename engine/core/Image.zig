@@ -11,9 +11,19 @@ const Self = @This();
  
 handle: vk.Image,
 view: vk.ImageView,
-memory: vk.DeviceMemory,
+allocation: VkAllocator.Allocation,
 
 pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, size: vk.Extent2D, usage: vk.ImageUsageFlags, format: vk.Format, with_mips: bool, name: [:0]const u8) !Self {
+    return createWithComponents(vc, vk_allocator, size, usage, format, with_mips, .{
+        .r = .identity,
+        .g = .identity,
+        .b = .identity,
+        .a = .identity,
+    }, name);
+}
+
+// components is the swizzle the view applies when the image is read
+pub fn createWithComponents(vc: *const VulkanContext, vk_allocator: *VkAllocator, size: vk.Extent2D, usage: vk.ImageUsageFlags, format: vk.Format, with_mips: bool, components: vk.ComponentMapping, name: [:0]const u8) !Self {
     const extent = vk.Extent3D {
         .width = size.width,
         .height = size.height,
@@ -39,27 +49,15 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, size: vk.Ext
     errdefer vc.device.destroyImage(handle, null);
     if (name.len != 0) try vk_helpers.setDebugName(vc, handle, name);
 
-    const mem_requirements = vc.device.getImageMemoryRequirements(handle);
-
-    const memory = try vc.device.allocateMemory(&.{
-        .allocation_size = mem_requirements.size,
-        .memory_type_index = try vk_allocator.findMemoryType(mem_requirements.memory_type_bits, .{ .device_local_bit = true }),
-    }, null);
-    errdefer vc.device.freeMemory(memory, null);
-
-    try vc.device.bindImageMemory(handle, memory, 0);
+    const allocation = try vk_allocator.allocateImage(vc, handle);
+    errdefer allocation.free(vc);
 
     const view_create_info = vk.ImageViewCreateInfo {
         .flags = .{},
         .image = handle,
         .view_type = if (extent.height == 1 and extent.width != 1) vk.ImageViewType.@"1d" else vk.ImageViewType.@"2d",
         .format = format,
-        .components = .{
-            .r = .identity,
-            .g = .identity,
-            .b = .identity,
-            .a = .identity,
-        },
+        .components = components,
         .subresource_range = .{
             .aspect_mask = .{ .color_bit = true },
             .base_mip_level = 0,
@@ -73,7 +71,7 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, size: vk.Ext
     errdefer vc.device.destroyImageView(view, null);
 
     return Self {
-        .memory = memory,
+        .allocation = allocation,
         .handle = handle,
         .view = view,
     };
@@ -82,5 +80,5 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, size: vk.Ext
 pub fn destroy(self: Self, vc: *const VulkanContext) void {
     vc.device.destroyImageView(self.view, null);
     vc.device.destroyImage(self.handle, null);
-    vc.device.freeMemory(self.memory, null);
+    self.allocation.free(vc);
 }
@@ -0,0 +1,164 @@
+// on-disk cache for things that are slow to build from scratch --
+// SPIR-V of shaders compiled at runtime and the driver's pipeline cache
+//
+// lives in $MOONSHINE_CACHE_DIR if that is set, otherwise in the app data
+// directory of the platform -- if neither can be opened, nothing is persisted
+// and this only acts as an in-memory pipeline cache
+
+const std = @import("std");
+const vk = @import("vulkan");
+
+const VulkanContext = @import("./VulkanContext.zig");
+
+handle: vk.PipelineCache,
+dir: ?std.fs.Dir,
+
+// keyed by device UUID so that different devices and driver
+// versions don't keep clobbering each other's data
+pipeline_file_name: [pipeline_file_name_len]u8,
+
+const Self = @This();
+
+const pipeline_file_name_len = "pipelines-".len + 2 * vk.UUID_SIZE + ".bin".len;
+const spirv_file_name_len = "spirv-".len + 16 + ".spv".len;
+
+const max_file_size = 1 << 30;
+
+pub fn create(vc: *const VulkanContext, allocator: std.mem.Allocator) !Self {
+    var properties = vk.PhysicalDeviceProperties2 {
+        .properties = undefined,
+    };
+    vc.instance.getPhysicalDeviceProperties2(vc.physical_device.handle, &properties);
+
+    var pipeline_file_name: [pipeline_file_name_len]u8 = undefined;
+    _ = std.fmt.bufPrint(&pipeline_file_name, "pipelines-{}.bin", .{ std.fmt.fmtSliceHexLower(&properties.properties.pipeline_cache_uuid) }) catch unreachable;
+
+    var dir = openDir(allocator);
+    errdefer if (dir) |*d| d.close();
+
+    const initial_data = if (dir) |d| d.readFileAlloc(allocator, &pipeline_file_name, max_file_size) catch null else null;
+    defer if (initial_data) |data| allocator.free(data);
+
+    // drivers are meant to ignore data they can't use, but
+    // not all of them do, so fall back to starting empty
+    const handle = vc.device.createPipelineCache(&.{
+        .initial_data_size = if (initial_data) |data| data.len else 0,
+        .p_initial_data = if (initial_data) |data| data.ptr else null,
+    }, null) catch try vc.device.createPipelineCache(&.{
+        .initial_data_size = 0,
+        .p_initial_data = null,
+    }, null);
+
+    return Self {
+        .handle = handle,
+        .dir = dir,
+        .pipeline_file_name = pipeline_file_name,
+    };
+}
+
+// persists what pipeline creation has added to the cache first -- failing
+// to do so only costs the next run some time, so it is not an error
+pub fn destroy(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
+    self.save(vc, allocator) catch |err| std.log.warn("couldn't save pipeline cache: {}", .{ err });
+    vc.device.destroyPipelineCache(self.handle, null);
+    if (self.dir) |*dir| dir.close();
+}
+
+fn openDir(allocator: std.mem.Allocator) ?std.fs.Dir {
+    const path = std.process.getEnvVarOwned(allocator, "MOONSHINE_CACHE_DIR") catch |err| switch (err) {
+        error.EnvironmentVariableNotFound => std.fs.getAppDataDir(allocator, "moonshine" ++ std.fs.path.sep_str ++ "cache") catch return null,
+        else => return null,
+    };
+    defer allocator.free(path);
+
+    return std.fs.cwd().makeOpenPath(path, .{}) catch null;
+}
+
+// writes everything the driver has cached so far so the next run can start from it
+fn save(self: *const Self, vc: *const VulkanContext, allocator: std.mem.Allocator) !void {
+    const dir = self.dir orelse return;
+
+    var size: usize = undefined;
+    _ = try vc.device.getPipelineCacheData(self.handle, &size, null);
+    const data = try allocator.alloc(u8, size);
+    defer allocator.free(data);
+    _ = try vc.device.getPipelineCacheData(self.handle, &size, data.ptr);
+
+    try writeFile(dir, &self.pipeline_file_name, data[0..size]);
+}
+
+// written to the side and renamed over so that other processes
+// never see a partially written file
+fn writeFile(dir: std.fs.Dir, name: []const u8, data: []const u8) !void {
+    var file = try dir.atomicFile(name, .{});
+    defer file.deinit();
+
+    try file.file.writeAll(data);
+    try file.finish();
+}
+
+fn spirvFileName(key: u64) [spirv_file_name_len]u8 {
+    var name: [spirv_file_name_len]u8 = undefined;
+    _ = std.fmt.bufPrint(&name, "spirv-{x:0>16}.spv", .{ key }) catch unreachable;
+    return name;
+}
+
+// returns null if nothing is cached under key, otherwise
+// caller owns returned memory
+pub fn loadSpirv(self: *const Self, allocator: std.mem.Allocator, key: u64) ?[]u8 {
+    const dir = self.dir orelse return null;
+    const name = spirvFileName(key);
+    return dir.readFileAlloc(allocator, &name, max_file_size) catch null;
+}
+
+pub fn storeSpirv(self: *const Self, key: u64, code: []const u8) !void {
+    const dir = self.dir orelse return;
+    const name = spirvFileName(key);
+    try writeFile(dir, &name, code);
+}
+
+// key for the SPIR-V compile_cmd produces from the shader at path,
+// covering the command itself (so defines and targets) along with
+// the source of the shader and everything it includes
+//
+// includes are expected to be relative to the file including them,
+// which is the only way the shaders here use them
+pub fn hashShader(allocator: std.mem.Allocator, compile_cmd: []const []const u8, path: []const u8) !u64 {
+    var hasher = std.hash.Wyhash.init(0);
+    for (compile_cmd) |arg| {
+        hasher.update(arg);
+        hasher.update(&.{ 0 });
+    }
+
+    var arena = std.heap.ArenaAllocator.init(allocator);
+    defer arena.deinit();
+
+    var visited = std.StringHashMapUnmanaged(void) {};
+    var to_visit = std.ArrayListUnmanaged([]const u8) {};
+    try to_visit.append(arena.allocator(), path);
+
+    while (to_visit.popOrNull()) |file_path| {
+        const entry = try visited.getOrPut(arena.allocator(), file_path);
+        if (entry.found_existing) continue;
+
+        const source = try std.fs.cwd().readFileAlloc(arena.allocator(), file_path, max_file_size);
+        hasher.update(file_path);
+        hasher.update(&.{ 0 });
+        hasher.update(source);
+
+        var lines = std.mem.tokenizeAny(u8, source, "\r\n");
+        while (lines.next()) |line| {
+            const trimmed = std.mem.trimLeft(u8, line, " \t");
+            if (!std.mem.startsWith(u8, trimmed, "#include")) continue;
+
+            var parts = std.mem.splitScalar(u8, trimmed, '"');
+            _ = parts.next();
+            const include = parts.next() orelse continue;
+
+            const dirname = std.fs.path.dirname(file_path) orelse ".";
+            try to_visit.append(arena.allocator(), try std.fs.path.resolve(arena.allocator(), &.{ dirname, include }));
+        }
+    }
+
+    return hasher.final();
+}
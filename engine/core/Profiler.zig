@@ -0,0 +1,171 @@
+// GPU timestamp profiler
+//
+// scopes are recorded around work in a command buffer and timed by the GPU --
+// once it's done with them, their durations are gathered per name
+//
+// results are only ever read once available, never waited on, so they
+// lag behind what is being recorded by however long the GPU takes
+
+const std = @import("std");
+const vk = @import("vulkan");
+
+const core = @import("./core.zig");
+const VulkanContext = core.VulkanContext;
+const Ticket = core.Commands.Ticket;
+const vk_helpers = core.vk_helpers;
+
+query_pool: vk.QueryPool, // null if the queue family can't write timestamps
+ns_per_tick: f64,
+valid_mask: u64, // of the bits timestamps actually have
+
+// scopes are handed out front to back, wrapping around, each with a pair of queries
+//
+// positions only ever increase -- the slot is position modulo max_scopes
+head: u64, // where the next scope goes
+tail: u64, // oldest scope not yet gathered
+names: [max_scopes][:0]const u8,
+tickets: [max_scopes]Ticket, // of the submission each scope is part of
+
+passes: std.BoundedArray(Pass, max_passes),
+
+const Self = @This();
+
+const max_scopes = 1024;
+const max_passes = 64;
+
+pub const Scope = struct {
+    slot: ?u32, // null if dropped
+};
+
+pub const Pass = struct {
+    name: [:0]const u8,
+    last_ns: f64, // of the latest scope gathered
+    total_ns: f64,
+    count: u64,
+
+    pub fn averageNs(self: Pass) f64 {
+        return self.total_ns / @as(f64, @floatFromInt(self.count));
+    }
+};
+
+// only command buffers of queue_family_index may have scopes recorded into them
+pub fn create(vc: *const VulkanContext, queue_family_index: u32) !Self {
+    const families = vk_helpers.getVkSliceBounded(8, @TypeOf(vc.instance).getPhysicalDeviceQueueFamilyProperties, .{ vc.instance, vc.physical_device.handle }).slice();
+    const valid_bits = families[queue_family_index].timestamp_valid_bits;
+
+    var properties = vk.PhysicalDeviceProperties2 {
+        .properties = undefined,
+    };
+    vc.instance.getPhysicalDeviceProperties2(vc.physical_device.handle, &properties);
+
+    const query_pool = if (valid_bits != 0) blk: {
+        const pool = try vc.device.createQueryPool(&.{
+            .query_type = .timestamp,
+            .query_count = 2 * max_scopes,
+        }, null);
+        vc.device.resetQueryPool(pool, 0, 2 * max_scopes);
+        break :blk pool;
+    } else .null_handle;
+
+    return Self {
+        .query_pool = query_pool,
+        .ns_per_tick = properties.properties.limits.timestamp_period,
+        .valid_mask = if (valid_bits == 64) std.math.maxInt(u64) else (@as(u64, 1) << @intCast(valid_bits)) - 1,
+        .head = 0,
+        .tail = 0,
+        .names = undefined,
+        .tickets = undefined,
+        .passes = .{},
+    };
+}
+
+pub fn destroy(self: *Self, vc: *const VulkanContext) void {
+    if (self.query_pool != .null_handle) vc.device.destroyQueryPool(self.query_pool, null);
+}
+
+// name must outlive the profiler
+//
+// the scope must be ended in the same command buffer, which is to be
+// submitted with ticket -- if it never is, the scope is just dropped
+// once ticket is done
+//
+// if too many scopes are waiting to be gathered, this one is dropped right away
+pub fn begin(self: *Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer, ticket: Ticket, name: [:0]const u8) Scope {
+    if (self.query_pool == .null_handle or self.head - self.tail == max_scopes) return Scope { .slot = null };
+
+    const slot: u32 = @intCast(self.head % max_scopes);
+    self.head += 1;
+    self.names[slot] = name;
+    self.tickets[slot] = ticket;
+
+    // waits for everything before it so work from earlier scopes isn't counted
+    vc.device.cmdWriteTimestamp2(command_buffer, .{ .all_commands_bit = true }, self.query_pool, 2 * slot);
+
+    return Scope { .slot = slot };
+}
+
+pub fn end(self: *const Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer, scope: Scope) void {
+    const slot = scope.slot orelse return;
+    vc.device.cmdWriteTimestamp2(command_buffer, .{ .all_commands_bit = true }, self.query_pool, 2 * slot + 1);
+}
+
+// gathers whatever scopes the GPU is done with, leaving the rest for later
+//
+// completed is the latest ticket done, as in Commands.completed
+pub fn collect(self: *Self, vc: *const VulkanContext, completed: Ticket) !void {
+    while (self.tail != self.head) {
+        const slot: u32 = @intCast(self.tail % max_scopes);
+
+        // value then availability of each query
+        var timestamps: [2][2]u64 = undefined;
+        _ = try vc.device.getQueryPoolResults(self.query_pool, 2 * slot, 2, @sizeOf(@TypeOf(timestamps)), &timestamps, @sizeOf([2]u64), .{ .@"64_bit" = true, .with_availability_bit = true });
+        const available = timestamps[0][1] != 0 and timestamps[1][1] != 0;
+
+        // if its submission is done but it isn't available, it was never submitted
+        if (!available and self.tickets[slot] > completed) break;
+
+        vc.device.resetQueryPool(self.query_pool, 2 * slot, 2);
+        self.tail += 1;
+
+        if (!available) continue;
+
+        const ticks = (timestamps[1][0] -% timestamps[0][0]) & self.valid_mask;
+        self.accumulate(self.names[slot], @as(f64, @floatFromInt(ticks)) * self.ns_per_tick);
+    }
+}
+
+fn accumulate(self: *Self, name: [:0]const u8, ns: f64) void {
+    const pass = for (self.passes.slice()) |*existing| {
+        if (std.mem.eql(u8, existing.name, name)) break existing;
+    } else blk: {
+        // past max_passes distinct names, new ones just aren't tracked
+        const added = self.passes.addOne() catch return;
+        added.* = Pass {
+            .name = name,
+            .last_ns = 0,
+            .total_ns = 0,
+            .count = 0,
+        };
+        break :blk added;
+    };
+
+    pass.last_ns = ns;
+    pass.total_ns += ns;
+    pass.count += 1;
+}
+
+// in the order each was first gathered
+pub fn results(self: *const Self) []const Pass {
+    return self.passes.constSlice();
+}
+
+// forgets everything gathered so far
+pub fn clear(self: *Self) void {
+    self.passes.len = 0;
+}
+
+pub fn writeReport(self: *const Self, writer: anytype) !void {
+    for (self.results()) |pass| {
+        try writer.print("{s:<32} {d:>10.3}ms total, {d:>8.3}ms average over {} runs\n", .{ pass.name, pass.total_ns / std.time.ns_per_ms, pass.averageNs() / std.time.ns_per_ms, pass.count });
+    }
+}
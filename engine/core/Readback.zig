@@ -0,0 +1,174 @@
+// asynchronous way to get small bits of device-local buffers/images back to CPU
+//
+// copies are recorded into whatever command buffer is being recorded anyway,
+// e.g. a frame's, and their results picked up once its submission is done --
+// a frame or two later, without the CPU ever waiting on the GPU
+//
+// more-so designed for debugging and inspecting stuff than for "real" transfers
+
+const core = @import("core.zig");
+const VulkanContext = core.VulkanContext;
+const VkAllocator = core.Allocator;
+const Ticket = core.Commands.Ticket;
+const vk_helpers = core.vk_helpers;
+
+const std = @import("std");
+const vk = @import("vulkan");
+
+// slot_size bytes for each slot
+buffer: VkAllocator.HostBuffer(u8),
+slots: [max_requests]Slot,
+
+const Self = @This();
+
+const max_requests = 32;
+const slot_size = 256;
+
+const Slot = struct {
+    state: enum { free, pending, cancelled } = .free,
+    ticket: Ticket = 0, // of the submission the copy is part of
+    size: u32 = 0,
+    generation: u32 = 0, // bumped each time the slot is handed out, to catch stale requests
+};
+
+pub const Request = struct {
+    slot: u32,
+    generation: u32,
+};
+
+pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator) !Self {
+    var staging_memory = vk_allocator.withCategory(.staging);
+    const buffer = try staging_memory.createHostBuffer(vc, u8, max_requests * slot_size, .{ .transfer_dst_bit = true });
+    errdefer buffer.destroy(vc);
+    try vk_helpers.setDebugName(vc, buffer.handle, "readback");
+
+    return Self {
+        .buffer = buffer,
+        .slots = [_]Slot { .{} } ** max_requests,
+    };
+}
+
+pub fn destroy(self: *Self, vc: *const VulkanContext) void {
+    self.buffer.destroy(vc);
+}
+
+fn claimSlot(self: *Self, ticket: Ticket, size: u32) !Request {
+    std.debug.assert(size <= slot_size);
+
+    for (&self.slots, 0..) |*slot, i| {
+        if (slot.state != .free) continue;
+        slot.state = .pending;
+        slot.ticket = ticket;
+        slot.size = size;
+        slot.generation +%= 1;
+        return Request {
+            .slot = @intCast(i),
+            .generation = slot.generation,
+        };
+    }
+
+    return error.TooManyReadbacks;
+}
+
+fn claimedSlot(self: *Self, request: Request) *Slot {
+    const slot = &self.slots[request.slot];
+    std.debug.assert(slot.state == .pending and slot.generation == request.generation);
+    return slot;
+}
+
+// anything before in the queue, including earlier submissions, may be writing the source
+fn recordBeforeCopy(vc: *const VulkanContext, command_buffer: vk.CommandBuffer) void {
+    vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
+        .memory_barrier_count = 1,
+        .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+            .src_stage_mask = .{ .all_commands_bit = true },
+            .src_access_mask = .{ .memory_write_bit = true },
+            .dst_stage_mask = .{ .copy_bit = true },
+            .dst_access_mask = .{ .transfer_read_bit = true },
+        }),
+    });
+}
+
+// submission being done doesn't make writes visible to the host on its own
+fn recordAfterCopy(vc: *const VulkanContext, command_buffer: vk.CommandBuffer) void {
+    vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
+        .memory_barrier_count = 1,
+        .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+            .src_stage_mask = .{ .copy_bit = true },
+            .src_access_mask = .{ .transfer_write_bit = true },
+            .dst_stage_mask = .{ .host_bit = true },
+            .dst_access_mask = .{ .host_read_bit = true },
+        }),
+    });
+}
+
+// command_buffer must be submitted with ticket, and the result then taken with `get`
+pub fn recordCopyBufferItem(self: *Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer, ticket: Ticket, comptime BufferInner: type, buffer: VkAllocator.DeviceBuffer(BufferInner), idx: vk.DeviceSize) !Request {
+    const request = try self.claimSlot(ticket, @sizeOf(BufferInner));
+
+    recordBeforeCopy(vc, command_buffer);
+    vc.device.cmdCopyBuffer(command_buffer, buffer.handle, self.buffer.handle, 1, @ptrCast(&vk.BufferCopy {
+        .src_offset = @sizeOf(BufferInner) * idx,
+        .dst_offset = request.slot * slot_size,
+        .size = @sizeOf(BufferInner),
+    }));
+    recordAfterCopy(vc, command_buffer);
+
+    return request;
+}
+
+// command_buffer must be submitted with ticket, and the result then taken with `get`
+// src_image must be in src_layout at this point in command_buffer
+pub fn recordCopyImagePixel(self: *Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer, ticket: Ticket, comptime PixelType: type, src_image: vk.Image, src_layout: vk.ImageLayout, offset: vk.Offset3D) !Request {
+    const request = try self.claimSlot(ticket, @sizeOf(PixelType));
+
+    recordBeforeCopy(vc, command_buffer);
+    vc.device.cmdCopyImageToBuffer(command_buffer, src_image, src_layout, self.buffer.handle, 1, @ptrCast(&vk.BufferImageCopy {
+        .buffer_offset = request.slot * slot_size,
+        .buffer_row_length = 0,
+        .buffer_image_height = 0,
+        .image_subresource = vk.ImageSubresourceLayers {
+            .aspect_mask = .{ .color_bit = true },
+            .mip_level = 0,
+            .base_array_layer = 0,
+            .layer_count = 1,
+        },
+        .image_offset = offset,
+        .image_extent = vk.Extent3D {
+            .width = 1,
+            .height = 1,
+            .depth = 1,
+        }
+    }));
+    recordAfterCopy(vc, command_buffer);
+
+    return request;
+}
+
+// null if the copy isn't done yet, otherwise its result, after which request is used up
+//
+// T must be what the request was recorded with
+// completed is the latest ticket done, as in Commands.completed
+pub fn get(self: *Self, comptime T: type, request: Request, completed: Ticket) ?T {
+    const slot = self.claimedSlot(request);
+    std.debug.assert(slot.size == @sizeOf(T));
+
+    if (slot.ticket > completed) return null;
+    slot.state = .free;
+
+    const offset = request.slot * slot_size;
+    return std.mem.bytesToValue(T, self.buffer.data[offset..][0..@sizeOf(T)]);
+}
+
+// for results that are no longer wanted -- the GPU may still be copying,
+// so the slot is only reused once `collect` sees it's done
+pub fn cancel(self: *Self, request: Request) void {
+    self.claimedSlot(request).state = .cancelled;
+}
+
+// frees up the slots of cancelled requests that are done
+pub fn collect(self: *Self, completed: Ticket) void {
+    for (&self.slots) |*slot| {
+        if (slot.state == .cancelled and slot.ticket <= completed) slot.state = .free;
+    }
+}
@@ -14,7 +14,8 @@ sample_count: u32,
 const Self = @This();
 
 pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, extent: vk.Extent2D, name: [:0]const u8) !Self {
-    const image = try Image.create(vc, vk_allocator, extent, .{ .storage_bit = true, .transfer_src_bit = true, }, .r32g32b32a32_sfloat, false, name);
+    var sensor_memory = vk_allocator.withCategory(.sensor);
+    const image = try Image.create(vc, &sensor_memory, extent, .{ .storage_bit = true, .transfer_src_bit = true, }, .r32g32b32a32_sfloat, false, name);
     errdefer image.destroy(vc);
 
     return Self {
@@ -0,0 +1,200 @@
+// persistently mapped host buffer that uploads are staged through
+//
+// space is handed out front to back, wrapping around, and is reclaimed
+// once the timeline semaphore of the owning commands says the submission
+// that used it has completed
+
+const std = @import("std");
+const vk = @import("vulkan");
+
+const core = @import("./core.zig");
+const VulkanContext = core.VulkanContext;
+const VkAllocator = core.Allocator;
+const vk_helpers = core.vk_helpers;
+
+buffer: VkAllocator.HostBuffer(u8),
+semaphore: vk.Semaphore, // timeline, not owned
+
+// positions only ever increase -- the offset into the buffer is position modulo its size
+head: u64, // where the next reservation goes
+tail: u64, // start of the oldest reservation that may still be in use
+
+in_flight: std.BoundedArray(InFlight, max_in_flight),
+
+// buffers grown out of while still in use
+outgrown: std.BoundedArray(Outgrown, max_in_flight),
+
+const Self = @This();
+
+const max_in_flight = 64;
+const alignment = 16; // enough for any texel size a buffer to image copy may need
+
+const InFlight = struct {
+    end: u64, // head at time of submission
+    value: u64,
+};
+
+const Outgrown = struct {
+    buffer: VkAllocator.HostBuffer(u8),
+    value: u64, // unsubmitted until the submission using it is made
+};
+
+const unsubmitted = std.math.maxInt(u64);
+
+pub fn Region(comptime T: type) type {
+    return struct {
+        buffer: vk.Buffer,
+        offset: vk.DeviceSize,
+        data: []T,
+    };
+}
+
+// semaphore must be a timeline semaphore that outlives the ring
+pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, size: vk.DeviceSize, semaphore: vk.Semaphore) !Self {
+    const buffer = try createBuffer(vc, vk_allocator, size);
+    errdefer buffer.destroy(vc);
+
+    return Self {
+        .buffer = buffer,
+        .semaphore = semaphore,
+        .head = 0,
+        .tail = 0,
+        .in_flight = .{},
+        .outgrown = .{},
+    };
+}
+
+// nothing staged may still be in use
+pub fn destroy(self: *Self, vc: *const VulkanContext) void {
+    for (self.outgrown.slice()) |outgrown| outgrown.buffer.destroy(vc);
+    self.buffer.destroy(vc);
+}
+
+fn createBuffer(vc: *const VulkanContext, vk_allocator: *VkAllocator, size: vk.DeviceSize) !VkAllocator.HostBuffer(u8) {
+    var staging_memory = vk_allocator.withCategory(.staging);
+    const buffer = try staging_memory.createHostBuffer(vc, u8, std.mem.alignForward(vk.DeviceSize, size, alignment), .{ .transfer_src_bit = true });
+    errdefer buffer.destroy(vc);
+    try vk_helpers.setDebugName(vc, buffer.handle, "staging ring");
+    return buffer;
+}
+
+// returned region stays valid until the next submission marked completes,
+// waiting on earlier submissions or growing the ring to make space
+pub fn reserve(self: *Self, comptime T: type, vc: *const VulkanContext, vk_allocator: *VkAllocator, count: usize) !Region(T) {
+    comptime std.debug.assert(@alignOf(T) <= alignment);
+
+    const size = count * @sizeOf(T);
+    if (size == 0) return Region(T) {
+        .buffer = self.buffer.handle,
+        .offset = 0,
+        .data = &.{},
+    };
+
+    try self.makeRoom(vc, vk_allocator, size);
+
+    const start = self.placement(size);
+    self.head = start + size;
+
+    const offset = start % self.buffer.data.len;
+    return Region(T) {
+        .buffer = self.buffer.handle,
+        .offset = offset,
+        .data = @as([*]T, @ptrCast(@alignCast(self.buffer.data.ptr + offset)))[0..count],
+    };
+}
+
+// reserves space for src and copies it in
+pub fn stage(self: *Self, comptime T: type, vc: *const VulkanContext, vk_allocator: *VkAllocator, src: []const T) !Region(T) {
+    const region = try self.reserve(T, vc, vk_allocator, src.len);
+    @memcpy(region.data, src);
+    return region;
+}
+
+// to be called once the submission using what has been reserved since the
+// last one has been made, with the value it signals the semaphore to
+//
+// values must increase from one call to the next
+pub fn markSubmitted(self: *Self, vc: *const VulkanContext, value: u64) !void {
+    if (self.in_flight.len == max_in_flight) {
+        try self.waitFor(vc, self.in_flight.get(0).value);
+        try self.retire(vc);
+    }
+    self.in_flight.appendAssumeCapacity(.{
+        .end = self.head,
+        .value = value,
+    });
+    for (self.outgrown.slice()) |*outgrown| {
+        if (outgrown.value == unsubmitted) outgrown.value = value;
+    }
+}
+
+fn waitFor(self: *const Self, vc: *const VulkanContext, value: u64) !void {
+    _ = try vc.device.waitSemaphores(&.{
+        .semaphore_count = 1,
+        .p_semaphores = @ptrCast(&self.semaphore),
+        .p_values = @ptrCast(&value),
+    }, std.math.maxInt(u64));
+}
+
+// reclaims whatever the GPU is done with
+pub fn retire(self: *Self, vc: *const VulkanContext) !void {
+    const completed = try vc.device.getSemaphoreCounterValue(self.semaphore);
+
+    while (self.in_flight.len != 0 and self.in_flight.get(0).value <= completed) {
+        self.tail = self.in_flight.orderedRemove(0).end;
+    }
+
+    var i: usize = 0;
+    while (i < self.outgrown.len) {
+        if (self.outgrown.get(i).value <= completed) {
+            self.outgrown.swapRemove(i).buffer.destroy(vc);
+        } else {
+            i += 1;
+        }
+    }
+}
+
+// where a reservation of size would start, skipping ahead to
+// the front of the buffer if it doesn't fit before the end
+fn placement(self: *const Self, size: u64) u64 {
+    const capacity = self.buffer.data.len;
+    const start = std.mem.alignForward(u64, self.head, alignment);
+    if (start % capacity + size > capacity) return (start / capacity + 1) * capacity;
+    return start;
+}
+
+fn fits(self: *const Self, size: u64) bool {
+    return self.placement(size) + size - self.tail <= self.buffer.data.len;
+}
+
+fn makeRoom(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, size: u64) !void {
+    try self.retire(vc);
+    while (!self.fits(size)) {
+        // what's left is either not submitted yet or the buffer is just too small
+        if (self.in_flight.len == 0) return self.grow(vc, vk_allocator, size);
+
+        try self.waitFor(vc, self.in_flight.get(0).value);
+        try self.retire(vc);
+    }
+}
+
+// moves on to a bigger buffer, keeping the old one around until the
+// submission using its unsubmitted reservations is done
+fn grow(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, size: u64) !void {
+    const new_buffer = try createBuffer(vc, vk_allocator, @max(self.buffer.data.len * 2, size));
+    errdefer new_buffer.destroy(vc);
+
+    if (self.head == self.tail) {
+        self.buffer.destroy(vc);
+    } else {
+        if (self.outgrown.len == max_in_flight) return error.TooManyOutgrownBuffers;
+        self.outgrown.appendAssumeCapacity(.{
+            .buffer = self.buffer,
+            .value = unsubmitted,
+        });
+    }
+
+    self.buffer = new_buffer;
+    self.head = 0;
+    self.tail = 0;
+}
@@ -3,6 +3,7 @@ const std = @import("std");
 const builtin = @import("builtin");
 
 const vk_helpers = @import("../engine.zig").core.vk_helpers;
+const PipelineCache = @import("../engine.zig").core.PipelineCache;
 
 const validate = @import("build_options").vk_validation;
 
@@ -131,6 +132,8 @@ const instance_cmds = vk.InstanceCommandFlags {
     .getDeviceProcAddr = true,
     .createDevice = true,
     .getPhysicalDeviceMemoryProperties = true,
+    .getPhysicalDeviceMemoryProperties2 = true,
+    .getPhysicalDeviceFormatProperties = true,
     .getPhysicalDeviceProperties2 = true,
 };
 
@@ -203,6 +206,12 @@ const device_commands = vk.DeviceCommandFlags {
     .cmdUpdateBuffer = true,
     .createComputePipelines = true,
     .cmdDispatch = true,
+    .waitSemaphores = true,
+    .getSemaphoreCounterValue = true,
+    .createPipelineCache = true,
+    .destroyPipelineCache = true,
+    .getPipelineCacheData = true,
+    .cmdWriteTimestamp2 = true,
 };
 
 const validation_device_commands = if (validate) vk.DeviceCommandFlags {
@@ -250,6 +259,12 @@ debug_messenger: if (validate) vk.DebugUtilsMessengerEXT else void,
 
 queue: vk.Queue,
 
+// on a dedicated transfer-only family if the device has one, otherwise the same as queue
+transfer_queue: vk.Queue,
+
+// for all pipeline creation, backed by disk when possible
+pipeline_cache: PipelineCache,
+
 const Self = @This();
 
 const QueueFamilyAcceptable = fn(vk.Instance, vk.PhysicalDevice, u32) bool;
@@ -266,12 +281,13 @@ pub fn create(allocator: std.mem.Allocator, app_name: [*:0]const u8, instance_ex
     errdefer if (validate) instance.destroyDebugUtilsMessengerEXT(debug_messenger, null);
 
     const physical_device = try PhysicalDevice.pick(instance, allocator, if (queueFamilyAcceptable) |acc| acc else returnsTrue, device_extensions);
-    const device = try physical_device.createLogicalDevice(instance, device_extensions, features);
+    const device = try physical_device.createLogicalDevice(instance, allocator, device_extensions, features);
     errdefer device.destroyDevice(null);
 
     const queue = device.getDeviceQueue(physical_device.queue_family_index, 0);
+    const transfer_queue = if (physical_device.hasTransferQueueFamily()) device.getDeviceQueue(physical_device.transfer_queue_family_index, 0) else queue;
 
-    return Self {
+    var self = Self {
         .base = base,
         .instance = instance,
         .debug_messenger = debug_messenger,
@@ -279,10 +295,18 @@ pub fn create(allocator: std.mem.Allocator, app_name: [*:0]const u8, instance_ex
         .physical_device = physical_device,
 
         .queue = queue,
+        .transfer_queue = transfer_queue,
+
+        .pipeline_cache = undefined,
     };
+    self.pipeline_cache = try PipelineCache.create(&self, allocator);
+
+    return self;
 }
 
-pub fn destroy(self: Self) void {
+pub fn destroy(self: Self, allocator: std.mem.Allocator) void {
+    var pipeline_cache = self.pipeline_cache;
+    pipeline_cache.destroy(&self, allocator);
     self.device.destroyDevice(null);
 
     if (validate) self.instance.destroyDebugUtilsMessengerEXT(self.debug_messenger, null);
@@ -293,6 +317,12 @@ pub fn destroy(self: Self) void {
 const PhysicalDevice = struct {
     handle: vk.PhysicalDevice,
     queue_family_index: u32,
+    transfer_queue_family_index: u32, // same as queue_family_index if there's no dedicated one
+    memory_budget: bool, // whether VK_EXT_memory_budget is enabled
+
+    pub fn hasTransferQueueFamily(self: PhysicalDevice) bool {
+        return self.transfer_queue_family_index != self.queue_family_index;
+    }
 
     fn pickQueueFamily(instance: Instance, device: vk.PhysicalDevice, comptime queueFamilyAcceptable: QueueFamilyAcceptable) !u32 {
         const families = vk_helpers.getVkSliceBounded(8, Instance.getPhysicalDeviceQueueFamilyProperties, .{ instance, device }).slice();
@@ -310,6 +340,20 @@ const PhysicalDevice = struct {
         } else return VulkanContextError.UnavailableQueues;
     }
 
+    // a family that can only transfer is usually backed by the copy engine,
+    // so its work can run alongside whatever the main queue is doing
+    fn pickTransferQueueFamily(instance: Instance, device: vk.PhysicalDevice, main_family: u32) u32 {
+        const families = vk_helpers.getVkSliceBounded(8, Instance.getPhysicalDeviceQueueFamilyProperties, .{ instance, device }).slice();
+
+        for (families, 0..) |family, i| {
+            if (family.queue_flags.transfer_bit and
+                !family.queue_flags.graphics_bit and
+                !family.queue_flags.compute_bit) return @intCast(i);
+        }
+
+        return main_family;
+    }
+
     fn pick(instance: Instance, allocator: std.mem.Allocator, comptime queueFamilyAcceptable: QueueFamilyAcceptable, extensions: []const [*:0]const u8) !PhysicalDevice {
         const devices = (try vk_helpers.getVkSliceBounded(4, Instance.enumeratePhysicalDevices, .{ instance })).slice();
 
@@ -319,6 +363,8 @@ const PhysicalDevice = struct {
                     break PhysicalDevice {
                         .handle = device,
                         .queue_family_index = index,
+                        .transfer_queue_family_index = pickTransferQueueFamily(instance, device, index),
+                        .memory_budget = try PhysicalDevice.deviceExtensionsAvailable(instance, device, allocator, &.{ vk.extension_info.ext_memory_budget.name }),
                     };
                 } else |err| return err;
             }
@@ -344,15 +390,31 @@ const PhysicalDevice = struct {
         return true;
     }
 
-    fn createLogicalDevice(self: *const PhysicalDevice, instance: Instance, extensions: []const [*:0]const u8, features: ?*const anyopaque) !Device {
+    fn createLogicalDevice(self: *const PhysicalDevice, instance: Instance, allocator: std.mem.Allocator, required_extensions: []const [*:0]const u8, features: ?*const anyopaque) !Device {
+        // optional extensions are enabled on top of the required ones whenever available
+        const already_required = for (required_extensions) |extension_name| {
+            if (std.mem.orderZ(u8, extension_name, vk.extension_info.ext_memory_budget.name) == .eq) break true;
+        } else false;
+        const extensions = if (self.memory_budget and !already_required)
+            try std.mem.concat(allocator, [*:0]const u8, &.{ required_extensions, &.{ vk.extension_info.ext_memory_budget.name } })
+        else
+            try allocator.dupe([*:0]const u8, required_extensions);
+        defer allocator.free(extensions);
+
         const priority = [_]f32{1.0};
         const queue_create_info = [_]vk.DeviceQueueCreateInfo{
             .{
                 .queue_family_index = self.queue_family_index,
                 .queue_count = 1,
                 .p_queue_priorities = &priority,
-            }
+            },
+            .{
+                .queue_family_index = self.transfer_queue_family_index,
+                .queue_count = 1,
+                .p_queue_priorities = &priority,
+            },
         };
+        const queue_create_info_count: u32 = if (self.hasTransferQueueFamily()) 2 else 1;
 
         var vulkan_13_features = vk.PhysicalDeviceVulkan13Features {
             .p_next = @constCast(features),
@@ -369,6 +431,8 @@ const PhysicalDevice = struct {
             .descriptor_binding_partially_bound = vk.TRUE,
             .host_query_reset = vk.TRUE,
             .descriptor_binding_update_unused_while_pending = vk.TRUE,
+            .descriptor_binding_variable_descriptor_count = vk.TRUE,
+            .timeline_semaphore = vk.TRUE,
         };
 
         return try instance.createDevice(
@@ -376,7 +440,7 @@ const PhysicalDevice = struct {
             instance.dispatch.vkGetDeviceProcAddr,
             self.handle,
             &.{
-                .queue_create_info_count = queue_create_info.len,
+                .queue_create_info_count = queue_create_info_count,
                 .p_queue_create_infos = &queue_create_info,
                 .enabled_layer_count = if (validate) validation_layers.len else 0,
                 .pp_enabled_layer_names = if (validate) &validation_layers else undefined,
@@ -2,9 +2,13 @@ pub const VulkanContext = @import("./VulkanContext.zig");
 pub const Allocator = @import("./Allocator.zig");
 pub const Commands = @import("./Commands.zig");
 pub const DestructionQueue = @import("./DestructionQueue.zig");
+pub const DeviceArray = @import("./device_array.zig").DeviceArray;
 pub const Image = @import("./Image.zig");
+pub const PipelineCache = @import("./PipelineCache.zig");
+pub const Profiler = @import("./Profiler.zig");
+pub const Readback = @import("./Readback.zig");
 pub const Sensor = @import("./Sensor.zig");
-pub const SyncCopier = @import("./SyncCopier.zig");
+pub const StagingRing = @import("./StagingRing.zig");
 
 pub const descriptor = @import("./descriptor.zig");
 pub const pipeline = @import("./pipeline.zig");
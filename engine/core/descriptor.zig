@@ -15,7 +15,7 @@ pub const DescriptorBindingInfo = struct {
 pub fn DescriptorLayout(comptime bindings: []const DescriptorBindingInfo, comptime layout_flags: vk.DescriptorSetLayoutCreateFlags, comptime max_sets: comptime_int, comptime debug_name: [*:0]const u8) type {
     return struct {
         handle: vk.DescriptorSetLayout,
-        pool: if (is_push_descriptor) void else vk.DescriptorPool,
+        pool: if (has_pool) vk.DescriptorPool else void,
 
         const Self = @This();
 
@@ -31,6 +31,12 @@ pub fn DescriptorLayout(comptime bindings: []const DescriptorBindingInfo, compti
 
         const is_push_descriptor = layout_flags.contains(.{ .push_descriptor_bit_khr = true });
 
+        // a pool for sets with a variable count binding would need to be sized for the
+        // count they're allocated with, so it's up to the user to make one
+        const has_variable_count = bindings[bindings.len - 1].binding_flags.contains(.{ .variable_descriptor_count_bit = true });
+
+        const has_pool = !is_push_descriptor and !has_variable_count;
+
         pub fn create(vc: *const VulkanContext, samplers: [sampler_count]vk.Sampler) !Self {
             var vk_bindings: [bindings.len]vk.DescriptorSetLayoutBinding = undefined;
             comptime var vk_binding_flags: [bindings.len]vk.DescriptorBindingFlags = undefined;
@@ -72,7 +78,7 @@ pub fn DescriptorLayout(comptime bindings: []const DescriptorBindingInfo, compti
 
             return Self {
                 .handle = handle,
-                .pool = if (is_push_descriptor) {} else try vc.device.createDescriptorPool(&.{
+                .pool = if (!has_pool) {} else try vc.device.createDescriptorPool(&.{
                     .flags = .{},
                     .max_sets = max_sets,
                     .pool_size_count = pool_sizes.len,
@@ -81,7 +87,7 @@ pub fn DescriptorLayout(comptime bindings: []const DescriptorBindingInfo, compti
             };
         }
 
-        pub usingnamespace if (is_push_descriptor) struct {} else struct {
+        pub usingnamespace if (!has_pool) struct {} else struct {
             pub fn allocate_set(self: *const Self, vc: *const VulkanContext, writes: [bindings.len]vk.WriteDescriptorSet) !vk.DescriptorSet {
                 var descriptor_set: vk.DescriptorSet = undefined;
 
@@ -117,7 +123,7 @@ pub fn DescriptorLayout(comptime bindings: []const DescriptorBindingInfo, compti
         };
 
         pub fn destroy(self: *Self, vc: *const VulkanContext) void {
-            if (!is_push_descriptor) vc.device.destroyDescriptorPool(self.pool, null);
+            if (has_pool) vc.device.destroyDescriptorPool(self.pool, null);
             vc.device.destroyDescriptorSetLayout(self.handle, null);
         }
     };
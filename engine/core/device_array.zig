@@ -0,0 +1,122 @@
+const std = @import("std");
+const vk = @import("vulkan");
+
+const core = @import("./core.zig");
+const VulkanContext = core.VulkanContext;
+const VkAllocator = core.Allocator;
+const Commands = core.Commands;
+const vk_helpers = core.vk_helpers;
+
+// device buffer that grows as needed, with the old contents copied over on the GPU
+//
+// growing moves the buffer, so its handle and address must be fetched again
+// after anything that may grow it
+pub fn DeviceArray(comptime T: type, comptime usage: vk.BufferUsageFlags, comptime category: VkAllocator.Category, comptime name: [:0]const u8) type {
+    return struct {
+        buffer: VkAllocator.DeviceBuffer(T) = .{},
+        capacity: u32 = 0,
+
+        // grown out of, destroyed once the submission copying out of them is done
+        retired: std.ArrayListUnmanaged(Retired) = .{},
+
+        const Self = @This();
+
+        const Retired = struct {
+            buffer: VkAllocator.DeviceBuffer(T),
+            ticket: Commands.Ticket,
+        };
+
+        const min_capacity = 64;
+
+        pub fn handle(self: *const Self) vk.Buffer {
+            return self.buffer.handle;
+        }
+
+        // must've been created with shader device address bit enabled
+        pub fn getAddress(self: *const Self, vc: *const VulkanContext) vk.DeviceAddress {
+            return self.buffer.getAddress(vc);
+        }
+
+        pub fn is_null(self: *const Self) bool {
+            return self.buffer.is_null();
+        }
+
+        // commands must be in recording state
+        // makes room for at least capacity elements, keeping the first len of them
+        // grows geometrically so that appending one at a time is amortized
+        //
+        // returns whether the buffer moved
+        pub fn recordEnsureCapacity(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, len: u32, capacity: u32) !bool {
+            std.debug.assert(len <= self.capacity);
+            if (capacity <= self.capacity) return false;
+
+            self.collect(vc, try commands.completed(vc));
+            try self.retired.ensureUnusedCapacity(allocator, 1);
+
+            const new_capacity = @max(capacity, self.capacity * 2, min_capacity);
+            var categorized = vk_allocator.withCategory(category);
+            const new_buffer = try categorized.createDeviceBuffer(vc, T, new_capacity, usage.merge(.{ .transfer_src_bit = true, .transfer_dst_bit = true }));
+            errdefer new_buffer.destroy(vc);
+            try vk_helpers.setDebugName(vc, new_buffer.handle, name);
+
+            if (len != 0) {
+                // anything earlier in commands may have written the old buffer
+                vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
+                    .memory_barrier_count = 1,
+                    .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+                        .src_stage_mask = .{ .all_commands_bit = true },
+                        .src_access_mask = .{ .memory_write_bit = true },
+                        .dst_stage_mask = .{ .copy_bit = true },
+                        .dst_access_mask = .{ .transfer_read_bit = true },
+                    }),
+                });
+                commands.recordCopyBuffer(vc, new_buffer.handle, self.buffer.handle, &.{
+                    vk.BufferCopy {
+                        .src_offset = 0,
+                        .dst_offset = 0,
+                        .size = @as(vk.DeviceSize, len) * @sizeOf(T),
+                    },
+                });
+                vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
+                    .memory_barrier_count = 1,
+                    .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+                        .src_stage_mask = .{ .copy_bit = true },
+                        .src_access_mask = .{ .transfer_write_bit = true },
+                        .dst_stage_mask = .{ .all_commands_bit = true },
+                        .dst_access_mask = .{ .memory_read_bit = true, .memory_write_bit = true },
+                    }),
+                });
+            }
+
+            if (!self.buffer.is_null()) self.retired.appendAssumeCapacity(.{
+                .buffer = self.buffer,
+                .ticket = commands.pendingTicket(),
+            });
+            self.buffer = new_buffer;
+            self.capacity = @intCast(new_capacity);
+
+            return true;
+        }
+
+        // destroys buffers grown out of that are no longer in use
+        pub fn collect(self: *Self, vc: *const VulkanContext, completed: Commands.Ticket) void {
+            var kept: usize = 0;
+            for (self.retired.items) |retired| {
+                if (retired.ticket <= completed) {
+                    retired.buffer.destroy(vc);
+                } else {
+                    self.retired.items[kept] = retired;
+                    kept += 1;
+                }
+            }
+            self.retired.shrinkRetainingCapacity(kept);
+        }
+
+        // nothing may still be in use
+        pub fn destroy(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
+            for (self.retired.items) |retired| retired.buffer.destroy(vc);
+            self.retired.deinit(allocator);
+            self.buffer.destroy(vc);
+        }
+    };
+}
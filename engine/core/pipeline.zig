@@ -27,7 +27,16 @@ pub fn createShaderModule(vc: *const VulkanContext, comptime shader_path: []cons
             .ray_tracing => build_options.rt_shader_compile_cmd,
             .compute => build_options.compute_shader_compile_cmd,
         };
-        var compile_process = std.ChildProcess.init(compile_cmd ++ &[_][]const u8 { "shaders/" ++ shader_path }, allocator);
+        const source_path = "shaders/" ++ shader_path;
+
+        // if the source can't be hashed, just compile and let the compiler report what's wrong
+        const key = core.PipelineCache.hashShader(allocator, compile_cmd, source_path) catch null;
+        if (key) |k| if (vc.pipeline_cache.loadSpirv(allocator, k)) |cached| {
+            to_free = cached;
+            break :blk cached;
+        };
+
+        var compile_process = std.ChildProcess.init(compile_cmd ++ &[_][]const u8 { source_path }, allocator);
         compile_process.stdout_behavior = .Pipe;
         try compile_process.spawn();
         const stdout = blk_inner: {
@@ -50,6 +59,7 @@ pub fn createShaderModule(vc: *const VulkanContext, comptime shader_path: []cons
 
         const term = try compile_process.wait();
         if (term == .Exited and term.Exited != 0) return error.ShaderCompileFail;
+        if (key) |k| if (term == .Exited) vc.pipeline_cache.storeSpirv(k, stdout) catch |err| std.log.warn("couldn't cache SPIR-V for {s}: {}", .{ shader_path, err });
         break :blk stdout;
     };
     return try vc.device.createShaderModule(&.{
@@ -259,7 +269,7 @@ pub fn Pipeline(
             };
 
             const old_handle = self.handle;
-            _ = try vc.device.createComputePipelines(.null_handle, 1, @ptrCast(&create_info), null, @ptrCast(&self.handle));
+            _ = try vc.device.createComputePipelines(vc.pipeline_cache.handle, 1, @ptrCast(&create_info), null, @ptrCast(&self.handle));
             errdefer vc.device.destroyPipeline(self.handle, null);
 
             return old_handle;
@@ -4,6 +4,7 @@ const vk = @import("vulkan");
 const core = @import("../engine.zig").core;
 const VulkanContext = core.VulkanContext;
 const DestructionQueue = core.DestructionQueue;
+const Commands = core.Commands;
 const VkAllocator = core.Allocator;
 const vk_helpers = core.vk_helpers;
 
@@ -99,18 +100,32 @@ pub fn startFrame(self: *Self, vc: *const VulkanContext) !vk.CommandBuffer {
     return frame.command_buffer;
 }
 
-pub fn recreate(self: *Self, vc: *const VulkanContext, new_extent: vk.Extent2D, destruction_queue: *DestructionQueue, allocator: std.mem.Allocator) !void {
-    try destruction_queue.add(allocator, self.swapchain.handle);
+// old swapchain is destroyed once the frames submitted so far are done
+pub fn recreate(self: *Self, vc: *const VulkanContext, new_extent: vk.Extent2D, commands: *const Commands, destruction_queue: *DestructionQueue, allocator: std.mem.Allocator) !void {
+    try destruction_queue.add(allocator, commands.last_ticket, self.swapchain.handle);
     try self.swapchain.recreate(vc, new_extent);
 }
 
-pub fn endFrame(self: *Self, vc: *const VulkanContext) !vk.Result {
+// frame is submitted with a ticket from commands, so it can be waited on along with everything else
+pub fn endFrame(self: *Self, vc: *const VulkanContext, commands: *Commands) !vk.Result {
     const frame = self.frames[self.frame_index];
 
     if (metrics) vc.device.cmdWriteTimestamp2(frame.command_buffer, .{ .bottom_of_pipe_bit = true }, frame.query_pool, 1);
 
     try vc.device.endCommandBuffer(frame.command_buffer);
 
+    // only claimed once submitted, as in Commands.submit
+    const ticket = commands.pendingTicket();
+    const signal_infos = [2]vk.SemaphoreSubmitInfo {
+        .{
+            .semaphore = frame.command_completed,
+            .value = 0,
+            .stage_mask =  .{ .color_attachment_output_bit = true },
+            .device_index = 0,
+        },
+        commands.signalInfo(ticket),
+    };
+
     // TODO: figure out why color_attachment_output_bit is the right thing here
     try vc.device.queueSubmit2(vc.queue, 1, &[_]vk.SubmitInfo2 { .{
         .flags = .{},
@@ -126,14 +141,11 @@ pub fn endFrame(self: *Self, vc: *const VulkanContext) !vk.Result {
             .command_buffer = frame.command_buffer,
             .device_mask = 0,
         }),
-        .signal_semaphore_info_count = 1,
-        .p_signal_semaphore_infos = @ptrCast(&vk.SemaphoreSubmitInfoKHR {
-            .semaphore = frame.command_completed,
-            .value = 0,
-            .stage_mask =  .{ .color_attachment_output_bit = true },
-            .device_index = 0,
-        }),
+        .signal_semaphore_info_count = signal_infos.len,
+        .p_signal_semaphore_infos = &signal_infos,
     }}, frame.fence);
+    const claimed = commands.claimTicket();
+    std.debug.assert(claimed == ticket);
 
     if (self.swapchain.present(vc, vc.queue, frame.command_completed)) |ok| {
         // if ok, frame presented successfully and we should wait for previous frame
@@ -1,6 +1,5 @@
 pub const Display = @import("./Display.zig");
 pub const Swapchain = @import("./Swapchain.zig");
-const metrics = @import("build_options").vk_metrics;
 
 const vk = @import("vulkan");
 pub const required_instance_functions = vk.InstanceCommandFlags {
@@ -11,17 +10,13 @@ pub const required_instance_functions = vk.InstanceCommandFlags {
     .getPhysicalDeviceSurfaceCapabilitiesKHR = true,
 };
 
-const base_required_device_functions = vk.DeviceCommandFlags {
+pub const required_device_functions = vk.DeviceCommandFlags {
     .getSwapchainImagesKHR = true,
     .createSwapchainKHR = true,
     .acquireNextImage2KHR = true,
     .queuePresentKHR = true,
     .destroySwapchainKHR = true,
 };
-const metrics_device_functions = vk.DeviceCommandFlags {
-    .cmdWriteTimestamp2 = true,
-};
-pub const required_device_functions = if (metrics) base_required_device_functions.merge(metrics_device_functions) else base_required_device_functions;
 
 pub const required_device_extensions = [_][*:0]const u8{
     vk.extension_info.khr_swapchain.name,
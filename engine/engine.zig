@@ -8,3 +8,5 @@ pub const gui = @import("./gui/gui.zig");
 
 // utils
 pub const vector = @import("./vector.zig");
+pub const tracing = @import("./tracing.zig");
+pub const parallel = @import("./parallel.zig");
@@ -133,6 +133,10 @@ pub fn inputScalar(comptime T: type, label: [*:0]const u8, p_data: *T, step: ?T,
     return c.igInputScalar(label, data_type, p_data, if (step) |s| &s else null, if (step_fast) |s| &s else null, "%d", 0);
 }
 
+pub fn checkbox(label: [*:0]const u8, v: *bool) bool {
+    return c.igCheckbox(label, v);
+}
+
 const Col = enum(c_int) {
     text,
     _,
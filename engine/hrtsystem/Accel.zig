@@ -6,13 +6,19 @@ const VulkanContext = engine.core.VulkanContext;
 const Commands = engine.core.Commands;
 const VkAllocator = engine.core.Allocator;
 const vk_helpers = engine.core.vk_helpers;
+const DeviceArray = engine.core.DeviceArray;
 
 const MeshManager = @import("./MeshManager.zig");
 const AliasTable = @import("./alias_table.zig").AliasTable;
+const light_tree = @import("./light_tree.zig");
 
 const vector = @import("../vector.zig");
 const Mat3x4 = vector.Mat3x4(f32);
 const F32x3 = vector.Vec3(f32);
+const F32x4 = vector.Vec4(f32);
+const U32x3 = vector.Vec3(u32);
+
+const parallel = engine.parallel;
 
 // "accel" perhaps the wrong name for this struct at this point, maybe "heirarchy" would be better
 // the acceleration structure is the primary world heirarchy, and controls
@@ -46,8 +52,86 @@ pub const Geometry = extern struct {
 const BottomLevelAccels = std.MultiArrayList(struct {
     handle: vk.AccelerationStructureKHR,
     buffer: VkAllocator.DeviceBuffer(u8),
+    meshes: []const MeshManager.Handle, // meshes this BLAS was built from, in geometry order
+    bounds: Bounds, // of its meshes, as of its last build or refit
+    ref_count: u32, // instances using this BLAS, destroyed when zero
 });
 
+// axis-aligned box, to tell how far instances have moved since the TLAS was built
+const Bounds = struct {
+    min: F32x3,
+    max: F32x3,
+
+    const empty = Bounds {
+        .min = F32x3.new(std.math.inf(f32), std.math.inf(f32), std.math.inf(f32)),
+        .max = F32x3.new(-std.math.inf(f32), -std.math.inf(f32), -std.math.inf(f32)),
+    };
+
+    fn addPoint(self: *Bounds, point: F32x3) void {
+        self.min = F32x3.new(@min(self.min.x, point.x), @min(self.min.y, point.y), @min(self.min.z, point.z));
+        self.max = F32x3.new(@max(self.max.x, point.x), @max(self.max.y, point.y), @max(self.max.z, point.z));
+    }
+
+    fn merged(self: Bounds, other: Bounds) Bounds {
+        var result = self;
+        result.addPoint(other.min);
+        result.addPoint(other.max);
+        return result;
+    }
+
+    fn transformed(self: Bounds, transform: Mat3x4) Bounds {
+        if (self.min.x > self.max.x) return empty;
+        var result = empty;
+        for (0..8) |corner| {
+            result.addPoint(transform.mul_point(F32x3.new(
+                if (corner & 1 == 0) self.min.x else self.max.x,
+                if (corner & 2 == 0) self.min.y else self.max.y,
+                if (corner & 4 == 0) self.min.z else self.max.z,
+            )));
+        }
+        return result;
+    }
+
+    fn surfaceArea(self: Bounds) f32 {
+        if (self.min.x > self.max.x) return 0;
+        const extent = self.max.sub(self.min);
+        return 2 * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+};
+
+fn meshBounds(mesh_manager: MeshManager, meshes: []const MeshManager.Handle) Bounds {
+    var bounds = Bounds.empty;
+    for (meshes) |mesh| {
+        for (mesh_manager.meshes.items(.positions)[mesh]) |position| bounds.addPoint(position);
+    }
+    return bounds;
+}
+
+// finds the live BLAS built from a list of meshes, so instances of the same
+// meshes share one -- keys are the `meshes` of the BLASes themselves
+const BlasLookup = std.HashMapUnmanaged([]const MeshManager.Handle, u32, struct {
+    pub fn hash(self: @This(), key: []const MeshManager.Handle) u64 {
+        _ = self;
+        return std.hash.Wyhash.hash(0, std.mem.sliceAsBytes(key));
+    }
+    pub fn eql(self: @This(), a: []const MeshManager.Handle, b: []const MeshManager.Handle) bool {
+        _ = self;
+        return std.mem.eql(MeshManager.Handle, a, b);
+    }
+}, std.hash_map.default_max_load_percentage);
+
+// host-side info for each instance, in same order as instances_host
+const InstanceData = struct {
+    handle: Handle, // handle this instance was given out as
+    blas: u32, // idx of BLAS this instance uses
+    geometry_count: u24, // geometries this instance owns, starting at its custom index
+};
+
+const GeometryRange = struct {
+    start: u24,
+    count: u24,
+};
+
 const TableData = extern struct {
     instance: u32,
     geometry: u32,
@@ -55,61 +139,143 @@ const TableData = extern struct {
 };
 const AliasTableT = AliasTable(TableData);
 
+// each triangle of each sampled geometry, in the order they were added
+const Emitter = struct {
+    handle: Handle, // of the instance this is part of
+    geometry: u32, // idx in that instance's geometries
+    primitive: u32,
+};
+
+// where the emitters of an instance are, indexed by handle
+const EmitterRange = struct {
+    start: u32,
+    count: u32,
+    dirty: bool, // whether areas need to be recomputed
+};
+
 blases: BottomLevelAccels = .{},
+blas_lookup: BlasLookup = .{},
 
 instance_count: u32 = 0,
-instances_device: VkAllocator.DeviceBuffer(vk.AccelerationStructureInstanceKHR) = .{},
-instances_host: VkAllocator.HostBuffer(vk.AccelerationStructureInstanceKHR) = .{},
+instance_data: std.ArrayListUnmanaged(InstanceData) = .{},
+
+// handles stay stable while instances get moved around to keep them tightly packed,
+// so keep track of where each one currently is
+instance_indices: std.ArrayListUnmanaged(u32) = .{},
+free_handles: std.ArrayListUnmanaged(Handle) = .{},
+free_blases: std.ArrayListUnmanaged(u32) = .{},
+
+instances_device: InstancesArray = .{},
+instances_host: std.ArrayListUnmanaged(vk.AccelerationStructureInstanceKHR) = .{},
 instances_address: vk.DeviceAddress = 0,
 
 // keep track of inverse transform -- non-inverse we can get from instances_device
 // transforms provided by shader only in hit/intersection shaders but we need them
 // in raygen
 // ray queries provide them in any shader which would be a benefit of using them
-world_to_instance_device: VkAllocator.DeviceBuffer(Mat3x4) = .{},
-world_to_instance_host: VkAllocator.HostBuffer(Mat3x4) = .{},
+world_to_instance_device: WorldToInstanceArray = .{},
+world_to_instance_host: std.ArrayListUnmanaged(Mat3x4) = .{},
 
 // flat jagged array for geometries --
 // use instanceCustomIndex + GeometryID() here to get geometry
 geometry_count: u24 = 0,
-geometries: VkAllocator.DeviceBuffer(Geometry) = .{},
+geometries: GeometriesArray = .{},
+free_geometry_ranges: std.ArrayListUnmanaged(GeometryRange) = .{}, // left behind by destroyed instances, sorted and never adjacent
 
 // tlas stuff
 tlas_handle: vk.AccelerationStructureKHR = .null_handle,
 tlas_buffer: VkAllocator.DeviceBuffer(u8) = .{},
 
+tlas_size: vk.DeviceSize = 0, // what tlas_buffer has room for
+
 tlas_update_scratch_buffer: VkAllocator.DeviceBuffer(u8) = .{},
 tlas_update_scratch_address: vk.DeviceAddress = 0,
+tlas_update_scratch_size: vk.DeviceSize = 0,
+
+// builds are deferred to recordUpdateTlas, so that adding many instances only builds once
+tlas_dirty: bool = true, // instances added or removed since the last build, so it can't just be refit
+tlas_flags: vk.BuildAccelerationStructureFlagsKHR = tlas_trace_flags, // of the last build, refits must match
+tlas_refit_count: u32 = 0, // since the last build
+tlas_built_bounds: std.ArrayListUnmanaged(Bounds) = .{}, // of each instance, as of the last build
+
+// light sampling
+//
+// areas and bounds are kept around so that only instances that are added, moved or hidden
+// need theirs recomputed, though the table and tree themselves are rebuilt from all of them,
+// the table only when areas or emitters actually changed
+emitters: std.ArrayListUnmanaged(Emitter) = .{},
+emitter_areas: std.ArrayListUnmanaged(f32) = .{}, // world space, zero if hidden
+emitter_triangles: std.ArrayListUnmanaged(light_tree.Triangle) = .{}, // world space bounds and normals
+emitter_ranges: std.ArrayListUnmanaged(EmitterRange) = .{},
+emitters_dirty: bool = false, // alias table and light tree must be rebuilt with recordUpdateEmitters
+emitter_layout_dirty: bool = false, // emitters were added, removed or renumbered, not just moved
+emitter_lookup_geometry_count: u32 = 0, // geometry count as of the last lookup layout, which is where its trails start
+light_tree_stale: bool = false, // skipped by recordUpdateEmitters while unused, so must be rebuilt before being sampled with
+
+alias_table: AliasTableArray = .{}, // to sample lights, first entry is a header with the entry count and sum
+
+// other way to sample lights, taking into account where they are relative to the shading point
+//
+// leaves refer to alias table entries for the triangles themselves
+light_tree_nodes: LightTreeArray = .{},
 
-alias_table: VkAllocator.DeviceBuffer(AliasTableT.TableEntry) = .{}, // to sample lights
+// first, for each geometry, where in here the trails to its triangles start,
+// only meaningful for sampled geometries, then those trails
+light_tree_lookup: LightTreeLookupArray = .{},
 
 const Self = @This();
 
-const max_instances = 4096; // TODO: resizable buffers
-const max_geometries = 4096; // TODO: resizable buffers
+const InstancesArray = DeviceArray(vk.AccelerationStructureInstanceKHR, .{ .shader_device_address_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true, .storage_buffer_bit = true }, .accel, "instances");
+const WorldToInstanceArray = DeviceArray(Mat3x4, .{ .storage_buffer_bit = true }, .accel, "world to instance");
+const GeometriesArray = DeviceArray(Geometry, .{ .storage_buffer_bit = true }, .accel, "geometries");
+const AliasTableArray = DeviceArray(AliasTableT.TableEntry, .{ .storage_buffer_bit = true }, .accel, "emitter alias table");
+const LightTreeArray = DeviceArray(light_tree.Node, .{ .storage_buffer_bit = true }, .accel, "emitter light tree");
+const LightTreeLookupArray = DeviceArray(u32, .{ .storage_buffer_bit = true }, .accel, "emitter light tree lookup");
 
+// builds a BLAS for each list of geometries, appending them to blases
+//
+// they are then compacted, as builds are sized for the worst case and
+// the BLASes usually end up needing quite a bit less
+//
 // lots of temp memory allocations here
-// commands must be in recording state
-// returns scratch buffers that must be kept alive until command is completed
-fn makeBlases(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, geometries: []const []const Geometry, blases: *BottomLevelAccels) ![]const VkAllocator.OwnedDeviceBuffer {
+// submits to commands and waits for it to be done, so commands must not be recording
+fn makeBlases(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, geometries: []const []const Geometry, blases: *BottomLevelAccels) !void {
+    if (geometries.len == 0) return;
+
+    var accel_memory = vk_allocator.withCategory(.accel);
+
     const build_geometry_infos = try allocator.alloc(vk.AccelerationStructureBuildGeometryInfoKHR, geometries.len);
     defer allocator.free(build_geometry_infos);
     defer for (build_geometry_infos) |build_geometry_info| allocator.free(build_geometry_info.p_geometries.?[0..build_geometry_info.geometry_count]);
 
-    const scratch_buffers = try allocator.alloc(VkAllocator.OwnedDeviceBuffer, geometries.len);
-
     const build_infos = try allocator.alloc([*]vk.AccelerationStructureBuildRangeInfoKHR, geometries.len);
     defer allocator.free(build_infos);
     defer for (build_infos, build_geometry_infos) |build_info, build_geometry_info| allocator.free(build_info[0..build_geometry_info.geometry_count]);
 
+    // every build gets its own part of a single scratch buffer
+    const scratch_offsets = try allocator.alloc(vk.DeviceSize, geometries.len);
+    defer allocator.free(scratch_offsets);
+    const scratch_alignment = getScratchOffsetAlignment(vc);
+    var scratch_size: vk.DeviceSize = 0;
+
+    const first_blas = blases.len;
     try blases.ensureUnusedCapacity(allocator, geometries.len);
+    errdefer {
+        for (first_blas..blases.len) |i| {
+            const blas = blases.get(i);
+            vc.device.destroyAccelerationStructureKHR(blas.handle, null);
+            blas.buffer.destroy(vc);
+            allocator.free(blas.meshes);
+        }
+        blases.shrinkRetainingCapacity(first_blas);
+    }
 
-    for (geometries, build_infos, build_geometry_infos, scratch_buffers) |list, *build_info, *build_geometry_info, *scratch_buffer| {
+    for (geometries, build_infos, build_geometry_infos, scratch_offsets) |list, *build_info, *build_geometry_info, *scratch_offset| {
         const vk_geometries = try allocator.alloc(vk.AccelerationStructureGeometryKHR, list.len);
 
         build_geometry_info.* = vk.AccelerationStructureBuildGeometryInfoKHR {
             .type = .bottom_level_khr,
-            .flags = .{ .prefer_fast_trace_bit_khr = true },
+            .flags = blas_flags,
             .mode = .build_khr,
             .geometry_count = @intCast(vk_geometries.len),
             .p_geometries = vk_geometries.ptr,
@@ -121,47 +287,19 @@ fn makeBlases(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
 
         build_info.* = (try allocator.alloc(vk.AccelerationStructureBuildRangeInfoKHR, list.len)).ptr;
 
-        for (list, vk_geometries, primitive_counts, 0..) |geo, *geometry, *primitive_count, j| {
-            const mesh = mesh_manager.meshes.get(geo.mesh);
-
-            geometry.* = vk.AccelerationStructureGeometryKHR {
-                .geometry_type = .triangles_khr,
-                .flags = .{ .opaque_bit_khr = true },
-                .geometry = .{
-                    .triangles = .{
-                        .vertex_format = .r32g32b32_sfloat,
-                        .vertex_data = .{
-                            .device_address = mesh.position_buffer.getAddress(vc),
-                        },
-                        .vertex_stride = @sizeOf(F32x3),
-                        .max_vertex = @intCast(mesh.vertex_count - 1),
-                        .index_type = .uint32,
-                        .index_data = .{
-                            .device_address = mesh.index_buffer.getAddress(vc),
-                        },
-                        .transform_data = .{
-                            .device_address = 0,
-                        }
-                    }
-                }
-            };
-
-            build_info.*[j] =  vk.AccelerationStructureBuildRangeInfoKHR {
-                .primitive_count = @intCast(mesh.index_count),
-                .primitive_offset = 0,
-                .transform_offset = 0,
-                .first_vertex = 0,
-            };
-            primitive_count.* = build_info.*[j].primitive_count;
-        }
+        const meshes = try allocator.alloc(MeshManager.Handle, list.len);
+        errdefer allocator.free(meshes);
+        for (list, meshes) |geo, *mesh| mesh.* = geo.mesh;
+
+        fillBlasGeometries(vc, mesh_manager, meshes, vk_geometries, build_info.*[0..list.len]);
+        for (build_info.*[0..list.len], primitive_counts) |range, *primitive_count| primitive_count.* = range.primitive_count;
 
         const size_info = getBuildSizesInfo(vc, build_geometry_info, primitive_counts.ptr);
 
-        scratch_buffer.* = try vk_allocator.createOwnedDeviceBuffer(vc, size_info.build_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
-        errdefer scratch_buffer.destroy(vc);
-        build_geometry_info.scratch_data.device_address = scratch_buffer.getAddress(vc);
+        scratch_offset.* = scratch_size;
+        scratch_size += std.mem.alignForward(vk.DeviceSize, size_info.build_scratch_size, scratch_alignment);
 
-        const buffer = try vk_allocator.createDeviceBuffer(vc, allocator, u8, size_info.acceleration_structure_size, .{ .acceleration_structure_storage_bit_khr = true });
+        const buffer = try accel_memory.createDeviceBuffer(vc, u8, size_info.acceleration_structure_size, .{ .acceleration_structure_storage_bit_khr = true });
         errdefer buffer.destroy(vc);
 
         build_geometry_info.dst_acceleration_structure = try vc.device.createAccelerationStructureKHR(&.{
@@ -175,49 +313,345 @@ fn makeBlases(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
         blases.appendAssumeCapacity(.{
             .handle = build_geometry_info.dst_acceleration_structure,
             .buffer = buffer,
+            .meshes = meshes,
+            .bounds = meshBounds(mesh_manager, meshes),
+            .ref_count = 0,
         });
     }
 
-    vc.device.cmdBuildAccelerationStructuresKHR(commands.buffer, @intCast(build_geometry_infos.len), build_geometry_infos.ptr, build_infos.ptr);
+    // buffer addresses aren't necessarily aligned enough for scratch, so leave room to align it
+    const scratch_buffer = try accel_memory.createOwnedDeviceBuffer(vc, scratch_size + scratch_alignment, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
+    defer scratch_buffer.destroy(vc);
+    const scratch_address = std.mem.alignForward(vk.DeviceAddress, scratch_buffer.getAddress(vc), scratch_alignment);
+    for (build_geometry_infos, scratch_offsets) |*build_geometry_info, scratch_offset| {
+        build_geometry_info.scratch_data.device_address = scratch_address + scratch_offset;
+    }
+
+    const compacted_sizes = try allocator.alloc(vk.DeviceSize, geometries.len);
+    defer allocator.free(compacted_sizes);
+    try commands.createAccelStructsAndGetCompactedSizes(vc, build_geometry_infos, build_infos, blases.items(.handle)[first_blas..], compacted_sizes);
 
-    return scratch_buffers;
+    try compactBlases(vc, &accel_memory, allocator, commands, blases, first_blas, compacted_sizes);
 }
 
-// accel must not be in use
-// alias table currently unimplemented
+// moves BLASes starting at first_blas into buffers of their compacted sizes
+// submits to commands and waits for it to be done, so commands must not be recording
+fn compactBlases(vc: *const VulkanContext, accel_memory: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, blases: *BottomLevelAccels, first_blas: usize, compacted_sizes: []const vk.DeviceSize) !void {
+    const handles = blases.items(.handle)[first_blas..];
+    const buffers = blases.items(.buffer)[first_blas..];
+    std.debug.assert(handles.len == compacted_sizes.len);
+
+    const copy_infos = try allocator.alloc(vk.CopyAccelerationStructureInfoKHR, handles.len);
+    defer allocator.free(copy_infos);
+    const compacted_buffers = try allocator.alloc(VkAllocator.DeviceBuffer(u8), handles.len);
+    defer allocator.free(compacted_buffers);
+
+    var created_count: usize = 0;
+    errdefer for (copy_infos[0..created_count], compacted_buffers[0..created_count]) |copy_info, compacted_buffer| {
+        vc.device.destroyAccelerationStructureKHR(copy_info.dst, null);
+        compacted_buffer.destroy(vc);
+    };
+
+    for (handles, compacted_sizes, copy_infos, compacted_buffers) |handle, compacted_size, *copy_info, *compacted_buffer| {
+        compacted_buffer.* = try accel_memory.createDeviceBuffer(vc, u8, compacted_size, .{ .acceleration_structure_storage_bit_khr = true });
+        errdefer compacted_buffer.destroy(vc);
+
+        copy_info.* = vk.CopyAccelerationStructureInfoKHR {
+            .src = handle,
+            .dst = try vc.device.createAccelerationStructureKHR(&.{
+                .buffer = compacted_buffer.handle,
+                .offset = 0,
+                .size = compacted_size,
+                .type = .bottom_level_khr,
+            }, null),
+            .mode = .compact_khr,
+        };
+        created_count += 1;
+    }
+
+    try commands.copyAccelStructs(vc, copy_infos);
+
+    var saved_bytes: vk.DeviceSize = 0;
+    for (handles, buffers, copy_infos, compacted_buffers) |*handle, *buffer, copy_info, compacted_buffer| {
+        saved_bytes += buffer.allocation.size -| compacted_buffer.allocation.size;
+        vc.device.destroyAccelerationStructureKHR(handle.*, null);
+        buffer.destroy(vc);
+        handle.* = copy_info.dst;
+        buffer.* = compacted_buffer;
+    }
+
+    std.log.info("compacted {} BLAS, saving {d:.2}MiB", .{ handles.len, @as(f64, @floatFromInt(saved_bytes)) / (1024 * 1024) });
+}
+
+fn getScratchOffsetAlignment(vc: *const VulkanContext) u32 {
+    var accel_properties = vk.PhysicalDeviceAccelerationStructurePropertiesKHR {
+        .max_geometry_count = undefined,
+        .max_instance_count = undefined,
+        .max_primitive_count = undefined,
+        .max_per_stage_descriptor_acceleration_structures = undefined,
+        .max_per_stage_descriptor_update_after_bind_acceleration_structures = undefined,
+        .max_descriptor_set_acceleration_structures = undefined,
+        .max_descriptor_set_update_after_bind_acceleration_structures = undefined,
+        .min_acceleration_structure_scratch_offset_alignment = undefined,
+    };
+    var properties = vk.PhysicalDeviceProperties2 {
+        .p_next = &accel_properties,
+        .properties = undefined,
+    };
+    vc.instance.getPhysicalDeviceProperties2(vc.physical_device.handle, &properties);
+    return accel_properties.min_acceleration_structure_scratch_offset_alignment;
+}
+
+// allow updates so deforming meshes can be refit rather than rebuilt
+const blas_flags = vk.BuildAccelerationStructureFlagsKHR { .prefer_fast_trace_bit_khr = true, .allow_update_bit_khr = true, .allow_compaction_bit_khr = true };
+
+fn fillBlasGeometries(vc: *const VulkanContext, mesh_manager: MeshManager, meshes: []const MeshManager.Handle, vk_geometries: []vk.AccelerationStructureGeometryKHR, build_ranges: []vk.AccelerationStructureBuildRangeInfoKHR) void {
+    for (meshes, vk_geometries, build_ranges) |mesh_idx, *geometry, *build_range| {
+        const mesh = mesh_manager.meshes.get(mesh_idx);
+
+        geometry.* = vk.AccelerationStructureGeometryKHR {
+            .geometry_type = .triangles_khr,
+            .flags = .{ .opaque_bit_khr = true },
+            .geometry = .{
+                .triangles = .{
+                    .vertex_format = .r32g32b32_sfloat,
+                    .vertex_data = .{
+                        .device_address = mesh.position_buffer.getAddress(vc),
+                    },
+                    .vertex_stride = @sizeOf(F32x3),
+                    .max_vertex = @intCast(mesh.vertex_count - 1),
+                    .index_type = .uint32,
+                    .index_data = .{
+                        .device_address = mesh.index_buffer.getAddress(vc),
+                    },
+                    .transform_data = .{
+                        .device_address = 0,
+                    }
+                }
+            }
+        };
+
+        build_range.* =  vk.AccelerationStructureBuildRangeInfoKHR {
+            .primitive_count = @intCast(mesh.index_count),
+            .primitive_offset = 0,
+            .transform_offset = 0,
+            .first_vertex = 0,
+        };
+    }
+}
+
+fn usesAnyOf(meshes: []const MeshManager.Handle, updated: []const MeshManager.Handle) bool {
+    for (meshes) |mesh| {
+        if (std.mem.indexOfScalar(MeshManager.Handle, updated, mesh) != null) return true;
+    }
+    return false;
+}
+
+// refits every BLAS built from any of `updated` after their positions have been updated in-place,
+// all in a single build command
+// mesh topology must be unchanged
+// commands must be in recording state
+// returns scratch buffers that must be kept alive until command is completed
+//
+// must recordUpdateTlas afterwards for TLAS to see changes
+pub fn recordRefitMeshes(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, updated: []const MeshManager.Handle) ![]const VkAllocator.OwnedDeviceBuffer {
+    var accel_memory = vk_allocator.withCategory(.accel);
+
+    var build_geometry_infos = std.ArrayList(vk.AccelerationStructureBuildGeometryInfoKHR).init(allocator);
+    defer build_geometry_infos.deinit();
+    defer for (build_geometry_infos.items) |build_geometry_info| allocator.free(build_geometry_info.p_geometries.?[0..build_geometry_info.geometry_count]);
+
+    var build_infos = std.ArrayList([*]vk.AccelerationStructureBuildRangeInfoKHR).init(allocator);
+    defer build_infos.deinit();
+    defer for (build_infos.items, build_geometry_infos.items) |build_info, build_geometry_info| allocator.free(build_info[0..build_geometry_info.geometry_count]);
+
+    var scratch_buffers = std.ArrayList(VkAllocator.OwnedDeviceBuffer).init(allocator);
+    errdefer scratch_buffers.deinit();
+    errdefer for (scratch_buffers.items) |scratch_buffer| scratch_buffer.destroy(vc);
+
+    for (self.blases.items(.handle), self.blases.items(.meshes), self.blases.items(.bounds)) |handle, meshes, *bounds| {
+        if (!usesAnyOf(meshes, updated)) continue;
+        bounds.* = meshBounds(mesh_manager, meshes);
+
+        try build_geometry_infos.ensureUnusedCapacity(1);
+        try build_infos.ensureUnusedCapacity(1);
+
+        const vk_geometries = try allocator.alloc(vk.AccelerationStructureGeometryKHR, meshes.len);
+        errdefer allocator.free(vk_geometries);
+        const build_ranges = try allocator.alloc(vk.AccelerationStructureBuildRangeInfoKHR, meshes.len);
+        errdefer allocator.free(build_ranges);
+        const primitive_counts = try allocator.alloc(u32, meshes.len);
+        defer allocator.free(primitive_counts);
+
+        fillBlasGeometries(vc, mesh_manager, meshes, vk_geometries, build_ranges);
+        for (build_ranges, primitive_counts) |range, *primitive_count| primitive_count.* = range.primitive_count;
+
+        var build_geometry_info = vk.AccelerationStructureBuildGeometryInfoKHR {
+            .type = .bottom_level_khr,
+            .flags = blas_flags,
+            .mode = .update_khr,
+            .src_acceleration_structure = handle,
+            .dst_acceleration_structure = handle,
+            .geometry_count = @intCast(vk_geometries.len),
+            .p_geometries = vk_geometries.ptr,
+            .scratch_data = undefined,
+        };
+
+        const size_info = getBuildSizesInfo(vc, &build_geometry_info, primitive_counts.ptr);
+        const scratch_buffer = try accel_memory.createOwnedDeviceBuffer(vc, size_info.update_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
+        errdefer scratch_buffer.destroy(vc);
+        try scratch_buffers.append(scratch_buffer);
+        build_geometry_info.scratch_data.device_address = scratch_buffer.getAddress(vc);
+
+        build_geometry_infos.appendAssumeCapacity(build_geometry_info);
+        build_infos.appendAssumeCapacity(build_ranges.ptr);
+    }
+
+    // areas of instances of these meshes have changed too
+    for (self.instance_data.items) |data| {
+        if (usesAnyOf(self.blases.items(.meshes)[data.blas], updated)) self.markEmittersDirty(data.handle);
+    }
+
+    if (build_geometry_infos.items.len != 0) {
+        const scope = commands.beginScope(vc, "refit BLAS");
+        vc.device.cmdBuildAccelerationStructuresKHR(commands.buffer, @intCast(build_geometry_infos.items.len), build_geometry_infos.items.ptr, build_infos.items.ptr);
+        commands.endScope(vc, scope);
+
+        // make refit BLASes visible to the TLAS build
+        const barriers = [_]vk.MemoryBarrier2 {
+            .{
+                .src_stage_mask = .{ .acceleration_structure_build_bit_khr = true },
+                .src_access_mask = .{ .acceleration_structure_write_bit_khr = true },
+                .dst_stage_mask = .{ .acceleration_structure_build_bit_khr = true, .ray_tracing_shader_bit_khr = true },
+                .dst_access_mask = .{ .acceleration_structure_read_bit_khr = true },
+            }
+        };
+        vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
+            .memory_barrier_count = barriers.len,
+            .p_memory_barriers = &barriers,
+        });
+    }
+
+    return scratch_buffers.toOwnedSlice();
+}
+
+// new instances go in slots past anything the in-flight render's TLAS
+// refers to, and grown buffers are retired rather than freed, so accel may
+// be in use unless a new BLAS has to be built, see hasBlasFor
+//
+// the TLAS only sees the instance after the next recordUpdateTlas,
+// and light sampling after the next recordUpdateEmitters
 pub const Handle = u32;
 pub fn uploadInstance(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, instance: Instance) !Handle {
-    std.debug.assert(self.geometry_count + instance.geometries.len <= max_geometries);
-    std.debug.assert(self.instance_count < max_instances);
+    var handle: Handle = undefined;
+    try self.uploadInstances(vc, vk_allocator, allocator, commands, mesh_manager, &.{ instance }, (&handle)[0..1]);
+    return handle;
+}
 
-    try commands.startRecording(vc);
-    const scratch_buffers = try makeBlases(vc, vk_allocator, allocator, commands, mesh_manager, &.{ instance.geometries }, &self.blases);
-    defer allocator.free(scratch_buffers);
-    defer for (scratch_buffers) |scratch_buffer| scratch_buffer.destroy(vc);
+// like uploadInstance, but building whatever BLASes the instances need
+// together, and recording everything else in a single submission
+pub fn uploadInstances(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, instances: []const Instance, handles: []Handle) !void {
+    std.debug.assert(instances.len == handles.len);
+    if (instances.len == 0) return;
+
+    var emitter_count: usize = 0;
+    var geometry_count: usize = 0;
+    for (instances) |instance| {
+        emitter_count += emitterCount(mesh_manager, instance.geometries);
+        geometry_count += instance.geometries.len;
+    }
 
-    // update geometries flat jagged array
+    try self.instance_data.ensureUnusedCapacity(allocator, instances.len);
+    try self.instance_indices.ensureUnusedCapacity(allocator, instances.len);
+    try self.instances_host.ensureUnusedCapacity(allocator, instances.len);
+    try self.world_to_instance_host.ensureUnusedCapacity(allocator, instances.len);
+    try self.emitter_ranges.ensureUnusedCapacity(allocator, instances.len);
+    try self.ensureUnusedEmitterCapacity(allocator, emitter_count);
+    try self.blas_lookup.ensureUnusedCapacity(allocator, @intCast(instances.len));
+
+    // reuse the BLAS of another instance of the same meshes if there is one,
+    // and build the rest, once for each distinct list of meshes
+    const blas_indices = try allocator.alloc(u32, instances.len);
+    defer allocator.free(blas_indices);
     {
-        if (self.geometries.is_null()) {
-            self.geometries = try vk_allocator.createDeviceBuffer(vc, allocator, Geometry, max_geometries, .{ .storage_buffer_bit = true, .transfer_dst_bit = true });
-            try vk_helpers.setDebugName(vc, self.geometries.handle, "geometries");
+        const all_meshes = try allocator.alloc(MeshManager.Handle, geometry_count);
+        defer allocator.free(all_meshes);
+
+        // meshes to their index in to_build
+        var building = BlasLookup {};
+        defer building.deinit(allocator);
+        try building.ensureTotalCapacity(allocator, @intCast(instances.len));
+        var to_build = try std.ArrayListUnmanaged([]const Geometry).initCapacity(allocator, instances.len);
+        defer to_build.deinit(allocator);
+        const is_new = try allocator.alloc(bool, instances.len);
+        defer allocator.free(is_new);
+
+        var offset: usize = 0;
+        for (instances, blas_indices, is_new) |instance, *blas_idx, *new| {
+            const meshes = all_meshes[offset..][0..instance.geometries.len];
+            offset += meshes.len;
+            for (instance.geometries, meshes) |geometry, *mesh| mesh.* = geometry.mesh;
+
+            new.* = !self.blas_lookup.contains(meshes);
+            if (new.*) {
+                const result = building.getOrPutAssumeCapacity(meshes);
+                if (!result.found_existing) {
+                    result.value_ptr.* = @intCast(to_build.items.len);
+                    to_build.appendAssumeCapacity(instance.geometries);
+                }
+                blas_idx.* = result.value_ptr.*;
+            } else {
+                blas_idx.* = self.blas_lookup.get(meshes).?;
+            }
         }
 
-        commands.recordUpdateBuffer(Geometry, vc, self.geometries, instance.geometries, self.geometry_count);
+        if (to_build.items.len != 0) {
+            const first_new = self.blases.len;
+            try makeBlases(vc, vk_allocator, allocator, commands, mesh_manager, to_build.items, &self.blases);
+
+            // put new BLASes in free slots if there are any -- going from the last,
+            // so the one being moved is always at the end
+            const new_indices = try allocator.alloc(u32, to_build.items.len);
+            defer allocator.free(new_indices);
+            var i = to_build.items.len;
+            while (i > 0) {
+                i -= 1;
+                new_indices[i] = if (self.free_blases.popOrNull()) |free_idx| free_idx_blk: {
+                    self.blases.set(free_idx, self.blases.pop());
+                    break :free_idx_blk free_idx;
+                } else @intCast(first_new + i);
+                self.blas_lookup.putAssumeCapacityNoClobber(self.blases.items(.meshes)[new_indices[i]], new_indices[i]);
+            }
 
-        self.geometry_count += @intCast(instance.geometries.len);
+            for (blas_indices, is_new) |*blas_idx, new| {
+                if (new) blas_idx.* = new_indices[blas_idx.*];
+            }
+        }
     }
+    for (blas_indices) |blas_idx| self.blases.items(.ref_count)[blas_idx] += 1;
 
-    // upload instance
-    {
-        if (self.instances_device.is_null()) {
-            self.instances_device = try vk_allocator.createDeviceBuffer(vc, allocator, vk.AccelerationStructureInstanceKHR, max_instances, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true, .storage_buffer_bit = true });
-            self.instances_host = try vk_allocator.createHostBuffer(vc, vk.AccelerationStructureInstanceKHR, max_instances, .{ .transfer_src_bit = true });
-            try vk_helpers.setDebugName(vc, self.instances_device.handle, "instances");
-            self.instances_address = self.instances_device.getAddress(vc);
-        }
+    try commands.startRecording(vc);
+
+    const first_instance = self.instance_count;
+    if (try self.instances_device.recordEnsureCapacity(vc, vk_allocator, allocator, commands, self.instance_count, self.instance_count + @as(u32, @intCast(instances.len)))) {
+        self.instances_address = self.instances_device.getAddress(vc);
+    }
+    _ = try self.world_to_instance_device.recordEnsureCapacity(vc, vk_allocator, allocator, commands, self.instance_count, self.instance_count + @as(u32, @intCast(instances.len)));
+
+    for (instances, blas_indices, handles) |instance, blas_idx, *handle| {
+        // update geometries flat jagged array
+        const custom_index = blk: {
+            const old_geometry_count = self.geometry_count;
+            const custom_index = self.allocateGeometries(@intCast(instance.geometries.len));
+            _ = try self.geometries.recordEnsureCapacity(vc, vk_allocator, allocator, commands, old_geometry_count, self.geometry_count);
 
-        const custom_index: u24 = self.geometry_count - @as(u24, @intCast(instance.geometries.len));
-        const vk_instance = vk.AccelerationStructureInstanceKHR {
+            // may be more than the 64 KiB an inline update allows
+            try commands.recordStageBuffer(Geometry, vc, vk_allocator, self.geometries.buffer, instance.geometries, custom_index);
+
+            break :blk custom_index;
+        };
+
+        self.instances_host.appendAssumeCapacity(vk.AccelerationStructureInstanceKHR {
             .transform = vk.TransformMatrixKHR {
                 .matrix = @bitCast(instance.transform),
             },
@@ -230,86 +664,200 @@ pub fn uploadInstance(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAl
                 .flags = 0,
             },
             .acceleration_structure_reference = vc.device.getAccelerationStructureDeviceAddressKHR(&.{
-                .acceleration_structure = self.blases.items(.handle)[self.blases.len - 1],
+                .acceleration_structure = self.blases.items(.handle)[blas_idx],
             }),
+        });
+        self.world_to_instance_host.appendAssumeCapacity(instance.transform.inverse_affine());
+
+        // hand out a recycled handle if there is one
+        handle.* = blk: {
+            if (self.free_handles.popOrNull()) |free_handle| {
+                self.instance_indices.items[free_handle] = self.instance_count;
+                break :blk free_handle;
+            } else {
+                self.instance_indices.appendAssumeCapacity(self.instance_count);
+                break :blk @as(Handle, @intCast(self.instance_indices.items.len - 1));
+            }
         };
+        self.instance_data.appendAssumeCapacity(.{
+            .handle = handle.*,
+            .blas = blas_idx,
+            .geometry_count = @intCast(instance.geometries.len),
+        });
+        self.appendEmittersAssumeCapacity(mesh_manager, handle.*, instance.geometries);
 
-        self.instances_host.data[self.instance_count] = vk_instance;
-
-        commands.recordUpdateBuffer(vk.AccelerationStructureInstanceKHR, vc, self.instances_device, &.{ vk_instance }, self.instance_count); // TODO: can copy
+        self.instance_count += 1;
     }
+    self.tlas_dirty = true;
+
+    // new instances are contiguous at the end, so upload them in one go
+    try commands.recordStageBuffer(vk.AccelerationStructureInstanceKHR, vc, vk_allocator, self.instances_device.buffer, self.instances_host.items[first_instance..], first_instance);
+    try commands.recordStageBuffer(Mat3x4, vc, vk_allocator, self.world_to_instance_device.buffer, self.world_to_instance_host.items[first_instance..], first_instance);
+
+    // make instance data visible to the eventual TLAS build and shaders,
+    // which are later in submission order
+    vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
+        .memory_barrier_count = 1,
+        .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+            .src_stage_mask = .{ .copy_bit = true, .clear_bit = true }, // cmdUpdateBuffer seems to be clear for some reason
+            .src_access_mask = .{ .transfer_write_bit = true },
+            .dst_stage_mask = .{ .acceleration_structure_build_bit_khr = true, .ray_tracing_shader_bit_khr = true },
+            .dst_access_mask = .{ .acceleration_structure_read_bit_khr = true, .shader_storage_read_bit = true },
+        }),
+    });
+    _ = try commands.submit(vc);
+}
 
-    // upload world_to_instance matrix
-    {
-        if (self.world_to_instance_device.is_null()) {
-            self.world_to_instance_device = try vk_allocator.createDeviceBuffer(vc, allocator, Mat3x4, max_instances, .{ .storage_buffer_bit = true, .transfer_dst_bit = true });
-            self.world_to_instance_host = try vk_allocator.createHostBuffer(vc, Mat3x4, max_instances, .{ .transfer_src_bit = true });
-        }
-
-        self.world_to_instance_host.data[self.instance_count] = instance.transform.inverse_affine();
+// whether instances of geometries would reuse an existing BLAS, rather than
+// building a new one, which needs accel not to be in use
+pub fn hasBlasFor(self: *const Self, allocator: std.mem.Allocator, geometries: []const Geometry) !bool {
+    const meshes = try allocator.alloc(MeshManager.Handle, geometries.len);
+    defer allocator.free(meshes);
+    for (geometries, meshes) |geometry, *mesh| mesh.* = geometry.mesh;
+    return self.blas_lookup.contains(meshes);
+}
 
-        commands.recordUpdateBuffer(Mat3x4, vc, self.world_to_instance_device, &.{ instance.transform.inverse_affine() }, self.instance_count);
+// first fit in ranges freed by destroyed instances, otherwise at end
+fn allocateGeometries(self: *Self, count: u24) u24 {
+    for (self.free_geometry_ranges.items, 0..) |*range, i| {
+        if (range.count < count) continue;
+        const start = range.start;
+        range.start += count;
+        range.count -= count;
+        if (range.count == 0) _ = self.free_geometry_ranges.orderedRemove(i);
+        return start;
     }
 
-    self.instance_count += 1;
+    const start = self.geometry_count;
+    self.geometry_count += count;
+    return start;
+}
 
-    // update TLAS
-    var geometry_info = vk.AccelerationStructureBuildGeometryInfoKHR {
-        .type = .top_level_khr,
-        .flags = .{ .prefer_fast_trace_bit_khr = true, .allow_update_bit_khr = true },
-        .mode = .build_khr,
-        .geometry_count = 1,
-        .p_geometries = @ptrCast(&vk.AccelerationStructureGeometryKHR {
-            .geometry_type = .instances_khr,
-            .flags = .{ .opaque_bit_khr = true },
-            .geometry = .{
-                .instances = .{
-                    .array_of_pointers = vk.FALSE,
-                    .data = .{
-                        .device_address = self.instances_address,
-                    }
-                }
-            },
-        }),
-        .scratch_data = undefined,
-    };
+// merges range into its free neighbors, giving back whatever ends up at the end
+//
+// must have capacity for another free range
+fn releaseGeometries(self: *Self, start: u24, count: u24) void {
+    if (count == 0) return;
+
+    const ranges = &self.free_geometry_ranges;
+    var i: usize = 0;
+    while (i < ranges.items.len and ranges.items[i].start < start) i += 1;
+
+    const merges_previous = i > 0 and ranges.items[i - 1].start + ranges.items[i - 1].count == start;
+    const merges_next = i < ranges.items.len and start + count == ranges.items[i].start;
+    if (merges_previous and merges_next) {
+        ranges.items[i - 1].count += count + ranges.items[i].count;
+        _ = ranges.orderedRemove(i);
+    } else if (merges_previous) {
+        ranges.items[i - 1].count += count;
+    } else if (merges_next) {
+        ranges.items[i].start = start;
+        ranges.items[i].count += count;
+    } else {
+        ranges.insertAssumeCapacity(i, .{
+            .start = start,
+            .count = count,
+        });
+    }
 
-    const size_info = getBuildSizesInfo(vc, &geometry_info, @ptrCast(&self.instance_count));
+    const last = ranges.getLast();
+    if (last.start + last.count == self.geometry_count) {
+        self.geometry_count = last.start;
+        _ = ranges.pop();
+    }
+}
 
-    const scratch_buffer = try vk_allocator.createOwnedDeviceBuffer(vc, size_info.build_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
-    defer scratch_buffer.destroy(vc);
+// accel must not be in use
+// moves last instance into the destroyed one's place to keep instances tightly packed,
+// so host instance buffers must be reuploaded and TLAS rebuilt to see changes
+pub fn destroyInstance(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator, handle: Handle) !void {
+    try self.free_handles.ensureUnusedCapacity(allocator, 1);
+    try self.free_blases.ensureUnusedCapacity(allocator, 1);
+    try self.free_geometry_ranges.ensureUnusedCapacity(allocator, 1);
+
+    const index = self.instance_indices.items[handle];
+    const data = self.instance_data.items[index];
+
+    // release geometries
+    self.releaseGeometries(self.instances_host.items[index].instance_custom_index_and_mask.instance_custom_index, data.geometry_count);
+
+    // release BLAS
+    const ref_count = &self.blases.items(.ref_count)[data.blas];
+    ref_count.* -= 1;
+    if (ref_count.* == 0) {
+        const blas = self.blases.get(data.blas);
+        const removed = self.blas_lookup.remove(blas.meshes);
+        std.debug.assert(removed);
+        vc.device.destroyAccelerationStructureKHR(blas.handle, null);
+        blas.buffer.destroy(vc);
+        allocator.free(blas.meshes);
+        self.blases.set(data.blas, .{
+            .handle = .null_handle,
+            .buffer = .{},
+            .meshes = &.{},
+            .bounds = Bounds.empty,
+            .ref_count = 0,
+        });
+        self.free_blases.appendAssumeCapacity(data.blas);
+    }
 
-    self.tlas_buffer.destroy(vc);
-    self.tlas_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, u8, size_info.acceleration_structure_size, .{ .acceleration_structure_storage_bit_khr = true });
+    // release emitters, moving later ones down to keep them tightly packed
+    {
+        const range = self.emitter_ranges.items[handle];
+        const end = range.start + range.count;
+        std.mem.copyForwards(Emitter, self.emitters.items[range.start..], self.emitters.items[end..]);
+        std.mem.copyForwards(f32, self.emitter_areas.items[range.start..], self.emitter_areas.items[end..]);
+        std.mem.copyForwards(light_tree.Triangle, self.emitter_triangles.items[range.start..], self.emitter_triangles.items[end..]);
+        self.emitters.shrinkRetainingCapacity(self.emitters.items.len - range.count);
+        self.emitter_areas.shrinkRetainingCapacity(self.emitter_areas.items.len - range.count);
+        self.emitter_triangles.shrinkRetainingCapacity(self.emitter_triangles.items.len - range.count);
+        for (self.emitter_ranges.items) |*other| {
+            if (other.start > range.start) other.start -= range.count;
+        }
+        self.emitter_ranges.items[handle] = .{
+            .start = 0,
+            .count = 0,
+            .dirty = false,
+        };
 
-    vc.device.destroyAccelerationStructureKHR(self.tlas_handle, null);
-    geometry_info.dst_acceleration_structure = try vc.device.createAccelerationStructureKHR(&.{
-        .buffer = self.tlas_buffer.handle,
-        .offset = 0,
-        .size = size_info.acceleration_structure_size,
-        .type = .top_level_khr,
-    }, null);
-    self.tlas_handle = geometry_info.dst_acceleration_structure;
+        // the table refers to instances by index, which may be about to change
+        if (range.count != 0 or self.emitters.items.len != 0) {
+            self.emitters_dirty = true;
+            self.emitter_layout_dirty = true;
+        }
+    }
 
-    geometry_info.scratch_data.device_address = scratch_buffer.getAddress(vc);
+    // move last instance into freed place
+    const last = self.instance_count - 1;
+    if (index != last) {
+        self.instances_host.items[index] = self.instances_host.items[last];
+        self.world_to_instance_host.items[index] = self.world_to_instance_host.items[last];
+        self.instance_data.items[index] = self.instance_data.items[last];
+        self.instance_indices.items[self.instance_data.items[index].handle] = index;
+    }
+    _ = self.instances_host.pop();
+    _ = self.world_to_instance_host.pop();
+    _ = self.instance_data.pop();
+    self.instance_count -= 1;
+    self.tlas_dirty = true;
 
-    self.tlas_update_scratch_buffer.destroy(vc);
-    self.tlas_update_scratch_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, u8, size_info.update_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
-    self.tlas_update_scratch_address = self.tlas_update_scratch_buffer.getAddress(vc);
+    self.free_handles.appendAssumeCapacity(handle);
+}
 
-    vc.device.cmdBuildAccelerationStructuresKHR(commands.buffer, 1, @ptrCast(&geometry_info), &[_][*]const vk.AccelerationStructureBuildRangeInfoKHR{ @ptrCast(&vk.AccelerationStructureBuildRangeInfoKHR {
-        .primitive_count = @intCast(self.instance_count),
-        .first_vertex = 0,
-        .primitive_offset = 0,
-        .transform_offset = 0,
-    })});
-    try commands.submitAndIdleUntilDone(vc);
+// where in the instance buffers the instance with this handle currently is
+pub fn instanceIndex(self: *const Self, handle: Handle) u32 {
+    return self.instance_indices.items[handle];
+}
 
-    return @intCast(self.instance_count - 1);
+// host-side only, must reupload instances and refit TLAS to see changes
+pub fn updateTransform(self: *Self, handle: Handle, new_transform: Mat3x4) void {
+    const index = self.instanceIndex(handle);
+    self.instances_host.items[index].transform = @bitCast(new_transform);
+    self.world_to_instance_host.items[index] = new_transform.inverse_affine();
+    self.markEmittersDirty(handle);
 }
 
-// inspection bool specifies whether some buffers should be created with the `transfer_src_flag` for inspection
-pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, instances: []const Instance, inspection: bool) !Self {
+pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, instances: []const Instance) !Self {
     // as an optimization, see if any instances contain identical mesh lists,
     // because we only need to create as many BLASes as there are unique mesh lists
     var unique_mesh_lists_hash = std.ArrayHashMap([]const Geometry, u32, struct {
@@ -346,25 +894,44 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
     var blases = BottomLevelAccels {};
     errdefer blases.deinit(allocator);
     
+    try makeBlases(vc, vk_allocator, allocator, commands, mesh_manager, unique_mesh_lists_hash.keys(), &blases);
+
+    // for instances uploaded later on to find these
+    var blas_lookup = BlasLookup {};
+    errdefer blas_lookup.deinit(allocator);
+    try blas_lookup.ensureTotalCapacity(allocator, @intCast(blases.len));
+    for (blases.items(.meshes), 0..) |meshes, blas_idx| blas_lookup.putAssumeCapacity(meshes, @intCast(blas_idx));
+
     try commands.startRecording(vc);
-    const scratch_buffers = try makeBlases(vc, vk_allocator, allocator, commands, mesh_manager, unique_mesh_lists_hash.keys(), &blases);
-    defer allocator.free(scratch_buffers);
-    defer for (scratch_buffers) |scratch_buffer| scratch_buffer.destroy(vc);
+
+    // handles are just indices until something gets destroyed
+    var instance_data = try std.ArrayListUnmanaged(InstanceData).initCapacity(allocator, instances.len);
+    errdefer instance_data.deinit(allocator);
+    var instance_indices = try std.ArrayListUnmanaged(u32).initCapacity(allocator, instances.len);
+    errdefer instance_indices.deinit(allocator);
+    for (instances, 0..) |instance, i| {
+        const blas_idx = unique_mesh_lists_hash.get(instance.geometries).?;
+        blases.items(.ref_count)[blas_idx] += 1;
+        instance_data.appendAssumeCapacity(.{
+            .handle = @intCast(i),
+            .blas = blas_idx,
+            .geometry_count = @intCast(instance.geometries.len),
+        });
+        instance_indices.appendAssumeCapacity(@intCast(i));
+    }
 
     // create geometries flat jagged array
     var total_geometry_count: u24 = 0;
     for (instances) |instance| {
         total_geometry_count += @intCast(instance.geometries.len);
     }
-    const geometries_host = try vk_allocator.createHostBuffer(vc, Geometry, total_geometry_count, .{ .transfer_src_bit = true });
-    defer geometries_host.destroy(vc);
-    const geometries = blk: {
-        var buffer_flags = vk.BufferUsageFlags { .storage_buffer_bit = true, .transfer_dst_bit = true };
-        if (inspection) buffer_flags = buffer_flags.merge(.{ .transfer_src_bit = true });
-        const geometries = try vk_allocator.createDeviceBuffer(vc, allocator, Geometry, total_geometry_count, buffer_flags);
-        errdefer geometries.destroy(vc);
-        try vk_helpers.setDebugName(vc, geometries.handle, "geometries");
 
+    var geometries = GeometriesArray {};
+    errdefer geometries.destroy(vc, allocator);
+    if (total_geometry_count != 0) {
+        _ = try geometries.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, total_geometry_count);
+
+        const geometries_host = try commands.staging.reserve(Geometry, vc, vk_allocator, total_geometry_count);
         var flat_idx: u32 = 0;
         for (instances) |instance| {
             for (instance.geometries) |geometry| {
@@ -373,27 +940,25 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
             }
         }
 
-        if (total_geometry_count != 0) {
-            commands.recordUploadBuffer(Geometry, vc, geometries, geometries_host);
-        }
-
-        break :blk geometries;
-    };
-    errdefer geometries.destroy(vc);
+        commands.recordCopyBuffer(vc, geometries.handle(), geometries_host.buffer, &.{
+            vk.BufferCopy {
+                .src_offset = geometries_host.offset,
+                .dst_offset = 0,
+                .size = total_geometry_count * @sizeOf(Geometry),
+            },
+        });
+    }
 
     // create instance
     const instance_count: u32 = @intCast(instances.len);
-    const instances_host = try vk_allocator.createHostBuffer(vc, vk.AccelerationStructureInstanceKHR, instance_count, .{ .transfer_src_bit = true });
-    const instances_device = blk: {
-        var instances_buffer_flags = vk.BufferUsageFlags { .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true, .storage_buffer_bit = true };
-        if (inspection) instances_buffer_flags = instances_buffer_flags.merge(.{ .transfer_src_bit = true });
-        const instances_device = try vk_allocator.createDeviceBuffer(vc, allocator, vk.AccelerationStructureInstanceKHR, instance_count, instances_buffer_flags);
-        errdefer instances_device.destroy(vc);
-        try vk_helpers.setDebugName(vc, instances_device.handle, "instances");
-
+    var instances_host = try std.ArrayListUnmanaged(vk.AccelerationStructureInstanceKHR).initCapacity(allocator, instance_count);
+    errdefer instances_host.deinit(allocator);
+    var instances_device = InstancesArray {};
+    errdefer instances_device.destroy(vc, allocator);
+    {
         var custom_index: u24 = 0;
-        for (instances_host.data, instances) |*instance_host, instance| {
-            instance_host.* = .{
+        for (instances) |instance| {
+            instances_host.appendAssumeCapacity(.{
                 .transform = vk.TransformMatrixKHR {
                     .matrix = @bitCast(instance.transform),
                 },
@@ -408,139 +973,43 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
                 .acceleration_structure_reference = vc.device.getAccelerationStructureDeviceAddressKHR(&.{
                     .acceleration_structure = blases.items(.handle)[unique_mesh_lists_hash.get(instance.geometries).?],
                 }),
-            };
+            });
             custom_index += @intCast(instance.geometries.len);
         }
 
         if (instance_count != 0) {
-            commands.recordUploadBuffer(vk.AccelerationStructureInstanceKHR, vc, instances_device, instances_host);
+            _ = try instances_device.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, instance_count);
+            try commands.recordStageBuffer(vk.AccelerationStructureInstanceKHR, vc, vk_allocator, instances_device.buffer, instances_host.items, 0);
         }
-
-        break :blk instances_device;
-    };
-    errdefer instances_device.destroy(vc);
+    }
 
     const instances_address = instances_device.getAddress(vc);
 
-    const world_to_instance_host = try vk_allocator.createHostBuffer(vc, Mat3x4, instance_count, .{ .transfer_src_bit = true });
-    const world_to_instance_device = blk: {
-        const buffer = try vk_allocator.createDeviceBuffer(vc, allocator, Mat3x4, instance_count, .{ .storage_buffer_bit = true, .transfer_dst_bit = true });
-        errdefer buffer.destroy(vc);
-
-        for (instances, world_to_instance_host.data) |instance, *inverse| {
-            inverse.* = instance.transform.inverse_affine();
+    var world_to_instance_host = try std.ArrayListUnmanaged(Mat3x4).initCapacity(allocator, instance_count);
+    errdefer world_to_instance_host.deinit(allocator);
+    var world_to_instance_device = WorldToInstanceArray {};
+    errdefer world_to_instance_device.destroy(vc, allocator);
+    {
+        for (instances) |instance| {
+            world_to_instance_host.appendAssumeCapacity(instance.transform.inverse_affine());
         }
 
         if (instance_count != 0) {
-            commands.recordUploadBuffer(Mat3x4, vc, buffer, world_to_instance_host);
+            _ = try world_to_instance_device.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, instance_count);
+            try commands.recordStageBuffer(Mat3x4, vc, vk_allocator, world_to_instance_device.buffer, world_to_instance_host.items, 0);
         }
+    }
 
-        break :blk buffer;
-    };
-    errdefer world_to_instance_device.destroy(vc);
-
-    // create TLAS
-    var geometry_info = vk.AccelerationStructureBuildGeometryInfoKHR {
-        .type = .top_level_khr,
-        .flags = .{ .prefer_fast_trace_bit_khr = true, .allow_update_bit_khr = true },
-        .mode = .build_khr,
-        .geometry_count = 1,
-        .p_geometries = @ptrCast(&vk.AccelerationStructureGeometryKHR {
-            .geometry_type = .instances_khr,
-            .flags = .{ .opaque_bit_khr = true },
-            .geometry = .{
-                .instances = .{
-                    .array_of_pointers = vk.FALSE,
-                    .data = .{
-                        .device_address = instances_address,
-                    }
-                }
-            },
-        }),
-        .scratch_data = undefined,
-    };
-
-    const size_info = getBuildSizesInfo(vc, &geometry_info, @ptrCast(&instance_count));
-
-    const scratch_buffer = try vk_allocator.createOwnedDeviceBuffer(vc, size_info.build_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
-    defer scratch_buffer.destroy(vc);
-
-    const tlas_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, u8, size_info.acceleration_structure_size, .{ .acceleration_structure_storage_bit_khr = true });
-    errdefer tlas_buffer.destroy(vc);
-
-    geometry_info.dst_acceleration_structure = try vc.device.createAccelerationStructureKHR(&.{
-        .buffer = tlas_buffer.handle,
-        .offset = 0,
-        .size = size_info.acceleration_structure_size,
-        .type = .top_level_khr,
-    }, null);
-    errdefer vc.device.destroyAccelerationStructureKHR(geometry_info.dst_acceleration_structure, null);
-
-    geometry_info.scratch_data.device_address = scratch_buffer.getAddress(vc);
-
-    const update_scratch_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, u8, size_info.update_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
-    errdefer update_scratch_buffer.destroy(vc);
-
-    vc.device.cmdBuildAccelerationStructuresKHR(commands.buffer, 1, @ptrCast(&geometry_info), &[_][*]const vk.AccelerationStructureBuildRangeInfoKHR{ @ptrCast(&vk.AccelerationStructureBuildRangeInfoKHR {
-        .primitive_count = instance_count,
-        .first_vertex = 0,
-        .primitive_offset = 0,
-        .transform_offset = 0,
-    })});
-
-    var alias_staging_buffer = VkAllocator.HostBuffer(AliasTableT.TableEntry) {};
-    defer alias_staging_buffer.destroy(vc);
-    const alias_table = blk: {
-
-        var weights = std.ArrayList(f32).init(allocator);
-        defer weights.deinit();
-
-        var table_data = std.ArrayList(TableData).init(allocator);
-        defer table_data.deinit();
-
-        for (instances, 0..) |instance, i| {
-            for (instance.geometries, 0..) |instance_geometry, j| {
-                if (!instance_geometry.sampled) continue;
-
-                const mesh_idx = instance_geometry.mesh;
-                const positions = mesh_manager.meshes.items(.positions)[mesh_idx];
-                const indices = mesh_manager.meshes.items(.indices)[mesh_idx];
-                for (indices, 0..) |index, k| {
-                    const p0 = instance.transform.mul_point(positions[index.x]);
-                    const p1 = instance.transform.mul_point(positions[index.y]);
-                    const p2 = instance.transform.mul_point(positions[index.z]);
-                    const area = p1.sub(p0).cross(p2.sub(p0)).length() / 2.0;
-                    try weights.append(area);
-                    try table_data.append(.{
-                        .instance = @intCast(i),
-                        .geometry = @intCast(j),
-                        .primitive = @intCast(k),
-                    });
-                }
-            }
-        }
-
-        const table = try AliasTableT.create(allocator, weights.items, table_data.items);
-        defer allocator.free(table.entries);
-
-        const buffer = try vk_allocator.createDeviceBuffer(vc, allocator, AliasTableT.TableEntry, table.entries.len + 1, .{ .storage_buffer_bit = true, .transfer_dst_bit = true });
-        errdefer buffer.destroy(vc);
-
-        alias_staging_buffer = try vk_allocator.createHostBuffer(vc, AliasTableT.TableEntry, table.entries.len + 1, .{ .transfer_src_bit = true });
-
-        alias_staging_buffer.data[0].alias = @intCast(table.entries.len);
-        alias_staging_buffer.data[0].select = table.sum;
-        @memcpy(alias_staging_buffer.data[1..], table.entries);
-
-        commands.recordUploadBuffer(AliasTableT.TableEntry, vc, buffer, alias_staging_buffer);
-
-        break :blk buffer;
-    };
-    errdefer alias_table.destroy(vc);
-    try commands.submitAndIdleUntilDone(vc);
+    var emitter_ranges = try std.ArrayListUnmanaged(EmitterRange).initCapacity(allocator, instance_count);
+    errdefer emitter_ranges.deinit(allocator);
 
-    return Self {
+    var self = Self {
         .blases = blases,
+        .blas_lookup = blas_lookup,
+
+        .instance_count = instance_count,
+        .instance_data = instance_data,
+        .instance_indices = instance_indices,
 
         .instances_device = instances_device,
         .instances_host = instances_host,
@@ -549,27 +1018,51 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
         .world_to_instance_device = world_to_instance_device,
         .world_to_instance_host = world_to_instance_host,
 
-        .tlas_handle = geometry_info.dst_acceleration_structure,
-        .tlas_buffer = tlas_buffer,
-
-        .tlas_update_scratch_buffer = update_scratch_buffer,
-        .tlas_update_scratch_address = update_scratch_buffer.getAddress(vc),
-
         .geometry_count = total_geometry_count,
         .geometries = geometries,
 
-        .alias_table = alias_table,
+        .emitter_ranges = emitter_ranges,
     };
+
+    errdefer {
+        vc.device.destroyAccelerationStructureKHR(self.tlas_handle, null);
+        self.tlas_buffer.destroy(vc);
+        self.tlas_update_scratch_buffer.destroy(vc);
+        self.tlas_built_bounds.deinit(allocator);
+        self.emitters.deinit(allocator);
+        self.emitter_areas.deinit(allocator);
+        self.emitter_triangles.deinit(allocator);
+        self.alias_table.destroy(vc, allocator);
+        self.light_tree_nodes.destroy(vc, allocator);
+        self.light_tree_lookup.destroy(vc, allocator);
+    }
+
+    var emitter_count: usize = 0;
+    for (instances) |instance| emitter_count += emitterCount(mesh_manager, instance.geometries);
+    try self.ensureUnusedEmitterCapacity(allocator, emitter_count);
+    for (instances, 0..) |instance, handle| self.appendEmittersAssumeCapacity(mesh_manager, @intCast(handle), instance.geometries);
+    try self.recordUpdateEmitters(vc, vk_allocator, allocator, commands, mesh_manager);
+
+    const scratch_buffer = try self.recordUpdateTlas(vc, vk_allocator, allocator, commands.buffer);
+    defer scratch_buffer.destroy(vc);
+    try commands.submitAndIdleUntilDone(vc);
+
+    return self;
 }
 
 // probably bad idea if you're changing many
-// must recordRebuild to see changes
+// must recordUpdateTlas to see changes, and recordUpdateEmitters for light sampling to
 pub fn recordUpdateSingleTransform(self: *Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer, instance_idx: u32, new_transform: Mat3x4) void {
+    // kept in sync so recordUpdateTlas can tell how far instances have moved
+    self.instances_host.items[instance_idx].transform = @bitCast(new_transform);
+    self.world_to_instance_host.items[instance_idx] = new_transform.inverse_affine();
+    self.markEmittersDirty(self.instance_data.items[instance_idx].handle);
+
     const offset = @sizeOf(vk.AccelerationStructureInstanceKHR) * instance_idx + @offsetOf(vk.AccelerationStructureInstanceKHR, "transform");
     const offset_inverse = @sizeOf(Mat3x4) * instance_idx;
     const size = @sizeOf(vk.TransformMatrixKHR);
-    vc.device.cmdUpdateBuffer(command_buffer, self.instances_device.handle, offset, size, &new_transform);
-    vc.device.cmdUpdateBuffer(command_buffer, self.world_to_instance_device.handle, offset_inverse, size, &new_transform.inverse_affine());
+    vc.device.cmdUpdateBuffer(command_buffer, self.instances_device.handle(), offset, size, &new_transform);
+    vc.device.cmdUpdateBuffer(command_buffer, self.world_to_instance_device.handle(), offset_inverse, size, &new_transform.inverse_affine());
     const barriers = [_]vk.BufferMemoryBarrier2 {
         .{
             .src_stage_mask = .{ .clear_bit = true }, // cmdUpdateBuffer seems to be clear for some reason
@@ -578,7 +1071,7 @@ pub fn recordUpdateSingleTransform(self: *Self, vc: *const VulkanContext, comman
             .dst_access_mask = .{ .acceleration_structure_read_bit_khr = true, .shader_storage_read_bit = true },
             .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
             .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-            .buffer = self.instances_device.handle,
+            .buffer = self.instances_device.handle(),
             .offset = offset,
             .size = size,
         },
@@ -589,7 +1082,7 @@ pub fn recordUpdateSingleTransform(self: *Self, vc: *const VulkanContext, comman
             .dst_access_mask = .{ .shader_storage_read_bit = true },
             .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
             .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-            .buffer = self.world_to_instance_device.handle,
+            .buffer = self.world_to_instance_device.handle(),
             .offset = offset_inverse,
             .size = size,
         },
@@ -600,16 +1093,17 @@ pub fn recordUpdateSingleTransform(self: *Self, vc: *const VulkanContext, comman
     });
 }
 
-// TODO: get it working
-pub fn updateVisibility(self: *Self, instance_idx: u32, visible: bool) void {
-    self.instances_host.data[instance_idx].instance_custom_index_and_mask.mask = if (visible) 0xFF else 0x00;
+// host-side only, must reupload instances and refit TLAS to see changes
+pub fn updateVisibility(self: *Self, handle: Handle, visible: bool) void {
+    self.instances_host.items[self.instanceIndex(handle)].instance_custom_index_and_mask.mask = if (visible) 0xFF else 0x00;
+    self.markEmittersDirty(handle);
 }
 
 // probably bad idea if you're changing many
 pub fn recordUpdateSingleMaterial(self: Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer, geometry_idx: u32, new_material_idx: u32) void {
     const offset = @sizeOf(Geometry) * geometry_idx + @offsetOf(Geometry, "material");
     const size = @sizeOf(u32);
-    vc.device.cmdUpdateBuffer(command_buffer, self.geometries.handle, offset, size, &new_material_idx);
+    vc.device.cmdUpdateBuffer(command_buffer, self.geometries.handle(), offset, size, &new_material_idx);
     vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
         .buffer_memory_barrier_count = 1,
         .p_buffer_memory_barriers = @ptrCast(&vk.BufferMemoryBarrier2 {
@@ -619,14 +1113,43 @@ pub fn recordUpdateSingleMaterial(self: Self, vc: *const VulkanContext, command_
             .dst_access_mask = .{ .shader_storage_read_bit = true },
             .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
             .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-            .buffer = self.geometries.handle,
+            .buffer = self.geometries.handle(),
             .offset = offset,
             .size = size,
         }),
     });
 }
 
-pub fn recordRebuild(self: *Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer) !void {
+// refitting keeps the TLAS topology as it was built, so it gets looser as
+// instances move -- past either of these, it is rebuilt instead
+const max_tlas_refits = 256;
+const max_tlas_growth = 1.5; // see tlasGrowth
+
+// builds after instances are added or removed are for tracing, while those
+// for refits getting too loose are likely to keep happening as things move
+const tlas_trace_flags = vk.BuildAccelerationStructureFlagsKHR { .prefer_fast_trace_bit_khr = true, .allow_update_bit_khr = true };
+const tlas_build_flags = vk.BuildAccelerationStructureFlagsKHR { .prefer_fast_build_bit_khr = true, .allow_update_bit_khr = true };
+
+const min_tlas_capacity = 64;
+
+// brings the TLAS up to date with instances_device, which must have everything
+// in instances_host, either refitting or rebuilding it as needed
+//
+// commands must be in recording state
+// returns scratch buffer that must be kept alive until command is completed,
+// which is null if it wasn't needed
+//
+// if the TLAS needs more room than it has, it is recreated, so the old one must no longer be in use
+pub fn recordUpdateTlas(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, command_buffer: vk.CommandBuffer) !VkAllocator.OwnedDeviceBuffer {
+    var accel_memory = vk_allocator.withCategory(.accel);
+
+    const build_flags: ?vk.BuildAccelerationStructureFlagsKHR = if (self.tlas_dirty or self.tlas_handle == .null_handle)
+        tlas_trace_flags
+    else if (self.tlas_refit_count >= max_tlas_refits or self.tlasGrowth() > max_tlas_growth)
+        tlas_build_flags
+    else
+        null;
+
     const geometry = vk.AccelerationStructureGeometryKHR {
         .geometry_type = .instances_khr,
         .flags = .{ .opaque_bit_khr = true },
@@ -642,9 +1165,9 @@ pub fn recordRebuild(self: *Self, vc: *const VulkanContext, command_buffer: vk.C
 
     var geometry_info = vk.AccelerationStructureBuildGeometryInfoKHR {
         .type = .top_level_khr,
-        .flags = .{ .prefer_fast_trace_bit_khr = true, .allow_update_bit_khr = true },
-        .mode = .update_khr,
-        .src_acceleration_structure = self.tlas_handle,
+        .flags = build_flags orelse self.tlas_flags,
+        .mode = if (build_flags != null) .build_khr else .update_khr,
+        .src_acceleration_structure = if (build_flags != null) .null_handle else self.tlas_handle,
         .dst_acceleration_structure = self.tlas_handle,
         .geometry_count = 1,
         .p_geometries = @ptrCast(&geometry),
@@ -653,6 +1176,51 @@ pub fn recordRebuild(self: *Self, vc: *const VulkanContext, command_buffer: vk.C
         },
     };
 
+    var scratch_buffer = VkAllocator.OwnedDeviceBuffer {};
+    errdefer scratch_buffer.destroy(vc);
+
+    if (build_flags) |flags| {
+        try self.tlas_built_bounds.ensureTotalCapacity(allocator, self.instance_count);
+
+        const size_info = getBuildSizesInfo(vc, &geometry_info, @ptrCast(&self.instance_count));
+        if (size_info.acceleration_structure_size > self.tlas_size or size_info.update_scratch_size > self.tlas_update_scratch_size) {
+            // leave room to grow, so adding instances one by one doesn't mean recreating it every time,
+            // and for either kind of build, so switching between them doesn't either
+            const reserved_count = @max(2 * self.instance_count, min_tlas_capacity);
+            var reserved_info = geometry_info;
+            reserved_info.flags = tlas_trace_flags;
+            const trace_size_info = getBuildSizesInfo(vc, &reserved_info, @ptrCast(&reserved_count));
+            reserved_info.flags = tlas_build_flags;
+            const build_size_info = getBuildSizesInfo(vc, &reserved_info, @ptrCast(&reserved_count));
+            try self.recreateTlas(vc, &accel_memory, @max(trace_size_info.acceleration_structure_size, build_size_info.acceleration_structure_size), @max(trace_size_info.update_scratch_size, build_size_info.update_scratch_size));
+            geometry_info.dst_acceleration_structure = self.tlas_handle;
+        }
+
+        scratch_buffer = try accel_memory.createOwnedDeviceBuffer(vc, size_info.build_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
+        geometry_info.scratch_data.device_address = scratch_buffer.getAddress(vc);
+
+        self.tlas_built_bounds.clearRetainingCapacity();
+        for (self.instances_host.items, self.instance_data.items) |instance, data| {
+            self.tlas_built_bounds.appendAssumeCapacity(self.instanceBounds(instance, data));
+        }
+        self.tlas_flags = flags;
+        self.tlas_dirty = false;
+        self.tlas_refit_count = 0;
+    } else {
+        self.tlas_refit_count += 1;
+    }
+
+    // instances may have just been written
+    vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
+        .memory_barrier_count = 1,
+        .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+            .src_stage_mask = .{ .copy_bit = true, .clear_bit = true },
+            .src_access_mask = .{ .transfer_write_bit = true },
+            .dst_stage_mask = .{ .acceleration_structure_build_bit_khr = true },
+            .dst_access_mask = .{ .acceleration_structure_read_bit_khr = true },
+        }),
+    });
+
     const build_info = vk.AccelerationStructureBuildRangeInfoKHR {
         .primitive_count = self.instance_count,
         .first_vertex = 0,
@@ -676,29 +1244,465 @@ pub fn recordRebuild(self: *Self, vc: *const VulkanContext, command_buffer: vk.C
         .memory_barrier_count = barriers.len,
         .p_memory_barriers = &barriers,
     });
+
+    return scratch_buffer;
+}
+
+// old TLAS must no longer be in use
+fn recreateTlas(self: *Self, vc: *const VulkanContext, accel_memory: *VkAllocator, size: vk.DeviceSize, update_scratch_size: vk.DeviceSize) !void {
+    const buffer = try accel_memory.createDeviceBuffer(vc, u8, size, .{ .acceleration_structure_storage_bit_khr = true });
+    errdefer buffer.destroy(vc);
+
+    const update_scratch_buffer = try accel_memory.createDeviceBuffer(vc, u8, update_scratch_size, .{ .shader_device_address_bit = true, .storage_buffer_bit = true });
+    errdefer update_scratch_buffer.destroy(vc);
+
+    const handle = try vc.device.createAccelerationStructureKHR(&.{
+        .buffer = buffer.handle,
+        .offset = 0,
+        .size = size,
+        .type = .top_level_khr,
+    }, null);
+
+    vc.device.destroyAccelerationStructureKHR(self.tlas_handle, null);
+    self.tlas_buffer.destroy(vc);
+    self.tlas_update_scratch_buffer.destroy(vc);
+
+    self.tlas_handle = handle;
+    self.tlas_buffer = buffer;
+    self.tlas_size = size;
+    self.tlas_update_scratch_buffer = update_scratch_buffer;
+    self.tlas_update_scratch_address = update_scratch_buffer.getAddress(vc);
+    self.tlas_update_scratch_size = update_scratch_size;
+}
+
+fn instanceBounds(self: *const Self, instance: vk.AccelerationStructureInstanceKHR, data: InstanceData) Bounds {
+    return self.blases.items(.bounds)[data.blas].transformed(@bitCast(instance.transform));
+}
+
+// how much bigger instances get when each is merged with where it was at the
+// last build -- a rough measure of how much looser refits have made the TLAS
+fn tlasGrowth(self: *const Self) f32 {
+    var built_area: f32 = 0;
+    var grown_area: f32 = 0;
+    for (self.instances_host.items, self.instance_data.items, self.tlas_built_bounds.items) |instance, data, built| {
+        built_area += built.surfaceArea();
+        grown_area += built.merged(self.instanceBounds(instance, data)).surfaceArea();
+    }
+    return if (built_area == 0) 1 else grown_area / built_area;
+}
+
+fn emitterCount(mesh_manager: MeshManager, geometries: []const Geometry) usize {
+    var count: usize = 0;
+    for (geometries) |geometry| {
+        if (geometry.sampled) count += mesh_manager.meshes.items(.indices)[geometry.mesh].len;
+    }
+    return count;
+}
+
+fn ensureUnusedEmitterCapacity(self: *Self, allocator: std.mem.Allocator, count: usize) !void {
+    try self.emitters.ensureUnusedCapacity(allocator, count);
+    try self.emitter_areas.ensureUnusedCapacity(allocator, count);
+    try self.emitter_triangles.ensureUnusedCapacity(allocator, count);
+}
+
+// adds every triangle of the sampled geometries of the instance with this handle,
+// with areas and bounds left to be computed by recordUpdateEmitters
+fn appendEmittersAssumeCapacity(self: *Self, mesh_manager: MeshManager, handle: Handle, geometries: []const Geometry) void {
+    const range = EmitterRange {
+        .start = @intCast(self.emitters.items.len),
+        .count = @intCast(emitterCount(mesh_manager, geometries)),
+        .dirty = true,
+    };
+    if (handle == self.emitter_ranges.items.len) {
+        self.emitter_ranges.appendAssumeCapacity(range);
+    } else {
+        self.emitter_ranges.items[handle] = range;
+    }
+
+    for (geometries, 0..) |geometry, geometry_idx| {
+        if (!geometry.sampled) continue;
+        for (0..mesh_manager.meshes.items(.indices)[geometry.mesh].len) |primitive| {
+            self.emitters.appendAssumeCapacity(.{
+                .handle = handle,
+                .geometry = @intCast(geometry_idx),
+                .primitive = @intCast(primitive),
+            });
+            self.emitter_areas.appendAssumeCapacity(0.0);
+            self.emitter_triangles.appendAssumeCapacity(undefined);
+        }
+    }
+
+    if (range.count != 0) {
+        self.emitters_dirty = true;
+        self.emitter_layout_dirty = true;
+    }
+}
+
+// whether recordUpdateEmitters must be called before shaders next sample lights,
+// light_tree being whether they sample with the tree
+pub fn needsEmitterUpdate(self: *const Self, light_tree: bool) bool {
+    return self.emitters_dirty or (light_tree and self.light_tree_stale);
+}
+
+fn markEmittersDirty(self: *Self, handle: Handle) void {
+    const range = &self.emitter_ranges.items[handle];
+    if (range.count == 0) return;
+    range.dirty = true;
+    self.emitters_dirty = true;
+}
+
+// triangles of a single geometry of a single instance whose areas and bounds need computing
+const AreaRun = struct {
+    first: u32, // in emitters
+    offset: u32, // triangles in runs before this one
+    count: u32,
+    transform: Mat3x4,
+    positions: []const F32x3,
+    indices: []const U32x3,
+    hidden: bool,
+};
+
+const AreaPass = struct {
+    runs: []const AreaRun,
+    areas: []f32,
+    triangles: []light_tree.Triangle,
+    areas_changed: *std.atomic.Value(bool), // set if any area came out different than before
+
+    // takes triangles [start, end) over all runs
+    fn run(self: *const AreaPass, start: usize, end: usize) void {
+        // last run starting at or before start
+        var lo: usize = 0;
+        var hi: usize = self.runs.len;
+        while (hi - lo > 1) {
+            const mid = (lo + hi) / 2;
+            if (self.runs[mid].offset <= start) lo = mid else hi = mid;
+        }
+
+        var position = start;
+        var run_idx = lo;
+        while (position < end) : (run_idx += 1) {
+            const area_run = self.runs[run_idx];
+            const run_start = position - area_run.offset;
+            const run_end = @min(end - area_run.offset, area_run.count);
+            const areas = self.areas[area_run.first + run_start..area_run.first + run_end];
+            if (area_run.hidden) {
+                if (std.mem.indexOfNone(f32, areas, &.{ 0.0 }) != null) self.areas_changed.store(true, .monotonic);
+                @memset(areas, 0.0);
+            } else {
+                // a block at a time, so rigid moves can be told apart from ones changing areas
+                var block: [area_block]f32 = undefined;
+                var block_start: usize = 0;
+                while (block_start < areas.len) : (block_start += area_block) {
+                    const block_areas = areas[block_start..@min(block_start + area_block, areas.len)];
+                    triangleAreas(area_run.transform, area_run.positions, area_run.indices[run_start + block_start..][0..block_areas.len], block[0..block_areas.len]);
+                    if (!std.mem.eql(u8, std.mem.sliceAsBytes(block_areas), std.mem.sliceAsBytes(block[0..block_areas.len]))) self.areas_changed.store(true, .monotonic);
+                    @memcpy(block_areas, block[0..block_areas.len]);
+                }
+            }
+            // hidden ones have no area so don't end up in any node's bounds, but still need to be something
+            triangleShapes(area_run.transform, area_run.positions, area_run.indices[run_start..run_end], self.triangles[area_run.first + run_start..area_run.first + run_end]);
+            position = area_run.offset + run_end;
+        }
+    }
+};
+
+const area_lanes = 8;
+const area_block = 32 * area_lanes;
+const AreaVector = @Vector(area_lanes, f32);
+
+// world space area of each triangle, area_lanes triangles at a time
+//
+// translation doesn't change area, so only edges are transformed
+fn triangleAreas(transform: Mat3x4, positions: []const F32x3, indices: []const U32x3, areas: []f32) void {
+    var i: usize = 0;
+    while (i + area_lanes <= indices.len) : (i += area_lanes) {
+        var edges: [2][3][area_lanes]f32 = undefined;
+        for (indices[i..][0..area_lanes], 0..) |index, lane| {
+            const p0 = positions[index.x];
+            const edge1 = positions[index.y].sub(p0);
+            const edge2 = positions[index.z].sub(p0);
+            edges[0][0][lane] = edge1.x;
+            edges[0][1][lane] = edge1.y;
+            edges[0][2][lane] = edge1.z;
+            edges[1][0][lane] = edge2.x;
+            edges[1][1][lane] = edge2.y;
+            edges[1][2][lane] = edge2.z;
+        }
+
+        const e1 = transformEdges(transform, edges[0]);
+        const e2 = transformEdges(transform, edges[1]);
+        const cross_x = e1[1] * e2[2] - e1[2] * e2[1];
+        const cross_y = e1[2] * e2[0] - e1[0] * e2[2];
+        const cross_z = e1[0] * e2[1] - e1[1] * e2[0];
+        const half: AreaVector = @splat(0.5);
+        areas[i..][0..area_lanes].* = @sqrt(cross_x * cross_x + cross_y * cross_y + cross_z * cross_z) * half;
+    }
+
+    for (indices[i..], areas[i..]) |index, *area| {
+        const p0 = positions[index.x];
+        const edge1 = transform.mul_vec(positions[index.y].sub(p0));
+        const edge2 = transform.mul_vec(positions[index.z].sub(p0));
+        area.* = edge1.cross(edge2).length() / 2.0;
+    }
+}
+
+fn transformEdges(transform: Mat3x4, edges: [3][area_lanes]f32) [3]AreaVector {
+    const x: AreaVector = edges[0];
+    const y: AreaVector = edges[1];
+    const z: AreaVector = edges[2];
+
+    var transformed: [3]AreaVector = undefined;
+    for ([3]F32x4 { transform.x, transform.y, transform.z }, &transformed) |row, *axis| {
+        axis.* = x * @as(AreaVector, @splat(row.x)) + y * @as(AreaVector, @splat(row.y)) + z * @as(AreaVector, @splat(row.z));
+    }
+    return transformed;
+}
+
+// world space bounds and front face normal of each triangle, for the light tree
+//
+// normal is the same as the shader gets by transforming the object space one with
+// the inverse transpose, which flips relative to the cross product of the
+// transformed edges if the transform does
+fn triangleShapes(transform: Mat3x4, positions: []const F32x3, indices: []const U32x3, triangles: []light_tree.Triangle) void {
+    const determinant = transform.x.truncate().dot(transform.y.truncate().cross(transform.z.truncate()));
+    const orientation: f32 = if (determinant < 0.0) -1.0 else 1.0;
+
+    for (indices, triangles) |index, *triangle| {
+        const p0 = transform.mul_point(positions[index.x]);
+        const p1 = transform.mul_point(positions[index.y]);
+        const p2 = transform.mul_point(positions[index.z]);
+
+        const normal = p0.sub(p2).cross(p1.sub(p2));
+        const length = normal.length();
+        triangle.* = .{
+            .min = F32x3.new(@min(p0.x, p1.x, p2.x), @min(p0.y, p1.y, p2.y), @min(p0.z, p1.z, p2.z)),
+            .max = F32x3.new(@max(p0.x, p1.x, p2.x), @max(p0.y, p1.y, p2.y), @max(p0.z, p1.z, p2.z)),
+            .normal = if (length == 0.0) F32x3.new(0.0, 0.0, 0.0) else normal.mul_scalar(orientation / length),
+        };
+    }
+}
+
+// below this many triangles, not worth spreading the area pass over threads
+const min_area_chunk = 4 * 1024;
+
+// recomputes the areas and bounds of emitters of instances added, moved or hidden since last time,
+// then rebuilds the light tree from all of them and uploads it
+//
+// the alias table and the geometry part of the tree lookup only depend on areas and on which
+// emitters there are, so are left alone if instances only moved rigidly -- otherwise they're
+// rebuilt and uploaded whole, as sampling relies on a single table over every triangle
+//
+// light_tree is whether shaders sample with the tree, and if not, it's left to be
+// built once they do, see needsEmitterUpdate
+//
+// commands must be in recording state
+pub fn recordUpdateEmitters(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, mesh_manager: MeshManager, light_tree: bool) !void {
+    var areas_changed = std.atomic.Value(bool).init(false);
+
+    // areas and bounds
+    {
+        var runs = std.ArrayList(AreaRun).init(allocator);
+        defer runs.deinit();
+
+        var dirty_count: u32 = 0;
+        for (self.emitter_ranges.items, 0..) |range, handle| {
+            if (!range.dirty) continue;
+
+            const index = self.instance_indices.items[handle];
+            const instance = self.instances_host.items[index];
+            const meshes = self.blases.items(.meshes)[self.instance_data.items[index].blas];
+
+            // emitters are in runs of whole geometries
+            var start: u32 = 0;
+            while (start < range.count) {
+                const mesh = meshes[self.emitters.items[range.start + start].geometry];
+                const mesh_indices = mesh_manager.meshes.items(.indices)[mesh];
+                try runs.append(.{
+                    .first = range.start + start,
+                    .offset = dirty_count,
+                    .count = @intCast(mesh_indices.len),
+                    .transform = @bitCast(instance.transform),
+                    .positions = mesh_manager.meshes.items(.positions)[mesh],
+                    .indices = mesh_indices,
+                    .hidden = instance.instance_custom_index_and_mask.mask == 0,
+                });
+                start += @intCast(mesh_indices.len);
+                dirty_count += @intCast(mesh_indices.len);
+            }
+        }
+
+        if (dirty_count != 0) {
+            parallel.forChunks(dirty_count, min_area_chunk, &AreaPass {
+                .runs = runs.items,
+                .areas = self.emitter_areas.items,
+                .triangles = self.emitter_triangles.items,
+                .areas_changed = &areas_changed,
+            }, AreaPass.run);
+        }
+
+        for (self.emitter_ranges.items) |*range| range.dirty = false;
+    }
+
+    const rebuild_table = self.emitter_layout_dirty or areas_changed.load(.monotonic);
+
+    // earlier traces may still be reading the old table and tree
+    vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
+        .memory_barrier_count = 1,
+        .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+            .src_stage_mask = .{ .ray_tracing_shader_bit_khr = true },
+            .dst_stage_mask = .{ .copy_bit = true },
+        }),
+    });
+
+    // table
+    if (rebuild_table) {
+        const TableDataPass = struct {
+            emitters: []const Emitter,
+            instance_indices: []const u32,
+            table_data: []TableData,
+
+            fn run(pass: *const @This(), start: usize, end: usize) void {
+                for (pass.emitters[start..end], pass.table_data[start..end]) |emitter, *data| {
+                    data.* = .{
+                        .instance = pass.instance_indices[emitter.handle],
+                        .geometry = emitter.geometry,
+                        .primitive = emitter.primitive,
+                    };
+                }
+            }
+        };
+
+        const table_data = try allocator.alloc(TableData, self.emitters.items.len);
+        defer allocator.free(table_data);
+        parallel.forChunks(table_data.len, min_area_chunk, &TableDataPass {
+            .emitters = self.emitters.items,
+            .instance_indices = self.instance_indices.items,
+            .table_data = table_data,
+        }, TableDataPass.run);
+
+        const table = try AliasTableT.create(allocator, self.emitter_areas.items, table_data);
+        defer allocator.free(table.entries);
+
+        const entry_count: u32 = @intCast(table.entries.len + 1);
+        _ = try self.alias_table.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, entry_count);
+
+        const alias_staging = try commands.staging.reserve(AliasTableT.TableEntry, vc, vk_allocator, entry_count);
+        alias_staging.data[0].alias = @intCast(table.entries.len);
+        alias_staging.data[0].select = table.sum;
+        @memcpy(alias_staging.data[1..], table.entries);
+
+        commands.recordCopyBuffer(vc, self.alias_table.handle(), alias_staging.buffer, &.{
+            vk.BufferCopy {
+                .src_offset = alias_staging.offset,
+                .dst_offset = 0,
+                .size = alias_staging.data.len * @sizeOf(AliasTableT.TableEntry),
+            },
+        });
+    }
+
+    // tree
+    if (!light_tree) {
+        self.light_tree_stale = true;
+    } else {
+        const tree = try light_tree.LightTree.create(allocator, self.emitter_triangles.items, self.emitter_areas.items);
+        defer tree.destroy(allocator);
+
+        const node_count: u32 = @intCast(tree.nodes.len);
+        _ = try self.light_tree_nodes.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, node_count);
+
+        // geometries' first emitters, then the tree's trails, with the first part
+        // only changing along with which emitters and geometries there are
+        const relayout_lookup = self.emitter_layout_dirty or self.light_tree_stale or self.geometry_count != self.emitter_lookup_geometry_count;
+        const lookup_count: u32 = @intCast(@max(@as(usize, self.geometry_count) + tree.trails.len, 1));
+        const lookup_start: u32 = if (relayout_lookup) 0 else self.geometry_count;
+        _ = try self.light_tree_lookup.recordEnsureCapacity(vc, vk_allocator, allocator, commands, lookup_start, lookup_count);
+
+        const nodes_staging = try commands.staging.reserve(light_tree.Node, vc, vk_allocator, node_count);
+        @memcpy(nodes_staging.data, tree.nodes);
+
+        const lookup_staging = try commands.staging.reserve(u32, vc, vk_allocator, lookup_count - lookup_start);
+        if (relayout_lookup) {
+            @memset(lookup_staging.data[0..self.geometry_count], std.math.maxInt(u32));
+            for (self.emitters.items, 0..) |emitter, i| {
+                // first triangle of a geometry
+                if (emitter.primitive != 0) continue;
+                const instance = self.instances_host.items[self.instance_indices.items[emitter.handle]];
+                lookup_staging.data[instance.instance_custom_index_and_mask.instance_custom_index + emitter.geometry] = @intCast(self.geometry_count + i);
+            }
+        }
+        @memcpy(lookup_staging.data[self.geometry_count - lookup_start..][0..tree.trails.len], tree.trails);
+
+        commands.recordCopyBuffer(vc, self.light_tree_nodes.handle(), nodes_staging.buffer, &.{
+            vk.BufferCopy {
+                .src_offset = nodes_staging.offset,
+                .dst_offset = 0,
+                .size = nodes_staging.data.len * @sizeOf(light_tree.Node),
+            },
+        });
+        if (lookup_staging.data.len != 0) {
+            commands.recordCopyBuffer(vc, self.light_tree_lookup.handle(), lookup_staging.buffer, &.{
+                vk.BufferCopy {
+                    .src_offset = lookup_staging.offset,
+                    .dst_offset = @as(vk.DeviceSize, lookup_start) * @sizeOf(u32),
+                    .size = lookup_staging.data.len * @sizeOf(u32),
+                },
+            });
+        }
+        self.emitter_lookup_geometry_count = self.geometry_count;
+        self.light_tree_stale = false;
+    }
+
+    vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
+        .memory_barrier_count = 1,
+        .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+            .src_stage_mask = .{ .copy_bit = true },
+            .src_access_mask = .{ .transfer_write_bit = true },
+            .dst_stage_mask = .{ .ray_tracing_shader_bit_khr = true },
+            .dst_access_mask = .{ .shader_storage_read_bit = true },
+        }),
+    });
+
+    self.emitters_dirty = false;
+    self.emitter_layout_dirty = false;
 }
 
 pub fn destroy(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
-    self.instances_device.destroy(vc);
-    self.instances_host.destroy(vc);
-    self.world_to_instance_device.destroy(vc);
-    self.world_to_instance_host.destroy(vc);
+    self.instances_device.destroy(vc, allocator);
+    self.instances_host.deinit(allocator);
+    self.world_to_instance_device.destroy(vc, allocator);
+    self.world_to_instance_host.deinit(allocator);
 
-    self.geometries.destroy(vc);
+    self.geometries.destroy(vc, allocator);
 
-    self.alias_table.destroy(vc);
+    self.emitters.deinit(allocator);
+    self.emitter_areas.deinit(allocator);
+    self.emitter_triangles.deinit(allocator);
+    self.emitter_ranges.deinit(allocator);
+    self.alias_table.destroy(vc, allocator);
+    self.light_tree_nodes.destroy(vc, allocator);
+    self.light_tree_lookup.destroy(vc, allocator);
 
     self.tlas_update_scratch_buffer.destroy(vc);
+    self.tlas_built_bounds.deinit(allocator);
 
     const blases_slice = self.blases.slice();
     const blases_handles = blases_slice.items(.handle);
     const blases_buffers = blases_slice.items(.buffer);
+    const blases_meshes = blases_slice.items(.meshes);
 
     for (0..self.blases.len) |i| {
         vc.device.destroyAccelerationStructureKHR(blases_handles[i], null);
         blases_buffers[i].destroy(vc);
+        allocator.free(blases_meshes[i]);
     }
     self.blases.deinit(allocator);
+    self.blas_lookup.deinit(allocator);
+
+    self.instance_data.deinit(allocator);
+    self.instance_indices.deinit(allocator);
+    self.free_handles.deinit(allocator);
+    self.free_blases.deinit(allocator);
+    self.free_geometry_ranges.deinit(allocator);
 
     vc.device.destroyAccelerationStructureKHR(self.tlas_handle, null);
     self.tlas_buffer.destroy(vc);
@@ -143,21 +143,19 @@ pub fn addBackground(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAll
     const texture_name = try std.fmt.allocPrintZ(allocator, "background {s}", .{ name });
     defer allocator.free(texture_name);
 
+    var texture_memory = vk_allocator.withCategory(.texture);
+
     const equirectangular_extent = color_image.extent;
-    const equirectangular_image = try Image.create(vc, vk_allocator, equirectangular_extent, .{ .transfer_dst_bit = true, .sampled_bit = true }, .r32g32b32a32_sfloat, false, texture_name);
+    const equirectangular_image = try Image.create(vc, &texture_memory, equirectangular_extent, .{ .transfer_dst_bit = true, .sampled_bit = true }, .r32g32b32a32_sfloat, false, texture_name);
     defer equirectangular_image.destroy(vc);
 
-    const equirectangular_image_host = try vk_allocator.createHostBuffer(vc, [4]f32, @intCast(color_image.asSlice().len), .{ .transfer_src_bit = true });
-    defer equirectangular_image_host.destroy(vc);
-    @memcpy(equirectangular_image_host.data, color_image.asSlice());
-
     const equal_area_map_size: u32 = @min(std.math.floorPowerOfTwo(u32, color_image.extent.height), maximum_equal_area_map_size);
     const equal_area_extent = vk.Extent2D { .width = equal_area_map_size, .height = equal_area_map_size };
 
-    const equal_area_image = try Image.create(vc, vk_allocator, equal_area_extent, .{ .storage_bit = true, .sampled_bit = true }, .r32g32b32a32_sfloat, false, texture_name);
+    const equal_area_image = try Image.create(vc, &texture_memory, equal_area_extent, .{ .storage_bit = true, .sampled_bit = true }, .r32g32b32a32_sfloat, false, texture_name);
     errdefer equal_area_image.destroy(vc);
 
-    const luminance_image = try Image.create(vc, vk_allocator, equal_area_extent, .{ .storage_bit = true, .sampled_bit = true }, .r32_sfloat, true, texture_name);
+    const luminance_image = try Image.create(vc, &texture_memory, equal_area_extent, .{ .storage_bit = true, .sampled_bit = true }, .r32_sfloat, true, texture_name);
     errdefer luminance_image.destroy(vc);
 
     const actual_mip_count = std.math.log2(equal_area_map_size) + 1;
@@ -188,6 +186,8 @@ pub fn addBackground(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAll
 
     try commands.startRecording(vc);
 
+    const equirectangular_image_host = try commands.staging.stage([4]f32, vc, vk_allocator, color_image.asSlice());
+
     // copy equirectangular image to device
     vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
         .image_memory_barrier_count = 3,
@@ -242,8 +242,8 @@ pub fn addBackground(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAll
             },
         },
     });
-    vc.device.cmdCopyBufferToImage(commands.buffer, equirectangular_image_host.handle, equirectangular_image.handle, .transfer_dst_optimal, 1, @ptrCast(&vk.BufferImageCopy {
-        .buffer_offset = 0,
+    vc.device.cmdCopyBufferToImage(commands.buffer, equirectangular_image_host.buffer, equirectangular_image.handle, .transfer_dst_optimal, 1, @ptrCast(&vk.BufferImageCopy {
+        .buffer_offset = equirectangular_image_host.offset,
         .buffer_row_length = 0,
         .buffer_image_height = 0,
         .image_subresource = .{
@@ -289,6 +289,7 @@ pub fn addBackground(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAll
     });
 
     // do conversion
+    const conversion_scope = commands.beginScope(vc, "background conversion");
     self.equirectangular_to_equal_area_pipeline.recordBindPipeline(vc, commands.buffer);
     self.equirectangular_to_equal_area_pipeline.recordPushDescriptors(vc, commands.buffer, .{
         .src_texture = equirectangular_image.view,
@@ -296,6 +297,7 @@ pub fn addBackground(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAll
     });
     const dispatch_size = if (equal_area_map_size > shader_local_size) @divExact(equal_area_map_size, shader_local_size) else 1;
     self.equirectangular_to_equal_area_pipeline.recordDispatch(vc, commands.buffer, .{ .width = dispatch_size, .height = dispatch_size, .depth = 1 });
+    commands.endScope(vc, conversion_scope);
 
     vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
         .image_memory_barrier_count = 1,
@@ -321,6 +323,7 @@ pub fn addBackground(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAll
         },
     });
 
+    const luminance_scope = commands.beginScope(vc, "background luminance");
     self.luminance_pipeline.recordBindPipeline(vc, commands.buffer);
     self.luminance_pipeline.recordPushDescriptors(vc, commands.buffer, .{
         .src_color_image = equal_area_image.view,
@@ -361,6 +364,7 @@ pub fn addBackground(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAll
         const mip_dispatch_size = if (dst_mip_size > shader_local_size) @divExact(dst_mip_size, shader_local_size) else 1;
         self.fold_pipeline.recordDispatch(vc, commands.buffer, .{ .width = mip_dispatch_size, .height = mip_dispatch_size, .depth = 1 });
     }
+    commands.endScope(vc, luminance_scope);
     vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
         .image_memory_barrier_count = 1,
         .p_image_memory_barriers = &[1]vk.ImageMemoryBarrier2 {
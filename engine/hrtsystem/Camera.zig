@@ -65,6 +65,16 @@ pub fn appendSensor(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllo
     return @intCast(self.sensors.items.len - 1);
 }
 
+// replaces the sensor at handle with a fresh one of the given extent, freeing the old one
+pub fn recreateSensor(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, handle: SensorHandle, extent: vk.Extent2D) !void {
+    var buf: [32]u8 = undefined;
+    const name = try std.fmt.bufPrintZ(&buf, "render {}", .{handle});
+
+    const sensor = try Sensor.create(vc, vk_allocator, extent, name);
+    self.sensors.items[handle].destroy(vc);
+    self.sensors.items[handle] = sensor;
+}
+
 pub const LensHandle = u32;
 pub fn appendLens(self: *Self, allocator: std.mem.Allocator, lens: Lens) !LensHandle {
     try self.lenses.append(allocator, lens);
@@ -8,6 +8,7 @@ const VulkanContext = core.VulkanContext;
 const Commands = core.Commands;
 const VkAllocator = core.Allocator;
 const Image = core.Image;
+const DestructionQueue = core.DestructionQueue;
 const vk_helpers = core.vk_helpers;
 
 const F32x2 = engine.vector.Vec2(f32);
@@ -106,7 +107,7 @@ fn StructFromTaggedUnion(comptime Union: type, comptime InnerFn: fn(type) type)
 
 fn VariantBuffer(comptime T: type) type {
     return struct {
-        buffer: VkAllocator.DeviceBuffer(T) = .{},
+        buffer: core.DeviceArray(T, .{ .shader_device_address_bit = true }, .other, "material variant " ++ @typeName(T)) = .{},
         addr: vk.DeviceAddress = 0,
         len: vk.DeviceSize = 0,
     };
@@ -114,9 +115,17 @@ fn VariantBuffer(comptime T: type) type {
 
 const VariantBuffers = StructFromTaggedUnion(MaterialVariant, VariantBuffer);
 
+// where each material's variant data lives, so that addresses may be
+// patched when a variant buffer grows and moves
+const VariantRef = struct {
+    type: MaterialType,
+    index: u32,
+};
+
 material_count: u32,
 textures: TextureManager,
-materials: VkAllocator.DeviceBuffer(Material),
+materials: core.DeviceArray(Material, .{ .storage_buffer_bit = true }, .other, "materials"),
+variant_refs: std.ArrayListUnmanaged(VariantRef),
 
 variant_buffers: VariantBuffers,
 
@@ -124,43 +133,45 @@ pub const Handle = u32;
 
 const Self = @This();
 
-const max_materials = 512; // TODO: resizable buffers
-
 pub fn createEmpty(vc: *const VulkanContext) !Self {
     return Self {
         .material_count = 0,
         .materials = .{},
+        .variant_refs = .{},
         .variant_buffers = .{},
         .textures = try TextureManager.create(vc),
     };
 }
 
-// you can either do this or create below, but not both
 // texture handles must've been already added to the MaterialManager's textures
 pub fn upload(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, info: MaterialInfo) !Handle {
-    std.debug.assert(self.material_count < max_materials);
+    try self.variant_refs.ensureUnusedCapacity(allocator, 1);
 
     try commands.startRecording(vc);
+    _ = try self.materials.recordEnsureCapacity(vc, vk_allocator, allocator, commands, self.material_count, self.material_count + 1);
     inline for (@typeInfo(MaterialVariant).Union.fields, 0..) |field, field_idx| {
         if (@as(MaterialType, @enumFromInt(field_idx)) == std.meta.activeTag(info.variant)) {
+            const variant_buffer = &@field(self.variant_buffers, field.name);
             if (@sizeOf(field.type) != 0) {
-                const variant_buffer = &@field(self.variant_buffers, field.name);
-                if (variant_buffer.buffer.is_null()) {
-                    variant_buffer.buffer = try vk_allocator.createDeviceBuffer(vc, allocator, field.type, max_materials, .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
+                if (try variant_buffer.buffer.recordEnsureCapacity(vc, vk_allocator, allocator, commands, @intCast(variant_buffer.len), @intCast(variant_buffer.len + 1))) {
                     variant_buffer.addr = variant_buffer.buffer.getAddress(vc);
+                    try self.recordPatchAddresses(vc, vk_allocator, allocator, commands, std.meta.activeTag(info.variant), variant_buffer.addr, @sizeOf(field.type));
                 }
-                commands.recordUpdateBuffer(field.type, vc, variant_buffer.buffer, &.{ @field(info.variant, field.name) }, variant_buffer.len);
-                variant_buffer.len += 1;
+                commands.recordUpdateBuffer(field.type, vc, variant_buffer.buffer.buffer, &.{ @field(info.variant, field.name) }, variant_buffer.len);
             }
+            variant_buffer.len += 1;
 
             const gpu_material = Material {
                 .normal = info.normal,
                 .emissive = info.emissive,
                 .type = std.meta.activeTag(info.variant),
-                .addr = @field(self.variant_buffers, field.name).addr + (@field(self.variant_buffers, field.name).len - 1) * @sizeOf(field.type),
+                .addr = variant_buffer.addr + (variant_buffer.len - 1) * @sizeOf(field.type),
             };
-            if (self.materials.is_null()) self.materials = try vk_allocator.createDeviceBuffer(vc, allocator, Material, max_materials, .{ .storage_buffer_bit = true, .transfer_dst_bit = true });
-            commands.recordUpdateBuffer(Material, vc, self.materials, &.{ gpu_material }, self.material_count);
+            commands.recordUpdateBuffer(Material, vc, self.materials.buffer, &.{ gpu_material }, self.material_count);
+            self.variant_refs.appendAssumeCapacity(.{
+                .type = gpu_material.type,
+                .index = @intCast(variant_buffer.len - 1),
+            });
         }
     }
     try commands.submitAndIdleUntilDone(vc);
@@ -169,78 +180,105 @@ pub fn upload(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator,
     return self.material_count - 1;
 }
 
+// commands must be in recording state
+// rewrites the addresses of all materials of material_type for the variant buffer now at base
+fn recordPatchAddresses(self: *const Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, material_type: MaterialType, base: vk.DeviceAddress, variant_size: vk.DeviceSize) !void {
+    var patch_count: usize = 0;
+    for (self.variant_refs.items) |ref| {
+        if (ref.type == material_type) patch_count += 1;
+    }
+    if (patch_count == 0) return;
+
+    const addresses = try commands.staging.reserve(vk.DeviceAddress, vc, vk_allocator, patch_count);
+    const regions = try allocator.alloc(vk.BufferCopy, patch_count);
+    defer allocator.free(regions);
+
+    var patch_index: usize = 0;
+    for (self.variant_refs.items, 0..) |ref, material_index| {
+        if (ref.type != material_type) continue;
+        addresses.data[patch_index] = base + ref.index * variant_size;
+        regions[patch_index] = vk.BufferCopy {
+            .src_offset = addresses.offset + patch_index * @sizeOf(vk.DeviceAddress),
+            .dst_offset = material_index * @sizeOf(Material) + @offsetOf(Material, "addr"),
+            .size = @sizeOf(vk.DeviceAddress),
+        };
+        patch_index += 1;
+    }
+
+    commands.recordCopyBuffer(vc, self.materials.handle(), addresses.buffer, regions);
+}
+
 pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, materials: []const MaterialInfo) !Self {
     var variant_lists = StructFromTaggedUnion(MaterialVariant, std.ArrayListUnmanaged) {};
     defer inline for (@typeInfo(MaterialVariant).Union.fields) |field| {
         @field(variant_lists, field.name).deinit(allocator);
     };
-    const variant_indices = try allocator.alloc(vk.DeviceAddress, materials.len);
-    defer allocator.free(variant_indices);
-    for (materials, variant_indices) |material_info, *variant_index| {
+    var variant_refs = try std.ArrayListUnmanaged(VariantRef).initCapacity(allocator, materials.len);
+    errdefer variant_refs.deinit(allocator);
+    for (materials) |material_info| {
         inline for (@typeInfo(MaterialVariant).Union.fields, 0..) |field, field_idx| {
             if (@as(MaterialType, @enumFromInt(field_idx)) == std.meta.activeTag(material_info.variant)) {
-                variant_index.* = @field(variant_lists, field.name).items.len;
+                variant_refs.appendAssumeCapacity(.{
+                    .type = std.meta.activeTag(material_info.variant),
+                    .index = @intCast(@field(variant_lists, field.name).items.len),
+                });
                 try @field(variant_lists, field.name).append(allocator, @field(material_info.variant, field.name));
             }
         }
     }
 
+    const material_count: u32 = @intCast(materials.len);
+
     var variant_buffers = VariantBuffers {};
-    inline for (@typeInfo(MaterialVariant).Union.fields) |field| {
-        if (@sizeOf(field.type) != 0) {
-            if (@field(variant_lists, field.name).items.len != 0) {
-                const data = @field(variant_lists, field.name).items;
-                const host_buffer = try vk_allocator.createHostBuffer(vc, field.type, @intCast(data.len), .{ .transfer_src_bit = true });
-                defer host_buffer.destroy(vc);
-
-                const device_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, field.type, @intCast(data.len), .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
-                errdefer device_buffer.destroy(vc);
-
-                @memcpy(host_buffer.data, data);
-                try commands.startRecording(vc);
-                commands.recordUploadBuffer(field.type, vc, device_buffer, host_buffer);
-                try commands.submitAndIdleUntilDone(vc);
-
-                @field(variant_buffers, field.name) = .{
-                    .buffer = device_buffer,
-                    .addr = device_buffer.getAddress(vc),
-                    .len = data.len,
-                };
+    errdefer inline for (@typeInfo(VariantBuffers).Struct.fields) |field| {
+        @field(variant_buffers, field.name).buffer.destroy(vc, allocator);
+    };
+    var materials_gpu = core.DeviceArray(Material, .{ .storage_buffer_bit = true }, .other, "materials") {};
+    errdefer materials_gpu.destroy(vc, allocator);
+
+    if (material_count != 0) {
+        try commands.startRecording(vc);
+
+        inline for (@typeInfo(MaterialVariant).Union.fields) |field| {
+            const data = @field(variant_lists, field.name).items;
+            const variant_buffer = &@field(variant_buffers, field.name);
+            variant_buffer.len = data.len;
+            if (@sizeOf(field.type) != 0) {
+                if (data.len != 0) {
+                    _ = try variant_buffer.buffer.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, @intCast(data.len));
+                    try commands.recordStageBuffer(field.type, vc, vk_allocator, variant_buffer.buffer.buffer, data, 0);
+                    variant_buffer.addr = variant_buffer.buffer.getAddress(vc);
+                }
             }
         }
-    }
 
-    const material_count: u32 = @intCast(materials.len);
-    const materials_gpu = blk: {
-        var materials_host = try vk_allocator.createHostBuffer(vc, Material, material_count, .{ .transfer_src_bit = true });
-        defer materials_host.destroy(vc);
-        for (materials_host.data, materials, variant_indices) |*data, material, variant_index| {
+        _ = try materials_gpu.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, material_count);
+        const materials_host = try commands.staging.reserve(Material, vc, vk_allocator, material_count);
+        for (materials_host.data, materials, variant_refs.items) |*data, material, ref| {
             data.normal = material.normal;
             data.emissive = material.emissive;
-            data.type = std.meta.activeTag(material.variant);
+            data.type = ref.type;
             inline for (@typeInfo(MaterialVariant).Union.fields, 0..) |union_field, field_idx| {
                 if (@as(MaterialType, @enumFromInt(field_idx)) == data.type) {
-                    data.addr = @field(variant_buffers, union_field.name).addr + variant_index * @sizeOf(union_field.type);
+                    data.addr = @field(variant_buffers, union_field.name).addr + ref.index * @sizeOf(union_field.type);
                 }
             }
         }
-        const materials_gpu = try vk_allocator.createDeviceBuffer(vc, allocator, Material, material_count, .{ .storage_buffer_bit = true, .transfer_dst_bit = true });
-        errdefer materials_gpu.destroy(vc);
-
-        if (material_count != 0)
-        {
-            try commands.startRecording(vc);
-            commands.recordUploadBuffer(Material, vc, materials_gpu, materials_host);
-            try commands.submitAndIdleUntilDone(vc);
-        }
-
-        break :blk materials_gpu;
-    };
+        commands.recordCopyBuffer(vc, materials_gpu.handle(), materials_host.buffer, &.{
+            vk.BufferCopy {
+                .src_offset = materials_host.offset,
+                .dst_offset = 0,
+                .size = material_count * @sizeOf(Material),
+            },
+        });
+        try commands.submitAndIdleUntilDone(vc);
+    }
 
     return Self {
         .textures = try TextureManager.create(vc),
         .material_count = material_count,
         .materials = materials_gpu,
+        .variant_refs = variant_refs,
         .variant_buffers = variant_buffers,
     };
 }
@@ -254,7 +292,7 @@ pub fn recordUpdateSingleVariant(self: *Self, vc: *const VulkanContext, comptime
 
     const offset = @sizeOf(VariantType) * variant_idx;
     const size = @sizeOf(VariantType);
-    vc.device.cmdUpdateBuffer(command_buffer, @field(self.variant_buffers, variant_name).buffer.handle, offset, size, &new_data);
+    vc.device.cmdUpdateBuffer(command_buffer, @field(self.variant_buffers, variant_name).buffer.handle(), offset, size, &new_data);
 
     vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
         .buffer_memory_barrier_count = 1,
@@ -265,7 +303,7 @@ pub fn recordUpdateSingleVariant(self: *Self, vc: *const VulkanContext, comptime
             .dst_access_mask = .{ .shader_storage_read_bit = true },
             .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
             .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-            .buffer = @field(self.variant_buffers, variant_name).buffer.handle,
+            .buffer = @field(self.variant_buffers, variant_name).buffer.handle(),
             .offset = offset,
             .size = size,
         }),
@@ -274,31 +312,35 @@ pub fn recordUpdateSingleVariant(self: *Self, vc: *const VulkanContext, comptime
 
 pub fn destroy(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
     self.textures.destroy(vc, allocator);
-    self.materials.destroy(vc);
+    self.materials.destroy(vc, allocator);
+    self.variant_refs.deinit(allocator);
 
     inline for (@typeInfo(VariantBuffers).Struct.fields) |field| {
-        @field(self.variant_buffers, field.name).buffer.destroy(vc);
+        @field(self.variant_buffers, field.name).buffer.destroy(vc, allocator);
     }
 }
 
-// TODO: individual texture destruction
 pub const TextureManager = struct {
-    const max_descriptors = 1024; // TODO: consider using VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT, reallocation
+    // upper bound promised to the layout -- sets are only allocated as big as needed,
+    // and reallocated bigger as textures are added
+    const max_descriptors = 1 << 20;
+    const min_descriptors = 64;
+
     // must be kept in sync with shader
     pub const DescriptorLayout = core.descriptor.DescriptorLayout(&.{
+        .{
+            .name = "sampler",
+            .descriptor_type = .sampler,
+            .descriptor_count = 1,
+            .stage_flags = .{ .raygen_bit_khr = true },
+        },
         .{
             .name = "textures",
             .descriptor_type = .sampled_image,
             .descriptor_count = max_descriptors,
             .stage_flags = .{ .raygen_bit_khr = true },
-            .binding_flags = .{ .partially_bound_bit = true, .update_unused_while_pending_bit = true },
+            .binding_flags = .{ .partially_bound_bit = true, .update_unused_while_pending_bit = true, .variable_descriptor_count_bit = true },
         },
-        .{
-            .name = "sampler",
-            .descriptor_type = .sampler,
-            .descriptor_count = 1,
-            .stage_flags = .{ .raygen_bit_khr = true },
-        }
     }, .{}, 1, "Textures");
 
     pub const Source = union(enum) {
@@ -306,6 +348,7 @@ pub const TextureManager = struct {
             bytes: []const u8,
             extent: vk.Extent2D,
             format: vk.Format,
+            grey_alpha: bool = false, // two channels read as grey and alpha rather than red and green
         };
 
         raw: Raw,
@@ -322,44 +365,145 @@ pub const TextureManager = struct {
     }
 
     data: std.MultiArrayList(Image),
+    infos: std.ArrayListUnmanaged(Info), // parallel to data
+    free_handles: std.ArrayListUnmanaged(Handle), // destroyed textures whose slot can be reused
     descriptor_layout: DescriptorLayout,
+    descriptor_pool: vk.DescriptorPool,
     descriptor_set: vk.DescriptorSet,
+    descriptor_capacity: u32,
+
+    // grown out of -- their sets may still be bound by pending work, and
+    // they are small, so they're kept around until destruction
+    retired_pools: std.ArrayListUnmanaged(vk.DescriptorPool),
+
     sampler: vk.Sampler,
 
+    const Info = struct {
+        extent: vk.Extent2D,
+        format: vk.Format,
+        grey_alpha: bool,
+    };
+
+    // textures aren't downsampled past this
+    const min_downsample_extent = 64;
+
     pub fn create(vc: *const VulkanContext) !TextureManager {
         const sampler = try createSampler(vc);
-        const descriptor_layout = try DescriptorLayout.create(vc, .{ sampler });
+        errdefer vc.device.destroySampler(sampler, null);
+
+        var descriptor_layout = try DescriptorLayout.create(vc, .{ sampler });
+        errdefer descriptor_layout.destroy(vc);
 
         var descriptor_set: vk.DescriptorSet = undefined;
-        try vc.device.allocateDescriptorSets(&vk.DescriptorSetAllocateInfo {
-            .descriptor_pool = descriptor_layout.pool,
-            .descriptor_set_count = 1,
-            .p_set_layouts = @ptrCast(&descriptor_layout.handle),
-        }, @ptrCast(&descriptor_set));
-        try vk_helpers.setDebugName(vc, descriptor_set, "textures");
-        
+        const descriptor_pool = try allocateSet(vc, descriptor_layout, min_descriptors, &descriptor_set);
+
         return TextureManager {
             .data = .{},
+            .infos = .{},
+            .free_handles = .{},
             .descriptor_layout = descriptor_layout,
+            .descriptor_pool = descriptor_pool,
             .descriptor_set = descriptor_set,
+            .descriptor_capacity = min_descriptors,
+            .retired_pools = .{},
             .sampler = sampler,
         };
     }
 
+    // returns pool that the set with room for capacity textures was allocated from
+    fn allocateSet(vc: *const VulkanContext, descriptor_layout: DescriptorLayout, capacity: u32, descriptor_set: *vk.DescriptorSet) !vk.DescriptorPool {
+        const pool_sizes = [_]vk.DescriptorPoolSize {
+            .{
+                .type = .sampler,
+                .descriptor_count = 1,
+            },
+            .{
+                .type = .sampled_image,
+                .descriptor_count = capacity,
+            },
+        };
+        const pool = try vc.device.createDescriptorPool(&.{
+            .flags = .{},
+            .max_sets = 1,
+            .pool_size_count = pool_sizes.len,
+            .p_pool_sizes = &pool_sizes,
+        }, null);
+        errdefer vc.device.destroyDescriptorPool(pool, null);
+
+        try vc.device.allocateDescriptorSets(&vk.DescriptorSetAllocateInfo {
+            .p_next = &vk.DescriptorSetVariableDescriptorCountAllocateInfo {
+                .descriptor_set_count = 1,
+                .p_descriptor_counts = @ptrCast(&capacity),
+            },
+            .descriptor_pool = pool,
+            .descriptor_set_count = 1,
+            .p_set_layouts = @ptrCast(&descriptor_layout.handle),
+        }, @ptrCast(descriptor_set));
+        try vk_helpers.setDebugName(vc, descriptor_set.*, "textures");
+
+        return pool;
+    }
+
+    // moves to a set with room for at least capacity textures, rewriting
+    // the descriptors of the live ones into it
+    //
+    // the set must be fetched again afterwards
+    fn growDescriptors(self: *TextureManager, vc: *const VulkanContext, allocator: std.mem.Allocator, capacity: u32) !void {
+        if (capacity > max_descriptors) return error.TooManyTextures;
+        const new_capacity = @min(@max(capacity, self.descriptor_capacity * 2), max_descriptors);
+
+        try self.retired_pools.ensureUnusedCapacity(allocator, 1);
+
+        var new_set: vk.DescriptorSet = undefined;
+        const new_pool = try allocateSet(vc, self.descriptor_layout, new_capacity, &new_set);
+        errdefer vc.device.destroyDescriptorPool(new_pool, null);
+
+        const image_infos = try allocator.alloc(vk.DescriptorImageInfo, self.data.len);
+        defer allocator.free(image_infos);
+        const writes = try allocator.alloc(vk.WriteDescriptorSet, self.data.len);
+        defer allocator.free(writes);
+
+        var write_count: u32 = 0;
+        for (self.data.items(.view), 0..) |view, texture_index| {
+            if (view == .null_handle) continue; // destroyed, left dangling
+            image_infos[write_count] = vk.DescriptorImageInfo {
+                .image_layout = .shader_read_only_optimal,
+                .image_view = view,
+                .sampler = .null_handle,
+            };
+            writes[write_count] = vk.WriteDescriptorSet {
+                .dst_set = new_set,
+                .dst_binding = 1,
+                .dst_array_element = @intCast(texture_index),
+                .descriptor_count = 1,
+                .descriptor_type = .sampled_image,
+                .p_image_info = @ptrCast(&image_infos[write_count]),
+                .p_buffer_info = undefined,
+                .p_texel_buffer_view = undefined,
+            };
+            write_count += 1;
+        }
+        vc.device.updateDescriptorSets(write_count, writes.ptr, 0, null);
+
+        self.retired_pools.appendAssumeCapacity(self.descriptor_pool);
+        self.descriptor_pool = new_pool;
+        self.descriptor_set = new_set;
+        self.descriptor_capacity = new_capacity;
+    }
+
     pub const Handle = u32;
 
     pub fn upload(self: *TextureManager, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, source: Source, name: [:0]const u8) !TextureManager.Handle {
-        const texture_index: TextureManager.Handle = @intCast(self.data.len);
-        std.debug.assert(texture_index < max_descriptors);
-
         var extent: vk.Extent2D = undefined;
         var bytes: []const u8 = undefined;
         var format: vk.Format = undefined;
+        var grey_alpha = false;
         switch (source) {
             .raw => |raw_info| {
                 bytes = raw_info.bytes;
                 extent = raw_info.extent;
                 format = raw_info.format;
+                grey_alpha = raw_info.grey_alpha;
             },
             .f32x3 => {
                 bytes = std.mem.asBytes(&source.f32x3);
@@ -387,29 +531,321 @@ pub const TextureManager = struct {
                 format = .r32_sfloat;
             },
         }
-        const image = try Image.create(vc, vk_allocator, extent, .{ .transfer_dst_bit = true, .sampled_bit = true }, format, false, name);
-        try self.data.append(allocator, image);
+        const device_format = deviceFormat(vc, format);
+        const texture_index = try self.createTexture(vc, vk_allocator, allocator, extent, device_format, grey_alpha, name);
+        try commands.startRecording(vc);
+        try recordStageTexels(vc, vk_allocator, commands, self.data.items(.handle)[texture_index], bytes, extent, format, device_format, grey_alpha, commands.queue_family_index);
+        try commands.submitAndIdleUntilDone(vc);
+
+        return texture_index;
+    }
+
+    // commands must be in recording state
+    // writes handles of the created textures into handles, all staged through the commands' staging ring
+    // textures are released to dst_queue_family_index, see recordAcquire
+    //
+    // counts textures into uploaded as they're staged, so on error, the ones
+    // before the failing one are recorded and should still be submitted
+    pub fn recordUploadRaws(self: *TextureManager, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, sources: []const Source.Raw, names: []const [:0]const u8, handles: []Handle, uploaded: *usize, dst_queue_family_index: u32) !void {
+        std.debug.assert(sources.len == names.len and sources.len == handles.len);
+        uploaded.* = 0;
+
+        const scope = commands.beginScope(vc, "upload textures");
+        defer commands.endScope(vc, scope);
+
+        // so a texture that can't be staged can give its handle back
+        try self.free_handles.ensureUnusedCapacity(allocator, 1);
+
+        for (sources, names, handles) |source, name, *handle| {
+            const device_format = deviceFormat(vc, source.format);
+            handle.* = try self.createTexture(vc, vk_allocator, allocator, source.extent, device_format, source.grey_alpha, name);
+            recordStageTexels(vc, vk_allocator, commands, self.data.items(.handle)[handle.*], source.bytes, source.extent, source.format, device_format, source.grey_alpha, dst_queue_family_index) catch |err| {
+                // nothing has been submitted using it, so it can go right away
+                self.data.get(handle.*).destroy(vc);
+                self.data.set(handle.*, Image {
+                    .handle = .null_handle,
+                    .view = .null_handle,
+                    .allocation = .{},
+                });
+                self.free_handles.appendAssumeCapacity(handle.*);
+                return err;
+            };
+            uploaded.* += 1;
+        }
+    }
+
+    // formats textures may come in that devices don't have to support sampling,
+    // along with the wider format they're stored as if not
+    fn fallbackFormat(format: vk.Format) ?vk.Format {
+        return switch (format) {
+            .r8_srgb, .r8g8_srgb => .r8g8b8a8_srgb,
+            .r16_unorm => .r16_sfloat,
+            .r16g16_unorm => .r16g16_sfloat,
+            .r16g16b16a16_unorm => .r16g16b16a16_sfloat,
+            else => null,
+        };
+    }
+
+    // what a texture of format is actually created as on this device
+    fn deviceFormat(vc: *const VulkanContext, format: vk.Format) vk.Format {
+        const fallback = fallbackFormat(format) orelse return format;
+        const features = vc.instance.getPhysicalDeviceFormatProperties(vc.physical_device.handle, format).optimal_tiling_features;
+        return if (features.sampled_image_bit) format else fallback;
+    }
+
+    // commands must be in recording state
+    // stages bytes of format into image, widening them into device_format on the way if they differ
+    fn recordStageTexels(vc: *const VulkanContext, vk_allocator: *VkAllocator, commands: *Commands, image: vk.Image, bytes: []const u8, extent: vk.Extent2D, format: vk.Format, device_format: vk.Format, grey_alpha: bool, dst_queue_family_index: u32) !void {
+        if (format == device_format) return commands.recordStageDataToImage(vc, vk_allocator, image, bytes, extent, .shader_read_only_optimal, dst_queue_family_index);
+
+        const texel_count = extent.width * extent.height;
+        switch (format) {
+            // single channel is read as greyscale, so keep doing that
+            .r8_srgb => {
+                const region = try commands.staging.reserve([4]u8, vc, vk_allocator, texel_count);
+                for (region.data, bytes[0..texel_count]) |*dst, src| dst.* = .{ src, src, src, std.math.maxInt(u8) };
+                commands.recordUploadDataToImage(vc, image, region.buffer, region.offset, extent, .shader_read_only_optimal, dst_queue_family_index);
+            },
+            // what sampling r8g8 would give, with the swizzle it would have
+            .r8g8_srgb => {
+                const region = try commands.staging.reserve([4]u8, vc, vk_allocator, texel_count);
+                for (region.data, 0..) |*dst, i| dst.* = if (grey_alpha) .{ bytes[i * 2], bytes[i * 2], bytes[i * 2], bytes[i * 2 + 1] } else .{ bytes[i * 2], bytes[i * 2 + 1], 0, std.math.maxInt(u8) };
+                commands.recordUploadDataToImage(vc, image, region.buffer, region.offset, extent, .shader_read_only_optimal, dst_queue_family_index);
+            },
+            // same channels as half floats, which have a bit less precision but don't need to be widened further
+            .r16_unorm, .r16g16_unorm, .r16g16b16a16_unorm => {
+                const src: []align(1) const u16 = std.mem.bytesAsSlice(u16, bytes);
+                const region = try commands.staging.reserve(f16, vc, vk_allocator, src.len);
+                for (region.data, src) |*dst, value| dst.* = @floatCast(@as(f32, @floatFromInt(value)) / std.math.maxInt(u16));
+                commands.recordUploadDataToImage(vc, image, region.buffer, region.offset, extent, .shader_read_only_optimal, dst_queue_family_index);
+            },
+            else => unreachable, // no fallback
+        }
+    }
+
+    // commands must be in recording state, and wait for the submission of recordUploadRaws
+    // takes ownership of textures uploaded on another queue family for shader reads
+    pub fn recordAcquire(self: *const TextureManager, vc: *const VulkanContext, allocator: std.mem.Allocator, commands: *Commands, src_queue_family_index: u32, handles: []const Handle) !void {
+        const images = try allocator.alloc(vk.Image, handles.len);
+        defer allocator.free(images);
+
+        for (handles, images) |handle, *image| image.* = self.data.items(.handle)[handle];
+
+        try commands.recordAcquireImages(vc, allocator, images, src_queue_family_index, .transfer_dst_optimal, .shader_read_only_optimal, .{ .ray_tracing_shader_bit_khr = true }, .{ .shader_sampled_read_bit = true });
+    }
+
+    // creates image in a free slot and points its descriptor at it, leaving contents undefined
+    fn createTexture(self: *TextureManager, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, extent: vk.Extent2D, format: vk.Format, grey_alpha: bool, name: [:0]const u8) !Handle {
+        const reused_index = self.free_handles.popOrNull();
+        errdefer if (reused_index) |index| self.free_handles.appendAssumeCapacity(index);
+        const texture_index: Handle = reused_index orelse @intCast(self.data.len);
+        if (texture_index >= self.descriptor_capacity) try self.growDescriptors(vc, allocator, texture_index + 1);
+
+        const info = Info {
+            .extent = extent,
+            .format = format,
+            .grey_alpha = grey_alpha,
+        };
+        const image = try createImage(vc, vk_allocator, info, name);
+        errdefer image.destroy(vc);
+        if (reused_index) |index| {
+            self.data.set(index, image);
+            self.infos.items[index] = info;
+        } else {
+            try self.infos.ensureUnusedCapacity(allocator, 1);
+            try self.data.append(allocator, image);
+            self.infos.appendAssumeCapacity(info);
+        }
 
-        try commands.uploadDataToImage(vc, vk_allocator, image.handle, bytes, extent, .shader_read_only_optimal);
+        self.writeDescriptor(vc, texture_index, image.view);
 
+        return texture_index;
+    }
+
+    fn createImage(vc: *const VulkanContext, vk_allocator: *VkAllocator, info: Info, name: [:0]const u8) !Image {
+        var texture_memory = vk_allocator.withCategory(.texture);
+        return Image.createWithComponents(vc, &texture_memory, info.extent, .{ .transfer_src_bit = true, .transfer_dst_bit = true, .sampled_bit = true }, info.format, false, componentsFor(info.format, info.grey_alpha), name);
+    }
+
+    fn writeDescriptor(self: *const TextureManager, vc: *const VulkanContext, texture_index: Handle, view: vk.ImageView) void {
         vc.device.updateDescriptorSets(1, @ptrCast(&.{
             vk.WriteDescriptorSet {
                 .dst_set = self.descriptor_set,
-                .dst_binding = 0,
+                .dst_binding = 1,
                 .dst_array_element = texture_index,
                 .descriptor_count = 1,
                 .descriptor_type = .sampled_image,
                 .p_image_info = @ptrCast(&vk.DescriptorImageInfo {
                     .image_layout = .shader_read_only_optimal,
-                    .image_view = image.view,
+                    .image_view = view,
                     .sampler = .null_handle,
                 }),
                 .p_buffer_info = undefined,
                 .p_texel_buffer_view = undefined,
             },
         }), 0, null);
+    }
 
-        return texture_index;
+    // halves the resolution of the largest textures until at least bytes of memory
+    // is freed or none are left worth shrinking, returning how much was freed
+    //
+    // for when device memory is over budget -- materials keep their handles, they
+    // just see blurrier textures
+    //
+    // commands must be in recording state, with no pending work reading the
+    // texture descriptors, which are rewritten right away -- the old images
+    // are destroyed once the submission of commands is done
+    pub fn recordDownsampleToFree(self: *TextureManager, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, destruction_queue: *DestructionQueue, bytes: vk.DeviceSize) !vk.DeviceSize {
+        const scope = commands.beginScope(vc, "downsample textures");
+        defer commands.endScope(vc, scope);
+
+        var freed: vk.DeviceSize = 0;
+        while (freed < bytes) {
+            const texture_index = self.largestDownsampleable(vc) orelse break;
+            const old_image = self.data.get(texture_index);
+            const old_info = self.infos.items[texture_index];
+            const new_info = Info {
+                .extent = vk.Extent2D {
+                    .width = @max(old_info.extent.width / 2, 1),
+                    .height = @max(old_info.extent.height / 2, 1),
+                },
+                .format = old_info.format,
+                .grey_alpha = old_info.grey_alpha,
+            };
+
+            try destruction_queue.queue.ensureUnusedCapacity(allocator, 1);
+            const new_image = try createImage(vc, vk_allocator, new_info, "downsampled texture");
+            errdefer new_image.destroy(vc);
+
+            recordBlit(vc, commands.buffer, old_image.handle, old_info, new_image.handle, new_info);
+            destruction_queue.add(allocator, commands.pendingTicket(), old_image) catch unreachable; // capacity ensured above
+
+            self.data.set(texture_index, new_image);
+            self.infos.items[texture_index] = new_info;
+            self.writeDescriptor(vc, texture_index, new_image.view);
+
+            freed += old_image.allocation.size -| new_image.allocation.size;
+        }
+
+        return freed;
+    }
+
+    fn largestDownsampleable(self: *const TextureManager, vc: *const VulkanContext) ?Handle {
+        var largest: ?Handle = null;
+        var largest_size: vk.DeviceSize = 0;
+        for (self.data.items(.view), self.data.items(.allocation), self.infos.items, 0..) |view, allocation, info, texture_index| {
+            if (view == .null_handle) continue; // destroyed
+            if (@max(info.extent.width, info.extent.height) <= min_downsample_extent) continue;
+            if (allocation.size <= largest_size) continue;
+
+            const features = vc.instance.getPhysicalDeviceFormatProperties(vc.physical_device.handle, info.format).optimal_tiling_features;
+            if (!features.blit_src_bit or !features.blit_dst_bit) continue;
+
+            largest = @intCast(texture_index);
+            largest_size = allocation.size;
+        }
+        return largest;
+    }
+
+    // dst ends up ready for shader reads, src is left as a transfer source
+    fn recordBlit(vc: *const VulkanContext, command_buffer: vk.CommandBuffer, src: vk.Image, src_info: Info, dst: vk.Image, dst_info: Info) void {
+        const subresource_range = vk.ImageSubresourceRange {
+            .aspect_mask = .{ .color_bit = true },
+            .base_mip_level = 0,
+            .level_count = 1,
+            .base_array_layer = 0,
+            .layer_count = 1,
+        };
+        const subresource_layers = vk.ImageSubresourceLayers {
+            .aspect_mask = .{ .color_bit = true },
+            .mip_level = 0,
+            .base_array_layer = 0,
+            .layer_count = 1,
+        };
+
+        vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
+            .image_memory_barrier_count = 2,
+            .p_image_memory_barriers = &[2]vk.ImageMemoryBarrier2 {
+                .{
+                    // may have just been written by an earlier blit or upload
+                    .src_stage_mask = .{ .all_commands_bit = true },
+                    .src_access_mask = .{ .memory_write_bit = true },
+                    .dst_stage_mask = .{ .blit_bit = true },
+                    .dst_access_mask = .{ .transfer_read_bit = true },
+                    .old_layout = .shader_read_only_optimal,
+                    .new_layout = .transfer_src_optimal,
+                    .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                    .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                    .image = src,
+                    .subresource_range = subresource_range,
+                },
+                .{
+                    .dst_stage_mask = .{ .blit_bit = true },
+                    .dst_access_mask = .{ .transfer_write_bit = true },
+                    .old_layout = .undefined,
+                    .new_layout = .transfer_dst_optimal,
+                    .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                    .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                    .image = dst,
+                    .subresource_range = subresource_range,
+                },
+            },
+        });
+
+        const features = vc.instance.getPhysicalDeviceFormatProperties(vc.physical_device.handle, src_info.format).optimal_tiling_features;
+        vc.device.cmdBlitImage(command_buffer, src, .transfer_src_optimal, dst, .transfer_dst_optimal, 1, @ptrCast(&vk.ImageBlit {
+            .src_subresource = subresource_layers,
+            .src_offsets = .{
+                .{ .x = 0, .y = 0, .z = 0 },
+                .{ .x = @intCast(src_info.extent.width), .y = @intCast(src_info.extent.height), .z = 1 },
+            },
+            .dst_subresource = subresource_layers,
+            .dst_offsets = .{
+                .{ .x = 0, .y = 0, .z = 0 },
+                .{ .x = @intCast(dst_info.extent.width), .y = @intCast(dst_info.extent.height), .z = 1 },
+            },
+        }), if (features.sampled_image_filter_linear_bit) .linear else .nearest);
+
+        vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
+            .image_memory_barrier_count = 1,
+            .p_image_memory_barriers = @ptrCast(&vk.ImageMemoryBarrier2 {
+                .src_stage_mask = .{ .blit_bit = true },
+                .src_access_mask = .{ .transfer_write_bit = true },
+                .dst_stage_mask = .{ .ray_tracing_shader_bit_khr = true },
+                .dst_access_mask = .{ .shader_sampled_read_bit = true },
+                .old_layout = .transfer_dst_optimal,
+                .new_layout = .shader_read_only_optimal,
+                .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                .image = dst,
+                .subresource_range = subresource_range,
+            }),
+        });
+    }
+
+    // single channel textures are read as greyscale so they work as both scalars and colors,
+    // and grey-alpha ones likewise, but with their second channel as alpha
+    fn componentsFor(format: vk.Format, grey_alpha: bool) vk.ComponentMapping {
+        return switch (format) {
+            .r8_unorm, .r8_srgb, .r16_unorm, .r16_sfloat, .r32_sfloat => .{ .r = .r, .g = .r, .b = .r, .a = .one },
+            .r8g8_unorm, .r8g8_srgb, .r16g16_unorm, .r16g16_sfloat, .r32g32_sfloat => if (grey_alpha) .{ .r = .r, .g = .r, .b = .r, .a = .g } else .{ .r = .identity, .g = .identity, .b = .identity, .a = .identity },
+            else => .{ .r = .identity, .g = .identity, .b = .identity, .a = .identity },
+        };
+    }
+
+    // texture must no longer be referenced by any material
+    // its image is left to destruction_queue until the submission with ticket is done, so it
+    // may still be in use by that and before, and its descriptor is left dangling until the
+    // handle is reused, which partial binding allows
+    pub fn destroyTexture(self: *TextureManager, allocator: std.mem.Allocator, destruction_queue: *DestructionQueue, ticket: Commands.Ticket, handle: Handle) !void {
+        try self.free_handles.ensureUnusedCapacity(allocator, 1);
+        try destruction_queue.add(allocator, ticket, self.data.get(handle));
+        self.free_handles.appendAssumeCapacity(handle);
+        self.data.set(handle, Image {
+            .handle = .null_handle,
+            .view = .null_handle,
+            .allocation = .{},
+        });
     }
 
     pub fn destroy(self: *TextureManager, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
@@ -418,6 +854,11 @@ pub const TextureManager = struct {
             image.destroy(vc);
         }
         self.data.deinit(allocator);
+        self.infos.deinit(allocator);
+        self.free_handles.deinit(allocator);
+        for (self.retired_pools.items) |pool| vc.device.destroyDescriptorPool(pool, null);
+        self.retired_pools.deinit(allocator);
+        vc.device.destroyDescriptorPool(self.descriptor_pool, null);
         self.descriptor_layout.destroy(vc);
         vc.device.destroySampler(self.sampler, null);
     }
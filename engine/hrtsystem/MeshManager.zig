@@ -7,6 +7,7 @@ const core = engine.core;
 const VulkanContext = core.VulkanContext;
 const Commands = core.Commands;
 const VkAllocator = core.Allocator;
+const DestructionQueue = core.DestructionQueue;
 
 const vector = @import("../vector.zig");
 const U32x3 = vector.Vec3(u32);
@@ -29,11 +30,19 @@ pub const Mesh = struct {
         if (self.texcoords) |texcoords| allocator.free(texcoords);
         allocator.free(self.indices);
     }
+
+    // roughly how much device memory uploading it takes
+    pub fn byteSize(self: Mesh) usize {
+        var size = std.mem.sliceAsBytes(self.positions).len + std.mem.sliceAsBytes(self.indices).len;
+        if (self.normals) |normals| size += std.mem.sliceAsBytes(normals).len;
+        if (self.texcoords) |texcoords| size += std.mem.sliceAsBytes(texcoords).len;
+        return size;
+    }
 };
 
 // actual data we have per each mesh, CPU-side info
 // probably doesn't make sense to cache addresses?
-const Meshes = std.MultiArrayList(struct {
+const MeshData = struct {
     position_buffer: VkAllocator.DeviceBuffer(F32x3),
     texcoord_buffer: VkAllocator.DeviceBuffer(F32x2),
     normal_buffer: VkAllocator.DeviceBuffer(F32x3),
@@ -44,9 +53,20 @@ const Meshes = std.MultiArrayList(struct {
     index_count: u32,
 
     // data on host side -- atm only used for alias table construction for explicit samping
-    positions: []const F32x3,
+    positions: []F32x3,
     indices: []const U32x3,
-});
+
+    fn destroy(self: MeshData, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
+        self.position_buffer.destroy(vc);
+        self.texcoord_buffer.destroy(vc);
+        self.normal_buffer.destroy(vc);
+        self.index_buffer.destroy(vc);
+        allocator.free(self.positions);
+        allocator.free(self.indices);
+    }
+};
+
+const Meshes = std.MultiArrayList(MeshData);
 
 // store seperately to be able to get pointers to geometry data in shader
 const MeshAddresses = packed struct {
@@ -59,43 +79,201 @@ const MeshAddresses = packed struct {
 
 meshes: Meshes = .{},
 
-addresses_buffer: VkAllocator.DeviceBuffer(MeshAddresses) = .{},
+addresses_buffer: AddressesArray = .{},
 
-const Self = @This();
+const AddressesArray = core.DeviceArray(MeshAddresses, .{ .shader_device_address_bit = true, .storage_buffer_bit = true }, .mesh, "mesh addresses");
 
-const max_meshes = 4096; // TODO: resizable buffers
+const Self = @This();
 
 pub const Handle = u32;
 
 pub fn upload(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, host_mesh: Mesh) !Handle {
-    std.debug.assert(self.meshes.len < max_meshes);
-    
-    var position_staging_buffer = VkAllocator.HostBuffer(F32x3) {};
-    defer position_staging_buffer.destroy(vc);
-    var texcoord_staging_buffer = VkAllocator.HostBuffer(F32x2) {};
-    defer texcoord_staging_buffer.destroy(vc);
-    var normal_staging_buffer = VkAllocator.HostBuffer(F32x3) {};
-    defer normal_staging_buffer.destroy(vc);
-    var index_staging_buffer = VkAllocator.HostBuffer(U32x3) {};
-    defer index_staging_buffer.destroy(vc);
+    return self.uploadMany(vc, vk_allocator, allocator, commands, &.{ host_mesh });
+}
+
+// uploads all meshes with a single submit, returning handle of the first one --
+// the rest of the handles follow sequentially
+pub fn uploadMany(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, host_meshes: []const Mesh) !Handle {
+    const first_handle: Handle = @intCast(self.meshes.len);
+    if (host_meshes.len == 0) return first_handle;
+
+    try self.meshes.ensureUnusedCapacity(allocator, host_meshes.len);
+
+    errdefer {
+        // the transfer may have been submitted already, so can't free under it
+        transfer.wait(vc, transfer.last_ticket) catch {};
+        for (first_handle..self.meshes.len) |i| self.meshes.get(i).destroy(vc, allocator);
+        self.meshes.shrinkRetainingCapacity(first_handle);
+    }
 
     try commands.startRecording(vc);
-    const position_buffer = blk: {
-        position_staging_buffer = try vk_allocator.createHostBuffer(vc, F32x3, host_mesh.positions.len, .{ .transfer_src_bit = true });
-        @memcpy(position_staging_buffer.data, host_mesh.positions);
-        const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, F32x3, host_mesh.positions.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true });
-        commands.recordUploadBuffer(F32x3, vc, gpu_buffer, position_staging_buffer);
+    _ = try self.addresses_buffer.recordEnsureCapacity(vc, vk_allocator, allocator, commands, first_handle, @intCast(first_handle + host_meshes.len));
 
-        break :blk gpu_buffer;
-    };
+    const scope = commands.beginScope(vc, "upload meshes");
+    const addresses = try commands.staging.reserve(MeshAddresses, vc, vk_allocator, host_meshes.len);
+    for (host_meshes, addresses.data) |host_mesh, *mesh_addresses| {
+        self.meshes.appendAssumeCapacity(try recordUploadMesh(vc, vk_allocator, allocator, commands, host_mesh, mesh_addresses));
+    }
+
+    commands.recordCopyBuffer(vc, self.addresses_buffer.handle(), addresses.buffer, &.{
+        vk.BufferCopy {
+            .src_offset = addresses.offset,
+            .dst_offset = first_handle * @sizeOf(MeshAddresses),
+            .size = host_meshes.len * @sizeOf(MeshAddresses),
+        },
+    });
+    commands.endScope(vc, scope);
+    try commands.submitAndIdleUntilDone(vc);
+
+    return first_handle;
+}
+
+// like uploadMany, but uploads on transfer, and hands the meshes over to commands on the GPU
+// rather than waiting on the CPU, so that the upload may overlap with whatever commands is doing
+//
+// the next submission of commands is the first one that may use the meshes
+pub fn uploadManyWithTransfer(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, transfer: *Commands, commands: *Commands, host_meshes: []const Mesh) !Handle {
+    const first_handle: Handle = @intCast(self.meshes.len);
+    if (host_meshes.len == 0) return first_handle;
+
+    try self.meshes.ensureUnusedCapacity(allocator, host_meshes.len);
+
+    errdefer {
+        // the transfer may have been submitted already, so can't free under it
+        transfer.wait(vc, transfer.last_ticket) catch {};
+        for (first_handle..self.meshes.len) |i| self.meshes.get(i).destroy(vc, allocator);
+        self.meshes.shrinkRetainingCapacity(first_handle);
+    }
+
+    const addresses = try allocator.alloc(MeshAddresses, host_meshes.len);
+    defer allocator.free(addresses);
+
+    // position, texcoord, normal, index
+    const buffers = try allocator.alloc([4]vk.Buffer, host_meshes.len);
+    defer allocator.free(buffers);
+
+    try transfer.startRecording(vc);
+    const scope = transfer.beginScope(vc, "upload meshes");
+    for (host_meshes, addresses, buffers) |host_mesh, *mesh_addresses, *mesh_buffers| {
+        const mesh = try recordUploadMesh(vc, vk_allocator, allocator, transfer, host_mesh, mesh_addresses);
+        self.meshes.appendAssumeCapacity(mesh);
+        mesh_buffers.* = .{ mesh.position_buffer.handle, mesh.texcoord_buffer.handle, mesh.normal_buffer.handle, mesh.index_buffer.handle };
+    }
+    transfer.endScope(vc, scope);
+    const buffer_handles = std.mem.bytesAsSlice(vk.Buffer, std.mem.sliceAsBytes(buffers));
+    try transfer.recordReleaseBuffers(vc, allocator, buffer_handles, commands.queue_family_index);
+    const ticket = try transfer.submit(vc);
+
+    try commands.startRecording(vc);
+    try commands.waitForOther(transfer, ticket);
+    try commands.recordAcquireBuffers(vc, allocator, buffer_handles, transfer.queue_family_index, .{ .acceleration_structure_build_bit_khr = true, .ray_tracing_shader_bit_khr = true }, .{ .acceleration_structure_read_bit_khr = true, .shader_storage_read_bit = true });
+    _ = try self.addresses_buffer.recordEnsureCapacity(vc, vk_allocator, allocator, commands, first_handle, @intCast(first_handle + host_meshes.len));
+    try commands.recordStageBuffer(MeshAddresses, vc, vk_allocator, self.addresses_buffer.buffer, addresses, first_handle);
+    _ = try commands.submit(vc);
+
+    return first_handle;
+}
+
+// writes new positions into existing mesh, which must have the same vertex count
+// commands must be in recording state
+//
+// BLASes using this mesh must be refit afterwards
+pub fn recordUpdatePositions(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, commands: *Commands, handle: Handle, positions: []const F32x3) !void {
+    const mesh = self.meshes.get(handle);
+    std.debug.assert(positions.len == mesh.vertex_count);
+
+    @memcpy(mesh.positions, positions);
+    return recordUpdateAttribute(F32x3, vc, vk_allocator, commands, mesh.position_buffer, positions);
+}
+
+// writes new normals into existing mesh, which must have been created with normals
+// commands must be in recording state
+pub fn recordUpdateNormals(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator, commands: *Commands, handle: Handle, normals: []const F32x3) !void {
+    const mesh = self.meshes.get(handle);
+    std.debug.assert(normals.len == mesh.vertex_count);
+    if (mesh.normal_buffer.is_null()) return error.MeshHasNoNormals;
+
+    return recordUpdateAttribute(F32x3, vc, vk_allocator, commands, mesh.normal_buffer, normals);
+}
+
+fn recordUpdateAttribute(comptime T: type, vc: *const VulkanContext, vk_allocator: *VkAllocator, commands: *Commands, dst: VkAllocator.DeviceBuffer(T), src: []const T) !void {
+    try commands.recordStageBuffer(T, vc, vk_allocator, dst, src, 0);
+
+    // make visible to both acceleration structure builds and shaders
+    vc.device.cmdPipelineBarrier2(commands.buffer, &vk.DependencyInfo {
+        .buffer_memory_barrier_count = 1,
+        .p_buffer_memory_barriers = @ptrCast(&vk.BufferMemoryBarrier2 {
+            .src_stage_mask = .{ .copy_bit = true },
+            .src_access_mask = .{ .transfer_write_bit = true },
+            .dst_stage_mask = .{ .acceleration_structure_build_bit_khr = true, .ray_tracing_shader_bit_khr = true },
+            .dst_access_mask = .{ .acceleration_structure_read_bit_khr = true, .shader_storage_read_bit = true },
+            .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+            .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+            .buffer = dst.handle,
+            .offset = 0,
+            .size = vk.WHOLE_SIZE,
+        }),
+    });
+}
+
+// frees everything the mesh has, leaving its handle empty -- handles aren't reused
+//
+// mesh must not be in use by the GPU, nor by any BLAS
+pub fn destroyMesh(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator, handle: Handle) void {
+    self.meshes.get(handle).destroy(vc, allocator);
+    self.clearMesh(handle);
+}
+
+// like destroyMesh, but the mesh's buffers are left to destruction_queue until
+// the submission with ticket is done, so it may still be in use by that and before
+//
+// mesh must not be used by any BLAS
+pub fn destroyMeshAfter(self: *Self, allocator: std.mem.Allocator, destruction_queue: *DestructionQueue, ticket: Commands.Ticket, handle: Handle) !void {
+    const mesh = self.meshes.get(handle);
+
+    // position, texcoord, normal, index
+    try destruction_queue.queue.ensureUnusedCapacity(allocator, 4);
+    inline for (.{ mesh.position_buffer, mesh.texcoord_buffer, mesh.normal_buffer, mesh.index_buffer }) |buffer| {
+        if (!buffer.is_null()) destruction_queue.add(allocator, ticket, VkAllocator.OwnedDeviceBuffer {
+            .handle = buffer.handle,
+            .allocation = buffer.allocation,
+        }) catch unreachable; // capacity ensured above
+    }
+    allocator.free(mesh.positions);
+    allocator.free(mesh.indices);
+
+    self.clearMesh(handle);
+}
+
+fn clearMesh(self: *Self, handle: Handle) void {
+    self.meshes.set(handle, MeshData {
+        .position_buffer = .{},
+        .texcoord_buffer = .{},
+        .normal_buffer = .{},
+
+        .vertex_count = 0,
+
+        .index_buffer = .{},
+        .index_count = 0,
+
+        .positions = &[_]F32x3 {},
+        .indices = &[_]U32x3 {},
+    });
+}
+
+// records upload of host mesh into commands, staged through the commands' staging ring
+fn recordUploadMesh(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, host_mesh: Mesh, addresses: *MeshAddresses) !MeshData {
+    var mesh_memory = vk_allocator.withCategory(.mesh);
+
+    const position_buffer = try mesh_memory.createDeviceBuffer(vc, F32x3, host_mesh.positions.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true });
     errdefer position_buffer.destroy(vc);
+    try commands.recordStageBuffer(F32x3, vc, vk_allocator, position_buffer, host_mesh.positions, 0);
 
     const texcoord_buffer = blk: {
         if (host_mesh.texcoords) |texcoords| {
-            texcoord_staging_buffer = try vk_allocator.createHostBuffer(vc, F32x2, texcoords.len, .{ .transfer_src_bit = true });
-            @memcpy(texcoord_staging_buffer.data, texcoords);
-            const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, F32x2, texcoords.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
-            commands.recordUploadBuffer(F32x2, vc, gpu_buffer, texcoord_staging_buffer);
+            const gpu_buffer = try mesh_memory.createDeviceBuffer(vc, F32x2, texcoords.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
+            errdefer gpu_buffer.destroy(vc);
+            try commands.recordStageBuffer(F32x2, vc, vk_allocator, gpu_buffer, texcoords, 0);
             break :blk gpu_buffer;
         } else {
             break :blk VkAllocator.DeviceBuffer(F32x2) {};
@@ -105,10 +283,9 @@ pub fn upload(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator,
 
     const normal_buffer = blk: {
         if (host_mesh.normals) |normals| {
-            normal_staging_buffer = try vk_allocator.createHostBuffer(vc, F32x3, normals.len, .{ .transfer_src_bit = true });
-            @memcpy(normal_staging_buffer.data, normals);
-            const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, F32x3, normals.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
-            commands.recordUploadBuffer(F32x3, vc, gpu_buffer, normal_staging_buffer);
+            const gpu_buffer = try mesh_memory.createDeviceBuffer(vc, F32x3, normals.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
+            errdefer gpu_buffer.destroy(vc);
+            try commands.recordStageBuffer(F32x3, vc, vk_allocator, gpu_buffer, normals, 0);
             break :blk gpu_buffer;
         } else {
             break :blk VkAllocator.DeviceBuffer(F32x3) {};
@@ -116,17 +293,11 @@ pub fn upload(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator,
     };
     errdefer normal_buffer.destroy(vc);
 
-    const index_buffer = blk: {
-        index_staging_buffer = try vk_allocator.createHostBuffer(vc, U32x3, host_mesh.indices.len, .{ .transfer_src_bit = true });
-        @memcpy(index_staging_buffer.data, host_mesh.indices);
-        const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, U32x3, host_mesh.indices.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true });
-        commands.recordUploadBuffer(U32x3, vc, gpu_buffer, index_staging_buffer);
-
-        break :blk gpu_buffer;
-    };
+    const index_buffer = try mesh_memory.createDeviceBuffer(vc, U32x3, host_mesh.indices.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true });
     errdefer index_buffer.destroy(vc);
+    try commands.recordStageBuffer(U32x3, vc, vk_allocator, index_buffer, host_mesh.indices, 0);
 
-    const addresses = MeshAddresses {
+    addresses.* = MeshAddresses {
         .position_address = position_buffer.getAddress(vc),
         .texcoord_address = texcoord_buffer.getAddress(vc),
         .normal_address = normal_buffer.getAddress(vc) ,
@@ -134,11 +305,13 @@ pub fn upload(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator,
         .index_address = index_buffer.getAddress(vc),
     };
 
-    if (self.addresses_buffer.is_null()) self.addresses_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, MeshAddresses, max_meshes, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .storage_buffer_bit = true });
-    commands.recordUpdateBuffer(MeshAddresses, vc, self.addresses_buffer, &.{ addresses }, self.meshes.len);
-    try commands.submitAndIdleUntilDone(vc);
+    const positions = try allocator.dupe(F32x3, host_mesh.positions);
+    errdefer allocator.free(positions);
 
-    try self.meshes.append(allocator, .{
+    const indices = try allocator.dupe(U32x3, host_mesh.indices);
+    errdefer allocator.free(indices);
+
+    return MeshData {
         .position_buffer = position_buffer,
         .texcoord_buffer = texcoord_buffer,
         .normal_buffer = normal_buffer,
@@ -148,107 +321,31 @@ pub fn upload(self: *Self, vc: *const VulkanContext, vk_allocator: *VkAllocator,
         .index_buffer = index_buffer,
         .index_count = @intCast(host_mesh.indices.len),
 
-        .positions = try allocator.dupe(F32x3, host_mesh.positions),
-        .indices = try allocator.dupe(U32x3, host_mesh.indices),
-    });
-
-    return @intCast(self.meshes.len - 1);
+        .positions = positions,
+        .indices = indices,
+    };
 }
 
-// can't uploadMesh if you do this
 pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, host_meshes: []const Mesh) !Self {
     var meshes = Meshes {};
     try meshes.ensureTotalCapacity(allocator, host_meshes.len);
     errdefer meshes.deinit(allocator);
     
-    var addresses_buffer_host = try vk_allocator.createHostBuffer(vc, MeshAddresses, @intCast(host_meshes.len), .{ .transfer_src_bit = true });
-    defer addresses_buffer_host.destroy(vc);
-
-    var staging_buffers = std.ArrayList(VkAllocator.HostBuffer(u8)).init(allocator);
-    defer staging_buffers.deinit();
-    defer for (staging_buffers.items) |buffer| buffer.destroy(vc);
-
     if (host_meshes.len != 0) try commands.startRecording(vc);
 
-    for (host_meshes, addresses_buffer_host.data) |host_mesh, *addresses_buffer| {
-        const position_buffer = blk: {
-            const staging_buffer = try vk_allocator.createHostBuffer(vc, F32x3, host_mesh.positions.len, .{ .transfer_src_bit = true });
-            try staging_buffers.append(staging_buffer.toBytes());
-            @memcpy(staging_buffer.data, host_mesh.positions);
-            const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, F32x3, host_mesh.positions.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true });
-            commands.recordUploadBuffer(F32x3, vc, gpu_buffer, staging_buffer);
+    const addresses = try allocator.alloc(MeshAddresses, host_meshes.len);
+    defer allocator.free(addresses);
 
-            break :blk gpu_buffer;
-        };
-        errdefer position_buffer.destroy(vc);
-
-        const texcoord_buffer = blk: {
-            if (host_mesh.texcoords) |texcoords| {
-                const staging_buffer = try vk_allocator.createHostBuffer(vc, F32x2, texcoords.len, .{ .transfer_src_bit = true });
-                try staging_buffers.append(staging_buffer.toBytes());
-                @memcpy(staging_buffer.data, texcoords);
-                const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, F32x2, texcoords.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
-                commands.recordUploadBuffer(F32x2, vc, gpu_buffer, staging_buffer);
-                break :blk gpu_buffer;
-            } else {
-                break :blk VkAllocator.DeviceBuffer(F32x2) {};
-            }
-        };
-        errdefer texcoord_buffer.destroy(vc);
-
-        const normal_buffer = blk: {
-            if (host_mesh.normals) |normals| {
-                const staging_buffer = try vk_allocator.createHostBuffer(vc, F32x3, normals.len, .{ .transfer_src_bit = true });
-                try staging_buffers.append(staging_buffer.toBytes());
-                @memcpy(staging_buffer.data, normals);
-                const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, F32x3, normals.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true });
-                commands.recordUploadBuffer(F32x3, vc, gpu_buffer, staging_buffer);
-                break :blk gpu_buffer;
-            } else {
-                break :blk VkAllocator.DeviceBuffer(F32x3) {};
-            }
-        };
-        errdefer normal_buffer.destroy(vc);
-
-        const index_buffer = blk: {
-            const staging_buffer = try vk_allocator.createHostBuffer(vc, U32x3, host_mesh.indices.len, .{ .transfer_src_bit = true });
-            try staging_buffers.append(staging_buffer.toBytes());
-            @memcpy(staging_buffer.data, host_mesh.indices);
-            const gpu_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, U32x3, host_mesh.indices.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .acceleration_structure_build_input_read_only_bit_khr = true });
-            commands.recordUploadBuffer(U32x3, vc, gpu_buffer, staging_buffer);
-
-            break :blk gpu_buffer;
-        };
-        errdefer index_buffer.destroy(vc);
-
-        addresses_buffer.* = MeshAddresses {
-            .position_address = position_buffer.getAddress(vc),
-            .texcoord_address = texcoord_buffer.getAddress(vc),
-            .normal_address = normal_buffer.getAddress(vc) ,
-
-            .index_address = index_buffer.getAddress(vc),
-        };
-
-        meshes.appendAssumeCapacity(.{
-            .position_buffer = position_buffer,
-            .texcoord_buffer = texcoord_buffer,
-            .normal_buffer = normal_buffer,
-
-            .vertex_count = @intCast(host_mesh.positions.len),
-
-            .index_buffer = index_buffer,
-            .index_count = @intCast(host_mesh.indices.len),
-
-            .positions = try allocator.dupe(F32x3, host_mesh.positions),
-            .indices = try allocator.dupe(U32x3, host_mesh.indices),
-        });
+    for (host_meshes, addresses) |host_mesh, *mesh_addresses| {
+        meshes.appendAssumeCapacity(try recordUploadMesh(vc, vk_allocator, allocator, commands, host_mesh, mesh_addresses));
     }
 
-    const addresses_buffer = try vk_allocator.createDeviceBuffer(vc, allocator, MeshAddresses, addresses_buffer_host.data.len, .{ .shader_device_address_bit = true, .transfer_dst_bit = true, .storage_buffer_bit = true });
-    errdefer addresses_buffer.destroy(vc);
+    var addresses_buffer = AddressesArray {};
+    errdefer addresses_buffer.destroy(vc, allocator);
 
     if (host_meshes.len != 0) {
-        commands.recordUploadBuffer(MeshAddresses, vc, addresses_buffer, addresses_buffer_host);
+        _ = try addresses_buffer.recordEnsureCapacity(vc, vk_allocator, allocator, commands, 0, @intCast(host_meshes.len));
+        try commands.recordStageBuffer(MeshAddresses, vc, vk_allocator, addresses_buffer.buffer, addresses, 0);
         try commands.submitAndIdleUntilDone(vc);
     }
     
@@ -259,23 +356,8 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
 }
 
 pub fn destroy(self: *Self, vc: *const VulkanContext, allocator: std.mem.Allocator) void {
-    const slice = self.meshes.slice();
-    const position_buffers = slice.items(.position_buffer);
-    const texcoord_buffers = slice.items(.texcoord_buffer);
-    const normal_buffers = slice.items(.normal_buffer);
-    const index_buffers = slice.items(.index_buffer);
-    const positions = slice.items(.positions);
-    const indices = slice.items(.indices);
-
-    for (position_buffers, texcoord_buffers, normal_buffers, index_buffers, positions, indices) |position_buffer, texcoord_buffer, normal_buffer, index_buffer, position, index| {
-        position_buffer.destroy(vc);
-        texcoord_buffer.destroy(vc);
-        normal_buffer.destroy(vc);
-        index_buffer.destroy(vc);
-        allocator.free(position);
-        allocator.free(index);
-    }
+    for (0..self.meshes.len) |i| self.meshes.get(i).destroy(vc, allocator);
     self.meshes.deinit(allocator);
 
-    self.addresses_buffer.destroy(vc);
+    self.addresses_buffer.destroy(vc, allocator);
 }
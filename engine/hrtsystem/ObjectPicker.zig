@@ -47,9 +47,12 @@ pub const ClickedObject = struct {
 buffer: VkAllocator.HostBuffer(ClickDataShader),
 pipeline: Pipeline,
 
-command_pool: vk.CommandPool,
-command_buffer: vk.CommandBuffer,
-ready_fence: vk.Fence,
+// of the submission the latest pick is part of, until its result is taken
+pending: ?Commands.Ticket,
+
+pub const Pick = struct {
+    object: ?ClickedObject, // null if clicked background
+};
 
 pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands) !Self {
     const buffer = try vk_allocator.createHostBuffer(vc, ClickDataShader, 1, .{ .storage_buffer_bit = true });
@@ -58,78 +61,57 @@ pub fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: s
     var pipeline = try Pipeline.create(vc, vk_allocator, allocator, commands, {}, .{}, .{});
     errdefer pipeline.destroy(vc);
 
-    const command_pool = try vc.device.createCommandPool(&.{
-        .queue_family_index = vc.physical_device.queue_family_index,
-        .flags = .{ .transient_bit = true },
-    }, null);
-    errdefer vc.device.destroyCommandPool(command_pool, null);
-
-    var command_buffer: vk.CommandBuffer = undefined;
-    try vc.device.allocateCommandBuffers(&.{
-        .level = vk.CommandBufferLevel.primary,
-        .command_pool = command_pool,
-        .command_buffer_count = 1,
-    }, @ptrCast(&command_buffer));
-
-    const ready_fence = try vc.device.createFence(&.{
-        .flags = .{},
-    }, null);
-    errdefer vc.device.destroyFence(ready_fence, null);
-
     return Self {
         .buffer = buffer,
         .pipeline = pipeline,
-
-        .command_pool = command_pool,
-        .command_buffer = command_buffer,
-        .ready_fence = ready_fence,
+        .pending = null,
     };
 }
 
-pub fn getClickedObject(self: *Self, vc: *const VulkanContext, normalized_coords: F32x2, camera: Camera, accel: vk.AccelerationStructureKHR, sensor: Sensor) !?ClickedObject {
-    // begin
-    try vc.device.beginCommandBuffer(self.command_buffer, &.{ .flags = .{} });
-
+// command_buffer must be submitted with ticket, after which the pick can be taken
+// with `takePick` -- recording another pick before then replaces this one
+pub fn recordPick(self: *Self, vc: *const VulkanContext, command_buffer: vk.CommandBuffer, ticket: Commands.Ticket, normalized_coords: F32x2, camera: Camera, accel: vk.AccelerationStructureKHR, sensor: Sensor) void {
     // bind pipeline + sets
-    self.pipeline.recordBindPipeline(vc, self.command_buffer);
-    self.pipeline.recordPushDescriptors(vc, self.command_buffer, Pipeline.PushDescriptorData {
+    self.pipeline.recordBindPipeline(vc, command_buffer);
+    self.pipeline.recordPushDescriptors(vc, command_buffer, Pipeline.PushDescriptorData {
         .tlas = accel,
         .output_image = sensor.image.view,
         .click_data = self.buffer.handle,
     });
 
-    self.pipeline.recordPushConstants(vc, self.command_buffer, .{ .lens = camera.lenses.items[0], .click_position = normalized_coords });
+    self.pipeline.recordPushConstants(vc, command_buffer, .{ .lens = camera.lenses.items[0], .click_position = normalized_coords });
 
     // trace rays
-    self.pipeline.recordTraceRays(vc, self.command_buffer, vk.Extent2D { .width = 1, .height = 1 });
-
-    // end
-    try vc.device.endCommandBuffer(self.command_buffer);
-
-    const submit_info = vk.SubmitInfo2 {
-        .flags = .{},
-        .command_buffer_info_count = 1,
-        .p_command_buffer_infos = @ptrCast(&vk.CommandBufferSubmitInfo {
-            .command_buffer = self.command_buffer,
-            .device_mask = 0,
+    self.pipeline.recordTraceRays(vc, command_buffer, vk.Extent2D { .width = 1, .height = 1 });
+
+    // submission being done doesn't make writes visible to the host on its own
+    vc.device.cmdPipelineBarrier2(command_buffer, &vk.DependencyInfo {
+        .memory_barrier_count = 1,
+        .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+            .src_stage_mask = .{ .ray_tracing_shader_bit_khr = true },
+            .src_access_mask = .{ .shader_storage_write_bit = true },
+            .dst_stage_mask = .{ .host_bit = true },
+            .dst_access_mask = .{ .host_read_bit = true },
         }),
-        .wait_semaphore_info_count = 0,
-        .p_wait_semaphore_infos = undefined,
-        .signal_semaphore_info_count = 0,
-        .p_signal_semaphore_infos = undefined,
-    };
+    });
 
-    try vc.device.queueSubmit2(vc.queue, 1, @ptrCast(&submit_info), self.ready_fence);
-    _ = try vc.device.waitForFences(1, @ptrCast(&self.ready_fence), vk.TRUE, std.math.maxInt(u64));
-    try vc.device.resetFences(1, @ptrCast(&self.ready_fence));
-    try vc.device.resetCommandPool(self.command_pool, .{});
+    self.pending = ticket;
+}
+
+// null if there's no pick pending or it isn't done yet
+//
+// completed is the latest ticket done, as in Commands.completed
+pub fn takePick(self: *Self, completed: Commands.Ticket) ?Pick {
+    const ticket = self.pending orelse return null;
+    if (ticket > completed) return null;
+    self.pending = null;
 
-    return self.buffer.data[0].toClickedObject();
+    return Pick {
+        .object = self.buffer.data[0].toClickedObject(),
+    };
 }
 
 pub fn destroy(self: *Self, vc: *const VulkanContext) void {
     self.buffer.destroy(vc);
     self.pipeline.destroy(vc);
-    vc.device.destroyCommandPool(self.command_pool, null);
-    vc.device.destroyFence(self.ready_fence, null);
 }
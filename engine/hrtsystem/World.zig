@@ -22,6 +22,7 @@ const MeshManager = engine.hrtsystem.MeshManager;
 const Accel = engine.hrtsystem.Accel;
 
 const vector = engine.vector;
+const tracing = engine.tracing;
 const Mat3x4 = vector.Mat3x4(f32);
 const F32x4 = vector.Vec4(f32);
 const F32x3 = vector.Vec3(f32);
@@ -229,8 +230,10 @@ fn gltfMaterialToMaterial(vc: *const VulkanContext, vk_allocator: *VkAllocator,
 
 // glTF doesn't correspond very well to the internal data structures here so this is very inefficient
 // also very inefficient because it's written very inefficiently, can remove a lot of copying, but that's a problem for another time
-// inspection bool specifies whether some buffers should be created with the `transfer_src_flag` for inspection
-pub fn fromGlb(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, gltf: Gltf, inspection: bool) !Self {
+pub fn fromGlb(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, commands: *Commands, gltf: Gltf) !Self {
+    const span = tracing.begin("load glb world");
+    defer span.end();
+
     var materials = blk: {
         var material_list = std.ArrayListUnmanaged(MaterialManager.MaterialInfo) {};
         defer material_list.deinit(allocator);
@@ -351,7 +354,7 @@ pub fn fromGlb(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator:
     var meshes = try MeshManager.create(vc, vk_allocator, allocator, commands, objects.items);
     errdefer meshes.destroy(vc, allocator);
 
-    var accel = try Accel.create(vc, vk_allocator, allocator, commands, meshes, instances.items, inspection);
+    var accel = try Accel.create(vc, vk_allocator, allocator, commands, meshes, instances.items);
     errdefer accel.destroy(vc, allocator);
 
     return Self {
@@ -1,5 +1,42 @@
 const std = @import("std");
 
+const parallel = @import("../parallel.zig");
+
+// below this, not worth spreading over threads
+const min_parallel_chunk = 16 * 1024;
+
+// summed in fixed blocks rather than per-thread chunks so that the result
+// doesn't depend on how many threads there are
+const sum_block_size = 4 * 1024;
+
+fn sumWeights(allocator: std.mem.Allocator, weights: []const f32) std.mem.Allocator.Error!f32 {
+    const block_sums = try allocator.alloc(f32, std.math.divCeil(usize, weights.len, sum_block_size) catch unreachable);
+    defer allocator.free(block_sums);
+
+    const Blocks = struct {
+        weights: []const f32,
+        sums: []f32,
+
+        fn run(self: *const @This(), start: usize, end: usize) void {
+            for (self.sums[start..end], start..) |*block_sum, block| {
+                block_sum.* = 0.0;
+                for (self.weights[block * sum_block_size..@min((block + 1) * sum_block_size, self.weights.len)]) |weight| {
+                    block_sum.* += weight;
+                }
+            }
+        }
+    };
+    parallel.forChunks(block_sums.len, min_parallel_chunk / sum_block_size, &Blocks {
+        .weights = weights,
+        .sums = block_sums,
+    }, Blocks.run);
+
+    var weight_sum: f32 = 0.0;
+    for (block_sums) |block_sum| {
+        weight_sum += block_sum;
+    }
+    return weight_sum;
+}
 
 fn Entry(comptime Data: type) type {
     return extern struct {
@@ -22,26 +59,42 @@ pub fn AliasTable(comptime Data: type) type {
         // Vose's Method
         // weights may not be normalized
         // O(n) where n = raw_weights.len
+        //
+        // summing and scaling weights is spread across threads, pairing
+        // up small and large entries is a single sequential pass
         pub fn create(allocator: std.mem.Allocator, raw_weights: []const f32, datas: []const Data) std.mem.Allocator.Error!Self {
             std.debug.assert(raw_weights.len == datas.len);
 
             const entries = try allocator.alloc(TableEntry, raw_weights.len);
             errdefer allocator.free(entries);
 
-            var weight_sum: f32 = 0.0;
-            for (raw_weights) |weight| {
-                weight_sum += weight;
-            }
+            const weight_sum = try sumWeights(allocator, raw_weights);
+
+            const Scale = struct {
+                weights: []const f32,
+                datas: []const Data,
+                entries: []TableEntry,
+                scale: f32,
+
+                fn run(self: *const @This(), start: usize, end: usize) void {
+                    for (self.weights[start..end], self.datas[start..end], self.entries[start..end]) |weight, data, *entry| {
+                        entry.data = data;
+                        entry.select = weight * self.scale;
+                    }
+                }
+            };
+            parallel.forChunks(entries.len, min_parallel_chunk, &Scale {
+                .weights = raw_weights,
+                .datas = datas,
+                .entries = entries,
+                .scale = if (weight_sum == 0.0) 0.0 else @as(f32, @floatFromInt(entries.len)) / weight_sum,
+            }, Scale.run);
 
             var less_head: u32 = std.math.maxInt(u32);
             var more_head: u32 = std.math.maxInt(u32);
 
-            const n: u32 = @intCast(raw_weights.len);
-            for (raw_weights, entries, datas, 0..) |weight, *entry, data, i| {
-                entry.data = data;
-
-                const adjusted_weight = (weight * @as(f32, @floatFromInt(n))) / weight_sum;
-                entry.select = adjusted_weight;
+            for (entries, 0..) |*entry, i| {
+                const adjusted_weight = entry.select;
                 if (adjusted_weight < 1.0) {
                     entry.alias = less_head;
                     less_head = @intCast(i);
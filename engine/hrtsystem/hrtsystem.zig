@@ -7,6 +7,8 @@ pub const ObjectPicker = @import("ObjectPicker.zig");
 pub const pipeline = @import("pipeline.zig");
 pub const World = @import("World.zig");
 pub const Scene = @import("Scene.zig");
+pub const alias_table = @import("alias_table.zig");
+pub const light_tree = @import("light_tree.zig");
 
 const vk = @import("vulkan");
 pub const required_device_extensions = [_][*:0]const u8{
@@ -0,0 +1,436 @@
+// bounding volume hierarchy over emissive triangles, each node bounding the
+// positions, emission directions and power of the triangles below it, so that
+// the shader can pick triangles likely to matter at a point rather than just
+// big ones
+//
+// https://pbr-book.org/4ed/Light_Sources/Light_Sampling#BVHLightSampling
+//
+// emission isn't known here, so power is just area, same as the alias table,
+// and lights only emit from their front face, so the emission cone is always
+// a hemisphere around each normal and isn't stored
+
+const std = @import("std");
+
+const parallel = @import("../parallel.zig");
+const vector = @import("../vector.zig");
+const F32x3 = vector.Vec3(f32);
+
+// what the tree needs to know about each triangle, in world space
+pub const Triangle = struct {
+    min: F32x3,
+    max: F32x3,
+    normal: F32x3, // of front face, zero if degenerate
+};
+
+// same required by shader
+pub const Node = extern struct {
+    min: F32x3,
+    power: f32,
+    max: F32x3,
+    cos_theta_o: f32, // of cone around axis bounding normals
+    axis: F32x3,
+    link: Link,
+};
+
+// the first child of a node is right after it, so only the second is linked
+pub const Link = packed struct(u32) {
+    index: u31, // of triangle if leaf, otherwise of second child
+    leaf: bool,
+};
+
+// a trail has one bit per level, so the tree can be no deeper than this
+const max_depth = 32;
+
+// split candidates per axis
+const bucket_count = 12;
+
+// subtrees smaller than this aren't worth handing to another thread
+pub const min_parallel_subtree = 16 * 1024;
+
+const LightBounds = struct {
+    min: F32x3,
+    max: F32x3,
+    axis: F32x3,
+    cos_theta_o: f32,
+    power: f32,
+
+    const empty = LightBounds {
+        .min = F32x3.new(std.math.inf(f32), std.math.inf(f32), std.math.inf(f32)),
+        .max = F32x3.new(-std.math.inf(f32), -std.math.inf(f32), -std.math.inf(f32)),
+        .axis = F32x3.e_2,
+        .cos_theta_o = 1.0,
+        .power = 0.0,
+    };
+
+    fn fromTriangle(triangle: Triangle, power: f32) LightBounds {
+        const degenerate = triangle.normal.dot(triangle.normal) == 0.0;
+        return LightBounds {
+            .min = triangle.min,
+            .max = triangle.max,
+            .axis = if (degenerate) F32x3.e_2 else triangle.normal,
+            .cos_theta_o = if (degenerate) -1.0 else 1.0,
+            .power = power,
+        };
+    }
+
+    // bounds without power can't be sampled, so don't let them grow anything
+    fn merged(self: LightBounds, other: LightBounds) LightBounds {
+        if (self.power == 0.0) return other;
+        if (other.power == 0.0) return self;
+
+        const cone = mergeCones(self.axis, self.cos_theta_o, other.axis, other.cos_theta_o);
+        return LightBounds {
+            .min = F32x3.new(@min(self.min.x, other.min.x), @min(self.min.y, other.min.y), @min(self.min.z, other.min.z)),
+            .max = F32x3.new(@max(self.max.x, other.max.x), @max(self.max.y, other.max.y), @max(self.max.z, other.max.z)),
+            .axis = cone.axis,
+            .cos_theta_o = cone.cos_theta_o,
+            .power = self.power + other.power,
+        };
+    }
+
+    // back from what node made of it, which is the same as far as merging goes
+    fn fromNode(n: Node) LightBounds {
+        return LightBounds {
+            .min = n.min,
+            .max = n.max,
+            .axis = n.axis,
+            .cos_theta_o = n.cos_theta_o,
+            .power = n.power,
+        };
+    }
+
+    fn node(self: LightBounds, link: Link) Node {
+        return Node {
+            .min = if (self.power == 0.0) F32x3.new(0, 0, 0) else self.min,
+            .power = self.power,
+            .max = if (self.power == 0.0) F32x3.new(0, 0, 0) else self.max,
+            .cos_theta_o = self.cos_theta_o,
+            .axis = self.axis,
+            .link = link,
+        };
+    }
+
+    // surface area orientation heuristic, extent being that of the node being split
+    fn cost(self: LightBounds, extent: F32x3, axis: usize) f32 {
+        if (self.power == 0.0) return 0.0;
+
+        const theta_o = std.math.acos(self.cos_theta_o);
+        const theta_w = @min(theta_o + std.math.pi / 2.0, std.math.pi);
+        const sin_theta_o = @sqrt(@max(1.0 - self.cos_theta_o * self.cos_theta_o, 0.0));
+        const m_omega = 2.0 * std.math.pi * (1.0 - self.cos_theta_o) + std.math.pi / 2.0 * (2.0 * theta_w * sin_theta_o - @cos(theta_o - 2.0 * theta_w) - 2.0 * theta_o * sin_theta_o + self.cos_theta_o);
+
+        // penalize thin slabs
+        const kr = @max(extent.x, extent.y, extent.z) / component(extent, axis);
+
+        const size = self.max.sub(self.min);
+        const surface_area = 2.0 * (size.x * size.y + size.y * size.z + size.z * size.x);
+
+        return self.power * m_omega * kr * surface_area;
+    }
+};
+
+fn component(v: F32x3, axis: usize) f32 {
+    return switch (axis) {
+        0 => v.x,
+        1 => v.y,
+        2 => v.z,
+        else => unreachable,
+    };
+}
+
+const Cone = struct {
+    axis: F32x3,
+    cos_theta_o: f32,
+};
+
+// smallest cone containing both
+fn mergeCones(axis_a: F32x3, cos_theta_a: f32, axis_b: F32x3, cos_theta_b: f32) Cone {
+    const theta_a = std.math.acos(std.math.clamp(cos_theta_a, -1.0, 1.0));
+    const theta_b = std.math.acos(std.math.clamp(cos_theta_b, -1.0, 1.0));
+    const theta_d = std.math.acos(std.math.clamp(axis_a.dot(axis_b), -1.0, 1.0));
+
+    if (@min(theta_d + theta_b, std.math.pi) <= theta_a) return Cone { .axis = axis_a, .cos_theta_o = cos_theta_a };
+    if (@min(theta_d + theta_a, std.math.pi) <= theta_b) return Cone { .axis = axis_b, .cos_theta_o = cos_theta_b };
+
+    const entire_sphere = Cone { .axis = axis_a, .cos_theta_o = -1.0 };
+
+    const theta_o = (theta_a + theta_d + theta_b) / 2.0;
+    if (theta_o >= std.math.pi) return entire_sphere;
+
+    // rotate a's axis towards b's until its cone touches both
+    const rotation_axis = axis_a.cross(axis_b);
+    const rotation_axis_length = rotation_axis.length();
+    if (rotation_axis_length == 0.0) return entire_sphere;
+    const theta_r = theta_o - theta_a;
+    const axis = axis_a.mul_scalar(@cos(theta_r)).add(rotation_axis.div_scalar(rotation_axis_length).cross(axis_a).mul_scalar(@sin(theta_r)));
+
+    return Cone { .axis = axis.unit(), .cos_theta_o = @cos(theta_o) };
+}
+
+const Primitive = struct {
+    bounds: LightBounds,
+    centroid: F32x3,
+    index: u31, // of triangle
+};
+
+const Builder = struct {
+    nodes: []Node,
+    trails: []u32,
+    node_count: u32 = 0,
+
+    // appends nodes for primitives in depth-first order, returning their bounds
+    fn build(self: *Builder, primitives: []Primitive, depth: u32, trail: u32) LightBounds {
+        const node_index = self.node_count;
+        self.node_count += 1;
+
+        if (primitives.len == 1) {
+            const primitive = primitives[0];
+            self.nodes[node_index] = primitive.bounds.node(.{ .index = primitive.index, .leaf = true });
+            self.trails[primitive.index] = trail;
+            return primitive.bounds;
+        }
+
+        const split = partition(primitives, depth);
+        const first = self.build(primitives[0..split], depth + 1, trail);
+        const second_index = self.node_count;
+        const second = self.build(primitives[split..], depth + 1, trail | (@as(u32, 1) << @intCast(depth)));
+
+        const bounds = first.merged(second);
+        self.nodes[node_index] = bounds.node(.{ .index = @intCast(second_index), .leaf = false });
+        return bounds;
+    }
+};
+
+// the same tree as Builder, but with the levels above subtrees of about
+// subtree_size primitives split on this thread, and the subtrees themselves
+// built on others
+//
+// nodes are depth first with a node's first child right after it, so where each
+// subtree goes is known from how many primitives are in what comes before it
+const ParallelBuilder = struct {
+    nodes: []Node,
+    trails: []u32,
+    subtree_size: usize,
+    subtrees: std.ArrayListUnmanaged(Subtree) = .{},
+    inner: std.ArrayListUnmanaged(Inner) = .{}, // above the subtrees, depth first
+
+    const Subtree = struct {
+        primitives: []Primitive,
+        depth: u32,
+        trail: u32,
+        node_index: u32,
+    };
+
+    const Inner = struct {
+        node_index: u32,
+        second_index: u32,
+    };
+
+    fn build(self: *ParallelBuilder, allocator: std.mem.Allocator, primitives: []Primitive) std.mem.Allocator.Error!void {
+        try self.splitTop(allocator, primitives, 0, 0, 0);
+
+        parallel.forChunks(self.subtrees.items.len, 1, @as(*const ParallelBuilder, self), buildSubtrees);
+
+        // children come after their parents, so going backwards they're always done first
+        var i = self.inner.items.len;
+        while (i > 0) {
+            i -= 1;
+            const inner = self.inner.items[i];
+            const first = LightBounds.fromNode(self.nodes[inner.node_index + 1]);
+            const second = LightBounds.fromNode(self.nodes[inner.second_index]);
+            self.nodes[inner.node_index] = first.merged(second).node(.{ .index = @intCast(inner.second_index), .leaf = false });
+        }
+    }
+
+    fn splitTop(self: *ParallelBuilder, allocator: std.mem.Allocator, primitives: []Primitive, depth: u32, trail: u32, node_index: u32) std.mem.Allocator.Error!void {
+        if (primitives.len <= self.subtree_size) {
+            return self.subtrees.append(allocator, .{
+                .primitives = primitives,
+                .depth = depth,
+                .trail = trail,
+                .node_index = node_index,
+            });
+        }
+
+        const split = partition(primitives, depth);
+        // after this node and the 2 * split - 1 of the first child
+        const second_index: u32 = node_index + @as(u32, @intCast(2 * split));
+        try self.inner.append(allocator, .{
+            .node_index = node_index,
+            .second_index = second_index,
+        });
+        try self.splitTop(allocator, primitives[0..split], depth + 1, trail, node_index + 1);
+        try self.splitTop(allocator, primitives[split..], depth + 1, trail | (@as(u32, 1) << @intCast(depth)), second_index);
+    }
+
+    fn buildSubtrees(self: *const ParallelBuilder, start: usize, end: usize) void {
+        for (self.subtrees.items[start..end]) |subtree| {
+            var builder = Builder {
+                .nodes = self.nodes,
+                .trails = self.trails,
+                .node_count = subtree.node_index,
+            };
+            _ = builder.build(subtree.primitives, subtree.depth, subtree.trail);
+        }
+    }
+
+    fn deinit(self: *ParallelBuilder, allocator: std.mem.Allocator) void {
+        self.subtrees.deinit(allocator);
+        self.inner.deinit(allocator);
+    }
+};
+
+fn fitsDepth(depth: u32, count: usize) bool {
+    return depth + std.math.log2_int_ceil(usize, count) <= max_depth;
+}
+
+// reorders primitives so that the first returned many go in the first child
+//
+// bucketed surface area orientation heuristic, falling back to a median split
+// if it can't separate them or would make the tree too deep
+fn partition(primitives: []Primitive, depth: u32) usize {
+    var centroid_min = F32x3.new(std.math.inf(f32), std.math.inf(f32), std.math.inf(f32));
+    var centroid_max = F32x3.new(-std.math.inf(f32), -std.math.inf(f32), -std.math.inf(f32));
+    var extent_min = centroid_min;
+    var extent_max = centroid_max;
+    for (primitives) |primitive| {
+        const c = primitive.centroid;
+        centroid_min = F32x3.new(@min(centroid_min.x, c.x), @min(centroid_min.y, c.y), @min(centroid_min.z, c.z));
+        centroid_max = F32x3.new(@max(centroid_max.x, c.x), @max(centroid_max.y, c.y), @max(centroid_max.z, c.z));
+        const b = primitive.bounds;
+        extent_min = F32x3.new(@min(extent_min.x, b.min.x), @min(extent_min.y, b.min.y), @min(extent_min.z, b.min.z));
+        extent_max = F32x3.new(@max(extent_max.x, b.max.x), @max(extent_max.y, b.max.y), @max(extent_max.z, b.max.z));
+    }
+    const extent = extent_max.sub(extent_min);
+    const centroid_extent = centroid_max.sub(centroid_min);
+
+    var best_cost = std.math.inf(f32);
+    var best_axis: usize = 0;
+    var best_bucket: usize = 0;
+    for (0..3) |axis| {
+        if (!(component(centroid_extent, axis) > 0.0)) continue;
+
+        var buckets = [_]LightBounds { LightBounds.empty } ** bucket_count;
+        for (primitives) |primitive| {
+            const bucket = &buckets[bucketOf(primitive, centroid_min, centroid_extent, axis)];
+            bucket.* = bucket.merged(primitive.bounds);
+        }
+
+        var above: [bucket_count - 1]LightBounds = undefined;
+        var accumulated = LightBounds.empty;
+        var i: usize = bucket_count - 1;
+        while (i > 0) : (i -= 1) {
+            accumulated = accumulated.merged(buckets[i]);
+            above[i - 1] = accumulated;
+        }
+
+        var below = LightBounds.empty;
+        for (buckets[0..bucket_count - 1], above, 0..) |bucket, bucket_above, split| {
+            below = below.merged(bucket);
+            const cost = below.cost(extent, axis) + bucket_above.cost(extent, axis);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_bucket = split;
+            }
+        }
+    }
+
+    if (best_cost != std.math.inf(f32)) {
+        var split: usize = 0;
+        for (primitives, 0..) |primitive, i| {
+            if (bucketOf(primitive, centroid_min, centroid_extent, best_axis) <= best_bucket) {
+                std.mem.swap(Primitive, &primitives[split], &primitives[i]);
+                split += 1;
+            }
+        }
+        if (split != 0 and split != primitives.len and fitsDepth(depth + 1, @max(split, primitives.len - split))) return split;
+    }
+
+    // median along the axis centroids are most spread out along
+    const axis: usize = if (centroid_extent.x >= centroid_extent.y and centroid_extent.x >= centroid_extent.z) 0 else if (centroid_extent.y >= centroid_extent.z) 1 else 2;
+    std.sort.pdq(Primitive, primitives, axis, struct {
+        fn lessThan(sort_axis: usize, a: Primitive, b: Primitive) bool {
+            return component(a.centroid, sort_axis) < component(b.centroid, sort_axis);
+        }
+    }.lessThan);
+    return primitives.len / 2;
+}
+
+fn bucketOf(primitive: Primitive, centroid_min: F32x3, centroid_extent: F32x3, axis: usize) usize {
+    const offset = (component(primitive.centroid, axis) - component(centroid_min, axis)) / component(centroid_extent, axis);
+    return @min(@as(usize, @intFromFloat(offset * bucket_count)), bucket_count - 1);
+}
+
+pub const LightTree = struct {
+    nodes: []Node, // depth first, root first
+    trails: []u32, // for each triangle, which child leads to it at each level, lowest bit first
+
+    // always has at least one node, with zero power if there are no triangles
+    //
+    // O(n log n) where n = triangles.len, with all but the top levels spread over threads
+    pub fn create(allocator: std.mem.Allocator, triangles: []const Triangle, powers: []const f32) std.mem.Allocator.Error!LightTree {
+        return createWithMinSubtree(allocator, triangles, powers, min_parallel_subtree);
+    }
+
+    // same tree as create, but only handing subtrees of at least min_subtree
+    // triangles to other threads, so maxInt(usize) builds it all on this one
+    pub fn createWithMinSubtree(allocator: std.mem.Allocator, triangles: []const Triangle, powers: []const f32, min_subtree: usize) std.mem.Allocator.Error!LightTree {
+        std.debug.assert(triangles.len == powers.len);
+        std.debug.assert(triangles.len <= std.math.maxInt(u31));
+
+        const nodes = try allocator.alloc(Node, @max(2 * triangles.len, 2) - 1);
+        errdefer allocator.free(nodes);
+
+        const trails = try allocator.alloc(u32, triangles.len);
+        errdefer allocator.free(trails);
+
+        if (triangles.len == 0) {
+            nodes[0] = LightBounds.empty.node(.{ .index = 0, .leaf = true });
+            return LightTree {
+                .nodes = nodes,
+                .trails = trails,
+            };
+        }
+
+        const primitives = try allocator.alloc(Primitive, triangles.len);
+        defer allocator.free(primitives);
+        for (primitives, triangles, powers, 0..) |*primitive, triangle, power, i| {
+            primitive.* = .{
+                .bounds = LightBounds.fromTriangle(triangle, power),
+                .centroid = triangle.min.add(triangle.max).mul_scalar(0.5),
+                .index = @intCast(i),
+            };
+        }
+
+        // a few subtrees per thread, as they come out of the split uneven
+        const cpu_count = std.Thread.getCpuCount() catch 1;
+        const subtree_size = @max(min_subtree, triangles.len / (4 * cpu_count));
+        if (triangles.len / 2 < subtree_size) {
+            var builder = Builder {
+                .nodes = nodes,
+                .trails = trails,
+            };
+            _ = builder.build(primitives, 0, 0);
+            std.debug.assert(builder.node_count == nodes.len);
+        } else {
+            var builder = ParallelBuilder {
+                .nodes = nodes,
+                .trails = trails,
+                .subtree_size = subtree_size,
+            };
+            defer builder.deinit(allocator);
+            try builder.build(allocator, primitives);
+        }
+
+        return LightTree {
+            .nodes = nodes,
+            .trails = trails,
+        };
+    }
+
+    pub fn destroy(self: LightTree, allocator: std.mem.Allocator) void {
+        allocator.free(self.nodes);
+        allocator.free(self.trails);
+    }
+};
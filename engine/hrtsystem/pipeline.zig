@@ -160,11 +160,11 @@ pub fn Pipeline(
                 .base_pipeline_index = -1,
             };
             var handle: vk.Pipeline = undefined;
-            _ = try vc.device.createRayTracingPipelinesKHR(.null_handle, .null_handle, 1, @ptrCast(&create_info), null, @ptrCast(&handle));
+            _ = try vc.device.createRayTracingPipelinesKHR(.null_handle, vc.pipeline_cache.handle, 1, @ptrCast(&create_info), null, @ptrCast(&handle));
             errdefer vc.device.destroyPipeline(handle, null);
 
             const shader_info = comptime ShaderInfo.find(stages);
-            const sbt = try ShaderBindingTable.create(vc, vk_allocator, allocator, handle, cmd, shader_info.raygen_count, shader_info.miss_count, shader_info.hit_count, shader_info.callable_count);
+            const sbt = try ShaderBindingTable.create(vc, vk_allocator, handle, cmd, shader_info.raygen_count, shader_info.miss_count, shader_info.hit_count, shader_info.callable_count);
             errdefer sbt.destroy(vc);
 
             return Self {
@@ -234,7 +234,7 @@ pub fn Pipeline(
                 .base_pipeline_index = -1,
             };
             const old_handle = self.handle;
-            _ = try vc.device.createRayTracingPipelinesKHR(.null_handle, .null_handle, 1, @ptrCast(&create_info), null, @ptrCast(&self.handle));
+            _ = try vc.device.createRayTracingPipelinesKHR(.null_handle, vc.pipeline_cache.handle, 1, @ptrCast(&create_info), null, @ptrCast(&self.handle));
             errdefer vc.device.destroyPipeline(self.handle, null);
 
             try self.sbt.recreate(vc, vk_allocator, self.handle, cmd);
@@ -324,6 +324,7 @@ pub const StandardPipeline = Pipeline(
         flip_image: bool align(@alignOf(vk.Bool32)) = true,
         indexed_attributes: bool align(@alignOf(vk.Bool32)) = true,
         two_component_normal_texture: bool align(@alignOf(vk.Bool32)) = true,
+        mesh_light_tree: bool align(@alignOf(vk.Bool32)) = true, // whether emissive meshes are sampled with the light tree rather than the alias table
     },
     extern struct {
         lens: Camera.Lens,
@@ -359,6 +360,20 @@ pub const StandardPipeline = Pipeline(
             .stage_flags = .{ .raygen_bit_khr = true },
             .binding_flags = .{ .partially_bound_bit = true },
         },
+        .{
+            .name = "emitter_light_tree",
+            .descriptor_type = .storage_buffer,
+            .descriptor_count = 1,
+            .stage_flags = .{ .raygen_bit_khr = true },
+            .binding_flags = .{ .partially_bound_bit = true },
+        },
+        .{
+            .name = "emitter_light_tree_lookup",
+            .descriptor_type = .storage_buffer,
+            .descriptor_count = 1,
+            .stage_flags = .{ .raygen_bit_khr = true },
+            .binding_flags = .{ .partially_bound_bit = true },
+        },
         .{
             .name = "meshes",
             .descriptor_type = .storage_buffer,
@@ -454,7 +469,7 @@ const ShaderBindingTable = struct {
 
     handle_size_aligned: u32,
 
-    fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, allocator: std.mem.Allocator, pipeline: vk.Pipeline, cmd: *Commands, raygen_entry_count: u32, miss_entry_count: u32, hit_entry_count: u32, callable_entry_count: u32) !ShaderBindingTable {
+    fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, pipeline: vk.Pipeline, cmd: *Commands, raygen_entry_count: u32, miss_entry_count: u32, hit_entry_count: u32, callable_entry_count: u32) !ShaderBindingTable {
         const rt_properties = blk: {
             var rt_properties: vk.PhysicalDeviceRayTracingPipelinePropertiesKHR = undefined;
             rt_properties.s_type = .physical_device_ray_tracing_pipeline_properties_khr;
@@ -479,9 +494,10 @@ const ShaderBindingTable = struct {
         const callable_index = std.mem.alignForward(u32, hit_index + hit_entry_count * handle_size_aligned, rt_properties.shader_group_base_alignment);
         const sbt_size = callable_index + callable_entry_count * handle_size_aligned;
 
+        try cmd.startRecording(vc);
+
         // query sbt from pipeline
-        const sbt = try vk_allocator.createHostBuffer(vc, u8, sbt_size, .{ .transfer_src_bit = true });
-        defer sbt.destroy(vc);
+        const sbt = try cmd.staging.reserve(u8, vc, vk_allocator, sbt_size);
         try vc.device.getRayTracingShaderGroupHandlesKHR(pipeline, 0, group_count, sbt.data.len, sbt.data.ptr);
 
         const raygen_size = handle_size_aligned * raygen_entry_count;
@@ -494,19 +510,24 @@ const ShaderBindingTable = struct {
         std.mem.copyBackwards(u8, sbt.data[hit_index..hit_index + hit_size], sbt.data[raygen_size + miss_size..raygen_size + miss_size + hit_size]);
         std.mem.copyBackwards(u8, sbt.data[miss_index..miss_index + miss_size], sbt.data[raygen_size..raygen_size + miss_size]);
 
-        const handle = try vk_allocator.createDeviceBuffer(vc, allocator, u8, sbt_size, .{ .shader_binding_table_bit_khr = true, .transfer_dst_bit = true, .shader_device_address_bit = true });
+        const handle = try vk_allocator.createDeviceBuffer(vc, u8, sbt_size, .{ .shader_binding_table_bit_khr = true, .transfer_dst_bit = true, .shader_device_address_bit = true });
         errdefer handle.destroy(vc);
 
-        try cmd.startRecording(vc);
-        cmd.recordUploadBuffer(u8, vc, handle, sbt);
-        try cmd.submit(vc);
+        cmd.recordCopyBuffer(vc, handle.handle, sbt.buffer, &.{
+            vk.BufferCopy {
+                .src_offset = sbt.offset,
+                .dst_offset = 0,
+                .size = sbt_size,
+            },
+        });
+        const ticket = try cmd.submit(vc);
 
         const raygen_address = handle.getAddress(vc);
         const miss_address = raygen_address + miss_index;
         const hit_address = raygen_address + hit_index;
         const callable_address = raygen_address + callable_index;
 
-        try cmd.idleUntilDone(vc);
+        try cmd.wait(vc, ticket);
 
         return ShaderBindingTable {
             .handle = handle,
@@ -551,9 +572,10 @@ const ShaderBindingTable = struct {
         const callable_index = std.mem.alignForward(u32, hit_index + self.hit_count * handle_size_aligned, rt_properties.shader_group_base_alignment);
         const sbt_size = callable_index + self.callable_count * handle_size_aligned;
 
+        try cmd.startRecording(vc);
+
         // query sbt from pipeline
-        const sbt = try vk_allocator.createHostBuffer(vc, u8, sbt_size, .{ .transfer_src_bit = true });
-        defer sbt.destroy(vc);
+        const sbt = try cmd.staging.reserve(u8, vc, vk_allocator, sbt_size);
         try vc.device.getRayTracingShaderGroupHandlesKHR(pipeline, 0, group_count, sbt.data.len, sbt.data.ptr);
 
         const raygen_size = handle_size_aligned * self.raygen_count;
@@ -566,8 +588,13 @@ const ShaderBindingTable = struct {
         std.mem.copyBackwards(u8, sbt.data[hit_index..hit_index + hit_size], sbt.data[raygen_size + miss_size..raygen_size + miss_size + hit_size]);
         std.mem.copyBackwards(u8, sbt.data[miss_index..miss_index + miss_size], sbt.data[raygen_size..raygen_size + miss_size]);
 
-        try cmd.startRecording(vc);
-        cmd.recordUploadBuffer(u8, vc, self.handle, sbt);
+        cmd.recordCopyBuffer(vc, self.handle.handle, sbt.buffer, &.{
+            vk.BufferCopy {
+                .src_offset = sbt.offset,
+                .dst_offset = 0,
+                .size = sbt_size,
+            },
+        });
         try cmd.submitAndIdleUntilDone(vc);
     }
 
@@ -0,0 +1,38 @@
+// splitting host-side loops across threads
+//
+// threads are spawned for each call rather than kept around, so callers
+// pick a min_chunk big enough for that to be lost in the work itself --
+// then it's fine even for passes redone every frame, e.g. emitter areas
+// while emissive instances are moving
+
+const std = @import("std");
+
+const max_threads = 64;
+
+// calls func(context, start, end) on disjoint chunks covering [0, count),
+// one per thread with as many threads as there are cores, returning once
+// they're all done
+//
+// chunks are at least min_chunk long, so small counts just run on this thread
+pub fn forChunks(count: usize, min_chunk: usize, context: anytype, comptime func: fn (@TypeOf(context), usize, usize) void) void {
+    const cpu_count = std.Thread.getCpuCount() catch 1;
+    const thread_count = std.math.clamp(count / @max(min_chunk, 1), 1, @min(cpu_count, max_threads));
+    const chunk_size = std.math.divCeil(usize, count, thread_count) catch unreachable;
+
+    var threads: [max_threads]?std.Thread = undefined;
+    for (1..thread_count) |i| {
+        const start = @min(i * chunk_size, count);
+        const end = @min(start + chunk_size, count);
+        threads[i] = std.Thread.spawn(.{}, func, .{ context, start, end }) catch blk: {
+            // still correct, just slower
+            func(context, start, end);
+            break :blk null;
+        };
+    }
+
+    func(context, 0, @min(chunk_size, count));
+
+    for (threads[1..thread_count]) |thread| {
+        if (thread) |spawned| spawned.join();
+    }
+}
@@ -5,6 +5,7 @@ const engine = @import("engine");
 
 const VulkanContext = engine.core.VulkanContext;
 const Commands = engine.core.Commands;
+const StagingRing = engine.core.StagingRing;
 const VkAllocator = engine.core.Allocator;
 const Pipeline = engine.hrtsystem.pipeline.StandardPipeline;
 const Scene = engine.hrtsystem.Scene;
@@ -15,6 +16,8 @@ const TextureManager = MaterialManager.TextureManager;
 const Accel = engine.hrtsystem.Accel;
 const Camera = engine.hrtsystem.Camera;
 const Background = engine.hrtsystem.BackgroundManager;
+const alias_table = engine.hrtsystem.alias_table;
+const light_tree = engine.hrtsystem.light_tree;
 
 const exr = engine.fileformats.exr;
 const Rgba2D = exr.helpers.Rgba2D;
@@ -34,12 +37,12 @@ const TestingContext = struct {
 
     fn create(allocator: std.mem.Allocator, extent: vk.Extent2D) !TestingContext {
         const vc = try VulkanContext.create(allocator, "engine-tests", &.{}, &engine.hrtsystem.required_device_extensions, &engine.hrtsystem.required_device_features, null);
-        errdefer vc.destroy();
+        errdefer vc.destroy(allocator);
 
         var vk_allocator = try VkAllocator.create(&vc, allocator);
         errdefer vk_allocator.destroy(&vc, allocator);
 
-        var commands = try Commands.create(&vc);
+        var commands = try Commands.create(&vc, &vk_allocator);
         errdefer commands.destroy(&vc);
 
         const output_buffer = try vk_allocator.createHostBuffer(&vc, [4]f32, extent.width * extent.height, .{ .transfer_dst_bit = true });
@@ -104,7 +107,7 @@ const TestingContext = struct {
         self.output_buffer.destroy(&self.vc);
         self.commands.destroy(&self.vc);
         self.vk_allocator.destroy(&self.vc, allocator);
-        self.vc.destroy();
+        self.vc.destroy(allocator);
     }
 };
 
@@ -296,6 +299,12 @@ test "white sphere on white background is white" {
                 }
             },
         });
+
+        // renderers build this along with the frame that needs it
+        try tc.commands.startRecording(&tc.vc);
+        const tlas_scratch_buffer = try world.accel.recordUpdateTlas(&tc.vc, &tc.vk_allocator, allocator, tc.commands.buffer);
+        defer tlas_scratch_buffer.destroy(&tc.vc);
+        try tc.commands.submitAndIdleUntilDone(&tc.vc);
     }
 
     var camera = Camera {};
@@ -406,6 +415,12 @@ test "inside illuminating sphere is white" {
                 }
             },
         });
+
+        // renderers build this along with the frame that needs it
+        try tc.commands.startRecording(&tc.vc);
+        const tlas_scratch_buffer = try world.accel.recordUpdateTlas(&tc.vc, &tc.vk_allocator, allocator, tc.commands.buffer);
+        defer tlas_scratch_buffer.destroy(&tc.vc);
+        try tc.commands.submitAndIdleUntilDone(&tc.vc);
     }
 
     var camera = Camera {};
@@ -454,34 +469,317 @@ test "inside illuminating sphere is white" {
     }
 }
 
-// TODO: revive this once mesh sampling works with instance upload API
-// test "inside illuminating sphere is white with mesh sampling" {
-//     const allocator = std.testing.allocator;
-
-//     const extent = vk.Extent2D { .width = 32, .height = 32 };
-//     var tc = try TestingContext.create(allocator, extent);
-//     defer tc.destroy(allocator);
-
-//     var scene = try Scene.fromGlbExr(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, "assets/sphere_internal.glb", "assets/white.exr", extent, false);
-//     defer scene.destroy(&tc.vc, allocator);
-
-//     var pipeline = try Pipeline.create(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, .{ scene.world.descriptor_layout, scene.background.descriptor_layout, scene.camera.descriptor_layout }, .{
-//         .@"0" = .{
-//             .samples_per_run = 512,
-//             .max_bounces = 1024,
-//             .env_samples_per_bounce = 0,
-//             .mesh_samples_per_bounce = 1,
-//         }
-//     });
-//     defer pipeline.destroy(&tc.vc);
-
-//     try tc.renderToOutput(&pipeline, &scene);
-
-//     for (tc.output_buffer.data) |pixel| {
-//         for (pixel[0..3]) |component| {
-//             // TODO: this should be able to have tighter error bounds but is weird on my GPU for some reason
-//             // first upgrade GPU then determine if bug actually exists
-//             if (!std.math.approxEqAbs(f32, component, 1.0, 0.1)) return error.NonWhitePixel;
-//         }
-//     }
-// }
+test "inside illuminating sphere is white with mesh sampling" {
+    const allocator = std.testing.allocator;
+
+    const extent = vk.Extent2D { .width = 32, .height = 32 };
+    var tc = try TestingContext.create(allocator, extent);
+    defer tc.destroy(allocator);
+
+    var world = try World.createEmpty(&tc.vc);
+
+    // add sphere to world
+    {
+        const mesh_handle = try world.meshes.upload(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, try icosphere(5, allocator, true));
+
+        const normal_texture = try world.materials.textures.upload(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, TextureManager.Source {
+            .f32x2 = MaterialManager.MaterialInfo.default_normal,
+        }, "");
+        const albedo_texture = try world.materials.textures.upload(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, TextureManager.Source {
+            .f32x3 = F32x3.new(0.5, 0.5, 0.5),
+        }, "");
+        const emissive_texture = try world.materials.textures.upload(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, TextureManager.Source {
+            .f32x3 = F32x3.new(0.5, 0.5, 0.5),
+        }, "");
+        const material_handle = try world.materials.upload(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, MaterialManager.MaterialInfo {
+            .normal = normal_texture,
+            .emissive = emissive_texture,
+            .variant = MaterialManager.MaterialVariant {
+                .lambert = MaterialManager.Lambert {
+                    .color = albedo_texture,
+                }
+            }
+        });
+
+        _ = try world.accel.uploadInstance(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, world.meshes, Accel.Instance {
+            .visible = true,
+            .transform = Mat3x4.identity,
+            .geometries = &[1]Accel.Geometry {
+                .{
+                    .material = material_handle,
+                    .mesh = mesh_handle,
+                    .sampled = true,
+                }
+            },
+        });
+
+        // renderers build this along with the frame that needs it
+        try tc.commands.startRecording(&tc.vc);
+        try world.accel.recordUpdateEmitters(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, world.meshes, true);
+        const tlas_scratch_buffer = try world.accel.recordUpdateTlas(&tc.vc, &tc.vk_allocator, allocator, tc.commands.buffer);
+        defer tlas_scratch_buffer.destroy(&tc.vc);
+        try tc.commands.submitAndIdleUntilDone(&tc.vc);
+    }
+
+    var camera = Camera {};
+    _ = try camera.appendLens(allocator, Camera.Lens {
+        .origin = F32x3.new(0, 0, 0),
+        .forward = F32x3.new(1, 0, 0),
+        .up = F32x3.new(0, 0, 1),
+        .vfov = std.math.pi / 3.0,
+        .aperture = 0,
+        .focus_distance = 1,
+    });
+    _ = try camera.appendSensor(&tc.vc, &tc.vk_allocator, allocator, extent);
+
+    var background = try Background.create(&tc.vc, allocator);
+    var black = [4]f32 {0, 0, 0, 1};
+    const image = Rgba2D {
+        .ptr = @ptrCast(&black),
+        .extent = .{
+            .width = 1,
+            .height = 1,
+        }
+    };
+    try background.addBackground(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, image, "black");
+
+    var scene = Scene {
+        .world = world,
+        .camera = camera,
+        .background = background,
+    };
+    defer scene.destroy(&tc.vc, allocator);
+
+    var pipeline = try Pipeline.create(&tc.vc, &tc.vk_allocator, allocator, &tc.commands, scene.world.materials.textures.descriptor_layout, .{
+        .samples_per_run = 512,
+        .max_bounces = 1024,
+        .env_samples_per_bounce = 0,
+        .mesh_samples_per_bounce = 1,
+    }, .{ scene.background.sampler });
+    defer pipeline.destroy(&tc.vc);
+
+    try tc.renderToOutput(&pipeline, &scene);
+
+    for (tc.output_buffer.data) |pixel| {
+        for (pixel[0..3]) |component| {
+            if (!std.math.approxEqAbs(f32, component, 1.0, 0.02)) return error.NonWhitePixel;
+        }
+    }
+}
+
+test "staging ring wraps around and grows" {
+    const allocator = std.testing.allocator;
+    var tc = try TestingContext.create(allocator, .{ .width = 1, .height = 1 });
+    defer tc.destroy(allocator);
+
+    // shares the timeline of the commands, so their submissions can stand in for uploads
+    var ring = try StagingRing.create(&tc.vc, &tc.vk_allocator, 256, tc.commands.semaphore);
+    defer ring.destroy(&tc.vc);
+
+    const first = try ring.reserve(u8, &tc.vc, &tc.vk_allocator, 100);
+    try std.testing.expectEqual(@as(vk.DeviceSize, 0), first.offset);
+    try tc.commands.startRecording(&tc.vc);
+    try ring.markSubmitted(&tc.vc, try tc.commands.submit(&tc.vc));
+
+    const second = try ring.reserve(u8, &tc.vc, &tc.vk_allocator, 100);
+    try std.testing.expectEqual(@as(vk.DeviceSize, 112), second.offset);
+    try tc.commands.startRecording(&tc.vc);
+    try ring.markSubmitted(&tc.vc, try tc.commands.submit(&tc.vc));
+
+    // doesn't fit before the end, but the first is reclaimable by now
+    const third = try ring.reserve(u8, &tc.vc, &tc.vk_allocator, 100);
+    try std.testing.expectEqual(first.buffer, third.buffer);
+    try std.testing.expectEqual(@as(vk.DeviceSize, 0), third.offset);
+
+    // third is still unsubmitted, so this can't wait for space and has to grow
+    const fourth = try ring.reserve(u8, &tc.vc, &tc.vk_allocator, 200);
+    try std.testing.expect(fourth.buffer != first.buffer);
+    try std.testing.expectEqual(@as(vk.DeviceSize, 0), fourth.offset);
+    try std.testing.expectEqual(@as(usize, 1), ring.outgrown.len);
+
+    try tc.commands.startRecording(&tc.vc);
+    const ticket = try tc.commands.submit(&tc.vc);
+    try ring.markSubmitted(&tc.vc, ticket);
+    try tc.commands.wait(&tc.vc, ticket);
+    try ring.retire(&tc.vc);
+    try std.testing.expectEqual(@as(usize, 0), ring.outgrown.len);
+}
+
+test "freed device memory coalesces" {
+    const allocator = std.testing.allocator;
+    var tc = try TestingContext.create(allocator, .{ .width = 1, .height = 1 });
+    defer tc.destroy(allocator);
+
+    const size = 1024 * 1024;
+    const a = try tc.vk_allocator.createDeviceBuffer(&tc.vc, u8, size, .{ .storage_buffer_bit = true });
+    const b = try tc.vk_allocator.createDeviceBuffer(&tc.vc, u8, size, .{ .storage_buffer_bit = true });
+    const c = try tc.vk_allocator.createDeviceBuffer(&tc.vc, u8, size, .{ .storage_buffer_bit = true });
+    defer c.destroy(&tc.vc);
+
+    // first fit in a fresh block
+    try std.testing.expect(a.allocation.block != null);
+    try std.testing.expectEqual(a.allocation.block, b.allocation.block);
+    try std.testing.expectEqual(a.allocation.block, c.allocation.block);
+    try std.testing.expectEqual(a.allocation.offset + size, b.allocation.offset);
+    try std.testing.expectEqual(b.allocation.offset + size, c.allocation.offset);
+
+    // only fits where a and b were if their ranges were merged
+    b.destroy(&tc.vc);
+    a.destroy(&tc.vc);
+    const merged = try tc.vk_allocator.createDeviceBuffer(&tc.vc, u8, 2 * size, .{ .storage_buffer_bit = true });
+    defer merged.destroy(&tc.vc);
+    try std.testing.expectEqual(a.allocation.block, merged.allocation.block);
+    try std.testing.expectEqual(a.allocation.offset, merged.allocation.offset);
+}
+
+// probability each entry of an alias table is picked with
+fn aliasTablePmf(allocator: std.mem.Allocator, entries: anytype) ![]f64 {
+    const pmf = try allocator.alloc(f64, entries.len);
+    @memset(pmf, 0.0);
+    const n: f64 = @floatFromInt(entries.len);
+    for (entries, pmf) |entry, *p| {
+        p.* += @min(@as(f64, entry.select), 1.0) / n;
+        if (entry.select < 1.0) pmf[entry.alias] += (1.0 - @as(f64, entry.select)) / n;
+    }
+    return pmf;
+}
+
+test "parallel alias table matches serial one" {
+    const allocator = std.testing.allocator;
+
+    // enough to be spread over threads
+    const count = 100 * 1000;
+
+    var prng = std.rand.DefaultPrng.init(0);
+    const weights = try allocator.alloc(f32, count);
+    defer allocator.free(weights);
+    const datas = try allocator.alloc(u32, count);
+    defer allocator.free(datas);
+    for (weights, datas, 0..) |*weight, *data, i| {
+        // some zero, some much bigger than the rest
+        weight.* = switch (i % 7) {
+            0 => 0.0,
+            1 => 100.0 * prng.random().float(f32),
+            else => prng.random().float(f32),
+        };
+        data.* = @intCast(i);
+    }
+
+    const parallel = try alias_table.AliasTable(u32).create(allocator, weights, datas);
+    defer allocator.free(parallel.entries);
+    const serial = try alias_table.NormalizedAliasTable.create(allocator, weights);
+    defer allocator.free(serial.entries);
+
+    try std.testing.expectApproxEqRel(serial.sum, parallel.sum, 1e-4);
+
+    const parallel_pmf = try aliasTablePmf(allocator, parallel.entries);
+    defer allocator.free(parallel_pmf);
+    const serial_pmf = try aliasTablePmf(allocator, serial.entries);
+    defer allocator.free(serial_pmf);
+
+    for (parallel.entries, parallel_pmf, serial_pmf, weights, 0..) |entry, parallel_p, serial_p, weight, i| {
+        try std.testing.expectEqual(@as(u32, @intCast(i)), entry.data);
+        const expected = @as(f64, weight) / serial.sum;
+        try std.testing.expectApproxEqAbs(expected, parallel_p, 1e-8);
+        try std.testing.expectApproxEqAbs(expected, serial_p, 1e-8);
+    }
+}
+
+test "light tree reaches every triangle with probability proportional to power" {
+    const allocator = std.testing.allocator;
+
+    const count = 1000;
+
+    var prng = std.rand.DefaultPrng.init(0);
+    const triangles = try allocator.alloc(light_tree.Triangle, count);
+    defer allocator.free(triangles);
+    const powers = try allocator.alloc(f32, count);
+    defer allocator.free(powers);
+    var total_power: f64 = 0.0;
+    for (triangles, powers) |*triangle, *power| {
+        const random = prng.random();
+        const min = F32x3.new(random.float(f32), random.float(f32), random.float(f32)).mul_scalar(10.0);
+        triangle.* = .{
+            .min = min,
+            .max = min.add(F32x3.new(random.float(f32), random.float(f32), random.float(f32))),
+            .normal = F32x3.new(random.float(f32) - 0.5, random.float(f32) - 0.5, random.float(f32) - 0.5).unit(),
+        };
+        power.* = 0.01 + random.float(f32);
+        total_power += power.*;
+    }
+
+    const tree = try light_tree.LightTree.create(allocator, triangles, powers);
+    defer tree.destroy(allocator);
+
+    try std.testing.expectEqual(@as(usize, 2 * count - 1), tree.nodes.len);
+    try std.testing.expectApproxEqRel(total_power, tree.nodes[0].power, 1e-4);
+
+    // children are contained in and add up to their parent
+    for (tree.nodes, 0..) |node, i| {
+        if (node.link.leaf) continue;
+        const first = tree.nodes[i + 1];
+        const second = tree.nodes[node.link.index];
+        try std.testing.expectApproxEqRel(node.power, first.power + second.power, 1e-4);
+        for ([2]light_tree.Node { first, second }) |child| {
+            try std.testing.expect(node.min.x <= child.min.x and node.min.y <= child.min.y and node.min.z <= child.min.z);
+            try std.testing.expect(node.max.x >= child.max.x and node.max.y >= child.max.y and node.max.z >= child.max.z);
+        }
+    }
+
+    // following the trail of a triangle, picking children by power, gets to it as often as its power says
+    for (tree.trails, powers, 0..) |trail, power, i| {
+        var node_index: usize = 0;
+        var depth: u6 = 0;
+        var pmf: f64 = 1.0;
+        while (!tree.nodes[node_index].link.leaf) : (depth += 1) {
+            const first_index = node_index + 1;
+            const second_index = tree.nodes[node_index].link.index;
+            node_index = if (trail & (@as(u32, 1) << @intCast(depth)) != 0) second_index else first_index;
+            pmf *= @as(f64, tree.nodes[node_index].power) / (tree.nodes[first_index].power + tree.nodes[second_index].power);
+        }
+        try std.testing.expectEqual(@as(u31, @intCast(i)), tree.nodes[node_index].link.index);
+        try std.testing.expectApproxEqRel(@as(f64, power) / total_power, pmf, 1e-3);
+    }
+}
+
+test "light tree built over threads matches one built on one" {
+    const allocator = std.testing.allocator;
+
+    const count = 5000;
+
+    var prng = std.rand.DefaultPrng.init(1);
+    const triangles = try allocator.alloc(light_tree.Triangle, count);
+    defer allocator.free(triangles);
+    const powers = try allocator.alloc(f32, count);
+    defer allocator.free(powers);
+    for (triangles, powers, 0..) |*triangle, *power, i| {
+        const random = prng.random();
+        const min = F32x3.new(random.float(f32), random.float(f32), random.float(f32)).mul_scalar(10.0);
+        triangle.* = .{
+            .min = min,
+            .max = min.add(F32x3.new(random.float(f32), random.float(f32), random.float(f32))),
+            .normal = F32x3.new(random.float(f32) - 0.5, random.float(f32) - 0.5, random.float(f32) - 0.5).unit(),
+        };
+        // some hidden ones too
+        power.* = if (i % 7 == 0) 0.0 else 0.01 + random.float(f32);
+    }
+
+    const serial = try light_tree.LightTree.createWithMinSubtree(allocator, triangles, powers, std.math.maxInt(usize));
+    defer serial.destroy(allocator);
+    const threaded = try light_tree.LightTree.createWithMinSubtree(allocator, triangles, powers, 64);
+    defer threaded.destroy(allocator);
+
+    try std.testing.expectEqualSlices(u8, std.mem.sliceAsBytes(serial.nodes), std.mem.sliceAsBytes(threaded.nodes));
+    try std.testing.expectEqualSlices(u32, serial.trails, threaded.trails);
+}
+
+test "light tree of nothing has one powerless node" {
+    const allocator = std.testing.allocator;
+
+    const tree = try light_tree.LightTree.create(allocator, &.{}, &.{});
+    defer tree.destroy(allocator);
+
+    try std.testing.expectEqual(@as(usize, 1), tree.nodes.len);
+    try std.testing.expectEqual(@as(f32, 0.0), tree.nodes[0].power);
+    try std.testing.expect(tree.nodes[0].link.leaf);
+}
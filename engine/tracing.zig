@@ -0,0 +1,168 @@
+// CPU tracing spans
+//
+// each thread records the spans it times into its own timeline, which
+// can be written out in the Chrome trace event format, viewable in
+// about://tracing or Perfetto
+//
+// unless the engine is built with tracing enabled, spans are
+// zero-sized and everything here compiles down to nothing
+
+const std = @import("std");
+
+pub const enabled = @import("build_options").tracing;
+
+const allocator = std.heap.c_allocator;
+
+const Event = struct {
+    name: [*:0]const u8,
+    start_ns: u64,
+    duration_ns: u64,
+};
+
+// the spans of a single thread
+//
+// only ever recorded into by that thread, the mutex is just so that
+// writing out can happen while other threads are still recording
+const Timeline = struct {
+    thread_id: std.Thread.Id,
+    mutex: std.Thread.Mutex,
+    events: std.ArrayListUnmanaged(Event),
+    next: ?*Timeline,
+};
+
+// timelines are kept around until the process exits, even
+// if their thread doesn't, so they can still be written out
+var timelines: ?*Timeline = null;
+var timelines_mutex = std.Thread.Mutex {};
+threadlocal var timeline: ?*Timeline = null;
+
+var epoch: ?std.time.Instant = null;
+var epoch_once = std.once(setEpoch);
+
+pub const Span = struct {
+    name: if (enabled) [*:0]const u8 else void,
+    start_ns: if (enabled) u64 else void,
+
+    pub inline fn end(self: Span) void {
+        if (enabled) record(self.name, self.start_ns, now() -| self.start_ns);
+    }
+};
+
+// name must outlive the trace being written out
+pub inline fn begin(name: [*:0]const u8) Span {
+    return if (enabled) Span {
+        .name = name,
+        .start_ns = now(),
+    } else Span {
+        .name = {},
+        .start_ns = {},
+    };
+}
+
+// locks mutex, recording how long it was waited on as a span
+// named name if it was held by someone else
+pub fn lock(mutex: *std.Thread.Mutex, name: [*:0]const u8) void {
+    if (!enabled) return mutex.lock();
+    if (mutex.tryLock()) return;
+
+    const span = begin(name);
+    mutex.lock();
+    span.end();
+}
+
+fn setEpoch() void {
+    epoch = std.time.Instant.now() catch null;
+}
+
+// nanoseconds since the first span, on a clock shared by all threads
+pub fn now() u64 {
+    epoch_once.call();
+    const start = epoch orelse return 0;
+    const instant = std.time.Instant.now() catch return 0;
+    return instant.since(start);
+}
+
+fn record(name: [*:0]const u8, start_ns: u64, duration_ns: u64) void {
+    const own = timeline orelse register() orelse return;
+
+    own.mutex.lock();
+    defer own.mutex.unlock();
+
+    // tracing is best effort, so spans are just dropped when out of memory
+    own.events.append(allocator, .{
+        .name = name,
+        .start_ns = start_ns,
+        .duration_ns = duration_ns,
+    }) catch {};
+}
+
+fn register() ?*Timeline {
+    const new = allocator.create(Timeline) catch return null;
+    new.* = Timeline {
+        .thread_id = std.Thread.getCurrentId(),
+        .mutex = .{},
+        .events = .{},
+        .next = null,
+    };
+
+    timelines_mutex.lock();
+    defer timelines_mutex.unlock();
+    new.next = timelines;
+    timelines = new;
+
+    timeline = new;
+    return new;
+}
+
+// writes every span recorded so far, from all threads, to path
+pub fn write(path: []const u8) !void {
+    if (!enabled) return;
+
+    const file = try std.fs.cwd().createFile(path, .{});
+    defer file.close();
+
+    var buffered = std.io.bufferedWriter(file.writer());
+    const writer = buffered.writer();
+
+    try writer.writeAll("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    timelines_mutex.lock();
+    defer timelines_mutex.unlock();
+
+    var first = true;
+    var current = timelines;
+    while (current) |thread| : (current = thread.next) {
+        thread.mutex.lock();
+        defer thread.mutex.unlock();
+
+        for (thread.events.items) |event| {
+            if (!first) try writer.writeByte(',');
+            first = false;
+
+            // timestamps are in microseconds
+            try writer.print("\n{{\"name\":{},\"ph\":\"X\",\"pid\":0,\"tid\":{},\"ts\":{d:.3},\"dur\":{d:.3}}}", .{
+                std.json.fmt(std.mem.span(event.name), .{}),
+                thread.thread_id,
+                @as(f64, @floatFromInt(event.start_ns)) / std.time.ns_per_us,
+                @as(f64, @floatFromInt(event.duration_ns)) / std.time.ns_per_us,
+            });
+        }
+    }
+
+    try writer.writeAll("\n]}\n");
+    try buffered.flush();
+}
+
+// writes to $MOONSHINE_TRACE if that is set, otherwise to
+// moonshine-trace.json in the working directory
+pub fn writeDefault() !void {
+    if (!enabled) return;
+
+    const path = std.process.getEnvVarOwned(allocator, "MOONSHINE_TRACE") catch |err| switch (err) {
+        error.EnvironmentVariableNotFound => return write("moonshine-trace.json"),
+        else => return err,
+    };
+    defer allocator.free(path);
+
+    try write(path);
+}
@@ -13,7 +13,7 @@ HdMoonshineCamera::HdMoonshineCamera(SdfPath const& id) : HdCamera(id) {}
 
 void HdMoonshineCamera::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* renderParam, HdDirtyBits* dirtyBits) {
     HdCamera::Sync(sceneDelegate, renderParam, dirtyBits);
-    HdMoonshine* msne = static_cast<HdMoonshineRenderParam*>(renderParam)->_moonshine;
+    HdMoonshine* msne = static_cast<HdMoonshineRenderParam*>(renderParam)->AcquireSceneForEdit();
 
     GfMatrix4f transform = GfMatrix4f(GetTransform());
     GfVec3f origin = transform.Transform(GfVec3f(0.0, 0.0, 0.0));
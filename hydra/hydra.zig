@@ -6,6 +6,7 @@ const engine = @import("engine");
 const core = engine.core;
 const VulkanContext = core.VulkanContext;
 const Commands = core.Commands;
+const DestructionQueue = core.DestructionQueue;
 const VkAllocator = core.Allocator;
 
 const hrtsystem = engine.hrtsystem;
@@ -19,6 +20,28 @@ const TextureManager = MaterialManager.TextureManager;
 const Accel = hrtsystem.Accel;
 const Pipeline = hrtsystem.pipeline.StandardPipeline;
 
+// packs sensor contents into a more compact readback format
+const OutputPipeline = core.pipeline.Pipeline("output/convert.hlsl", struct {}, extern struct {
+    format: SensorFormat,
+    exposure: f32,
+},
+&.{
+    .{
+        .name = "src_image",
+        .descriptor_type = .storage_image,
+        .descriptor_count = 1,
+        .stage_flags = .{ .compute_bit = true },
+    },
+    .{
+        .name = "dst_buffer",
+        .descriptor_type = .storage_buffer,
+        .descriptor_count = 1,
+        .stage_flags = .{ .compute_bit = true },
+    },
+});
+
+const tracing = engine.tracing;
+
 const vector = engine.vector;
 const F32x2 = vector.Vec2(f32);
 const F32x3 = vector.Vec3(f32);
@@ -43,19 +66,124 @@ pub const Material = extern struct {
 pub const TextureFormat = enum(c_int) {
     f16x4,
     u8x4_srgb,
+    u8x1,
+    u8x2,
+    u8x4,
+    u8x1_srgb,
+    u8x2_srgb,
+    u16x1,
+    u16x2,
+    u16x4,
+    f16x1,
+    f16x2,
+    f32x1,
+    f32x2,
+    f32x4,
+
+    // two channels read as grey and alpha
+    u8x2_grey_alpha,
+    u8x2_srgb_grey_alpha,
+    u16x2_grey_alpha,
+    f16x2_grey_alpha,
+    f32x2_grey_alpha,
 
     fn toVk(self: TextureFormat) vk.Format {
-        switch (self) {
-            .f16x4 => return .r16g16b16a16_sfloat,
-            .u8x4_srgb => return .r8g8b8a8_srgb,
-        }
+        return switch (self) {
+            .f16x4 => .r16g16b16a16_sfloat,
+            .u8x4_srgb => .r8g8b8a8_srgb,
+            .u8x1 => .r8_unorm,
+            .u8x2, .u8x2_grey_alpha => .r8g8_unorm,
+            .u8x4 => .r8g8b8a8_unorm,
+            .u8x1_srgb => .r8_srgb,
+            .u8x2_srgb, .u8x2_srgb_grey_alpha => .r8g8_srgb,
+            .u16x1 => .r16_unorm,
+            .u16x2, .u16x2_grey_alpha => .r16g16_unorm,
+            .u16x4 => .r16g16b16a16_unorm,
+            .f16x1 => .r16_sfloat,
+            .f16x2, .f16x2_grey_alpha => .r16g16_sfloat,
+            .f32x1 => .r32_sfloat,
+            .f32x2, .f32x2_grey_alpha => .r32g32_sfloat,
+            .f32x4 => .r32g32b32a32_sfloat,
+        };
     }
 
     fn pixelSizeInBytes(self: TextureFormat) usize {
-        switch (self) {
-            .f16x4 => return @sizeOf(f16) * 4,
-            .u8x4_srgb => return @sizeOf(u8) * 4,
-        }
+        return switch (self) {
+            .u8x1, .u8x1_srgb => @sizeOf(u8),
+            .u8x2, .u8x2_srgb, .u8x2_grey_alpha, .u8x2_srgb_grey_alpha => @sizeOf(u8) * 2,
+            .u8x4, .u8x4_srgb => @sizeOf(u8) * 4,
+            .u16x1 => @sizeOf(u16),
+            .u16x2, .u16x2_grey_alpha => @sizeOf(u16) * 2,
+            .u16x4 => @sizeOf(u16) * 4,
+            .f16x1 => @sizeOf(f16),
+            .f16x2, .f16x2_grey_alpha => @sizeOf(f16) * 2,
+            .f16x4 => @sizeOf(f16) * 4,
+            .f32x1 => @sizeOf(f32),
+            .f32x2, .f32x2_grey_alpha => @sizeOf(f32) * 2,
+            .f32x4 => @sizeOf(f32) * 4,
+        };
+    }
+
+    fn isGreyAlpha(self: TextureFormat) bool {
+        return switch (self) {
+            .u8x2_grey_alpha, .u8x2_srgb_grey_alpha, .u16x2_grey_alpha, .f16x2_grey_alpha, .f32x2_grey_alpha => true,
+            else => false,
+        };
+    }
+};
+
+pub const RawTexture = extern struct {
+    data: [*]const u8,
+    extent: vk.Extent2D,
+    format: TextureFormat,
+    name: [*:0]const u8,
+};
+
+// GPU time spent in a pass, over everything rendered or uploaded so far
+pub const PassTiming = extern struct {
+    name: [*:0]const u8,
+    last_ms: f64,
+    average_ms: f64,
+    count: u64,
+};
+
+// in bytes, of device memory
+pub const MemoryUsage = extern struct {
+    budget: u64,
+    usage: u64, // by everything in this process, not just moonshine
+
+    // what moonshine has allocated, by what it's for
+    mesh: u64,
+    accel: u64,
+    texture: u64,
+    sensor: u64,
+    staging: u64, // host memory rather than device
+    other: u64,
+};
+
+// what sensor data is read back as
+//
+// prefixed in C to not clash with TextureFormat
+pub const SensorFormat = enum(c_int) {
+    f32x4,
+    f16x4,
+    u8x4, // exposed and tonemapped
+    u8x4_srgb, // exposed, tonemapped, and sRGB encoded
+
+    fn pixelSizeInBytes(self: SensorFormat) usize {
+        return switch (self) {
+            .f32x4 => @sizeOf(f32) * 4,
+            .f16x4 => @sizeOf(f16) * 4,
+            .u8x4, .u8x4_srgb => @sizeOf(u8) * 4,
+        };
+    }
+
+    // whether exposure is applied when reading back to this
+    fn isExposed(self: SensorFormat) bool {
+        return switch (self) {
+            .f32x4, .f16x4 => false,
+            .u8x4, .u8x4_srgb => true,
+        };
     }
 };
 
@@ -64,14 +192,32 @@ pub const HdMoonshine = struct {
     vk_allocator: VkAllocator,
     vc: VulkanContext,
     commands: Commands,
+    transfer_commands: Commands, // uploads that may overlap with rendering
 
     world: World,
     camera: Camera,
     background: Background,
 
     pipeline: Pipeline,
+    output_pipeline: OutputPipeline,
+
+    // released sensors, kept around to be reused by the next one created
+    free_sensors: std.ArrayListUnmanaged(Camera.SensorHandle),
+
+    // applied when reading back to 8 bit formats
+    exposure: f32,
 
-    output_buffers: std.ArrayListUnmanaged(VkAllocator.HostBuffer([4]f32)),
+    // one per sensor
+    // guarded by readback_mutex rather than the big one so that finished frames
+    // can be read while the next is rendering
+    readbacks: std.ArrayListUnmanaged(Readback),
+    readback_mutex: std.Thread.Mutex,
+
+    // render submitted but not yet published, guarded by readback_mutex
+    in_flight: ?InFlight,
+
+    // resources the in-flight render may still be using
+    destruction_queue: DestructionQueue,
 
     // as a temporary hack, while the resource system is not yet streamlined,
     // force it to all be singlethreaded
@@ -83,6 +229,17 @@ pub const HdMoonshine = struct {
     // could technically be more granular
     need_instance_update: bool,
 
+    // meshes staged by (possibly parallel) rprim syncs, uploaded all at once on flush
+    //
+    // guarded by its own mutex so staging doesn't need to wait on the big one
+    staging_mutex: std.Thread.Mutex,
+    staged_meshes: std.ArrayListUnmanaged(MeshManager.Mesh),
+    next_mesh_handle: MeshManager.Handle,
+
+    // in-place updates of existing meshes, e.g. deforming ones, applied on flush as well
+    // and also guarded by staging_mutex -- only the latest of each is kept
+    staged_mesh_updates: std.AutoArrayHashMapUnmanaged(MeshManager.Handle, MeshUpdate),
+
     const MaterialUpdate = struct {
         normal: ?TextureManager.Handle = null,
         emissive: ?TextureManager.Handle = null,
@@ -92,15 +249,76 @@ pub const HdMoonshine = struct {
         ior: ?f32 = null,
     };
 
+    const MeshUpdate = struct {
+        positions: ?[]const F32x3 = null,
+        normals: ?[]const F32x3 = null,
+
+        fn destroy(self: MeshUpdate, allocator: std.mem.Allocator) void {
+            if (self.positions) |positions| allocator.free(positions);
+            if (self.normals) |normals| allocator.free(normals);
+        }
+    };
+
+    const InFlight = struct {
+        sensor: Camera.SensorHandle,
+        ticket: Commands.Ticket,
+        sample_count: u32, // once done
+    };
+
+    // double buffered so rendering can go on while the last frame is being read
+    const Readback = struct {
+        buffers: [2]VkAllocator.HostBuffer(u8),
+        converted: VkAllocator.OwnedDeviceBuffer, // null for f32x4, which is copied straight from the sensor
+        format: SensorFormat,
+        front: u1, // the published one, other is rendered into
+        published_sample_count: u32,
+        pins: u32, // maps not yet unmapped, during which front stays put
+
+        fn create(vc: *const VulkanContext, vk_allocator: *VkAllocator, extent: vk.Extent2D, format: SensorFormat) !Readback {
+            const size = extent.width * extent.height * format.pixelSizeInBytes();
+
+            var self = Readback {
+                .buffers = .{ .{}, .{} },
+                .converted = .{},
+                .format = format,
+                .front = 0,
+                .published_sample_count = 0,
+                .pins = 0,
+            };
+            errdefer self.destroy(vc);
+
+            var sensor_memory = vk_allocator.withCategory(.sensor);
+            var staging_memory = vk_allocator.withCategory(.staging);
+            if (format != .f32x4) self.converted = try sensor_memory.createOwnedDeviceBuffer(vc, size, .{ .storage_buffer_bit = true, .transfer_src_bit = true });
+            for (&self.buffers) |*buffer| {
+                buffer.* = try staging_memory.createHostBuffer(vc, u8, size, .{ .transfer_dst_bit = true });
+            }
+            self.clear();
+
+            return self;
+        }
+
+        // may be read before anything is rendered
+        fn clear(self: *Readback) void {
+            for (self.buffers) |buffer| @memset(buffer.data, 0);
+            self.published_sample_count = 0;
+        }
+
+        fn destroy(self: Readback, vc: *const VulkanContext) void {
+            for (self.buffers) |buffer| buffer.destroy(vc);
+            if (self.converted.handle != .null_handle) self.converted.destroy(vc);
+        }
+    };
+
     const samples_per_run = 1;
 
     const pipeline_settings = Pipeline.SpecConstants {
         .samples_per_run = samples_per_run,
         .max_bounces = 1024,
         .env_samples_per_bounce = 0,
-        .mesh_samples_per_bounce = 0,
+        .mesh_samples_per_bounce = 1, // emitters are kept up to date as instances change
         .flip_image = false,
-        .indexed_attributes = false,
+        .indexed_attributes = true,
         .two_component_normal_texture = false,
     };
 
@@ -113,14 +331,17 @@ pub const HdMoonshine = struct {
 
         self.allocator = allocator;
         self.vc = VulkanContext.create(self.allocator.allocator(), "hdMoonshine", &.{}, &hrtsystem.required_device_extensions, &hrtsystem.required_device_features, null) catch return null;
-        errdefer self.vc.destroy();
-
-        self.commands = Commands.create(&self.vc) catch return null;
-        errdefer self.commands.destroy(&self.vc);
+        errdefer self.vc.destroy(self.allocator.allocator());
 
         self.vk_allocator = VkAllocator.create(&self.vc, self.allocator.allocator()) catch return null;
         errdefer self.vk_allocator.destroy(&self.vc, self.allocator.allocator());
 
+        self.commands = Commands.create(&self.vc, &self.vk_allocator) catch return null;
+        errdefer self.commands.destroy(&self.vc);
+
+        self.transfer_commands = Commands.createTransfer(&self.vc, &self.vk_allocator) catch return null;
+        errdefer self.transfer_commands.destroy(&self.vc);
+
         self.world = World.createEmpty(&self.vc) catch return null;
         errdefer self.world.destroy(&self.vc, self.allocator.allocator());
 
@@ -134,19 +355,57 @@ pub const HdMoonshine = struct {
         self.pipeline = Pipeline.create(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, self.world.materials.textures.descriptor_layout, pipeline_settings, .{ self.background.sampler }) catch return null;
         errdefer self.pipeline.destroy(&self.vc);
 
-        self.output_buffers = .{};
+        self.output_pipeline = OutputPipeline.create(&self.vc, self.allocator.allocator(), .{}, .{}) catch return null;
+        errdefer self.output_pipeline.destroy(&self.vc);
+
+        self.free_sensors = .{};
+        self.exposure = 0.0;
+        self.readbacks = .{};
+        self.readback_mutex = .{};
+        self.in_flight = null;
+        self.destruction_queue = DestructionQueue.create();
         self.mutex = .{};
         self.material_updates = .{};
         self.need_instance_update = false;
+        self.staging_mutex = .{};
+        self.staged_meshes = .{};
+        self.next_mesh_handle = 0;
+        self.staged_mesh_updates = .{};
 
         return self;
     }
 
+    // submits without waiting for the GPU, leaving the frame to be published
+    // by whatever next notices it's done
     pub export fn HdMoonshineRender(self: *HdMoonshine, sensor: Camera.SensorHandle, lens: Camera.LensHandle) bool {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
+
+        const span = tracing.begin("render");
+        defer span.end();
+
+        // the render thread may have picked it as its target just before it was released
+        if (std.mem.indexOfScalar(Camera.SensorHandle, self.free_sensors.items, sensor) != null) return true;
+
+        // only one render in flight at a time, so the back buffer is free to render into
+        self.finishRender() catch return false;
+
+        // front only changes while a render is in flight, so once this has dropped any
+        // that couldn't be published as its readback is mapped, front stays as read here
+        const back_buffer = blk: {
+            self.readback_mutex.lock();
+            defer self.readback_mutex.unlock();
+            self.in_flight = null;
+            const readback = self.readbacks.items[sensor];
+            break :blk readback.buffers[1 - readback.front];
+        };
+        self.destruction_queue.collect(&self.vc, self.commands.completed(&self.vc) catch return false);
+
         self.commands.startRecording(&self.vc) catch return false;
 
+        var tlas_scratch_buffer = VkAllocator.OwnedDeviceBuffer {};
+        defer tlas_scratch_buffer.destroy(&self.vc);
+
         // update instance transforms
         {   
             if (self.material_updates.count() != 0) {
@@ -160,32 +419,32 @@ pub const HdMoonshine = struct {
                     if (update.value_ptr.normal) |normal| {
                         const offset = index * @sizeOf(MaterialManager.Material) + @offsetOf(MaterialManager.Material, "normal");
                         const bytes = std.mem.asBytes(&normal);
-                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.materials.handle, offset, bytes.len, bytes.ptr);
+                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.materials.handle(), offset, bytes.len, bytes.ptr);
                     }
                     if (update.value_ptr.emissive) |emissive| {
                         const offset = index * @sizeOf(MaterialManager.Material) + @offsetOf(MaterialManager.Material, "emissive");
                         const bytes = std.mem.asBytes(&emissive);
-                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.materials.handle, offset, bytes.len, bytes.ptr);
+                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.materials.handle(), offset, bytes.len, bytes.ptr);
                     }
                     if (update.value_ptr.color) |color| {
                         const offset = index * @sizeOf(MaterialManager.StandardPBR) + @offsetOf(MaterialManager.StandardPBR, "color");
                         const bytes = std.mem.asBytes(&color);
-                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle, offset, bytes.len, bytes.ptr);
+                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle(), offset, bytes.len, bytes.ptr);
                     }
                     if (update.value_ptr.metalness) |metalness| {
                         const offset = index * @sizeOf(MaterialManager.StandardPBR) + @offsetOf(MaterialManager.StandardPBR, "metalness");
                         const bytes = std.mem.asBytes(&metalness);
-                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle, offset, bytes.len, bytes.ptr);
+                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle(), offset, bytes.len, bytes.ptr);
                     }
                     if (update.value_ptr.roughness) |roughness| {
                         const offset = index * @sizeOf(MaterialManager.StandardPBR) + @offsetOf(MaterialManager.StandardPBR, "roughness");
                         const bytes = std.mem.asBytes(&roughness);
-                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle, offset, bytes.len, bytes.ptr);
+                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle(), offset, bytes.len, bytes.ptr);
                     }
                     if (update.value_ptr.ior) |ior| {
                         const offset = index * @sizeOf(MaterialManager.StandardPBR) + @offsetOf(MaterialManager.StandardPBR, "ior");
                         const bytes = std.mem.asBytes(&ior);
-                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle, offset, bytes.len, bytes.ptr);
+                        self.vc.device.cmdUpdateBuffer(self.commands.buffer, self.world.materials.variant_buffers.standard_pbr.buffer.handle(), offset, bytes.len, bytes.ptr);
                     }
                 }
 
@@ -198,7 +457,7 @@ pub const HdMoonshine = struct {
                         .dst_access_mask = .{ .shader_storage_read_bit = true },
                         .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
                         .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-                        .buffer = self.world.materials.materials.handle,
+                        .buffer = self.world.materials.materials.handle(),
                         .offset = 0,
                         .size = vk.WHOLE_SIZE,
                     },
@@ -209,7 +468,7 @@ pub const HdMoonshine = struct {
                         .dst_access_mask = .{ .shader_storage_read_bit = true },
                         .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
                         .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-                        .buffer = self.world.materials.variant_buffers.standard_pbr.buffer.handle,
+                        .buffer = self.world.materials.variant_buffers.standard_pbr.buffer.handle(),
                         .offset = 0,
                         .size = vk.WHOLE_SIZE,
                     },
@@ -220,15 +479,14 @@ pub const HdMoonshine = struct {
                 });
 
                 self.material_updates.clearRetainingCapacity();
+
+                // textures may be swapped in after the fact, e.g. once loaded in the background
+                self.clearAllSensors();
             }
 
             if (self.need_instance_update) {
-                var actual_size_instances = self.world.accel.instances_host;
-                actual_size_instances.data.len = self.world.accel.instance_count;
-                var actual_size_world_to_instance = self.world.accel.world_to_instance_host;
-                actual_size_world_to_instance.data.len = self.world.accel.instance_count;
-                self.commands.recordUploadBuffer(vk.AccelerationStructureInstanceKHR, &self.vc, self.world.accel.instances_device, actual_size_instances);
-                self.commands.recordUploadBuffer(Mat3x4, &self.vc, self.world.accel.world_to_instance_device, actual_size_world_to_instance);
+                self.commands.recordStageBuffer(vk.AccelerationStructureInstanceKHR, &self.vc, &self.vk_allocator, self.world.accel.instances_device.buffer, self.world.accel.instances_host.items, 0) catch return false;
+                self.commands.recordStageBuffer(Mat3x4, &self.vc, &self.vk_allocator, self.world.accel.world_to_instance_device.buffer, self.world.accel.world_to_instance_host.items, 0) catch return false;
 
                 const update_barriers = [_]vk.BufferMemoryBarrier2 {
                     .{
@@ -238,7 +496,7 @@ pub const HdMoonshine = struct {
                         .dst_access_mask = .{ .acceleration_structure_read_bit_khr = true, .shader_storage_read_bit = true },
                         .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
                         .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-                        .buffer = self.world.accel.instances_device.handle,
+                        .buffer = self.world.accel.instances_device.handle(),
                         .offset = 0,
                         .size = vk.WHOLE_SIZE,
                     },
@@ -249,7 +507,7 @@ pub const HdMoonshine = struct {
                         .dst_access_mask = .{ .shader_storage_read_bit = true },
                         .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
                         .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
-                        .buffer = self.world.accel.world_to_instance_device.handle,
+                        .buffer = self.world.accel.world_to_instance_device.handle(),
                         .offset = 0,
                         .size = vk.WHOLE_SIZE,
                     },
@@ -258,56 +516,21 @@ pub const HdMoonshine = struct {
                     .buffer_memory_barrier_count = update_barriers.len,
                     .p_buffer_memory_barriers = &update_barriers,
                 });
+            }
 
-                const geometry = vk.AccelerationStructureGeometryKHR {
-                    .geometry_type = .instances_khr,
-                    .flags = .{ .opaque_bit_khr = true },
-                    .geometry = .{
-                        .instances = .{
-                            .array_of_pointers = vk.FALSE,
-                            .data = .{
-                                .device_address = self.world.accel.instances_address,
-                            }
-                        }
-                    },
-                };
-
-                var geometry_info = vk.AccelerationStructureBuildGeometryInfoKHR {
-                    .type = .top_level_khr,
-                    .flags = .{ .prefer_fast_trace_bit_khr = true, .allow_update_bit_khr = true },
-                    .mode = .update_khr,
-                    .src_acceleration_structure = self.world.accel.tlas_handle,
-                    .dst_acceleration_structure = self.world.accel.tlas_handle,
-                    .geometry_count = 1,
-                    .p_geometries = @ptrCast(&geometry),
-                    .scratch_data = .{
-                        .device_address = self.world.accel.tlas_update_scratch_address,
-                    },
-                };
-
-                const build_info = vk.AccelerationStructureBuildRangeInfoKHR {
-                    .primitive_count = self.world.accel.instance_count,
-                    .first_vertex = 0,
-                    .primitive_offset = 0,
-                    .transform_offset = 0,
-                };
-
-                const build_info_ref = &build_info;
-
-                self.vc.device.cmdBuildAccelerationStructuresKHR(self.commands.buffer, 1, @ptrCast(&geometry_info), @ptrCast(&build_info_ref));
+            // instances added or removed since the last render only get built into the TLAS now, all at once,
+            // while transform and visibility changes just refit it unless it's gotten too loose
+            if (self.need_instance_update or self.world.accel.tlas_dirty) {
+                const scope = self.commands.beginScope(&self.vc, "update TLAS");
+                tlas_scratch_buffer = self.world.accel.recordUpdateTlas(&self.vc, &self.vk_allocator, self.allocator.allocator(), self.commands.buffer) catch return false;
+                self.commands.endScope(&self.vc, scope);
+            }
 
-                const ray_trace_barriers = [_]vk.MemoryBarrier2 {
-                    .{
-                        .src_stage_mask = .{ .acceleration_structure_build_bit_khr = true },
-                        .src_access_mask = .{ .acceleration_structure_write_bit_khr = true },
-                        .dst_stage_mask = .{ .ray_tracing_shader_bit_khr = true },
-                        .dst_access_mask = .{ .acceleration_structure_read_bit_khr = true },
-                    }
-                };
-                self.vc.device.cmdPipelineBarrier2(self.commands.buffer, &vk.DependencyInfo {
-                    .memory_barrier_count = ray_trace_barriers.len,
-                    .p_memory_barriers = &ray_trace_barriers,
-                });
+            // same for light sampling, where only emitters that were added, moved or hidden get their areas recomputed
+            if (self.world.accel.needsEmitterUpdate(pipeline_settings.mesh_light_tree)) {
+                const scope = self.commands.beginScope(&self.vc, "update emitters");
+                self.world.accel.recordUpdateEmitters(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, self.world.meshes, pipeline_settings.mesh_light_tree) catch return false;
+                self.commands.endScope(&self.vc, scope);
             }
 
             self.need_instance_update = false;
@@ -326,12 +549,106 @@ pub const HdMoonshine = struct {
         self.vc.device.cmdPushConstants(self.commands.buffer, self.pipeline.layout, .{ .raygen_bit_khr = true }, 0, bytes.len, bytes);
 
         // trace our stuff
+        const scope = self.commands.beginScope(&self.vc, "trace rays");
         self.pipeline.recordTraceRays(&self.vc, self.commands.buffer, self.camera.sensors.items[sensor].extent);
+        self.commands.endScope(&self.vc, scope);
+
+        const readback = &self.readbacks.items[sensor];
+        if (readback.format == .f32x4) {
+            self.camera.sensors.items[sensor].recordPrepareForCopy(&self.vc, self.commands.buffer, .{ .ray_tracing_shader_bit_khr = true }, .{ .copy_bit = true });
+            self.recordCopySensor(sensor, back_buffer.handle);
+        } else {
+            self.recordConvertSensor(sensor, readback.*);
+
+            // only ever read by the conversion, but leave it in the layout the next capture expects
+            self.camera.sensors.items[sensor].recordPrepareForCopy(&self.vc, self.commands.buffer, .{ .ray_tracing_shader_bit_khr = true, .compute_shader_bit = true }, .{});
+
+            const region = vk.BufferCopy {
+                .src_offset = 0,
+                .dst_offset = 0,
+                .size = back_buffer.data.len,
+            };
+            self.vc.device.cmdCopyBuffer(self.commands.buffer, readback.converted.handle, back_buffer.handle, 1, @ptrCast(&region));
+        }
 
-        // copy our stuff
-        self.camera.sensors.items[sensor].recordPrepareForCopy(&self.vc, self.commands.buffer, .{ .ray_tracing_shader_bit_khr = true }, .{ .copy_bit = true });
+        const ticket = self.commands.submit(&self.vc) catch return false;
+        if (tlas_scratch_buffer.handle != .null_handle) {
+            self.destruction_queue.add(self.allocator.allocator(), ticket, tlas_scratch_buffer) catch unreachable; // TODO: error handling
+            tlas_scratch_buffer = .{};
+        }
+
+        self.camera.sensors.items[sensor].sample_count += samples_per_run;
 
-        // copy rendered image to host-visible staging buffer
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        self.in_flight = .{
+            .sensor = sensor,
+            .ticket = ticket,
+            .sample_count = self.camera.sensors.items[sensor].sample_count,
+        };
+
+        return true;
+    }
+
+    // takes the big mutex once the in-flight render and everything else submitted,
+    // e.g. uploads, updates and their acquires, are done, so that anything they use may be changed
+    fn lockIdle(self: *HdMoonshine) void {
+        self.lock();
+        self.waitIdle();
+    }
+
+    // what lockIdle waits for, for when it's only known to be needed once locked
+    //
+    // assumes big mutex is held
+    fn waitIdle(self: *HdMoonshine) void {
+        const span = tracing.begin("wait for GPU");
+        defer span.end();
+        self.finishRender() catch unreachable; // TODO: error handling
+        self.transfer_commands.wait(&self.vc, self.transfer_commands.last_ticket) catch unreachable; // TODO: error handling
+        self.commands.wait(&self.vc, self.commands.last_ticket) catch unreachable; // TODO: error handling
+    }
+
+    // takes the big mutex, tracing how long it was contended for
+    //
+    // enough for edits of host-side state that only the next render reads,
+    // e.g. transforms, lenses, and material updates
+    fn lock(self: *HdMoonshine) void {
+        tracing.lock(&self.mutex, "wait for big mutex");
+    }
+
+    // waits for the in-flight render, if any, and publishes it
+    //
+    // assumes big mutex is held
+    fn finishRender(self: *HdMoonshine) !void {
+        const in_flight = blk: {
+            self.readback_mutex.lock();
+            defer self.readback_mutex.unlock();
+            break :blk self.in_flight orelse return;
+        };
+
+        try self.commands.wait(&self.vc, in_flight.ticket);
+
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        self.publishIfDone();
+    }
+
+    // a render into a mapped readback stays in flight until it's unmapped, or the next render drops it
+    //
+    // assumes readback_mutex is held
+    fn publishIfDone(self: *HdMoonshine) void {
+        const in_flight = self.in_flight orelse return;
+        const readback = &self.readbacks.items[in_flight.sensor];
+        if (readback.pins != 0) return;
+        if (!(self.commands.isDone(&self.vc, in_flight.ticket) catch false)) return;
+
+        readback.front = 1 - readback.front;
+        readback.published_sample_count = in_flight.sample_count;
+        self.in_flight = null;
+    }
+
+    // copies rendered image to host-visible buffer as is
+    fn recordCopySensor(self: *HdMoonshine, sensor: Camera.SensorHandle, dst: vk.Buffer) void {
         const copy = vk.BufferImageCopy {
             .buffer_offset = 0,
             .buffer_row_length = 0,
@@ -353,38 +670,290 @@ pub const HdMoonshine = struct {
                 .depth = 1,
             },
         };
-        self.vc.device.cmdCopyImageToBuffer(self.commands.buffer, self.camera.sensors.items[sensor].image.handle, .transfer_src_optimal, self.output_buffers.items[sensor].handle, 1, @ptrCast(&copy));
+        self.vc.device.cmdCopyImageToBuffer(self.commands.buffer, self.camera.sensors.items[sensor].image.handle, .transfer_src_optimal, dst, 1, @ptrCast(&copy));
+    }
 
-        self.commands.submitAndIdleUntilDone(&self.vc) catch return false;
+    // packs rendered image into the readback's compact format on the GPU,
+    // so that less has to cross the bus
+    fn recordConvertSensor(self: *HdMoonshine, sensor: Camera.SensorHandle, readback: Readback) void {
+        const captured = self.camera.sensors.items[sensor];
+
+        self.vc.device.cmdPipelineBarrier2(self.commands.buffer, &vk.DependencyInfo {
+            .memory_barrier_count = 1,
+            .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+                .src_stage_mask = .{ .ray_tracing_shader_bit_khr = true },
+                .src_access_mask = .{ .shader_storage_write_bit = true },
+                .dst_stage_mask = .{ .compute_shader_bit = true },
+                .dst_access_mask = .{ .shader_storage_read_bit = true },
+            }),
+        });
+
+        self.output_pipeline.recordBindPipeline(&self.vc, self.commands.buffer);
+        self.output_pipeline.recordPushDescriptors(&self.vc, self.commands.buffer, .{
+            .src_image = captured.image.view,
+            .dst_buffer = readback.converted.handle,
+        });
+        self.output_pipeline.recordPushConstants(&self.vc, self.commands.buffer, .{
+            .format = readback.format,
+            .exposure = self.exposure,
+        });
+        const shader_local_size = 8; // must be kept in sync with shader -- looks like HLSL doesn't support setting this via spec constants
+        const scope = self.commands.beginScope(&self.vc, "convert output");
+        self.output_pipeline.recordDispatch(&self.vc, self.commands.buffer, .{
+            .width = std.math.divCeil(u32, captured.extent.width, shader_local_size) catch unreachable,
+            .height = std.math.divCeil(u32, captured.extent.height, shader_local_size) catch unreachable,
+            .depth = 1,
+        });
+        self.commands.endScope(&self.vc, scope);
+
+        self.vc.device.cmdPipelineBarrier2(self.commands.buffer, &vk.DependencyInfo {
+            .buffer_memory_barrier_count = 1,
+            .p_buffer_memory_barriers = @ptrCast(&vk.BufferMemoryBarrier2 {
+                .src_stage_mask = .{ .compute_shader_bit = true },
+                .src_access_mask = .{ .shader_storage_write_bit = true },
+                .dst_stage_mask = .{ .copy_bit = true },
+                .dst_access_mask = .{ .transfer_read_bit = true },
+                .src_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                .dst_queue_family_index = vk.QUEUE_FAMILY_IGNORED,
+                .buffer = readback.converted.handle,
+                .offset = 0,
+                .size = vk.WHOLE_SIZE,
+            }),
+        });
+    }
 
-        self.camera.sensors.items[sensor].sample_count += samples_per_run;
+    // assumes big mutex is held
+    fn clearAllSensors(self: *HdMoonshine) void {
+        self.camera.clearAllSensors();
 
-        return true;
+        // so nobody thinks what's currently published, or about to be, is still up to date
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        for (self.readbacks.items) |*readback| readback.published_sample_count = 0;
+        if (self.in_flight) |*in_flight| in_flight.sample_count = 0;
     }
 
     pub export fn HdMoonshineRebuildPipeline(self: *HdMoonshine) bool {
-        self.mutex.lock();
+        self.lockIdle();
         defer self.mutex.unlock();
         const old_pipeline = self.pipeline.recreate(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, pipeline_settings) catch return false;
         self.vc.device.destroyPipeline(old_pipeline, null);
-        self.camera.clearAllSensors();
+        self.clearAllSensors();
         return true;
     }
 
-    pub export fn HdMoonshineCreateMesh(self: *HdMoonshine, positions: [*]const F32x3, maybe_normals: ?[*]const F32x3, maybe_texcoords: ?[*]const F32x2, position_count: usize, indices: [*]const U32x3, index_count: usize) MeshManager.Handle {
-        self.mutex.lock();
-        defer self.mutex.unlock();
+    pub export fn HdMoonshineCreateMesh(self: *HdMoonshine, positions: [*]const F32x3, position_count: usize, maybe_normals: ?[*]const F32x3, normal_count: usize, maybe_texcoords: ?[*]const F32x2, texcoord_count: usize, indices: [*]const U32x3, index_count: usize) MeshManager.Handle {
+        const handle = HdMoonshineStageMesh(self, positions, position_count, maybe_normals, normal_count, maybe_texcoords, texcoord_count, indices, index_count);
+        HdMoonshineFlushStagedMeshes(self);
+        return handle;
+    }
+
+    // copies mesh data and reserves a handle for it without touching the GPU --
+    // mesh is not usable until the next HdMoonshineFlushStagedMeshes
+    //
+    // normals and texcoords are per-vertex, so are dropped unless there's one per position
+    pub export fn HdMoonshineStageMesh(self: *HdMoonshine, positions: [*]const F32x3, position_count: usize, maybe_normals: ?[*]const F32x3, normal_count: usize, maybe_texcoords: ?[*]const F32x2, texcoord_count: usize, indices: [*]const U32x3, index_count: usize) MeshManager.Handle {
+        const allocator = self.allocator.allocator();
+
+        if (maybe_normals != null and normal_count != position_count) std.log.warn("ignoring {} normals for mesh with {} positions", .{ normal_count, position_count });
+        if (maybe_texcoords != null and texcoord_count != position_count) std.log.warn("ignoring {} texcoords for mesh with {} positions", .{ texcoord_count, position_count });
+
+        // do the copies outside of the lock
         const mesh = MeshManager.Mesh {
-            .positions = positions[0..position_count],
-            .normals = if (maybe_normals) |normals| normals[0..index_count * 3] else null,
-            .texcoords = if (maybe_texcoords) |texcoords| texcoords[0..index_count * 3] else null,
-            .indices = indices[0..index_count],
+            .positions = allocator.dupe(F32x3, positions[0..position_count]) catch unreachable, // TODO: error handling
+            .normals = if (maybe_normals != null and normal_count == position_count) allocator.dupe(F32x3, maybe_normals.?[0..normal_count]) catch unreachable else null, // TODO: error handling
+            .texcoords = if (maybe_texcoords != null and texcoord_count == position_count) allocator.dupe(F32x2, maybe_texcoords.?[0..texcoord_count]) catch unreachable else null, // TODO: error handling
+            .indices = allocator.dupe(U32x3, indices[0..index_count]) catch unreachable, // TODO: error handling
         };
-        return self.world.meshes.upload(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, mesh) catch unreachable; // TODO: error handling
+
+        self.staging_mutex.lock();
+        defer self.staging_mutex.unlock();
+        self.staged_meshes.append(allocator, mesh) catch unreachable; // TODO: error handling
+        const handle = self.next_mesh_handle;
+        self.next_mesh_handle += 1;
+        return handle;
+    }
+
+    // uploads all staged meshes in a single submit, and all staged updates
+    // and the BLAS refits they need in another
+    pub export fn HdMoonshineFlushStagedMeshes(self: *HdMoonshine) void {
+        // no need to wait for the in-flight render -- new meshes are
+        // written only in new buffers and address slots it doesn't use,
+        // and updates wait for it on the GPU
+        self.lock();
+        defer self.mutex.unlock();
+        self.flushStagedMeshes();
+        self.flushStagedMeshUpdates();
+    }
+
+    // for when an allocation of bytes failed for lack of device memory --
+    // shrinks textures until that much more would fit in the budget, and waits
+    // for the old images to actually be freed so the allocation can be retried
+    //
+    // returns false if there was nothing left to shrink
+    //
+    // assumes big mutex is held, and no commands are recording
+    fn shrinkTexturesToFree(self: *HdMoonshine, bytes: vk.DeviceSize) !bool {
+        try self.finishRender();
+
+        try self.commands.startRecording(&self.vc);
+        const needed = @max(bytes, self.vk_allocator.getBudget(&self.vc).excess(bytes));
+        const freed = try self.world.materials.textures.recordDownsampleToFree(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, &self.destruction_queue, needed);
+        const ticket = try self.commands.submit(&self.vc);
+
+        try self.commands.wait(&self.vc, ticket);
+        self.destruction_queue.collect(&self.vc, ticket);
+
+        return freed != 0;
+    }
+
+    // assumes big mutex is held
+    fn flushStagedMeshes(self: *HdMoonshine) void {
+        const allocator = self.allocator.allocator();
+
+        // grab staged meshes so staging can continue while we upload, along with
+        // the next handle to be reserved, which is one past the last of theirs
+        var next_handle: MeshManager.Handle = undefined;
+        var staged_meshes = blk: {
+            self.staging_mutex.lock();
+            defer self.staging_mutex.unlock();
+            const staged_meshes = self.staged_meshes;
+            self.staged_meshes = .{};
+            next_handle = self.next_mesh_handle;
+            break :blk staged_meshes;
+        };
+        defer staged_meshes.deinit(allocator);
+        defer for (staged_meshes.items) |*mesh| mesh.destroy(allocator);
+
+        if (staged_meshes.items.len == 0) return;
+
+        const span = tracing.begin("upload staged meshes");
+        defer span.end();
+
+        // mesh handles are already out, so there's no skipping any -- if they don't
+        // fit, make room by shrinking textures until they do
+        const first_handle = while (true) {
+            break self.world.meshes.uploadManyWithTransfer(&self.vc, &self.vk_allocator, allocator, &self.transfer_commands, &self.commands, staged_meshes.items) catch |err| switch (err) {
+                error.OutOfDeviceMemory => {
+                    var bytes: vk.DeviceSize = 0;
+                    for (staged_meshes.items) |mesh| bytes += mesh.byteSize();
+                    if (self.shrinkTexturesToFree(bytes) catch unreachable) continue; // TODO: error handling
+                    @panic("out of device memory for meshes, even with textures shrunk");
+                },
+                else => unreachable, // TODO: error handling
+            };
+        };
+
+        // handles were reserved in order of staging, and since flushes happen
+        // under the big mutex uploads happen in that order too
+        std.debug.assert(first_handle + staged_meshes.items.len == next_handle);
+    }
+
+    // assumes big mutex is held, and that meshes being updated have been flushed
+    fn flushStagedMeshUpdates(self: *HdMoonshine) void {
+        const allocator = self.allocator.allocator();
+
+        var updates = blk: {
+            self.staging_mutex.lock();
+            defer self.staging_mutex.unlock();
+            const updates = self.staged_mesh_updates;
+            self.staged_mesh_updates = .{};
+            break :blk updates;
+        };
+        defer updates.deinit(allocator);
+        defer for (updates.values()) |update| update.destroy(allocator);
+
+        if (updates.count() == 0) return;
+
+        const span = tracing.begin("update meshes");
+        defer span.end();
+
+        self.commands.startRecording(&self.vc) catch unreachable; // TODO: error handling
+
+        // the in-flight render may still be reading what is about to be overwritten
+        self.vc.device.cmdPipelineBarrier2(self.commands.buffer, &vk.DependencyInfo {
+            .memory_barrier_count = 1,
+            .p_memory_barriers = @ptrCast(&vk.MemoryBarrier2 {
+                .src_stage_mask = .{ .acceleration_structure_build_bit_khr = true, .ray_tracing_shader_bit_khr = true },
+                .dst_stage_mask = .{ .copy_bit = true, .acceleration_structure_build_bit_khr = true },
+            }),
+        });
+
+        var moved = std.ArrayList(MeshManager.Handle).init(allocator);
+        defer moved.deinit();
+        for (updates.keys(), updates.values()) |mesh, update| {
+            if (update.positions) |positions| {
+                self.world.meshes.recordUpdatePositions(&self.vc, &self.vk_allocator, &self.commands, mesh, positions) catch unreachable; // TODO: error handling
+                moved.append(mesh) catch unreachable; // TODO: error handling
+            }
+            if (update.normals) |normals| {
+                self.world.meshes.recordUpdateNormals(&self.vc, &self.vk_allocator, &self.commands, mesh, normals) catch unreachable; // TODO: error handling
+            }
+        }
+
+        const scratch_buffers = self.world.accel.recordRefitMeshes(&self.vc, &self.vk_allocator, allocator, &self.commands, self.world.meshes, moved.items) catch unreachable; // TODO: error handling
+        defer allocator.free(scratch_buffers);
+
+        const ticket = self.commands.submit(&self.vc) catch unreachable; // TODO: error handling
+        for (scratch_buffers) |scratch_buffer| {
+            self.destruction_queue.add(allocator, ticket, scratch_buffer) catch unreachable; // TODO: error handling
+        }
+
+        // TLAS refit picks up new BLAS bounds
+        if (moved.items.len != 0) self.need_instance_update = true;
+        self.clearAllSensors();
+    }
+
+    // positions must have same count as mesh was created with
+    //
+    // copied and applied on the next HdMoonshineFlushStagedMeshes
+    pub export fn HdMoonshineUpdateMeshPositions(self: *HdMoonshine, mesh: MeshManager.Handle, positions: [*]const F32x3, position_count: usize) void {
+        const allocator = self.allocator.allocator();
+        const copy = allocator.dupe(F32x3, positions[0..position_count]) catch unreachable; // TODO: error handling
+
+        self.staging_mutex.lock();
+        defer self.staging_mutex.unlock();
+        const result = self.staged_mesh_updates.getOrPutValue(allocator, mesh, .{}) catch unreachable; // TODO: error handling
+        if (result.value_ptr.positions) |old| allocator.free(old);
+        result.value_ptr.positions = copy;
+    }
+
+    // normals must have same count as mesh was created with, and mesh must have been created with normals
+    //
+    // copied and applied on the next HdMoonshineFlushStagedMeshes
+    pub export fn HdMoonshineUpdateMeshNormals(self: *HdMoonshine, mesh: MeshManager.Handle, normals: [*]const F32x3, normal_count: usize) void {
+        const allocator = self.allocator.allocator();
+        const copy = allocator.dupe(F32x3, normals[0..normal_count]) catch unreachable; // TODO: error handling
+
+        self.staging_mutex.lock();
+        defer self.staging_mutex.unlock();
+        const result = self.staged_mesh_updates.getOrPutValue(allocator, mesh, .{}) catch unreachable; // TODO: error handling
+        if (result.value_ptr.normals) |old| allocator.free(old);
+        result.value_ptr.normals = copy;
+    }
+
+    // mesh must no longer be used by any instance
+    pub export fn HdMoonshineDestroyMesh(self: *HdMoonshine, mesh: MeshManager.Handle) void {
+        // no need to wait for the in-flight render -- buffers are only freed once it's done
+        self.lock();
+        defer self.mutex.unlock();
+        const allocator = self.allocator.allocator();
+
+        // may still be staged, and may still have updates that are now pointless
+        if (mesh >= self.world.meshes.meshes.len) self.flushStagedMeshes();
+        {
+            self.staging_mutex.lock();
+            defer self.staging_mutex.unlock();
+            if (self.staged_mesh_updates.fetchSwapRemove(mesh)) |update| update.value.destroy(allocator);
+        }
+
+        // its upload, updates, and the renders that used it were all submitted to commands by now,
+        // with transfers waited on by commands' acquires
+        self.world.meshes.destroyMeshAfter(allocator, &self.destruction_queue, self.commands.last_ticket, mesh) catch unreachable; // TODO: error handling
     }
 
     pub export fn HdMoonshineCreateSolidTexture1(self: *HdMoonshine, source: f32, name: [*:0]const u8) TextureManager.Handle {
-        self.mutex.lock();
+        self.lockIdle();
         defer self.mutex.unlock();
         return self.world.materials.textures.upload(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, TextureManager.Source {
             .f32x1 = source,
@@ -392,7 +961,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineCreateSolidTexture2(self: *HdMoonshine, source: F32x2, name: [*:0]const u8) TextureManager.Handle {
-        self.mutex.lock();
+        self.lockIdle();
         defer self.mutex.unlock();
         return self.world.materials.textures.upload(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, TextureManager.Source {
             .f32x2 = source,
@@ -400,7 +969,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineCreateSolidTexture3(self: *HdMoonshine, source: F32x3, name: [*:0]const u8) TextureManager.Handle {
-        self.mutex.lock();
+        self.lockIdle();
         defer self.mutex.unlock();
         return self.world.materials.textures.upload(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, TextureManager.Source {
             .f32x3 = source,
@@ -408,7 +977,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineCreateRawTexture(self: *HdMoonshine, data: [*]u8, extent: vk.Extent2D, format: TextureFormat, name: [*:0]const u8) TextureManager.Handle {
-        self.mutex.lock();
+        self.lockIdle();
         defer self.mutex.unlock();
         const bytes = std.mem.sliceAsBytes(data[0..extent.width * extent.height * format.pixelSizeInBytes()]);
         return self.world.materials.textures.upload(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, TextureManager.Source {
@@ -416,12 +985,88 @@ pub const HdMoonshine = struct {
                 .bytes = bytes,
                 .extent = extent,
                 .format = format.toVk(),
+                .grey_alpha = format.isGreyAlpha(),
             },
         }, std.mem.span(name)) catch unreachable; // TODO: error handling
     }
 
+    // uploads all textures in a single submit, unless device memory runs out, in
+    // which case other textures are shrunk to make room and the rest are retried
+    //
+    // returns how many were uploaded -- any past that didn't fit even with
+    // everything else shrunk, and have no handles written
+    pub export fn HdMoonshineCreateRawTextures(self: *HdMoonshine, textures: [*]const RawTexture, count: usize, handles: [*]TextureManager.Handle) usize {
+        // no need to wait for the in-flight render -- textures go in new
+        // descriptor slots, which may be written while pending
+        self.lock();
+        defer self.mutex.unlock();
+
+        const span = tracing.begin("upload textures");
+        defer span.end();
+
+        const allocator = self.allocator.allocator();
+        const sources = allocator.alloc(TextureManager.Source.Raw, count) catch unreachable; // TODO: error handling
+        defer allocator.free(sources);
+        const names = allocator.alloc([:0]const u8, count) catch unreachable; // TODO: error handling
+        defer allocator.free(names);
+        for (textures[0..count], sources, names) |texture, *source, *name| {
+            source.* = TextureManager.Source.Raw {
+                .bytes = texture.data[0..texture.extent.width * texture.extent.height * texture.format.pixelSizeInBytes()],
+                .extent = texture.extent,
+                .format = texture.format.toVk(),
+                .grey_alpha = texture.format.isGreyAlpha(),
+            };
+            name.* = std.mem.span(texture.name);
+        }
+
+        var done: usize = 0;
+        while (done < count) {
+            // upload on the transfer queue, then have the next render wait for it on the GPU
+            var uploaded: usize = 0;
+            self.transfer_commands.startRecording(&self.vc) catch unreachable; // TODO: error handling
+            const result = self.world.materials.textures.recordUploadRaws(&self.vc, &self.vk_allocator, allocator, &self.transfer_commands, sources[done..], names[done..], handles[done..count], &uploaded, self.commands.queue_family_index);
+            const ticket = self.transfer_commands.submit(&self.vc) catch unreachable; // TODO: error handling
+
+            self.commands.startRecording(&self.vc) catch unreachable; // TODO: error handling
+            self.commands.waitForOther(&self.transfer_commands, ticket) catch unreachable; // TODO: error handling
+            self.world.materials.textures.recordAcquire(&self.vc, allocator, &self.commands, self.transfer_commands.queue_family_index, handles[done..][0..uploaded]) catch unreachable; // TODO: error handling
+            done += uploaded;
+
+            result catch |err| switch (err) {
+                error.OutOfDeviceMemory => {
+                    _ = self.commands.submit(&self.vc) catch unreachable; // TODO: error handling
+                    if (!(self.shrinkTexturesToFree(sources[done].bytes.len) catch unreachable)) break; // TODO: error handling
+                    continue;
+                },
+                else => unreachable, // TODO: error handling
+            };
+
+            // if that went over budget, shrink textures until back under -- this rewrites
+            // their descriptors, so unlike the upload, it has to wait for the in-flight render
+            const excess = self.vk_allocator.getBudget(&self.vc).excess(0);
+            if (excess != 0) {
+                self.finishRender() catch unreachable; // TODO: error handling
+                _ = self.world.materials.textures.recordDownsampleToFree(&self.vc, &self.vk_allocator, allocator, &self.commands, &self.destruction_queue, excess) catch unreachable; // TODO: error handling
+            }
+
+            _ = self.commands.submit(&self.vc) catch unreachable; // TODO: error handling
+        }
+
+        return done;
+    }
+
+    pub export fn HdMoonshineDestroyTexture(self: *HdMoonshine, texture: TextureManager.Handle) void {
+        // no need to wait for the in-flight render -- the image is only destroyed once it's done
+        self.lock();
+        defer self.mutex.unlock();
+
+        // its upload, acquire and any downsampling, and the renders that used it were all
+        // submitted to commands by now, with transfers waited on by commands' acquires
+        self.world.materials.textures.destroyTexture(self.allocator.allocator(), &self.destruction_queue, self.commands.last_ticket, texture) catch unreachable; // TODO: error handling
+    }
+
     pub export fn HdMoonshineCreateMaterial(self: *HdMoonshine, material: Material) MaterialManager.Handle {
-        self.mutex.lock();
+        self.lockIdle();
         defer self.mutex.unlock();
         return self.world.materials.upload(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, MaterialManager.MaterialInfo {
             .normal = material.normal,
@@ -433,7 +1078,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineSetMaterialNormal(self: *HdMoonshine, material: MaterialManager.Handle, image: TextureManager.Handle) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         const result = self.material_updates.getOrPut(self.allocator.allocator(), material) catch unreachable; // TODO: error handling
         if (!result.found_existing) result.value_ptr.* = .{};
@@ -441,7 +1086,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineSetMaterialEmissive(self: *HdMoonshine, material: MaterialManager.Handle, image: TextureManager.Handle) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         const result = self.material_updates.getOrPut(self.allocator.allocator(), material) catch unreachable; // TODO: error handling
         if (!result.found_existing) result.value_ptr.* = .{};
@@ -449,7 +1094,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineSetMaterialColor(self: *HdMoonshine, material: MaterialManager.Handle, image: TextureManager.Handle) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         const result = self.material_updates.getOrPut(self.allocator.allocator(), material) catch unreachable; // TODO: error handling
         if (!result.found_existing) result.value_ptr.* = .{};
@@ -457,7 +1102,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineSetMaterialMetalness(self: *HdMoonshine, material: MaterialManager.Handle, image: TextureManager.Handle) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         const result = self.material_updates.getOrPut(self.allocator.allocator(), material) catch unreachable; // TODO: error handling
         if (!result.found_existing) result.value_ptr.* = .{};
@@ -465,7 +1110,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineSetMaterialRoughness(self: *HdMoonshine, material: MaterialManager.Handle, image: TextureManager.Handle) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         const result = self.material_updates.getOrPut(self.allocator.allocator(), material) catch unreachable; // TODO: error handling
         if (!result.found_existing) result.value_ptr.* = .{};
@@ -473,7 +1118,7 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineSetMaterialIOR(self: *HdMoonshine, material: MaterialManager.Handle, ior: f32) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         const result = self.material_updates.getOrPut(self.allocator.allocator(), material) catch unreachable; // TODO: error handling
         if (!result.found_existing) result.value_ptr.* = .{};
@@ -481,77 +1126,283 @@ pub const HdMoonshine = struct {
     }
 
     pub export fn HdMoonshineCreateInstance(self: *HdMoonshine, transform: Mat3x4, geometries: [*]const Accel.Geometry, geometry_count: usize, visible: bool) Accel.Handle {
-        self.mutex.lock();
+        var handle: Accel.Handle = undefined;
+        HdMoonshineCreateInstances(self, (&transform)[0..1], 1, geometries, geometry_count, visible, (&handle)[0..1]);
+        return handle;
+    }
+
+    // instances of the same geometries, one per transform, all uploaded in a single submit
+    pub export fn HdMoonshineCreateInstances(self: *HdMoonshine, transforms: [*]const Mat3x4, count: usize, geometries: [*]const Accel.Geometry, geometry_count: usize, visible: bool, handles: [*]Accel.Handle) void {
+        self.lock();
         defer self.mutex.unlock();
-        const instance = Accel.Instance {
-            .transform = transform,
-            .visible = visible,
-            .geometries = geometries[0..geometry_count],
-        };
-        self.camera.clearAllSensors();
-        return self.world.accel.uploadInstance(&self.vc, &self.vk_allocator, self.allocator.allocator(), &self.commands, self.world.meshes, instance) catch unreachable; // TODO: error handling
+        // make sure any staged meshes these instances refer to actually exist
+        for (geometries[0..geometry_count]) |geometry| {
+            if (geometry.mesh >= self.world.meshes.meshes.len) {
+                self.flushStagedMeshes();
+                break;
+            }
+        }
+
+        const allocator = self.allocator.allocator();
+
+        // only building a new BLAS needs the GPU idle, new instances otherwise
+        // go past anything the in-flight render refers to
+        if (!(self.world.accel.hasBlasFor(allocator, geometries[0..geometry_count]) catch unreachable)) self.waitIdle(); // TODO: error handling
+
+        const instances = allocator.alloc(Accel.Instance, count) catch unreachable; // TODO: error handling
+        defer allocator.free(instances);
+        for (instances, transforms[0..count]) |*instance, transform| {
+            instance.* = Accel.Instance {
+                .transform = transform,
+                .visible = visible,
+                .geometries = geometries[0..geometry_count],
+            };
+        }
+        self.clearAllSensors();
+        self.world.accel.uploadInstances(&self.vc, &self.vk_allocator, allocator, &self.commands, self.world.meshes, instances, handles[0..count]) catch unreachable; // TODO: error handling
     }
 
     pub export fn HdMoonshineDestroyInstance(self: *HdMoonshine, handle: Accel.Handle) void {
-        HdMoonshineSetInstanceVisibility(self, handle, false); // sike. TODO: proper destruction
+        self.lockIdle();
+        defer self.mutex.unlock();
+        self.world.accel.destroyInstance(&self.vc, self.allocator.allocator(), handle) catch unreachable; // TODO: error handling
+        self.need_instance_update = true;
+        self.clearAllSensors();
     }
 
     pub export fn HdMoonshineSetInstanceVisibility(self: *HdMoonshine, handle: Accel.Handle, visible: bool) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
-        self.world.accel.instances_host.data[handle].instance_custom_index_and_mask.mask = if (visible) 0xFF else 0x00;
+        self.world.accel.updateVisibility(handle, visible);
         self.need_instance_update = true;
-        self.camera.clearAllSensors();
+        self.clearAllSensors();
     }
 
     pub export fn HdMoonshineSetInstanceTransform(self: *HdMoonshine, handle: Accel.Handle, new_transform: Mat3x4) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
-        self.world.accel.instances_host.data[handle].transform = @bitCast(new_transform);
+        self.world.accel.updateTransform(handle, new_transform);
         self.need_instance_update = true;
-        self.camera.clearAllSensors();
+        self.clearAllSensors();
+    }
+
+    // all get uploaded together on next render
+    pub export fn HdMoonshineSetInstanceTransforms(self: *HdMoonshine, handles: [*]const Accel.Handle, new_transforms: [*]const Mat3x4, count: usize) void {
+        self.lock();
+        defer self.mutex.unlock();
+        for (handles[0..count], new_transforms[0..count]) |handle, new_transform| {
+            self.world.accel.updateTransform(handle, new_transform);
+        }
+        self.need_instance_update = true;
+        self.clearAllSensors();
     }
 
-    pub export fn HdMoonshineCreateSensor(self: *HdMoonshine, extent: vk.Extent2D) Camera.SensorHandle {
-        self.mutex.lock();
+    pub export fn HdMoonshineCreateSensor(self: *HdMoonshine, extent: vk.Extent2D, format: SensorFormat) Camera.SensorHandle {
+        self.lockIdle();
         defer self.mutex.unlock();
-        self.output_buffers.append(self.allocator.allocator(), self.vk_allocator.createHostBuffer(&self.vc, [4]f32, extent.width * extent.height, .{ .transfer_dst_bit = true }) catch unreachable) catch unreachable;
-        return self.camera.appendSensor(&self.vc, &self.vk_allocator, self.allocator.allocator(), extent) catch unreachable; // TODO: error handling
+        return self.createSensor(extent, format) catch unreachable; // TODO: error handling
+    }
+
+    fn createSensor(self: *HdMoonshine, extent: vk.Extent2D, format: SensorFormat) !Camera.SensorHandle {
+        // a render buffer reallocated without actually changing can have its old sensor back as is
+        for (self.free_sensors.items, 0..) |handle, i| {
+            if (std.meta.eql(self.camera.sensors.items[handle].extent, extent) and self.readbacks.items[handle].format == format) {
+                _ = self.free_sensors.swapRemove(i);
+                self.camera.sensors.items[handle].clear();
+
+                self.readback_mutex.lock();
+                defer self.readback_mutex.unlock();
+                self.readbacks.items[handle].clear();
+                return handle;
+            }
+        }
+
+        const readback = try Readback.create(&self.vc, &self.vk_allocator, extent, format);
+        errdefer readback.destroy(&self.vc);
+
+        // otherwise take the slot of any released one, e.g. on resize, freeing what it had
+        if (self.free_sensors.getLastOrNull()) |handle| {
+            try self.camera.recreateSensor(&self.vc, &self.vk_allocator, handle, extent);
+            _ = self.free_sensors.pop();
+
+            self.readback_mutex.lock();
+            defer self.readback_mutex.unlock();
+            self.readbacks.items[handle].destroy(&self.vc);
+            self.readbacks.items[handle] = readback;
+            return handle;
+        }
+
+        // reserving may move readbacks, which are read under only readback_mutex
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        try self.readbacks.ensureUnusedCapacity(self.allocator.allocator(), 1);
+        const handle = try self.camera.appendSensor(&self.vc, &self.vk_allocator, self.allocator.allocator(), extent);
+        self.readbacks.appendAssumeCapacity(readback);
+        return handle;
+    }
+
+    // sensor must no longer be mapped, and renders into it are skipped from here on
+    //
+    // its memory is kept around for whichever sensor is created next,
+    // which waits for the in-flight render before reusing it
+    pub export fn HdMoonshineReleaseSensor(self: *HdMoonshine, sensor: Camera.SensorHandle) void {
+        self.lock();
+        defer self.mutex.unlock();
+        self.free_sensors.append(self.allocator.allocator(), sensor) catch unreachable; // TODO: error handling
+    }
+
+    // exposure is only applied on readback to 8 bit formats, so changing it keeps accumulated samples
+    pub export fn HdMoonshineSetExposure(self: *HdMoonshine, exposure: f32) void {
+        self.lock();
+        defer self.mutex.unlock();
+        self.exposure = exposure;
+
+        // have the next render republish those it applies to with the new exposure,
+        // including any the in-flight render was converting with the old one
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        for (self.readbacks.items) |*readback| {
+            if (readback.format.isExposed()) readback.published_sample_count = 0;
+        }
+        if (self.in_flight) |*in_flight| {
+            if (self.readbacks.items[in_flight.sensor].format.isExposed()) in_flight.sample_count = 0;
+        }
     }
 
-    pub export fn HdMoonshineGetSensorData(self: *const HdMoonshine, sensor: Camera.SensorHandle) [*][4]f32 {
-        return self.output_buffers.items[sensor].data.ptr;
+    // latest finished frame, which won't change until unmapped
+    //
+    // may be mapped any number of times, from any thread, as long as each is unmapped
+    pub export fn HdMoonshineMapSensorData(self: *HdMoonshine, sensor: Camera.SensorHandle) *anyopaque {
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        self.publishIfDone();
+        const readback = &self.readbacks.items[sensor];
+        readback.pins += 1;
+        return readback.buffers[readback.front].data.ptr;
+    }
+
+    pub export fn HdMoonshineUnmapSensorData(self: *HdMoonshine, sensor: Camera.SensorHandle) void {
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        self.readbacks.items[sensor].pins -= 1;
+    }
+
+    // samples in the latest finished frame
+    pub export fn HdMoonshineGetSensorSampleCount(self: *HdMoonshine, sensor: Camera.SensorHandle) u32 {
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        self.publishIfDone();
+        return self.readbacks.items[sensor].published_sample_count;
+    }
+
+    // samples in the latest frame that will be published, i.e. the in-flight one if it's of sensor
+    pub export fn HdMoonshineGetSensorSubmittedSampleCount(self: *HdMoonshine, sensor: Camera.SensorHandle) u32 {
+        self.readback_mutex.lock();
+        defer self.readback_mutex.unlock();
+        self.publishIfDone();
+        if (self.in_flight) |in_flight| {
+            if (in_flight.sensor == sensor) return in_flight.sample_count;
+        }
+        return self.readbacks.items[sensor].published_sample_count;
     }
 
     pub export fn HdMoonshineCreateLens(self: *HdMoonshine, info: Camera.Lens) Camera.LensHandle {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         return self.camera.appendLens(self.allocator.allocator(), info) catch unreachable; // TODO: error handling
     }
 
     pub export fn HdMoonshineSetLens(self: *HdMoonshine, handle: Camera.LensHandle, info: Camera.Lens) void {
-        self.mutex.lock();
+        self.lock();
         defer self.mutex.unlock();
         self.camera.lenses.items[handle] = info;
 
         // technically only need to clear sensors associated with this lens
         // but no easy mechanism to do this currently
-        self.camera.clearAllSensors();
+        self.clearAllSensors();
+    }
+
+    // writes up to capacity timings, returning how many passes there are in total
+    //
+    // names stay valid for as long as self does
+    pub export fn HdMoonshineGetPassTimings(self: *HdMoonshine, timings: [*]PassTiming, capacity: usize) usize {
+        self.lock();
+        defer self.mutex.unlock();
+
+        var count: usize = 0;
+        for ([_]*Commands { &self.commands, &self.transfer_commands }) |commands| {
+            commands.profiler.collect(&self.vc, commands.completed(&self.vc) catch return 0) catch return 0;
+            for (commands.profiler.results()) |pass| {
+                if (count < capacity) timings[count] = PassTiming {
+                    .name = pass.name.ptr,
+                    .last_ms = pass.last_ns / std.time.ns_per_ms,
+                    .average_ms = pass.averageNs() / std.time.ns_per_ms,
+                    .count = pass.count,
+                };
+                count += 1;
+            }
+        }
+        return count;
+    }
+
+    pub export fn HdMoonshineGetMemoryUsage(self: *HdMoonshine) MemoryUsage {
+        self.lock();
+        defer self.mutex.unlock();
+
+        const budget = self.vk_allocator.getBudget(&self.vc);
+        const statistics = self.vk_allocator.getStatistics();
+
+        var usage = MemoryUsage {
+            .budget = budget.budget,
+            .usage = budget.usage,
+            .mesh = undefined,
+            .accel = undefined,
+            .texture = undefined,
+            .sensor = undefined,
+            .staging = undefined,
+            .other = undefined,
+        };
+        inline for (@typeInfo(VkAllocator.Category).Enum.fields) |field| {
+            @field(usage, field.name) = statistics.categories.get(@enumFromInt(field.value)).bytes;
+        }
+        return usage;
+    }
+
+    // for spans on the C++ side -- returns the start to pass to HdMoonshineTraceEnd
+    pub export fn HdMoonshineTraceBegin(name: [*:0]const u8) u64 {
+        return if (tracing.enabled) tracing.begin(name).start_ns else 0;
+    }
+
+    // name must outlive self
+    pub export fn HdMoonshineTraceEnd(name: [*:0]const u8, start_ns: u64) void {
+        if (tracing.enabled) (tracing.Span {
+            .name = name,
+            .start_ns = start_ns,
+        }).end();
     }
 
     pub export fn HdMoonshineDestroy(self: *HdMoonshine) void {
+        tracing.writeDefault() catch |err| std.log.warn("failed to write trace: {}", .{ err });
+        self.transfer_commands.idleUntilDone(&self.vc) catch {};
+        self.commands.idleUntilDone(&self.vc) catch {};
+        self.destruction_queue.destroy(&self.vc, self.allocator.allocator());
+        for (self.staged_meshes.items) |*mesh| mesh.destroy(self.allocator.allocator());
+        self.staged_meshes.deinit(self.allocator.allocator());
+        for (self.staged_mesh_updates.values()) |update| update.destroy(self.allocator.allocator());
+        self.staged_mesh_updates.deinit(self.allocator.allocator());
         self.material_updates.deinit(self.allocator.allocator());
-        for (self.output_buffers.items) |output_buffer| {
-            output_buffer.destroy(&self.vc);
-        }
-        self.output_buffers.deinit(self.allocator.allocator());
+        for (self.readbacks.items) |readback| readback.destroy(&self.vc);
+        self.readbacks.deinit(self.allocator.allocator());
+        self.free_sensors.deinit(self.allocator.allocator());
+        self.output_pipeline.destroy(&self.vc);
         self.pipeline.destroy(&self.vc);
         self.world.destroy(&self.vc, self.allocator.allocator());
         self.background.destroy(&self.vc, self.allocator.allocator());
         self.camera.destroy(&self.vc, self.allocator.allocator());
+        self.transfer_commands.destroy(&self.vc);
         self.commands.destroy(&self.vc);
         self.vk_allocator.destroy(&self.vc, self.allocator.allocator());
-        self.vc.destroy();
+        self.vc.destroy(self.allocator.allocator());
         var alloc = self.allocator;
         alloc.allocator().destroy(self);
         _ = alloc.deinit();
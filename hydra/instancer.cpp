@@ -1,13 +1,13 @@
 #include "instancer.hpp"
 
+#include "pxr/imaging/hd/renderIndex.h"
 #include "pxr/imaging/hd/sceneDelegate.h"
 #include "pxr/imaging/hd/tokens.h"
 
 #include "pxr/base/gf/vec3f.h"
-#include "pxr/base/gf/vec4f.h"
+#include "pxr/base/gf/quatf.h"
 #include "pxr/base/gf/matrix4d.h"
-#include "pxr/base/gf/rotation.h"
-#include "pxr/base/gf/quaternion.h"
+#include "pxr/base/work/loops.h"
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -15,11 +15,24 @@ HdMoonshineInstancer::HdMoonshineInstancer(HdSceneDelegate* delegate, SdfPath co
 
 HdMoonshineInstancer::~HdMoonshineInstancer() {}
 
+static bool isTransformPrimvar(TfToken const& name) {
+    return name == HdInstancerTokens->instanceTranslations
+        || name == HdInstancerTokens->instanceRotations
+        || name == HdInstancerTokens->instanceScales
+        || name == HdInstancerTokens->instanceTransforms;
+}
+
 void HdMoonshineInstancer::Sync(HdSceneDelegate* delegate, HdRenderParam* renderParam, HdDirtyBits* dirtyBits) {
+    const SdfPath oldParentId = GetParentId();
     _UpdateInstancer(delegate, dirtyBits);
 
-    if (HdChangeTracker::IsAnyPrimvarDirty(*dirtyBits, GetId())) {
-        SdfPath const& id = GetId();
+    SdfPath const& id = GetId();
+    if (oldParentId != GetParentId()) {
+        EvictInstanceTransforms(delegate->GetRenderIndex(), oldParentId, id);
+    }
+    bool transformsDirty = HdChangeTracker::IsTransformDirty(*dirtyBits, id) || HdChangeTracker::IsInstanceIndexDirty(*dirtyBits, id);
+
+    if (HdChangeTracker::IsAnyPrimvarDirty(*dirtyBits, id)) {
         HdPrimvarDescriptorVector primvars = delegate->GetPrimvarDescriptors(id, HdInterpolationInstance);
 
         for (HdPrimvarDescriptor const& pv: primvars) {
@@ -27,84 +40,119 @@ void HdMoonshineInstancer::Sync(HdSceneDelegate* delegate, HdRenderParam* render
                 VtValue value = delegate->Get(id, pv.name);
                 if (!value.IsEmpty()) {
                     primvarMap_[pv.name] = value;
+                    transformsDirty |= isTransformPrimvar(pv.name);
                 }
             }
         }
     }
-}
-
- VtMatrix4dArray HdMoonshineInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId) {
-    GfMatrix4d instancerTransform = GetDelegate()->GetInstancerTransform(GetId());
-    VtIntArray instanceIndices = GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
 
-    VtMatrix4dArray instanceTransforms(instanceIndices.size());
+    if (transformsDirty) {
+        std::lock_guard<std::mutex> guard(cacheMutex_);
+        cache_.clear();
+    }
+}
 
-    VtValue translationsValue = primvarMap_[HdInstancerTokens->instanceTranslations];
-    VtValue rotationsValue = primvarMap_[HdInstancerTokens->instanceRotations];
-    VtValue scalesValue = primvarMap_[HdInstancerTokens->instanceScales];
-    VtValue transformsValue = primvarMap_[HdInstancerTokens->instanceTransforms];
+void HdMoonshineInstancer::Finalize(HdRenderParam* renderParam) {
+    EvictInstanceTransforms(GetDelegate()->GetRenderIndex(), GetParentId(), GetId());
+}
 
-    VtVec3dArray translations;
-    if (translationsValue.CanCast<VtVec3dArray>()) {
-        translations = translationsValue.Cast<VtVec3dArray>().UncheckedGet<VtVec3dArray>();
-    }
+void HdMoonshineInstancer::EvictInstanceTransforms(HdRenderIndex& renderIndex, SdfPath const& instancerId, SdfPath const& prototypeId) {
+    if (instancerId.IsEmpty()) return;
+    HdInstancer* instancer = renderIndex.GetInstancer(instancerId);
+    if (!instancer) return;
 
-    VtQuatdArray rotations;
-    if (rotationsValue.CanCast<VtQuatdArray>()) {
-        rotations = rotationsValue.Cast<VtQuatdArray>().UncheckedGet<VtQuatdArray>();
-    }
+    HdMoonshineInstancer* moonshineInstancer = static_cast<HdMoonshineInstancer*>(instancer);
+    std::lock_guard<std::mutex> guard(moonshineInstancer->cacheMutex_);
+    moonshineInstancer->cache_.erase(prototypeId);
+}
 
-    VtVec3dArray scales;
-    if (scalesValue.CanCast<VtVec3dArray>()) {
-        scales = scalesValue.Cast<VtVec3dArray>().UncheckedGet<VtVec3dArray>();
+template <typename T>
+static VtArray<T> getPrimvar(const TfHashMap<TfToken, VtValue, TfToken::HashFunctor>& primvarMap, TfToken const& name) {
+    const auto it = primvarMap.find(name);
+    if (it != primvarMap.end() && it->second.CanCast<VtArray<T>>()) {
+        return it->second.Cast<VtArray<T>>().template UncheckedGet<VtArray<T>>();
     }
+    return VtArray<T>();
+}
 
-    VtMatrix4dArray transforms;
-    if (transformsValue.CanCast<VtMatrix4dArray>()) {
-        transforms = transformsValue.Cast<VtMatrix4dArray>().UncheckedGet<VtMatrix4dArray>();
+std::shared_ptr<const std::vector<Mat3x4>> HdMoonshineInstancer::ComputeInstanceTransforms(SdfPath const &prototypeId) {
+    std::shared_ptr<const std::vector<Mat3x4>> parentTransforms;
+    if (!GetParentId().IsEmpty()) {
+        HdInstancer *parentInstancer = GetDelegate()->GetRenderIndex().GetInstancer(GetParentId());
+        parentTransforms = static_cast<HdMoonshineInstancer*>(parentInstancer)->ComputeInstanceTransforms(GetId());
     }
 
-    for (size_t i = 0; i < instanceIndices.size(); i++) {
-        int instanceIndex = instanceIndices[i];
-
-        GfMatrix4d out = instancerTransform;
-
-        GfMatrix4d temp;
-        if (i < translations.size()) {
-            temp.SetTranslate(translations[instanceIndex]);
-            out = temp * out;
-        }
-        if (i < rotations.size()) {
-            temp.SetRotate(rotations[instanceIndex]);
-            out = temp * out;
+    {
+        std::lock_guard<std::mutex> guard(cacheMutex_);
+        const auto it = cache_.find(prototypeId);
+        if (it != cache_.end() && it->second.parentTransforms == parentTransforms) {
+            return it->second.transforms;
         }
-        if (i < scales.size()) {
-            temp.SetScale(scales[instanceIndex]);
-            out = temp * out;
-        }
-        if (i < transforms.size()) {
-            temp = transforms[instanceIndex];
-            out = temp * out;
-        }
-
-        instanceTransforms[i] = out;
     }
 
-    if (GetParentId().IsEmpty()) {
-        return instanceTransforms;
-    }
-
-    HdInstancer *parentInstancer = GetDelegate()->GetRenderIndex().GetInstancer(GetParentId());
-    VtMatrix4dArray parentTransforms = static_cast<HdMoonshineInstancer*>(parentInstancer)->ComputeInstanceTransforms(GetId());
+    // primvarMap_ is only written in Sync, which hydra never runs alongside prototype syncs
+    const Mat3x4 instancerTransform = toMat3x4(GetDelegate()->GetInstancerTransform(GetId()));
+    const VtIntArray instanceIndices = GetDelegate()->GetInstanceIndices(GetId(), prototypeId);
+
+    const VtVec3fArray translations = getPrimvar<GfVec3f>(primvarMap_, HdInstancerTokens->instanceTranslations);
+    const VtQuatfArray rotations = getPrimvar<GfQuatf>(primvarMap_, HdInstancerTokens->instanceRotations);
+    const VtVec3fArray scales = getPrimvar<GfVec3f>(primvarMap_, HdInstancerTokens->instanceScales);
+    const VtMatrix4dArray transforms = getPrimvar<GfMatrix4d>(primvarMap_, HdInstancerTokens->instanceTransforms);
+
+    // instancer * translate * rotate * scale * transform, in float and straight into Mat3x4
+    std::vector<Mat3x4> instanceTransforms(instanceIndices.size());
+    WorkParallelForN(instanceIndices.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const size_t instanceIndex = instanceIndices[i];
+
+            const GfVec3f t = instanceIndex < translations.size() ? translations[instanceIndex] : GfVec3f(0.0f);
+            const GfVec3f s = instanceIndex < scales.size() ? scales[instanceIndex] : GfVec3f(1.0f);
+
+            float qw = 1.0f, qx = 0.0f, qy = 0.0f, qz = 0.0f;
+            if (instanceIndex < rotations.size()) {
+                const GfQuatf& q = rotations[instanceIndex];
+                qw = q.GetReal();
+                qx = q.GetImaginary()[0];
+                qy = q.GetImaginary()[1];
+                qz = q.GetImaginary()[2];
+            }
+            const float n = 2.0f / (qw * qw + qx * qx + qy * qy + qz * qz);
+
+            Mat3x4 local = Mat3x4 {
+                .x = F32x4 { .x = (1.0f - n * (qy * qy + qz * qz)) * s[0], .y = n * (qx * qy - qw * qz) * s[1], .z = n * (qx * qz + qw * qy) * s[2], .w = t[0] },
+                .y = F32x4 { .x = n * (qx * qy + qw * qz) * s[0], .y = (1.0f - n * (qx * qx + qz * qz)) * s[1], .z = n * (qy * qz - qw * qx) * s[2], .w = t[1] },
+                .z = F32x4 { .x = n * (qx * qz - qw * qy) * s[0], .y = n * (qy * qz + qw * qx) * s[1], .z = (1.0f - n * (qx * qx + qy * qy)) * s[2], .w = t[2] },
+            };
+            if (instanceIndex < transforms.size()) {
+                local = composeMat3x4(local, toMat3x4(transforms[instanceIndex]));
+            }
 
-    VtMatrix4dArray final(parentTransforms.size() * instanceTransforms.size());
-    for (size_t i = 0; i < parentTransforms.size(); ++i) {
-        for (size_t j = 0; j < instanceTransforms.size(); ++j) {
-            final[i * instanceTransforms.size() + j] = instanceTransforms[j] * parentTransforms[i];
+            instanceTransforms[i] = composeMat3x4(instancerTransform, local);
         }
+    });
+
+    std::shared_ptr<const std::vector<Mat3x4>> result;
+    if (parentTransforms) {
+        const size_t instanceCount = instanceTransforms.size();
+        std::vector<Mat3x4> final(parentTransforms->size() * instanceCount);
+        WorkParallelForN(final.size(), [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                final[i] = composeMat3x4((*parentTransforms)[i / instanceCount], instanceTransforms[i % instanceCount]);
+            }
+        });
+        result = std::make_shared<const std::vector<Mat3x4>>(std::move(final));
+    } else {
+        result = std::make_shared<const std::vector<Mat3x4>>(std::move(instanceTransforms));
     }
 
-    return final;
+    std::lock_guard<std::mutex> guard(cacheMutex_);
+    // prims sharing a child instancer may race here, keep the first so they all see the same pointer
+    const auto [it, inserted] = cache_.try_emplace(prototypeId, CachedTransforms { .transforms = result, .parentTransforms = parentTransforms });
+    if (!inserted) {
+        if (it->second.parentTransforms == parentTransforms) return it->second.transforms;
+        it->second = CachedTransforms { .transforms = result, .parentTransforms = parentTransforms };
+    }
+    return result;
 }
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -5,6 +5,11 @@
 #include "pxr/pxr.h"
 #include "pxr/imaging/hd/instancer.h"
 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdMoonshineInstancer : public HdInstancer {
@@ -13,9 +18,49 @@ public:
     ~HdMoonshineInstancer();
 
     void Sync(HdSceneDelegate *sceneDelegate, HdRenderParam *renderParam, HdDirtyBits *dirtyBits) override;
-    VtMatrix4dArray ComputeInstanceTransforms(const SdfPath& prototypeId);
+
+    void Finalize(HdRenderParam *renderParam) override;
+
+    // instance transforms of prototype, composed with those of any parent instancers
+    // cached per prototype, so may be called from multiple prims' syncs at once
+    std::shared_ptr<const std::vector<Mat3x4>> ComputeInstanceTransforms(const SdfPath& prototypeId);
+
+    // drops what instancerId has cached for prototypeId, for prototypes that are removed
+    // or stop using it -- does nothing if the instancer itself is already gone
+    static void EvictInstanceTransforms(HdRenderIndex& renderIndex, SdfPath const& instancerId, SdfPath const& prototypeId);
 private:
+    struct CachedTransforms {
+        std::shared_ptr<const std::vector<Mat3x4>> transforms;
+        std::shared_ptr<const std::vector<Mat3x4>> parentTransforms; // what transforms were composed with
+    };
+
     TfHashMap<TfToken, VtValue, TfToken::HashFunctor> primvarMap_;
+
+    std::mutex cacheMutex_;
+    std::unordered_map<SdfPath, CachedTransforms, SdfPath::Hash> cache_;
 };
 
+// row-vector GfMatrix to column-vector affine Mat3x4
+template <typename Matrix>
+inline Mat3x4 toMat3x4(const Matrix& matrix) {
+    return Mat3x4 {
+        .x = F32x4 { .x = float(matrix[0][0]), .y = float(matrix[1][0]), .z = float(matrix[2][0]), .w = float(matrix[3][0]) },
+        .y = F32x4 { .x = float(matrix[0][1]), .y = float(matrix[1][1]), .z = float(matrix[2][1]), .w = float(matrix[3][1]) },
+        .z = F32x4 { .x = float(matrix[0][2]), .y = float(matrix[1][2]), .z = float(matrix[2][2]), .w = float(matrix[3][2]) },
+    };
+}
+
+// affine transform that applies b, then a
+inline Mat3x4 composeMat3x4(const Mat3x4& a, const Mat3x4& b) {
+    const auto row = [&b](const F32x4& r) {
+        return F32x4 {
+            .x = r.x * b.x.x + r.y * b.y.x + r.z * b.z.x,
+            .y = r.x * b.x.y + r.y * b.y.y + r.z * b.z.y,
+            .z = r.x * b.x.z + r.y * b.y.z + r.z * b.z.z,
+            .w = r.x * b.x.w + r.y * b.y.w + r.z * b.z.w + r.w,
+        };
+    };
+    return Mat3x4 { .x = row(a.x), .y = row(a.y), .z = row(a.z) };
+}
+
 PXR_NAMESPACE_CLOSE_SCOPE
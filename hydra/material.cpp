@@ -1,12 +1,13 @@
 #include <cstdint>
 #include <memory>
 #include <optional>
+#include <pxr/imaging/hd/changeTracker.h>
+#include <pxr/imaging/hd/renderIndex.h>
+#include <pxr/imaging/hd/rprim.h>
 #include <pxr/usd/sdr/shaderNode.h>
 #include <pxr/usd/sdr/shaderProperty.h>
 #include <pxr/usd/sdr/registry.h>
 
-#include <pxr/imaging/hio/image.h>
-
 #include "material.hpp"
 
 #include "moonshine.h"
@@ -42,76 +43,94 @@ HdDirtyBits HdMoonshineMaterial::GetInitialDirtyBitsMask() const {
     return DirtyBits::DirtyParams;
 }
 
-std::optional<TextureFormat> usdFormatToMsneFormat(HioFormat format) {
-    if (format == HioFormatFloat16Vec3) {
-        return TextureFormat::f16x4;
-    } else if (format == HioFormatUNorm8Vec4srgb) {
-        return TextureFormat::u8x4_srgb;
-    } else if (format == HioFormatUNorm8Vec3srgb) {
-        return TextureFormat::u8x4_srgb;
+void HdMoonshineMaterial::Finalize(HdRenderParam* hdRenderParam) {
+    HdMoonshineRenderParam* renderParam = static_cast<HdMoonshineRenderParam*>(hdRenderParam);
+    renderParam->AcquireSceneForEdit();
+    for (auto const& [name, texture] : _textures) {
+        ReleaseTexture(renderParam, texture);
+    }
+    _textures.clear();
+}
+
+void HdMoonshineMaterial::ReleaseTexture(HdMoonshineRenderParam* renderParam, BoundTexture texture) {
+    if (texture.ticket) {
+        renderParam->_textureCache.Release(texture.ticket.value());
     } else {
-        return std::nullopt;
+        HdMoonshineDestroyTexture(renderParam->_moonshine, texture.solid);
     }
 }
 
-void rgbToRgba(std::unique_ptr<uint8_t[]>& data, size_t pixel_count, size_t src_bytes_per_pixel, size_t dst_bytes_per_pixel) {
-    for (size_t i = pixel_count - 1; i-- > 0;) {
-        for (size_t j = 0; j < src_bytes_per_pixel; j++) {
-            data[dst_bytes_per_pixel * i + j] = data[src_bytes_per_pixel * i + j];
-        }
+void setMaterialTexture(HdMoonshine* msne, MaterialHandle handle, TfToken const& name, ImageHandle texture) {
+    if (name == _tokens->diffuseColor) {
+        HdMoonshineSetMaterialColor(msne, handle, texture);
+    } else if (name == _tokens->emissiveColor) {
+        HdMoonshineSetMaterialEmissive(msne, handle, texture);
+    } else if (name == _tokens->normal) {
+        HdMoonshineSetMaterialNormal(msne, handle, texture);
+    } else if (name == _tokens->roughness) {
+        HdMoonshineSetMaterialRoughness(msne, handle, texture);
+    } else if (name == _tokens->metallic) {
+        HdMoonshineSetMaterialMetalness(msne, handle, texture);
     }
 }
 
-std::optional<ImageHandle> makeTexture(HdMoonshine* msne, VtValue value, std::string const& debug_name) {
+// what a file texture shows until it's loaded, same as the material defaults
+ImageHandle placeholderTexture(HdMoonshineRenderParam* renderParam, TfToken const& name) {
+    if (name == _tokens->emissiveColor) {
+        return renderParam->_black3;
+    } else if (name == _tokens->normal) {
+        return renderParam->_up;
+    } else if (name == _tokens->roughness) {
+        return renderParam->_white1;
+    } else if (name == _tokens->metallic) {
+        return renderParam->_black1;
+    } else {
+        return renderParam->_grey3;
+    }
+}
+
+std::optional<HdMoonshineMaterial::BoundTexture> makeTexture(HdMoonshineRenderParam* renderParam, MaterialHandle handle, TfToken const& name, VtValue value, std::string const& debug_name) {
+    HdMoonshine* msne = renderParam->_moonshine;
     if (value.IsHolding<SdfAssetPath>()) {
-        auto image = HioImage::OpenForReading(value.Get<SdfAssetPath>().GetResolvedPath());
-        std::optional<TextureFormat> format = usdFormatToMsneFormat(image->GetFormat());
-        if (!format) {
-            TF_CODING_ERROR("unknown format %u", image->GetFormat());
+        // swapped for the real thing once it's loaded in the background, which may be right away
+        setMaterialTexture(msne, handle, name, placeholderTexture(renderParam, name));
+        std::optional<HdMoonshineTextureCache::Ticket> ticket = renderParam->_textureCache.Acquire(value.Get<SdfAssetPath>().GetResolvedPath(), debug_name + " texture", [msne, handle, name](ImageHandle texture) {
+            setMaterialTexture(msne, handle, name, texture);
+        });
+        if (!ticket) {
             return std::nullopt;
         }
-
-        HioImage::StorageSpec spec;
-        spec.width  = image->GetWidth();
-        spec.height = image->GetHeight();
-        spec.format = image->GetFormat();
-        spec.flipped = true; // moonshine expects flipped UVs which is equivalent to flipping here
-        size_t imageSize = spec.width * spec.height * image->GetBytesPerPixel();
-        // moonshine does not support RGB formats so possibly allocate enough space to
-        // convert to RBGA in place
-        if (imageSize % 3 == 0) {
-            imageSize = (imageSize / 3) * 4;
-        }
-        std::unique_ptr<uint8_t[]> data = std::make_unique<uint8_t[]>(imageSize);
-        spec.data = data.get();
-        image->Read(spec);
-
-        // possibly pad to RGBA
-        if (image->GetBytesPerPixel() % 3 == 0) {
-            rgbToRgba(data, spec.width * spec.height, image->GetBytesPerPixel(), (image->GetBytesPerPixel() / 3) * 4);
-        }
-
-        Extent2D extent = Extent2D {
-            .width = static_cast<uint32_t>(spec.width),
-            .height = static_cast<uint32_t>(spec.height),
+        return HdMoonshineMaterial::BoundTexture {
+            .ticket = ticket,
+            .solid = 0,
         };
-        return HdMoonshineCreateRawTexture(msne, data.get(), extent, format.value(), (debug_name + " texture").c_str());
     } else if (value.IsHolding<GfVec3f>()) {
         GfVec3f vec = value.Get<GfVec3f>();
-        return HdMoonshineCreateSolidTexture3(msne, F32x3 { .x = vec[0], .y = vec[1], .z = vec[2] }, (debug_name + " f32x3").c_str());
+        ImageHandle texture = HdMoonshineCreateSolidTexture3(msne, F32x3 { .x = vec[0], .y = vec[1], .z = vec[2] }, (debug_name + " f32x3").c_str());
+        setMaterialTexture(msne, handle, name, texture);
+        return HdMoonshineMaterial::BoundTexture {
+            .ticket = std::nullopt,
+            .solid = texture,
+        };
     } else if (value.IsHolding<float>()) {
         float val = value.Get<float>();
-        return HdMoonshineCreateSolidTexture1(msne, val, (debug_name + " float").c_str());
+        ImageHandle texture = HdMoonshineCreateSolidTexture1(msne, val, (debug_name + " float").c_str());
+        setMaterialTexture(msne, handle, name, texture);
+        return HdMoonshineMaterial::BoundTexture {
+            .ticket = std::nullopt,
+            .solid = texture,
+        };
     } else {
         TF_CODING_ERROR("unknown value type %s", value.GetTypeName().c_str());
         return std::nullopt;
     }
 }
 
-bool SetTextureBasedOnValueAndName(HdMoonshine* msne, MaterialHandle handle, TfToken name, VtValue value, std::string const& debug_name) {
+bool HdMoonshineMaterial::SetTextureBasedOnValueAndName(HdMoonshineRenderParam* renderParam, TfToken name, VtValue value, std::string const& debug_name) {
+    HdMoonshine* msne = renderParam->_moonshine;
     if (name == _tokens->ior) {
         float ior = value.Get<float>();
-        HdMoonshineSetMaterialIOR(msne, handle, ior);
+        HdMoonshineSetMaterialIOR(msne, _handle, ior);
         return true;
     } else {
         // silently fail on unsupported
@@ -119,23 +138,22 @@ bool SetTextureBasedOnValueAndName(HdMoonshine* msne, MaterialHandle handle, TfT
             return true;
         }
 
-        std::optional<ImageHandle> maybe_texture = makeTexture(msne, value, debug_name + " " + name.GetString());
-        if (!maybe_texture) {
+        if (name == _tokens->emissiveColor) {
+            // a texture could be black too, but no way to know until it's loaded
+            _emissive = value.IsHolding<SdfAssetPath>() || (value.IsHolding<GfVec3f>() && value.Get<GfVec3f>() != GfVec3f(0.0f));
+        }
+
+        std::optional<BoundTexture> texture = makeTexture(renderParam, _handle, name, value, debug_name + " " + name.GetString());
+        if (!texture) {
             TF_CODING_ERROR("could not parse texture %s", (debug_name + " " + name.GetString()).c_str());
             return false;
         }
-        ImageHandle texture = maybe_texture.value();
-
-        if (name == _tokens->diffuseColor) {
-            HdMoonshineSetMaterialColor(msne, handle, texture);
-        } else if (name == _tokens->emissiveColor) {
-            HdMoonshineSetMaterialEmissive(msne, handle, texture);
-        } else if (name == _tokens->normal) {
-            HdMoonshineSetMaterialNormal(msne, handle, texture);
-        } else if (name == _tokens->roughness) {
-            HdMoonshineSetMaterialRoughness(msne, handle, texture);
-        } else if (name == _tokens->metallic) {
-            HdMoonshineSetMaterialMetalness(msne, handle, texture);
+
+        // the new texture is acquired before the old one is released so an unchanged file isn't reloaded
+        auto const [it, inserted] = _textures.try_emplace(name, texture.value());
+        if (!inserted) {
+            ReleaseTexture(renderParam, it->second);
+            it->second = texture.value();
         }
 
         return true;
@@ -143,12 +161,14 @@ bool SetTextureBasedOnValueAndName(HdMoonshine* msne, MaterialHandle handle, TfT
 }
 
 void HdMoonshineMaterial::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hdRenderParam, HdDirtyBits* dirtyBits) {
+    MOONSHINE_TRACE_SPAN("sync material");
     SdfPath const& id = GetId();
 
     HdMoonshineRenderParam* renderParam = static_cast<HdMoonshineRenderParam*>(hdRenderParam);
-    HdMoonshine* msne = renderParam->_moonshine;
 
     if (*dirtyBits & DirtyBits::DirtyParams) {
+        renderParam->AcquireSceneForEdit();
+
         const VtValue& resource = sceneDelegate->GetMaterialResource(id);
 
         if (!resource.IsHolding<HdMaterialNetworkMap>())
@@ -158,6 +178,7 @@ void HdMoonshineMaterial::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hd
         }
 
         const HdMaterialNetwork2& network = HdConvertToHdMaterialNetwork2(resource.UncheckedGet<HdMaterialNetworkMap>());
+        const bool was_emissive = _emissive;
 
         // find node connecting to surface output
         auto const& terminalConnIt = network.terminals.find(HdMaterialTerminalTokens->surface);
@@ -193,17 +214,30 @@ void HdMoonshineMaterial::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hd
                 if (sdrRole == SdrNodeRole->Texture) {
                     TfToken fileProperty = upstreamSdr->GetAssetIdentifierInputNames()[0];
                     VtValue value = upstreamNode.parameters.find(fileProperty)->second;
-                    SetTextureBasedOnValueAndName(msne, _handle, inputName, value, id.GetString());
+                    SetTextureBasedOnValueAndName(renderParam, inputName, value, id.GetString());
                 } else {
                     TF_CODING_ERROR("%s unknown connection %s: %s", id.GetText(), inputName.GetText(), upstreamSdr->GetRole().c_str());
                 }
             } else if (paramIt != node.parameters.end()) {
                 VtValue value = paramIt->second;
-                SetTextureBasedOnValueAndName(msne, _handle, inputName, value, id.GetString() + " parameter");
+                SetTextureBasedOnValueAndName(renderParam, inputName, value, id.GetString() + " parameter");
             } else {
                 SdrShaderPropertyConstPtr const& input = sdrNode->GetShaderInput(inputName);
                 VtValue value = input->GetDefaultValue();
-                SetTextureBasedOnValueAndName(msne, _handle, inputName, value, id.GetString() + " default");
+                SetTextureBasedOnValueAndName(renderParam, inputName, value, id.GetString() + " default");
+            }
+        }
+
+        // meshes only read this when their binding changes, so make them think it has
+        // if they need to start or stop sampling their instances for light
+        if (_emissive != was_emissive) {
+            HdRenderIndex& renderIndex = sceneDelegate->GetRenderIndex();
+            HdChangeTracker& changeTracker = renderIndex.GetChangeTracker();
+            for (SdfPath const& rprimId : renderIndex.GetRprimIds()) {
+                HdRprim const* rprim = renderIndex.GetRprim(rprimId);
+                if (rprim && rprim->GetMaterialId() == id) {
+                    changeTracker.MarkRprimDirty(rprimId, HdChangeTracker::DirtyMaterialId);
+                }
             }
         }
 
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <optional>
+#include <string>
+#include <unordered_map>
+
 #include <pxr/imaging/hd/material.h>
 #include <pxr/imaging/hd/sceneDelegate.h>
 
@@ -17,8 +21,25 @@ public:
     HdDirtyBits GetInitialDirtyBitsMask() const override;
 
     void Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* renderParam, HdDirtyBits* dirtyBits) override;
+    void Finalize(HdRenderParam* renderParam) override;
+
+    // either a reference into the texture cache or a solid color owned by this material
+    struct BoundTexture {
+        std::optional<HdMoonshineTextureCache::Ticket> ticket;
+        ImageHandle solid; // only if no ticket
+    };
 
     MaterialHandle _handle;
+
+    // whether emissiveColor is anything but black, so meshes know to sample it for light
+    bool _emissive = false;
+
+private:
+    bool SetTextureBasedOnValueAndName(HdMoonshineRenderParam* renderParam, TfToken name, VtValue value, std::string const& debug_name);
+    static void ReleaseTexture(HdMoonshineRenderParam* renderParam, BoundTexture texture);
+
+    // what each input currently uses, released once replaced
+    std::unordered_map<TfToken, BoundTexture, TfToken::HashFunctor> _textures;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
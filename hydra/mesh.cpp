@@ -11,8 +11,12 @@
 #include <pxr/imaging/hd/extComputationUtils.h>
 #include <pxr/base/gf/vec2f.h>
 #include <pxr/imaging/hd/vtBufferSource.h>
+#include <pxr/base/tf/hash.h>
+#include <pxr/base/work/loops.h>
 
+#include <memory>
 #include <optional>
+#include <unordered_map>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
@@ -28,6 +32,9 @@ HdMoonshineMesh::HdMoonshineMesh(SdfPath const& id, const HdMoonshineRenderParam
 
 HdDirtyBits HdMoonshineMesh::GetInitialDirtyBitsMask() const {
     return HdChangeTracker::DirtyPoints
+        | HdChangeTracker::DirtyNormals
+        | HdChangeTracker::DirtyPrimvar
+        | HdChangeTracker::DirtyTopology
         | HdChangeTracker::DirtyTransform
         | HdChangeTracker::DirtyInstancer
         | HdChangeTracker::DirtyVisibility
@@ -70,14 +77,14 @@ constexpr HdType typeToHdType() {
 }
 
 template<typename T>
-VtArray<T> HdMoonshineMesh::ComputePrimvar(HdSceneDelegate* sceneDelegate, VtVec3iArray const& indices, TfToken primvarName) const {
+VtArray<T> HdMoonshineMesh::ComputePrimvar(HdSceneDelegate* sceneDelegate, TfToken primvarName, HdInterpolation* interpolation) const {
     VtArray<T> primvar;
     VtValue boxedPrimvar = sceneDelegate->Get(GetId(), primvarName);
     if (boxedPrimvar.IsHolding<VtArray<T>>()) {
         std::optional<HdInterpolation> maybe_interpolation = FindPrimvarInterpolation(sceneDelegate, primvarName);
         if (!maybe_interpolation) return primvar;
-        HdInterpolation interpolation = maybe_interpolation.value();
-        if (interpolation == HdInterpolationFaceVarying) {
+        *interpolation = maybe_interpolation.value();
+        if (*interpolation == HdInterpolationFaceVarying) {
             const HdMeshTopology& topology = GetMeshTopology(sceneDelegate);
             HdMeshUtil meshUtil(&topology, GetId());
 
@@ -85,31 +92,90 @@ VtArray<T> HdMoonshineMesh::ComputePrimvar(HdSceneDelegate* sceneDelegate, VtVec
             VtValue res;
             meshUtil.ComputeTriangulatedFaceVaryingPrimvar(buffer.GetData(), buffer.GetNumElements(), typeToHdType<T>(), &res);
             primvar = res.Get<VtArray<T>>();
-        } else if (interpolation == HdInterpolationVertex) {
-            VtArray<T> indexedPrimvar = boxedPrimvar.Get<VtArray<T>>();
-            for (const auto index : indices) {
-                primvar.push_back(indexedPrimvar[index[0]]);
-                primvar.push_back(indexedPrimvar[index[1]]);
-                primvar.push_back(indexedPrimvar[index[2]]);
-            }
+        } else if (*interpolation == HdInterpolationVertex) {
+            // already indexed the same way as points
+            primvar = boxedPrimvar.Get<VtArray<T>>();
         } else {
-            TF_CODING_ERROR("Mesh %s has unknown %s primvar interpolation %s!", GetId().GetText(), primvarName.GetText(), TfEnum::GetDisplayName(interpolation).c_str());
+            TF_CODING_ERROR("Mesh %s has unknown %s primvar interpolation %s!", GetId().GetText(), primvarName.GetText(), TfEnum::GetDisplayName(*interpolation).c_str());
         }
     }
 
     return primvar;
 }
 
+struct WeldedCorner {
+    int point;
+    GfVec3f normal;
+    GfVec2f texcoord;
+
+    bool operator==(const WeldedCorner& other) const {
+        return point == other.point && normal == other.normal && texcoord == other.texcoord;
+    }
+};
+
+struct WeldedCornerHash {
+    size_t operator()(const WeldedCorner& corner) const {
+        return TfHash::Combine(corner.point, corner.normal, corner.texcoord);
+    }
+};
+
+// converts face-varying primvars into vertex ones, so everything can share the position indices --
+// each distinct (point, normal, texcoord) combination among the triangle corners becomes its own vertex
+static void WeldFaceVaryingPrimvars(VtVec3iArray& indices, VtVec3fArray& points, VtVec3fArray& normals, bool normalsFaceVarying, VtVec2fArray& texcoords, bool texcoordsFaceVarying) {
+    std::unordered_map<WeldedCorner, int, WeldedCornerHash> cornerToVertex;
+    cornerToVertex.reserve(indices.size() * 3);
+
+    VtVec3iArray weldedIndices(indices.size());
+    VtVec3fArray weldedPoints;
+    VtVec3fArray weldedNormals;
+    VtVec2fArray weldedTexcoords;
+    weldedPoints.reserve(points.size());
+    if (!normals.empty()) weldedNormals.reserve(points.size());
+    if (!texcoords.empty()) weldedTexcoords.reserve(points.size());
+
+    for (size_t i = 0; i < indices.size(); i++) {
+        for (size_t j = 0; j < 3; j++) {
+            const size_t corner = i * 3 + j;
+            const int point = indices[i][j];
+
+            WeldedCorner key = WeldedCorner {
+                .point = point,
+                .normal = normals.empty() ? GfVec3f(0.0f) : normals[normalsFaceVarying ? corner : point],
+                .texcoord = texcoords.empty() ? GfVec2f(0.0f) : texcoords[texcoordsFaceVarying ? corner : point],
+            };
+            const auto [it, inserted] = cornerToVertex.try_emplace(key, static_cast<int>(weldedPoints.size()));
+            if (inserted) {
+                weldedPoints.push_back(points[point]);
+                if (!normals.empty()) weldedNormals.push_back(key.normal);
+                if (!texcoords.empty()) weldedTexcoords.push_back(key.texcoord);
+            }
+            weldedIndices[i][j] = it->second;
+        }
+    }
+
+    indices = std::move(weldedIndices);
+    points = std::move(weldedPoints);
+    normals = std::move(weldedNormals);
+    texcoords = std::move(weldedTexcoords);
+}
+
 void HdMoonshineMesh::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hdRenderParam, HdDirtyBits* dirtyBits, TfToken const& reprToken) {
+    MOONSHINE_TRACE_SPAN("sync mesh");
     SdfPath const& id = GetId();
 
     HdRenderIndex& renderIndex = sceneDelegate->GetRenderIndex();
     HdMoonshineRenderParam* renderParam = static_cast<HdMoonshineRenderParam*>(hdRenderParam);
-    HdMoonshine* msne = renderParam->_moonshine;
+    HdMoonshine* msne = renderParam->AcquireSceneForEdit();
+
+    bool mesh_changed = false;
+    std::optional<MeshHandle> old_mesh; // replaced, to be destroyed once its instances are
 
-    bool mesh_changed = HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points);
+    const bool points_dirty = HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points);
+    const bool normals_dirty = HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, _tokens->normals);
+    const bool topology_dirty = HdChangeTracker::IsTopologyDirty(*dirtyBits, id);
+    const bool other_primvars_dirty = *dirtyBits & HdChangeTracker::DirtyPrimvar;
 
-    if (HdChangeTracker::IsPrimvarDirty(*dirtyBits, id, HdTokens->points)) {
+    if (points_dirty || normals_dirty || topology_dirty || other_primvars_dirty) {
         const HdMeshTopology& topology = GetMeshTopology(sceneDelegate);
         HdMeshUtil meshUtil(&topology,id);
         VtIntArray primitiveParams;
@@ -142,6 +208,7 @@ void HdMoonshineMesh::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hdRend
         }
 
         VtVec2fArray texcoords;
+        HdInterpolation texcoordInterpolation = HdInterpolationVertex;
         {
             // there's some way to infer this properly but this works most of the time
             const TfToken maybeTexcoordNames[] = {
@@ -159,16 +226,54 @@ void HdMoonshineMesh::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hdRend
             }
 
             if (!texcoordName.IsEmpty()) {
-                texcoords = ComputePrimvar<GfVec2f>(sceneDelegate, indices, texcoordName);
+                texcoords = ComputePrimvar<GfVec2f>(sceneDelegate, texcoordName, &texcoordInterpolation);
             }
         }
 
-        VtVec3fArray normals = ComputePrimvar<GfVec3f>(sceneDelegate, indices, _tokens->normals);
-        
-        // TODO: destroy mesh
-        _mesh = HdMoonshineCreateMesh(msne, reinterpret_cast<const F32x3*>(points.cdata()),  reinterpret_cast<const F32x3*>(normals.cdata()), reinterpret_cast<const F32x2*>(texcoords.cdata()), points.size(), reinterpret_cast<const U32x3*>(indices.cdata()), indices.size());
+        HdInterpolation normalInterpolation = HdInterpolationVertex;
+        VtVec3fArray normals = ComputePrimvar<GfVec3f>(sceneDelegate, _tokens->normals, &normalInterpolation);
+
+        // drop primvars that don't have a value for each point or triangle corner rather than reading past them
+        const size_t cornerCount = indices.size() * 3;
+        if (!texcoords.empty() && texcoords.size() != (texcoordInterpolation == HdInterpolationFaceVarying ? cornerCount : points.size())) {
+            TF_WARN("Mesh %s has %zu texcoords, which doesn't match its topology, ignoring them", id.GetText(), texcoords.size());
+            texcoords = VtVec2fArray();
+        }
+        if (!normals.empty() && normals.size() != (normalInterpolation == HdInterpolationFaceVarying ? cornerCount : points.size())) {
+            TF_WARN("Mesh %s has %zu normals, which doesn't match its topology, ignoring them", id.GetText(), normals.size());
+            normals = VtVec3fArray();
+        }
+
+        const bool texcoordsFaceVarying = !texcoords.empty() && texcoordInterpolation == HdInterpolationFaceVarying;
+        const bool normalsFaceVarying = !normals.empty() && normalInterpolation == HdInterpolationFaceVarying;
+        if (texcoordsFaceVarying || normalsFaceVarying) {
+            WeldFaceVaryingPrimvars(indices, points, normals, normalsFaceVarying, texcoords, texcoordsFaceVarying);
+        }
+
+        // if only points and normals changed (e.g., deforming mesh), write them into the existing mesh
+        // rather than making a new one -- face-varying welding may still have changed the indices, so check them
+        const bool update_in_place = !_indices.empty()
+            && !topology_dirty
+            && !other_primvars_dirty
+            && indices == _indices
+            && points.size() == _vertexCount
+            && normals.empty() != _hasNormals
+            && texcoords.empty() != _hasTexcoords;
+
+        if (update_in_place) {
+            if (points_dirty) HdMoonshineUpdateMeshPositions(msne, _mesh, reinterpret_cast<const F32x3*>(points.cdata()), points.size());
+            if (normals_dirty && _hasNormals) HdMoonshineUpdateMeshNormals(msne, _mesh, reinterpret_cast<const F32x3*>(normals.cdata()), normals.size());
+        } else {
+            if (!_indices.empty()) old_mesh = _mesh;
+            _mesh = HdMoonshineStageMesh(msne, reinterpret_cast<const F32x3*>(points.cdata()), points.size(), reinterpret_cast<const F32x3*>(normals.cdata()), normals.size(), reinterpret_cast<const F32x2*>(texcoords.cdata()), texcoords.size(), reinterpret_cast<const U32x3*>(indices.cdata()), indices.size());
+            _indices = indices;
+            _vertexCount = points.size();
+            _hasNormals = !normals.empty();
+            _hasTexcoords = !texcoords.empty();
+            mesh_changed = true;
+        }
 
-        *dirtyBits = *dirtyBits & ~HdChangeTracker::DirtyPoints;
+        *dirtyBits = *dirtyBits & ~(HdChangeTracker::DirtyPoints | HdChangeTracker::DirtyNormals | HdChangeTracker::DirtyPrimvar | HdChangeTracker::DirtyTopology);
     }
 
     bool old_visibility = IsVisible();
@@ -178,85 +283,91 @@ void HdMoonshineMesh::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hdRend
     }
     bool new_visibility = IsVisible();
 
-    // TODO: what is hydra SetMaterialId for
     bool material_changed = *dirtyBits & HdChangeTracker::DirtyMaterialId;
     if (*dirtyBits & HdChangeTracker::DirtyMaterialId) {
         const SdfPath& materialId = sceneDelegate->GetMaterialId(id);
+        SetMaterialId(materialId); // so the material can find this mesh if its emission changes
         if (materialId.IsEmpty()) {
             _material = renderParam->_defaultMaterial;
+            _emissive = false;
         } else {
             HdSprim* sprim = renderIndex.GetSprim(HdPrimTypeTokens->material, materialId);
             if (sprim) {
                 HdMoonshineMaterial* material = static_cast<HdMoonshineMaterial*>(sprim);
                 _material = material->_handle;
+                _emissive = material->_emissive;
             }
         }
         *dirtyBits = *dirtyBits & ~HdChangeTracker::DirtyMaterialId;
     }
 
-    bool transform_changed = HdChangeTracker::IsTransformDirty(*dirtyBits, id) || HdChangeTracker::IsInstancerDirty(*dirtyBits, id);
+    bool transform_changed = HdChangeTracker::IsTransformDirty(*dirtyBits, id);
 
     if (HdChangeTracker::IsTransformDirty(*dirtyBits, id)) {
         _transform = GfMatrix4f(sceneDelegate->GetTransform(id));
         *dirtyBits = *dirtyBits & ~HdChangeTracker::DirtyTransform;
     }
 
-    const auto instancerId = GetInstancerId();
+    _renderIndex = &renderIndex;
+    const SdfPath oldInstancerId = GetInstancerId();
     _UpdateInstancer(sceneDelegate, dirtyBits);
+    SdfPath const& instancerId = GetInstancerId();
     HdInstancer::_SyncInstancerAndParents(renderIndex, instancerId);
 
     bool instancer_count_changed = false;
 
     if (HdChangeTracker::IsInstancerDirty(*dirtyBits, id)) {
-        const size_t old_len = _instancesTransforms.size();
-        _instancesTransforms.clear();
+        if (oldInstancerId != instancerId) {
+            HdMoonshineInstancer::EvictInstanceTransforms(renderIndex, oldInstancerId, id);
+        }
+
+        const auto old_transforms = _instancesTransforms;
         if (instancerId.IsEmpty()) {
-            _instancesTransforms.push_back(GfMatrix4f(1.0));
+            _instancesTransforms = std::make_shared<const std::vector<Mat3x4>>(1, toMat3x4(GfMatrix4f(1.0)));
         } else {
             HdInstancer *instancer = renderIndex.GetInstancer(instancerId);
-            VtMatrix4dArray instanceTransforms = static_cast<HdMoonshineInstancer*>(instancer)->ComputeInstanceTransforms(id);
-            for (size_t i = 0; i < instanceTransforms.size(); i++) {
-                _instancesTransforms.push_back(GfMatrix4f(instanceTransforms[i]));
-            }
+            _instancesTransforms = static_cast<HdMoonshineInstancer*>(instancer)->ComputeInstanceTransforms(id);
         }
-        const size_t new_len = _instancesTransforms.size();
-        bool instancer_count_changed = old_len != new_len;
+        // instancer hands back the same cached transforms if nothing relevant changed
+        transform_changed |= old_transforms != _instancesTransforms;
+        instancer_count_changed = old_transforms->size() != _instancesTransforms->size();
         *dirtyBits = *dirtyBits & ~HdChangeTracker::DirtyInstancer;
     }
 
     // TODO: don't actually need to recreate everything on just a material change
-    bool need_to_recreate = mesh_changed || instancer_count_changed || material_changed;
+    bool need_to_recreate = mesh_changed || material_changed;
     if (need_to_recreate) {
         for (const InstanceHandle instance : _instances) {
-            HdMoonshineDestroyInstance(static_cast<HdMoonshineRenderParam*>(renderParam)->_moonshine, instance);
+            HdMoonshineDestroyInstance(msne, instance);
         }
         _instances.clear();
 
-        const Geometry geometry = Geometry {
-            .mesh = _mesh,
-            .material = _material,
-            .sampled = false,
-        };
-        for (size_t i = 0; i < _instancesTransforms.size(); i++) {
-            GfMatrix4f instanceTransform = _transform * _instancesTransforms[i];
-            const Mat3x4 matrix = Mat3x4 {
-                .x = F32x4 { .x = instanceTransform[0][0], .y = instanceTransform[1][0], .z = instanceTransform[2][0], .w = instanceTransform[3][0] },
-                .y = F32x4 { .x = instanceTransform[0][1], .y = instanceTransform[1][1], .z = instanceTransform[2][1], .w = instanceTransform[3][1] },
-                .z = F32x4 { .x = instanceTransform[0][2], .y = instanceTransform[1][2], .z = instanceTransform[2][2], .w = instanceTransform[3][2] },
-            };
-            _instances.push_back(HdMoonshineCreateInstance(msne, matrix, &geometry, 1, new_visibility));
+        if (old_mesh) {
+            HdMoonshineDestroyMesh(msne, *old_mesh);
+        }
+
+        // a freshly staged mesh can't have instances until it's flushed in CommitResources
+        if (mesh_changed) {
+            renderParam->AddPendingMesh(this);
+        } else {
+            CreateInstances(msne);
         }
     } else {
-        if (transform_changed) {
-            for (size_t i = 0; i < _instancesTransforms.size(); i++) {
-                GfMatrix4f instanceTransform = _transform * _instancesTransforms[i];
-                const Mat3x4 matrix = Mat3x4 {
-                    .x = F32x4 { .x = instanceTransform[0][0], .y = instanceTransform[1][0], .z = instanceTransform[2][0], .w = instanceTransform[3][0] },
-                    .y = F32x4 { .x = instanceTransform[0][1], .y = instanceTransform[1][1], .z = instanceTransform[2][1], .w = instanceTransform[3][1] },
-                    .z = F32x4 { .x = instanceTransform[0][2], .y = instanceTransform[1][2], .z = instanceTransform[2][2], .w = instanceTransform[3][2] },
-                };
-                HdMoonshineSetInstanceTransform(msne, _instances[i], matrix);
-            }
+        // only destroy or create the difference, the rest just get new transforms
+        while (_instances.size() > _instancesTransforms->size()) {
+            HdMoonshineDestroyInstance(msne, _instances.back());
+            _instances.pop_back();
+        }
+
+        if (transform_changed && !_instances.empty()) {
+            const Mat3x4 transform = toMat3x4(_transform);
+            std::vector<Mat3x4> matrices(_instances.size());
+            WorkParallelForN(_instances.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    matrices[i] = composeMat3x4((*_instancesTransforms)[i], transform);
+                }
+            });
+            HdMoonshineSetInstanceTransforms(msne, _instances.data(), matrices.data(), _instances.size());
         }
 
         if (old_visibility != new_visibility) {
@@ -264,6 +375,10 @@ void HdMoonshineMesh::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hdRend
                 HdMoonshineSetInstanceVisibility(msne, instance, new_visibility);
             }
         }
+
+        if (instancer_count_changed) {
+            CreateInstances(msne);
+        }
     }
 
     if (!HdChangeTracker::IsClean(*dirtyBits)) {
@@ -271,9 +386,40 @@ void HdMoonshineMesh::Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* hdRend
     }
 }
 
+void HdMoonshineMesh::CreateInstances(HdMoonshine* msne) {
+    const Geometry geometry = Geometry {
+        .mesh = _mesh,
+        .material = _material,
+        .sampled = _emissive,
+    };
+    const Mat3x4 transform = toMat3x4(_transform);
+    const size_t first = _instances.size();
+    if (first >= _instancesTransforms->size()) {
+        return;
+    }
+    std::vector<Mat3x4> matrices(_instancesTransforms->size() - first);
+    WorkParallelForN(matrices.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            matrices[i] = composeMat3x4((*_instancesTransforms)[first + i], transform);
+        }
+    });
+    _instances.resize(_instancesTransforms->size());
+    HdMoonshineCreateInstances(msne, matrices.data(), matrices.size(), &geometry, 1, IsVisible(), _instances.data() + first);
+}
+
 void HdMoonshineMesh::Finalize(HdRenderParam *renderParam) {
+    static_cast<HdMoonshineRenderParam*>(renderParam)->RemovePendingMesh(this);
+    HdMoonshine* msne = static_cast<HdMoonshineRenderParam*>(renderParam)->AcquireSceneForEdit();
     for (const InstanceHandle instance : _instances) {
-        HdMoonshineDestroyInstance(static_cast<HdMoonshineRenderParam*>(renderParam)->_moonshine, instance);
+        HdMoonshineDestroyInstance(msne, instance);
+    }
+    _instances.clear();
+    if (!_indices.empty()) {
+        HdMoonshineDestroyMesh(msne, _mesh);
+        _indices = {};
+    }
+    if (_renderIndex) {
+        HdMoonshineInstancer::EvictInstanceTransforms(*_renderIndex, GetInstancerId(), GetId());
     }
 }
 
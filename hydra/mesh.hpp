@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include <pxr/pxr.h>
@@ -22,6 +23,10 @@ public:
     void Sync(HdSceneDelegate* sceneDelegate, HdRenderParam* renderParam, HdDirtyBits* dirtyBits, TfToken const &reprToken) override;
 
     void Finalize(HdRenderParam *renderParam) override;
+
+    // creates an instance for each instancer transform that doesn't have one yet,
+    // mesh must already be flushed
+    void CreateInstances(HdMoonshine* msne);
 protected:
     void _InitRepr(TfToken const &reprToken, HdDirtyBits *dirtyBits) override;
 
@@ -33,15 +38,27 @@ private:
     std::optional<HdInterpolation> FindPrimvarInterpolation(HdSceneDelegate* sceneDelegate, TfToken name) const;
 
     template<typename T>
-    VtArray<T> ComputePrimvar(HdSceneDelegate* sceneDelegate, VtVec3iArray const& indices, TfToken primvarName) const;
+    VtArray<T> ComputePrimvar(HdSceneDelegate* sceneDelegate, TfToken primvarName, HdInterpolation* interpolation) const;
     
     GfMatrix4f _transform{1.0f};
     MeshHandle _mesh;
     MaterialHandle _material;
+    bool _emissive = false; // whether _material is, so instances are sampled for light
+
+    // what _mesh was created with, to know whether it can be updated in-place
+    // empty indices means no mesh yet
+    VtVec3iArray _indices = {};
+    size_t _vertexCount = 0;
+    bool _hasNormals = false;
+    bool _hasTexcoords = false;
+
+    // to evict _instancesTransforms from the instancer's cache once they're no longer needed
+    HdRenderIndex* _renderIndex = nullptr;
 
     // these two have same len
+    // transforms are shared with the instancer's cache
     std::vector<InstanceHandle> _instances = {};
-    std::vector<GfMatrix4f> _instancesTransforms = {};
+    std::shared_ptr<const std::vector<Mat3x4>> _instancesTransforms = std::make_shared<const std::vector<Mat3x4>>();
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -66,18 +66,77 @@ typedef struct Material {
 typedef enum TextureFormat {
     f16x4,
     u8x4_srgb,
+    u8x1,
+    u8x2,
+    u8x4,
+    u8x1_srgb,
+    u8x2_srgb,
+    u16x1,
+    u16x2,
+    u16x4,
+    f16x1,
+    f16x2,
+    f32x1,
+    f32x2,
+    f32x4,
+
+    // two channels read as grey and alpha
+    u8x2_grey_alpha,
+    u8x2_srgb_grey_alpha,
+    u16x2_grey_alpha,
+    f16x2_grey_alpha,
+    f32x2_grey_alpha,
 } TextureFormat;
 
+typedef enum SensorFormat {
+    SENSOR_FORMAT_F32X4,
+    SENSOR_FORMAT_F16X4,
+    SENSOR_FORMAT_U8X4,
+    SENSOR_FORMAT_U8X4_SRGB,
+} SensorFormat;
+
+typedef struct RawTexture {
+    const uint8_t* data;
+    Extent2D extent;
+    TextureFormat format;
+    const char* name;
+} RawTexture;
+
+typedef struct PassTiming {
+    const char* name;
+    double last_ms;
+    double average_ms;
+    uint64_t count;
+} PassTiming;
+
+typedef struct MemoryUsage {
+    uint64_t budget;
+    uint64_t usage;
+    uint64_t mesh;
+    uint64_t accel;
+    uint64_t texture;
+    uint64_t sensor;
+    uint64_t staging;
+    uint64_t other;
+} MemoryUsage;
+
 typedef struct HdMoonshine HdMoonshine;
 extern "C" HdMoonshine* HdMoonshineCreate(void);
 extern "C" void HdMoonshineDestroy(HdMoonshine*);
 extern "C" bool HdMoonshineRender(HdMoonshine*, SensorHandle, LensHandle);
 extern "C" bool HdMoonshineRebuildPipeline(HdMoonshine*);
-extern "C" MeshHandle HdMoonshineCreateMesh(HdMoonshine*, const F32x3*, const F32x3*, const F32x2*, size_t, const U32x3*, size_t);
+extern "C" MeshHandle HdMoonshineCreateMesh(HdMoonshine*, const F32x3*, size_t, const F32x3*, size_t, const F32x2*, size_t, const U32x3*, size_t);
+extern "C" MeshHandle HdMoonshineStageMesh(HdMoonshine*, const F32x3*, size_t, const F32x3*, size_t, const F32x2*, size_t, const U32x3*, size_t);
+extern "C" void HdMoonshineFlushStagedMeshes(HdMoonshine*);
+extern "C" void HdMoonshineUpdateMeshPositions(HdMoonshine*, MeshHandle, const F32x3*, size_t);
+extern "C" void HdMoonshineUpdateMeshNormals(HdMoonshine*, MeshHandle, const F32x3*, size_t);
+extern "C" void HdMoonshineDestroyMesh(HdMoonshine*, MeshHandle);
 extern "C" ImageHandle HdMoonshineCreateSolidTexture1(HdMoonshine*, float, const char*);
 extern "C" ImageHandle HdMoonshineCreateSolidTexture2(HdMoonshine*, F32x2, const char*);
 extern "C" ImageHandle HdMoonshineCreateSolidTexture3(HdMoonshine*, F32x3, const char*);
 extern "C" ImageHandle HdMoonshineCreateRawTexture(HdMoonshine*, uint8_t*, Extent2D, TextureFormat, const char*);
+extern "C" size_t HdMoonshineCreateRawTextures(HdMoonshine*, const RawTexture*, size_t, ImageHandle*);
+extern "C" void HdMoonshineDestroyTexture(HdMoonshine*, ImageHandle);
 extern "C" MaterialHandle HdMoonshineCreateMaterial(HdMoonshine*, Material);
 extern "C" void HdMoonshineSetMaterialNormal(HdMoonshine*, MaterialHandle, ImageHandle);
 extern "C" void HdMoonshineSetMaterialEmissive(HdMoonshine*, MaterialHandle, ImageHandle);
@@ -86,10 +145,35 @@ extern "C" void HdMoonshineSetMaterialMetalness(HdMoonshine*, MaterialHandle, Im
 extern "C" void HdMoonshineSetMaterialRoughness(HdMoonshine*, MaterialHandle, ImageHandle);
 extern "C" void HdMoonshineSetMaterialIOR(HdMoonshine*, MaterialHandle, float);
 extern "C" InstanceHandle HdMoonshineCreateInstance(HdMoonshine*, Mat3x4, const Geometry*, size_t, bool);
+extern "C" void HdMoonshineCreateInstances(HdMoonshine*, const Mat3x4*, size_t, const Geometry*, size_t, bool, InstanceHandle*);
 extern "C" void HdMoonshineDestroyInstance(HdMoonshine*, InstanceHandle);
 extern "C" void HdMoonshineSetInstanceTransform(HdMoonshine*, InstanceHandle, Mat3x4);
+extern "C" void HdMoonshineSetInstanceTransforms(HdMoonshine*, const InstanceHandle*, const Mat3x4*, size_t);
 extern "C" void HdMoonshineSetInstanceVisibility(HdMoonshine*, InstanceHandle, bool);
-extern "C" SensorHandle HdMoonshineCreateSensor(HdMoonshine*, Extent2D);
-extern "C" float* HdMoonshineGetSensorData(const HdMoonshine*, SensorHandle);
+extern "C" SensorHandle HdMoonshineCreateSensor(HdMoonshine*, Extent2D, SensorFormat);
+extern "C" void HdMoonshineReleaseSensor(HdMoonshine*, SensorHandle);
+extern "C" void HdMoonshineSetExposure(HdMoonshine*, float);
+extern "C" void* HdMoonshineMapSensorData(HdMoonshine*, SensorHandle);
+extern "C" void HdMoonshineUnmapSensorData(HdMoonshine*, SensorHandle);
+extern "C" uint32_t HdMoonshineGetSensorSampleCount(HdMoonshine*, SensorHandle);
+extern "C" uint32_t HdMoonshineGetSensorSubmittedSampleCount(HdMoonshine*, SensorHandle);
 extern "C" LensHandle HdMoonshineCreateLens(HdMoonshine*, Lens);
 extern "C" void HdMoonshineSetLens(HdMoonshine*, LensHandle, Lens);
+extern "C" size_t HdMoonshineGetPassTimings(HdMoonshine*, PassTiming*, size_t);
+extern "C" MemoryUsage HdMoonshineGetMemoryUsage(HdMoonshine*);
+extern "C" uint64_t HdMoonshineTraceBegin(const char*);
+extern "C" void HdMoonshineTraceEnd(const char*, uint64_t);
+
+// traces the enclosing scope if built with tracing, otherwise does nothing
+#ifdef MOONSHINE_TRACING
+struct HdMoonshineTraceSpan {
+    const char* name;
+    uint64_t start;
+
+    HdMoonshineTraceSpan(const char* name) : name(name), start(HdMoonshineTraceBegin(name)) {}
+    ~HdMoonshineTraceSpan() { HdMoonshineTraceEnd(name, start); }
+};
+#define MOONSHINE_TRACE_SPAN(name) HdMoonshineTraceSpan _moonshineTraceSpan(name)
+#else
+#define MOONSHINE_TRACE_SPAN(name)
+#endif
@@ -8,26 +8,68 @@
 #include "pxr/base/gf/vec3i.h"
 
 #include <cstdint>
+#include <optional>
 
 PXR_NAMESPACE_OPEN_SCOPE
 
 HdMoonshineRenderBuffer::HdMoonshineRenderBuffer(SdfPath const& id, HdMoonshineRenderDelegate* renderDelegate) : HdRenderBuffer(id), _renderDelegate(renderDelegate) {}
 
-HdMoonshineRenderBuffer::~HdMoonshineRenderBuffer() = default;
+HdMoonshineRenderBuffer::~HdMoonshineRenderBuffer() {
+    _Deallocate();
+}
+
+// formats we can read back directly, everything else gets Float32Vec4
+static std::optional<SensorFormat> sensorFormatFor(HdFormat format) {
+    switch (format) {
+        case HdFormatFloat32Vec4: return SENSOR_FORMAT_F32X4;
+        case HdFormatFloat16Vec4: return SENSOR_FORMAT_F16X4;
+        case HdFormatUNorm8Vec4: return SENSOR_FORMAT_U8X4;
+        case HdFormatUNorm8Vec4srgb: return SENSOR_FORMAT_U8X4_SRGB;
+        default: return std::nullopt;
+    }
+}
 
-void HdMoonshineRenderBuffer::_Deallocate() {} // TODO
+void HdMoonshineRenderBuffer::_Deallocate() {
+    if (!_allocated) {
+        return;
+    }
+    // make sure the render thread is done with it before it is reused
+    _renderDelegate->ClearRenderTarget(_sensor);
+    HdMoonshineReleaseSensor(_renderDelegate->_moonshine, _sensor);
+    _allocated = false;
+}
 
 bool HdMoonshineRenderBuffer::Allocate(GfVec3i const& dimensions, HdFormat format, bool multiSampled)
 {
+    _Deallocate();
+
     _width = dimensions[0];
     _height = dimensions[1];
 
-    _sensor = HdMoonshineCreateSensor(_renderDelegate->_moonshine, Extent2D { .width = _width, .height = _height });
-    _data =  reinterpret_cast<uint8_t*>(HdMoonshineGetSensorData(_renderDelegate->_moonshine, _sensor));
+    std::optional<SensorFormat> sensorFormat = sensorFormatFor(format);
+    _format = sensorFormat ? format : HdFormatFloat32Vec4;
+
+    _sensor = HdMoonshineCreateSensor(_renderDelegate->_moonshine, Extent2D { .width = _width, .height = _height }, sensorFormat.value_or(SENSOR_FORMAT_F32X4));
+    _allocated = true;
 
     return true;
 }
 
+// moonshine counts maps itself, and keeps handing out the same frame until they're all unmapped
+void* HdMoonshineRenderBuffer::Map() {
+    _mappers++;
+    return HdMoonshineMapSensorData(_renderDelegate->_moonshine, _sensor);
+}
+
+void HdMoonshineRenderBuffer::Unmap() {
+    HdMoonshineUnmapSensorData(_renderDelegate->_moonshine, _sensor);
+    _mappers--;
+}
+
+bool HdMoonshineRenderBuffer::IsConverged() const {
+    return _renderDelegate->IsConverged(_sensor);
+}
+
 void HdMoonshineRenderBuffer::Resolve() {}
 
 PXR_NAMESPACE_CLOSE_SCOPE
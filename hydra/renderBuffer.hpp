@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+
 #include "moonshine.h"
 
 #include "pxr/pxr.h"
@@ -19,22 +21,18 @@ public:
     unsigned int GetWidth() const override { return _width; }
     unsigned int GetHeight() const override { return _height; }
     unsigned int GetDepth() const override { return 1; }
-    HdFormat GetFormat() const override { return HdFormatFloat32Vec4; }
+    HdFormat GetFormat() const override { return _format; }
     bool IsMultiSampled() const override { return false; }
 
-    void* Map() override {
-        return _data;
-    }
-
-    void Unmap() override {}
+    // latest finished frame, which stays put until unmapped
+    void* Map() override;
+    void Unmap() override;
 
     bool IsMapped() const override {
-        return false;
+        return _mappers != 0;
     }
 
-    bool IsConverged() const override {
-        return false;
-    }
+    bool IsConverged() const override;
 
     void Resolve() override;
 
@@ -43,9 +41,11 @@ private:
     void _Deallocate() override;
 
     HdMoonshineRenderDelegate* _renderDelegate;
+    bool _allocated = false;
     unsigned int _width;
     unsigned int _height;
-    uint8_t* _data = nullptr;
+    HdFormat _format = HdFormatFloat32Vec4;
+    std::atomic<int> _mappers = 0;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
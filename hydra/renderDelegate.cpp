@@ -1,4 +1,7 @@
+#include <algorithm>
+#include <functional>
 #include <memory>
+#include <vector>
 
 #include <pxr/imaging/hd/extComputation.h>
 
@@ -14,8 +17,13 @@ PXR_NAMESPACE_OPEN_SCOPE
 
 TF_DEFINE_PRIVATE_TOKENS(_tokens,
     (rebuildPipeline)
+    (targetSampleCount)
+    (exposure)
 );
 
+static const int defaultTargetSampleCount = 1024;
+static const float defaultExposure = 0.0f;
+
 const TfTokenVector HdMoonshineRenderDelegate::SUPPORTED_RPRIM_TYPES = {
     HdPrimTypeTokens->mesh,
 };
@@ -56,10 +64,18 @@ bool HdMoonshineRenderDelegate::InvokeCommand(const TfToken &command, const HdCo
 void HdMoonshineRenderDelegate::_Initialize() {
     _moonshine = HdMoonshineCreate();
     _resourceRegistry = std::make_shared<HdResourceRegistry>();
-    _renderParam = std::make_unique<HdMoonshineRenderParam>(_moonshine);
+    _renderParam = std::make_unique<HdMoonshineRenderParam>(_moonshine, &_renderThread);
+    _targetSampleCount = std::max(GetRenderSetting<int>(_tokens->targetSampleCount, defaultTargetSampleCount), 1);
+    HdMoonshineSetExposure(_moonshine, GetRenderSetting<float>(_tokens->exposure, defaultExposure));
+
+    _renderThread.SetRenderCallback(std::bind(&HdMoonshineRenderDelegate::_RenderCallback, this));
+    _renderThread.StartThread();
+    _renderParam->StartRender();
 }
 
 HdMoonshineRenderDelegate::~HdMoonshineRenderDelegate() {
+    _renderParam->StopRender();
+    _renderThread.StopThread();
     _resourceRegistry.reset();
     HdMoonshineDestroy(_moonshine);
 }
@@ -80,7 +96,151 @@ HdResourceRegistrySharedPtr HdMoonshineRenderDelegate::GetResourceRegistry() con
     return _resourceRegistry;
 }
 
-void HdMoonshineRenderDelegate::CommitResources(HdChangeTracker *tracker) {}
+void HdMoonshineRenderDelegate::CommitResources(HdChangeTracker *tracker) {
+    MOONSHINE_TRACE_SPAN("commit resources");
+
+    // upload everything staged during this sync all at once, along with in-place
+    // updates of deforming meshes, then create the instances that were waiting on it
+    HdMoonshineFlushStagedMeshes(_moonshine);
+    for (HdMoonshineMesh* mesh : _renderParam->TakePendingMeshes()) {
+        mesh->CreateInstances(_moonshine);
+    }
+
+    // swap in whatever textures finished decoding in the background since last time
+    _renderParam->_textureCache.UploadDecoded();
+}
+
+// keeps accumulating samples into the current target until it converges,
+// or until a sync stops it to edit the scene
+void HdMoonshineRenderDelegate::_RenderCallback() {
+    while (!_renderThread.IsStopRequested()) {
+        // rendered outside of the lock so that setting the target doesn't wait for a frame,
+        // but marked as being rendered to so that clearing it does
+        std::optional<RenderTarget> target;
+        {
+            std::lock_guard<std::mutex> guard(_renderTargetMutex);
+            target = _renderTarget;
+            if (target) _renderingSensor = target->sensor;
+        }
+
+        bool rendered = false;
+        if (target) {
+            // textures still loading don't need more samples, just the CommitResources that swaps them in
+            //
+            // counts what's in flight, so the last run isn't rendered again while it's waiting to be published
+            if (HdMoonshineGetSensorSubmittedSampleCount(_moonshine, target->sensor) < _targetSampleCount) {
+                HdMoonshineRender(_moonshine, target->sensor, target->lens);
+                rendered = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> guard(_renderTargetMutex);
+                _renderingSensor.reset();
+            }
+            _renderTargetIdle.notify_all();
+        }
+
+        // nothing to do until an edit resets the sample count, or the target changes
+        if (!rendered && !_renderParam->WaitForRenderWork()) {
+            break;
+        }
+    }
+}
+
+void HdMoonshineRenderDelegate::SetRenderTarget(SensorHandle sensor, LensHandle lens) {
+    {
+        std::lock_guard<std::mutex> guard(_renderTargetMutex);
+        _renderTarget = RenderTarget {
+            .sensor = sensor,
+            .lens = lens,
+        };
+    }
+
+    // picks back up after any edits that stopped it, or wakes it if it's waiting
+    _renderParam->StartRender();
+}
+
+void HdMoonshineRenderDelegate::ClearRenderTarget(SensorHandle sensor) {
+    std::unique_lock<std::mutex> lock(_renderTargetMutex);
+    if (_renderTarget && _renderTarget->sensor == sensor) {
+        _renderTarget.reset();
+    }
+
+    // the render thread may have picked it up just before
+    _renderTargetIdle.wait(lock, [this, sensor]() { return _renderingSensor != sensor; });
+}
+
+bool HdMoonshineRenderDelegate::IsConverged(SensorHandle sensor) const {
+    // textures still loading are only swapped in by CommitResources, which hydra stops calling once converged
+    return HdMoonshineGetSensorSampleCount(_moonshine, sensor) >= _targetSampleCount && !_renderParam->_textureCache.Pending();
+}
+
+HdRenderSettingDescriptorList HdMoonshineRenderDelegate::GetRenderSettingDescriptors() const {
+    return {
+        HdRenderSettingDescriptor {
+            "Target sample count",
+            _tokens->targetSampleCount,
+            VtValue(defaultTargetSampleCount),
+        },
+        HdRenderSettingDescriptor {
+            "Exposure",
+            _tokens->exposure,
+            VtValue(defaultExposure),
+        },
+    };
+}
+
+void HdMoonshineRenderDelegate::SetRenderSetting(TfToken const& key, VtValue const& value) {
+    HdRenderDelegate::SetRenderSetting(key, value);
+    if (key == _tokens->targetSampleCount) {
+        VtValue count = VtValue::Cast<int>(value);
+        if (!count.IsEmpty()) {
+            _targetSampleCount = std::max(count.UncheckedGet<int>(), 1);
+            _renderParam->WakeRender();
+        }
+    } else if (key == _tokens->exposure) {
+        VtValue exposure = VtValue::Cast<float>(value);
+        if (!exposure.IsEmpty()) {
+            HdMoonshineSetExposure(_moonshine, exposure.UncheckedGet<float>());
+            _renderParam->WakeRender();
+        }
+    }
+}
+
+VtDictionary HdMoonshineRenderDelegate::GetRenderStats() const {
+    std::vector<PassTiming> timings(16);
+    size_t count = HdMoonshineGetPassTimings(_moonshine, timings.data(), timings.size());
+    if (count > timings.size()) {
+        timings.resize(count);
+        count = std::min(HdMoonshineGetPassTimings(_moonshine, timings.data(), timings.size()), timings.size());
+    }
+    timings.resize(count);
+
+    VtDictionary passes;
+    for (const PassTiming& timing : timings) {
+        VtDictionary pass;
+        pass["lastMs"] = VtValue(timing.last_ms);
+        pass["averageMs"] = VtValue(timing.average_ms);
+        pass["count"] = VtValue(timing.count);
+        passes[timing.name] = VtValue(pass);
+    }
+
+    MemoryUsage usage = HdMoonshineGetMemoryUsage(_moonshine);
+    VtDictionary memory;
+    memory["budget"] = VtValue(usage.budget);
+    memory["usage"] = VtValue(usage.usage);
+    memory["mesh"] = VtValue(usage.mesh);
+    memory["accel"] = VtValue(usage.accel);
+    memory["texture"] = VtValue(usage.texture);
+    memory["sensor"] = VtValue(usage.sensor);
+    memory["staging"] = VtValue(usage.staging);
+    memory["other"] = VtValue(usage.other);
+
+    VtDictionary stats;
+    stats["gpuPassTimings"] = VtValue(passes);
+    stats["gpuMemory"] = VtValue(memory);
+    return stats;
+}
 
 HdRenderPassSharedPtr HdMoonshineRenderDelegate::CreateRenderPass(HdRenderIndex *index, HdRprimCollection const& collection) {
     return HdRenderPassSharedPtr(new HdMoonshineRenderPass(index, collection));
@@ -165,7 +325,7 @@ HdRenderParam* HdMoonshineRenderDelegate::GetRenderParam() const {
 
 HdAovDescriptor HdMoonshineRenderDelegate::GetDefaultAovDescriptor(TfToken const& name) const {
     if (name == HdAovTokens->color) {
-        return HdAovDescriptor(HdFormatFloat32Vec3, false, VtValue(GfVec4f(0.0f)));
+        return HdAovDescriptor(HdFormatFloat16Vec4, false, VtValue(GfVec4f(0.0f)));
     } else {
         return HdAovDescriptor();
     }
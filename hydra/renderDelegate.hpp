@@ -1,9 +1,14 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <optional>
 
 #include <pxr/pxr.h>
 #include <pxr/imaging/hd/renderDelegate.h>
+#include <pxr/imaging/hd/renderThread.h>
 #include <pxr/imaging/hd/resourceRegistry.h>
 
 #include "renderParam.hpp"
@@ -50,6 +55,25 @@ public:
     HdRenderParam *GetRenderParam() const override;
 
     HdAovDescriptor GetDefaultAovDescriptor(TfToken const& name) const override;
+
+    HdRenderSettingDescriptorList GetRenderSettingDescriptors() const override;
+    void SetRenderSetting(TfToken const& key, VtValue const& value) override;
+
+    // GPU time of each pass, keyed by pass name
+    VtDictionary GetRenderStats() const override;
+
+    // what the render thread progressively renders, set by the render pass,
+    // which also (re)starts the render thread
+    void SetRenderTarget(SensorHandle sensor, LensHandle lens);
+
+    // stops rendering to sensor if that's what is being rendered to,
+    // after which it is safe to release
+    void ClearRenderTarget(SensorHandle sensor);
+
+    // whether the latest finished frame of sensor has all the samples it is going to get,
+    // and no textures are still on their way
+    bool IsConverged(SensorHandle sensor) const;
+
     HdMoonshine* _moonshine;
 private:
     static const TfTokenVector SUPPORTED_RPRIM_TYPES;
@@ -57,10 +81,23 @@ private:
     static const TfTokenVector SUPPORTED_BPRIM_TYPES;
 
     void _Initialize();
+    void _RenderCallback();
 
     HdResourceRegistrySharedPtr _resourceRegistry;
     std::unique_ptr<HdMoonshineRenderParam> _renderParam;
 
+    struct RenderTarget {
+        SensorHandle sensor;
+        LensHandle lens;
+    };
+
+    HdRenderThread _renderThread;
+    std::mutex _renderTargetMutex;
+    std::optional<RenderTarget> _renderTarget;
+    std::optional<SensorHandle> _renderingSensor; // by the render thread, outside of the lock
+    std::condition_variable _renderTargetIdle; // once _renderingSensor is reset
+    std::atomic<uint32_t> _targetSampleCount;
+
     HdMoonshineRenderDelegate(const HdMoonshineRenderDelegate &) = delete;
     HdMoonshineRenderDelegate &operator =(const HdMoonshineRenderDelegate &) = delete;
 };
@@ -1,15 +1,25 @@
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_set>
+#include <utility>
+
 #include <pxr/imaging/hd/renderDelegate.h>
+#include <pxr/imaging/hd/renderThread.h>
 
 #include "moonshine.h"
+#include "textureCache.hpp"
 
 PXR_NAMESPACE_OPEN_SCOPE
 
+class HdMoonshineMesh;
+
 class HdMoonshineRenderParam final : public HdRenderParam
 {
 public:
-    HdMoonshineRenderParam(HdMoonshine* moonshine) : _moonshine(moonshine) {
+    HdMoonshineRenderParam(HdMoonshine* moonshine, HdRenderThread* renderThread) : _moonshine(moonshine), _textureCache(moonshine), _renderThread(renderThread) {
         _black3 = HdMoonshineCreateSolidTexture3(_moonshine, F32x3 { .x = 0.0f, .y = 0.0f, .z = 0.0f }, "black3");
         _black1 = HdMoonshineCreateSolidTexture1(_moonshine, 0.0, "black1");
         _up = HdMoonshineCreateSolidTexture3(_moonshine, F32x3 { .x = 0.0f, .y = 0.0f, .z = 1.0f }, "up");
@@ -25,8 +35,75 @@ public:
         });
     }
 
+    // stops the render thread until the next render pass execution restarts it, so that
+    // edits made during sync and CommitResources don't each have to wait for a frame to finish
+    HdMoonshine* AcquireSceneForEdit() {
+        StopRender();
+        return _moonshine;
+    }
+
+    // (re)starts the render thread, waking it if it's waiting for more to render
+    void StartRender() {
+        {
+            std::lock_guard<std::mutex> guard(_renderWakeMutex);
+            _renderStopping = false;
+            _renderWakeRequested = true;
+        }
+        _renderWake.notify_all();
+        _renderThread->StartRender();
+    }
+
+    // blocks until the render thread is idle, waking it first if it's waiting for more to render
+    void StopRender() {
+        // only the first of many parallel syncs needs to go through the mutex,
+        // the rest see the flag whenever the render thread next checks it
+        if (!_renderStopping.exchange(true)) {
+            { std::lock_guard<std::mutex> guard(_renderWakeMutex); }
+            _renderWake.notify_all();
+        }
+        _renderThread->StopRender();
+    }
+
+    // wakes the render thread if it's waiting for more to render, e.g. once settings
+    // that make it render more, or render again, change
+    void WakeRender() {
+        {
+            std::lock_guard<std::mutex> guard(_renderWakeMutex);
+            _renderWakeRequested = true;
+        }
+        _renderWake.notify_all();
+    }
+
+    // for the render thread, once it has nothing left to render -- blocks until it might,
+    // returning false if it should stop instead
+    bool WaitForRenderWork() {
+        std::unique_lock<std::mutex> lock(_renderWakeMutex);
+        _renderWake.wait(lock, [this]() { return _renderWakeRequested || _renderStopping; });
+        _renderWakeRequested = false;
+        return !_renderStopping;
+    }
+
+    // meshes whose instances are waiting on a staged mesh upload,
+    // created in CommitResources once the staged meshes are flushed
+    void AddPendingMesh(HdMoonshineMesh* mesh) {
+        std::lock_guard<std::mutex> guard(_pendingMeshesMutex);
+        _pendingMeshes.insert(mesh);
+    }
+
+    void RemovePendingMesh(HdMoonshineMesh* mesh) {
+        std::lock_guard<std::mutex> guard(_pendingMeshesMutex);
+        _pendingMeshes.erase(mesh);
+    }
+
+    std::unordered_set<HdMoonshineMesh*> TakePendingMeshes() {
+        std::lock_guard<std::mutex> guard(_pendingMeshesMutex);
+        return std::exchange(_pendingMeshes, {});
+    }
+
     HdMoonshine* _moonshine;
 
+    HdMoonshineTextureCache _textureCache;
+
     // some defaults
     ImageHandle _black3;
     ImageHandle _black1;
@@ -34,6 +111,17 @@ public:
     ImageHandle _grey3;
     ImageHandle _white1;
     MaterialHandle _defaultMaterial;
+
+private:
+    HdRenderThread* _renderThread;
+
+    std::mutex _renderWakeMutex;
+    std::condition_variable _renderWake;
+    std::atomic<bool> _renderStopping = false;
+    bool _renderWakeRequested = false;
+
+    std::mutex _pendingMeshesMutex;
+    std::unordered_set<HdMoonshineMesh*> _pendingMeshes;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
\ No newline at end of file
@@ -14,6 +14,15 @@ HdMoonshineRenderPass::HdMoonshineRenderPass(HdRenderIndex *index, HdRprimCollec
 
 HdMoonshineRenderPass::~HdMoonshineRenderPass() {}
 
+bool HdMoonshineRenderPass::IsConverged() const {
+    if (!_sensor) {
+        return false;
+    }
+    HdMoonshineRenderDelegate* renderDelegate = static_cast<HdMoonshineRenderDelegate*>(GetRenderIndex()->GetRenderDelegate());
+    return renderDelegate->IsConverged(_sensor.value());
+}
+
+// rendering itself happens on the render delegate's render thread, this just points it at the right place
 void HdMoonshineRenderPass::_Execute(HdRenderPassStateSharedPtr const& renderPassState, TfTokenVector const& renderTags) {
     for (const auto aov : renderPassState->GetAovBindings()) {
         if (aov.aovName == HdAovTokens->color) {
@@ -22,7 +31,8 @@ void HdMoonshineRenderPass::_Execute(HdRenderPassStateSharedPtr const& renderPas
             const HdMoonshineCamera* camera = static_cast<const HdMoonshineCamera*>(renderPassState->GetCamera());
 
             HdMoonshineRenderBuffer* renderBuffer = static_cast<HdMoonshineRenderBuffer*>(aov.renderBuffer);
-            HdMoonshineRender(renderDelegate->_moonshine, renderBuffer->_sensor, camera->_handle);
+            renderDelegate->SetRenderTarget(renderBuffer->_sensor, camera->_handle);
+            _sensor = renderBuffer->_sensor;
         }
     }
 }
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <optional>
+
 #include "pxr/pxr.h"
 #include "pxr/imaging/hd/renderPass.h"
 
+#include "moonshine.h"
+
 PXR_NAMESPACE_OPEN_SCOPE
 
 class HdMoonshineRenderPass final : public HdRenderPass
@@ -10,8 +14,12 @@ class HdMoonshineRenderPass final : public HdRenderPass
 public:
     HdMoonshineRenderPass(HdRenderIndex *index, HdRprimCollection const &collection);
     ~HdMoonshineRenderPass() override;
+
+    bool IsConverged() const override;
 protected:
     void _Execute(HdRenderPassStateSharedPtr const& renderPassState, TfTokenVector const& renderTags) override;
+private:
+    std::optional<SensorHandle> _sensor;
 };
 
 PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,142 @@
+#include <cstring>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <pxr/base/tf/diagnostic.h>
+
+#include "texels.hpp"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+std::optional<TexelLayout> texelLayoutFor(HioFormat format) {
+    switch (format) {
+        case HioFormatUNorm8: return TexelLayout { .format = TextureFormat::u8x1, .channelSize = 1, .srcChannels = 1, .dstChannels = 1 };
+        case HioFormatUNorm8Vec2: return TexelLayout { .format = TextureFormat::u8x2_grey_alpha, .channelSize = 1, .srcChannels = 2, .dstChannels = 2 };
+        case HioFormatUNorm8Vec3: return TexelLayout { .format = TextureFormat::u8x4, .channelSize = 1, .srcChannels = 3, .dstChannels = 4 };
+        case HioFormatUNorm8Vec4: return TexelLayout { .format = TextureFormat::u8x4, .channelSize = 1, .srcChannels = 4, .dstChannels = 4 };
+        case HioFormatUNorm8srgb: return TexelLayout { .format = TextureFormat::u8x1_srgb, .channelSize = 1, .srcChannels = 1, .dstChannels = 1 };
+        case HioFormatUNorm8Vec2srgb: return TexelLayout { .format = TextureFormat::u8x2_srgb_grey_alpha, .channelSize = 1, .srcChannels = 2, .dstChannels = 2 };
+        case HioFormatUNorm8Vec3srgb: return TexelLayout { .format = TextureFormat::u8x4_srgb, .channelSize = 1, .srcChannels = 3, .dstChannels = 4 };
+        case HioFormatUNorm8Vec4srgb: return TexelLayout { .format = TextureFormat::u8x4_srgb, .channelSize = 1, .srcChannels = 4, .dstChannels = 4 };
+        // hio has no unorm16, 16 bit images come through as uint16
+        case HioFormatUInt16: return TexelLayout { .format = TextureFormat::u16x1, .channelSize = 2, .srcChannels = 1, .dstChannels = 1 };
+        case HioFormatUInt16Vec2: return TexelLayout { .format = TextureFormat::u16x2_grey_alpha, .channelSize = 2, .srcChannels = 2, .dstChannels = 2 };
+        case HioFormatUInt16Vec3: return TexelLayout { .format = TextureFormat::u16x4, .channelSize = 2, .srcChannels = 3, .dstChannels = 4 };
+        case HioFormatUInt16Vec4: return TexelLayout { .format = TextureFormat::u16x4, .channelSize = 2, .srcChannels = 4, .dstChannels = 4 };
+        case HioFormatFloat16: return TexelLayout { .format = TextureFormat::f16x1, .channelSize = 2, .srcChannels = 1, .dstChannels = 1 };
+        case HioFormatFloat16Vec2: return TexelLayout { .format = TextureFormat::f16x2_grey_alpha, .channelSize = 2, .srcChannels = 2, .dstChannels = 2 };
+        case HioFormatFloat16Vec3: return TexelLayout { .format = TextureFormat::f16x4, .channelSize = 2, .srcChannels = 3, .dstChannels = 4 };
+        case HioFormatFloat16Vec4: return TexelLayout { .format = TextureFormat::f16x4, .channelSize = 2, .srcChannels = 4, .dstChannels = 4 };
+        case HioFormatFloat32: return TexelLayout { .format = TextureFormat::f32x1, .channelSize = 4, .srcChannels = 1, .dstChannels = 1 };
+        case HioFormatFloat32Vec2: return TexelLayout { .format = TextureFormat::f32x2_grey_alpha, .channelSize = 4, .srcChannels = 2, .dstChannels = 2 };
+        case HioFormatFloat32Vec3: return TexelLayout { .format = TextureFormat::f32x4, .channelSize = 4, .srcChannels = 3, .dstChannels = 4 };
+        case HioFormatFloat32Vec4: return TexelLayout { .format = TextureFormat::f32x4, .channelSize = 4, .srcChannels = 4, .dstChannels = 4 };
+        default: return std::nullopt;
+    }
+}
+
+// scalar version, for whatever the vectorized ones leave over
+template <typename T>
+static void padToRgba(const T* src, T* dst, size_t texelCount, T alpha) {
+    for (size_t i = 0; i < texelCount; i++) {
+        dst[4 * i + 0] = src[3 * i + 0];
+        dst[4 * i + 1] = src[3 * i + 1];
+        dst[4 * i + 2] = src[3 * i + 2];
+        dst[4 * i + 3] = alpha;
+    }
+}
+
+// by far the most common case
+static void padToRgbaU8(const uint8_t* src, uint8_t* dst, size_t texelCount) {
+    size_t i = 0;
+#if defined(__SSSE3__)
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xFF000000u));
+    // does 4 texels at a time but loads 16 bytes, so leave enough of a tail to not read past the end
+    for (; i + 6 <= texelCount; i += 4) {
+        const __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alpha));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= texelCount; i += 16) {
+        const uint8x16x3_t rgb = vld3q_u8(src + 3 * i);
+        const uint8x16x4_t rgba = { rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_u8(0xFF) };
+        vst4q_u8(dst + 4 * i, rgba);
+    }
+#endif
+    padToRgba<uint8_t>(src + 3 * i, dst + 4 * i, texelCount - i, 0xFF);
+}
+
+// for both u16 and f16, which only differ in what alpha is
+static void padToRgbaU16(const uint16_t* src, uint16_t* dst, size_t texelCount, uint16_t alpha) {
+    size_t i = 0;
+#if defined(__SSSE3__)
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 3, 4, 5, -1, -1, 6, 7, 8, 9, 10, 11, -1, -1);
+    const __m128i alphas = _mm_setr_epi16(0, 0, 0, static_cast<short>(alpha), 0, 0, 0, static_cast<short>(alpha));
+    // does 2 texels at a time but loads 16 bytes, so leave enough of a tail to not read past the end
+    for (; i + 3 <= texelCount; i += 2) {
+        const __m128i rgb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 3 * i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 4 * i), _mm_or_si128(_mm_shuffle_epi8(rgb, shuffle), alphas));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 8 <= texelCount; i += 8) {
+        const uint16x8x3_t rgb = vld3q_u16(src + 3 * i);
+        const uint16x8x4_t rgba = { rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_u16(alpha) };
+        vst4q_u16(dst + 4 * i, rgba);
+    }
+#endif
+    padToRgba<uint16_t>(src + 3 * i, dst + 4 * i, texelCount - i, alpha);
+}
+
+static void padToRgbaF32(const float* src, float* dst, size_t texelCount) {
+    size_t i = 0;
+#if defined(__SSSE3__)
+    const __m128 ones = _mm_set1_ps(1.0f);
+    // loads a float past each texel, so leave the last one to the scalar version
+    for (; i + 2 <= texelCount; i++) {
+        const __m128 rgbx = _mm_loadu_ps(src + 3 * i);
+        const __m128 b1x1 = _mm_unpackhi_ps(rgbx, ones);
+        _mm_storeu_ps(dst + 4 * i, _mm_shuffle_ps(rgbx, b1x1, _MM_SHUFFLE(1, 0, 1, 0)));
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= texelCount; i += 4) {
+        const float32x4x3_t rgb = vld3q_f32(src + 3 * i);
+        const float32x4x4_t rgba = { rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_f32(1.0f) };
+        vst4q_f32(dst + 4 * i, rgba);
+    }
+#endif
+    padToRgba<float>(src + 3 * i, dst + 4 * i, texelCount - i, 1.0f);
+}
+
+void convertTexels(TexelLayout const& layout, const uint8_t* src, uint8_t* dst, size_t texelCount) {
+    if (layout.srcChannels == layout.dstChannels) {
+        std::memcpy(dst, src, texelCount * layout.srcChannels * layout.channelSize);
+        return;
+    }
+
+    // otherwise RGB to RGBA, with an opaque alpha
+    switch (layout.format) {
+        case TextureFormat::u8x4:
+        case TextureFormat::u8x4_srgb:
+            padToRgbaU8(src, dst, texelCount);
+            break;
+        case TextureFormat::u16x4:
+            padToRgbaU16(reinterpret_cast<const uint16_t*>(src), reinterpret_cast<uint16_t*>(dst), texelCount, 0xFFFF);
+            break;
+        case TextureFormat::f16x4:
+            padToRgbaU16(reinterpret_cast<const uint16_t*>(src), reinterpret_cast<uint16_t*>(dst), texelCount, 0x3C00); // 1.0 as a half
+            break;
+        case TextureFormat::f32x4:
+            padToRgbaF32(reinterpret_cast<const float*>(src), reinterpret_cast<float*>(dst), texelCount);
+            break;
+        default:
+            TF_CODING_ERROR("no conversion from %zu to %zu channels for format %d", layout.srcChannels, layout.dstChannels, layout.format);
+            break;
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+#include <pxr/pxr.h>
+#include <pxr/imaging/hio/types.h>
+
+#include "moonshine.h"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// how texels decoded as some HioFormat get uploaded
+struct TexelLayout {
+    TextureFormat format; // most compact moonshine format that keeps all the data
+    size_t channelSize; // in bytes
+    size_t srcChannels; // as decoded
+    size_t dstChannels; // as uploaded, RGB gets padded to RGBA as it is poorly supported
+};
+
+std::optional<TexelLayout> texelLayoutFor(HioFormat format);
+
+// converts texelCount texels from srcChannels to dstChannels, src and dst must not overlap
+void convertTexels(TexelLayout const& layout, const uint8_t* src, uint8_t* dst, size_t texelCount);
+
+PXR_NAMESPACE_CLOSE_SCOPE
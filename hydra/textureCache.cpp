@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include <pxr/base/arch/fileSystem.h>
+#include <pxr/imaging/hio/image.h>
+
+#include "textureCache.hpp"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+HdMoonshineTextureCache::HdMoonshineTextureCache(HdMoonshine* moonshine) : _moonshine(moonshine) {
+    // leave some room for the sync itself
+    const unsigned workerCount = std::max(1u, std::thread::hardware_concurrency() / 2);
+    for (unsigned i = 0; i < workerCount; i++) {
+        _workers.emplace_back(&HdMoonshineTextureCache::Work, this);
+    }
+}
+
+HdMoonshineTextureCache::~HdMoonshineTextureCache() {
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _stopping = true;
+    }
+    _jobsAvailable.notify_all();
+    for (std::thread& worker : _workers) {
+        worker.join();
+    }
+}
+
+std::optional<HdMoonshineTextureCache::Ticket> HdMoonshineTextureCache::Acquire(std::string const& resolvedPath, std::string const& debugName, ReadyCallback onReady) {
+    // only reads the header
+    auto image = HioImage::OpenForReading(resolvedPath);
+    if (!image) {
+        TF_CODING_ERROR("could not open %s", resolvedPath.c_str());
+        return std::nullopt;
+    }
+
+    std::optional<TexelLayout> layout = texelLayoutFor(image->GetFormat());
+    if (!layout) {
+        TF_CODING_ERROR("unknown format %u", image->GetFormat());
+        return std::nullopt;
+    }
+
+    // stays zero for assets that aren't plain files, e.g. in a usdz, which is fine as those can't be edited in place
+    double modificationTime = 0.0;
+    ArchGetModificationTime(resolvedPath.c_str(), &modificationTime);
+
+    Key key = Key {
+        .path = resolvedPath,
+        .modificationTime = modificationTime,
+        .format = layout->format,
+    };
+
+    std::optional<ImageHandle> ready;
+    Ticket ticket;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        ticket = _nextTicket++;
+
+        auto [it, inserted] = _entries.try_emplace(key, Entry {
+            .texture = std::nullopt,
+            .failed = false,
+            .job = _nextJob,
+            .refCount = 0,
+            .waiting = {},
+        });
+        if (inserted) {
+            _jobs.push_back(Job {
+                .id = _nextJob++,
+                .key = key,
+                .format = image->GetFormat(),
+                .layout = layout.value(),
+                .debugName = debugName,
+            });
+            _jobsAvailable.notify_one();
+        }
+
+        Entry& entry = it->second;
+        entry.refCount += 1;
+        if (entry.texture) {
+            ready = entry.texture;
+        } else if (!entry.failed) {
+            entry.waiting.push_back(ticket);
+        }
+
+        _references.emplace(ticket, Reference {
+            .key = std::move(key),
+            .onReady = onReady,
+        });
+    }
+
+    if (ready) {
+        onReady(ready.value());
+    }
+
+    return ticket;
+}
+
+void HdMoonshineTextureCache::Release(Ticket ticket) {
+    std::optional<ImageHandle> unused;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        auto referenceIt = _references.find(ticket);
+        if (referenceIt == _references.end()) {
+            TF_CODING_ERROR("texture reference released but not in cache");
+            return;
+        }
+
+        auto entryIt = _entries.find(referenceIt->second.key);
+        _references.erase(referenceIt);
+
+        Entry& entry = entryIt->second;
+        entry.waiting.erase(std::remove(entry.waiting.begin(), entry.waiting.end(), ticket), entry.waiting.end());
+        entry.refCount -= 1;
+        if (entry.refCount == 0) {
+            // anything decoded for this entry later on is dropped in UploadDecoded
+            const uint64_t job = entry.job;
+            _jobs.erase(std::remove_if(_jobs.begin(), _jobs.end(), [job](Job const& queued) { return queued.id == job; }), _jobs.end());
+            unused = entry.texture;
+            _entries.erase(entryIt);
+        }
+    }
+
+    if (unused) {
+        HdMoonshineDestroyTexture(_moonshine, unused.value());
+    }
+}
+
+void HdMoonshineTextureCache::UploadDecoded() {
+    std::vector<Decoded> decoded;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _decoded.erase(std::remove_if(_decoded.begin(), _decoded.end(), [this](Decoded const& texture) {
+            auto it = _entries.find(texture.key);
+            return it == _entries.end() || it->second.job != texture.job;
+        }), _decoded.end());
+        decoded = std::exchange(_decoded, {});
+    }
+
+    if (decoded.empty()) {
+        return;
+    }
+
+    std::vector<RawTexture> rawTextures;
+    rawTextures.reserve(decoded.size());
+    for (Decoded const& texture : decoded) {
+        rawTextures.push_back(RawTexture {
+            .data = texture.data.get(),
+            .extent = texture.extent,
+            .format = texture.key.format,
+            .name = texture.debugName.c_str(),
+        });
+    }
+    std::vector<ImageHandle> textures(decoded.size());
+    const size_t uploaded = HdMoonshineCreateRawTextures(_moonshine, rawTextures.data(), rawTextures.size(), textures.data());
+
+    // acquires and releases don't happen alongside this, so every entry is still around
+    std::vector<std::pair<ReadyCallback, ImageHandle>> notifications;
+    {
+        std::lock_guard<std::mutex> guard(_mutex);
+        for (size_t i = 0; i < decoded.size(); i++) {
+            Entry& entry = _entries.at(decoded[i].key);
+            if (i >= uploaded) {
+                // didn't fit in device memory, so materials keep their placeholders like a failed decode
+                TF_WARN("out of device memory for texture %s", decoded[i].debugName.c_str());
+                entry.failed = true;
+                entry.waiting.clear();
+                continue;
+            }
+            entry.texture = textures[i];
+            for (Ticket ticket : entry.waiting) {
+                notifications.emplace_back(_references.at(ticket).onReady, textures[i]);
+            }
+            entry.waiting.clear();
+        }
+    }
+
+    for (auto const& [onReady, texture] : notifications) {
+        onReady(texture);
+    }
+}
+
+bool HdMoonshineTextureCache::Pending() {
+    std::lock_guard<std::mutex> guard(_mutex);
+    return !_jobs.empty() || _decoding != 0 || !_decoded.empty();
+}
+
+void HdMoonshineTextureCache::Fail(Job const& job) {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _decoding -= 1;
+
+    // may have been released, or released and acquired again, since
+    auto it = _entries.find(job.key);
+    if (it != _entries.end() && it->second.job == job.id) {
+        it->second.failed = true;
+        it->second.waiting.clear();
+    }
+}
+
+void HdMoonshineTextureCache::Work() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _jobsAvailable.wait(lock, [this] { return _stopping || !_jobs.empty(); });
+            if (_stopping) {
+                return;
+            }
+            job = std::move(_jobs.front());
+            _jobs.pop_front();
+            _decoding += 1;
+        }
+
+        MOONSHINE_TRACE_SPAN("decode texture");
+        auto image = HioImage::OpenForReading(job.key.path);
+        if (!image) {
+            TF_CODING_ERROR("could not open %s", job.key.path.c_str());
+            Fail(job);
+            continue;
+        }
+
+        // file may have changed since Acquire read its header
+        if (image->GetFormat() != job.format) {
+            TF_CODING_ERROR("format of %s changed while loading", job.key.path.c_str());
+            Fail(job);
+            continue;
+        }
+
+        HioImage::StorageSpec spec;
+        spec.width  = image->GetWidth();
+        spec.height = image->GetHeight();
+        spec.format = image->GetFormat();
+        spec.flipped = true; // moonshine expects flipped UVs which is equivalent to flipping here
+        const size_t texelCount = spec.width * spec.height;
+        std::unique_ptr<uint8_t[]> data = std::make_unique<uint8_t[]>(texelCount * image->GetBytesPerPixel());
+        spec.data = data.get();
+        if (!image->Read(spec)) {
+            TF_CODING_ERROR("could not decode %s", job.key.path.c_str());
+            Fail(job);
+            continue;
+        }
+
+        const TexelLayout& layout = job.layout;
+        if (layout.srcChannels != layout.dstChannels) {
+            std::unique_ptr<uint8_t[]> converted = std::make_unique<uint8_t[]>(texelCount * layout.dstChannels * layout.channelSize);
+            convertTexels(layout, data.get(), converted.get(), texelCount);
+            data = std::move(converted);
+        }
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        _decoding -= 1;
+        _decoded.push_back(Decoded {
+            .job = job.id,
+            .key = std::move(job.key),
+            .debugName = std::move(job.debugName),
+            .data = std::move(data),
+            .extent = Extent2D {
+                .width = static_cast<uint32_t>(spec.width),
+                .height = static_cast<uint32_t>(spec.height),
+            },
+        });
+    }
+}
+
+PXR_NAMESPACE_CLOSE_SCOPE
@@ -0,0 +1,119 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <pxr/pxr.h>
+#include <pxr/base/tf/hash.h>
+
+#include "moonshine.h"
+#include "texels.hpp"
+
+PXR_NAMESPACE_OPEN_SCOPE
+
+// shares textures loaded from files between all materials
+// keyed on modification time too so that edited files get reloaded
+//
+// files are decoded on background threads, then uploaded together in UploadDecoded
+class HdMoonshineTextureCache final {
+public:
+    using Ticket = uint64_t;
+    using ReadyCallback = std::function<void(ImageHandle)>;
+
+    HdMoonshineTextureCache(HdMoonshine* moonshine);
+    ~HdMoonshineTextureCache();
+
+    // takes a reference to the texture at resolvedPath, starting to decode it if it isn't already
+    // onReady is called with the texture once it is uploaded, right away if it already is,
+    // and never if it fails to load
+    std::optional<Ticket> Acquire(std::string const& resolvedPath, std::string const& debugName, ReadyCallback onReady);
+
+    // drops a reference returned by Acquire, destroying the texture once there are none left
+    // onReady is never called after this
+    void Release(Ticket ticket);
+
+    // uploads everything decoded so far in a single submit and notifies whoever was waiting on it
+    // must not be called alongside syncs
+    void UploadDecoded();
+
+    // whether any acquired texture is still being decoded or waiting for UploadDecoded
+    bool Pending();
+
+private:
+    struct Key {
+        std::string path;
+        double modificationTime;
+        TextureFormat format;
+
+        bool operator==(Key const& other) const {
+            return path == other.path && modificationTime == other.modificationTime && format == other.format;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(Key const& key) const {
+            return TfHash::Combine(key.path, key.modificationTime, key.format);
+        }
+    };
+
+    struct Entry {
+        std::optional<ImageHandle> texture; // empty until uploaded
+        bool failed; // couldn't be loaded, so nobody waits on it
+        uint64_t job; // to tell apart decodes of entries that were released and acquired again
+        size_t refCount;
+        std::vector<Ticket> waiting;
+    };
+
+    struct Reference {
+        Key key;
+        ReadyCallback onReady;
+    };
+
+    struct Job {
+        uint64_t id;
+        Key key;
+        HioFormat format; // as decoded
+        TexelLayout layout;
+        std::string debugName;
+    };
+
+    struct Decoded {
+        uint64_t job;
+        Key key;
+        std::string debugName;
+        std::unique_ptr<uint8_t[]> data;
+        Extent2D extent;
+    };
+
+    void Work();
+
+    // gives up on the entry the job was decoding, leaving its waiters with their placeholders
+    void Fail(Job const& job);
+
+    HdMoonshine* _moonshine;
+
+    std::mutex _mutex;
+    std::unordered_map<Key, Entry, KeyHash> _entries;
+    std::unordered_map<Ticket, Reference> _references;
+    Ticket _nextTicket = 0;
+    uint64_t _nextJob = 0;
+
+    // guarded by _mutex too
+    std::condition_variable _jobsAvailable;
+    std::deque<Job> _jobs;
+    size_t _decoding = 0; // jobs taken by workers but not yet decoded or failed
+    std::vector<Decoded> _decoded;
+    bool _stopping = false;
+    std::vector<std::thread> _workers;
+};
+
+PXR_NAMESPACE_CLOSE_SCOPE
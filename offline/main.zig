@@ -88,17 +88,17 @@ pub fn main() !void {
     defer config.destroy(allocator);
 
     const context = try VulkanContext.create(allocator, "offline", &.{}, &engine.hrtsystem.required_device_extensions, &engine.hrtsystem.required_device_features, null);
-    defer context.destroy();
+    defer context.destroy(allocator);
 
     var vk_allocator = try VkAllocator.create(&context, allocator);
     defer vk_allocator.destroy(&context, allocator);
 
-    var commands = try Commands.create(&context);
+    var commands = try Commands.create(&context, &vk_allocator);
     defer commands.destroy(&context);
 
     try logger.log("set up initial state");
 
-    var scene = try Scene.fromGlbExr(&context, &vk_allocator, allocator, &commands, config.in_filepath, config.skybox_filepath, config.extent, false);
+    var scene = try Scene.fromGlbExr(&context, &vk_allocator, allocator, &commands, config.in_filepath, config.skybox_filepath, config.extent);
     defer scene.destroy(&context, allocator);
 
     try logger.log("load world");
@@ -128,6 +128,8 @@ pub fn main() !void {
         pipeline.recordBindTextureDescriptorSet(&context, commands.buffer, scene.world.materials.textures.descriptor_set);
         pipeline.recordPushDescriptors(&context, commands.buffer, scene.pushDescriptors(0, 0));
 
+        // one scope for all samples, so any number of them can be timed
+        const scope = commands.beginScope(&context, "trace rays");
         for (0..config.spp) |sample_count| {
             // push our stuff
             pipeline.recordPushConstants(&context, commands.buffer, .{ .lens = scene.camera.lenses.items[0], .sample_count = scene.camera.sensors.items[0].sample_count });
@@ -163,6 +165,7 @@ pub fn main() !void {
             }
             scene.camera.sensors.items[0].sample_count += 1;
         }
+        commands.endScope(&context, scope);
 
         // copy our stuff
         scene.camera.sensors.items[0].recordPrepareForCopy(&context, commands.buffer, .{ .ray_tracing_shader_bit_khr = true }, .{ .copy_bit = true });
@@ -191,13 +194,20 @@ pub fn main() !void {
         };
         context.device.cmdCopyImageToBuffer(commands.buffer, scene.camera.sensors.items[0].image.handle, .transfer_src_optimal, output_buffer.handle, 1, @ptrCast(&copy));
 
-        try commands.submitAndIdleUntilDone(&context);
+        const ticket = try commands.submit(&context);
+        try commands.wait(&context, ticket);
     }
 
     try logger.log("render");
 
+    try commands.profiler.collect(&context, try commands.completed(&context));
+    try std.io.getStdOut().writer().print("GPU time per pass:\n", .{});
+    try commands.profiler.writeReport(std.io.getStdOut().writer());
+
     // now done with GPU stuff/all rendering; can write from output buffer to exr
     try exr.helpers.Rgba2D.save(exr.helpers.Rgba2D { .ptr = output_buffer.data.ptr, .extent = scene.camera.sensors.items[0].extent }, allocator, config.out_filepath);
 
     try logger.log("write exr");
+
+    try engine.tracing.writeDefault();
 }
@@ -8,7 +8,7 @@ const Commands = core.Commands;
 const VkAllocator = core.Allocator;
 const DestructionQueue = core.DestructionQueue;
 const vk_helpers = core.vk_helpers;
-const SyncCopier = core.SyncCopier;
+const Readback = core.Readback;
 const TextureManager = core.Images.TextureManager;
 
 const hrtsystem = engine.hrtsystem;
@@ -78,11 +78,13 @@ pub fn main() !void {
     const config = try Config.fromCli(allocator);
     defer config.destroy(allocator);
 
+    defer engine.tracing.writeDefault() catch |err| std.log.warn("failed to write trace: {}", .{ err });
+
     const window = try Window.create(config.extent.width, config.extent.height, "online");
     defer window.destroy();
 
     const context = try VulkanContext.create(allocator, "online", &window.getRequiredInstanceExtensions(), &(displaysystem.required_device_extensions ++ hrtsystem.required_device_extensions), &hrtsystem.required_device_features, queueFamilyAcceptable);
-    defer context.destroy();
+    defer context.destroy(allocator);
 
     var vk_allocator = try VkAllocator.create(&context, allocator);
     defer vk_allocator.destroy(&context, allocator);
@@ -91,21 +93,21 @@ pub fn main() !void {
     var display = try Display.create(&context, window_extent, try window.createSurface(context.instance.handle));
     defer display.destroy(&context);
 
-    var commands = try Commands.create(&context);
+    var commands = try Commands.create(&context, &vk_allocator);
     defer commands.destroy(&context);
 
     var gui = try Platform.create(&context, display.swapchain, window, window_extent, &vk_allocator, &commands);
     defer gui.destroy(&context);
 
-    var destruction_queue = DestructionQueue.create(); // TODO: need to clean this every once in a while since we're only allowed a limited amount of most types of handles
+    var destruction_queue = DestructionQueue.create();
     defer destruction_queue.destroy(&context, allocator);
 
-    var sync_copier = try SyncCopier.create(&context, &vk_allocator, @sizeOf(vk.AccelerationStructureInstanceKHR));
-    defer sync_copier.destroy(&context);
+    var readback = try Readback.create(&context, &vk_allocator);
+    defer readback.destroy(&context);
 
     std.log.info("Set up initial state!", .{});
 
-    var scene = try Scene.fromGlbExr(&context, &vk_allocator, allocator, &commands, config.in_filepath, config.skybox_filepath, config.extent, true);
+    var scene = try Scene.fromGlbExr(&context, &vk_allocator, allocator, &commands, config.in_filepath, config.skybox_filepath, config.extent);
 
     defer scene.destroy(&context, allocator);
 
@@ -115,6 +117,7 @@ pub fn main() !void {
     defer object_picker.destroy(&context);
 
     var pipeline_opts = Pipeline.SpecConstants{};
+    var mesh_light_tree = pipeline_opts.mesh_light_tree; // as of the last successful build, which is what shaders go by
     var pipeline = try Pipeline.create(&context, &vk_allocator, allocator, &commands, scene.world.materials.textures.descriptor_layout, pipeline_opts, .{ scene.background.sampler });
     defer pipeline.destroy(&context);
 
@@ -135,15 +138,23 @@ pub fn main() !void {
     var rebuild_label_buffer: [20]u8 = undefined;
     var rebuild_label = try std.fmt.bufPrintZ(&rebuild_label_buffer, "Rebuild", .{});
     var rebuild_error = false;
+    var rebuild_requested = false;
     var has_clicked = false;
-    var current_clicked_object: ?ObjectPicker.ClickedObject = null;
+    var inspection: ?Inspection = null;
+    var clicked_pixel_request: ?Readback.Request = null;
     var current_clicked_color = F32x3.new(0.0, 0.0, 0.0);
 
     while (!window.shouldClose()) {
+        const frame_span = engine.tracing.begin("frame");
+        defer frame_span.end();
+
+        destruction_queue.collect(&context, try commands.completed(&context));
+        try commands.profiler.collect(&context, try commands.completed(&context));
+
         const command_buffer = if (display.startFrame(&context)) |buffer| buffer else |err| switch (err) {
             error.OutOfDateKHR => blk: {
                 const new_extent = window.getExtent();
-                try display.recreate(&context, new_extent, &destruction_queue, allocator);
+                try display.recreate(&context, new_extent, &commands, &destruction_queue, allocator);
                 try gui.resize(&context, display.swapchain);
                 active_sensor = try scene.camera.appendSensor(&context, &vk_allocator, allocator, new_extent);
                 break :blk try display.startFrame(&context); // don't recreate on second failure
@@ -151,6 +162,25 @@ pub fn main() !void {
             else => return err,
         };
 
+        // what endFrame signals, so what everything recorded this frame is tagged with --
+        // nothing may submit through commands before then, or it would take this ticket
+        const frame_ticket = commands.pendingTicket();
+
+        // pick up whatever readbacks are done, recording the ones that depend on them
+        {
+            const completed = try commands.completed(&context);
+            readback.collect(completed);
+            if (object_picker.takePick(completed)) |pick| {
+                if (inspection) |*inspected| inspected.cancel(&readback);
+                inspection = if (pick.object) |object| Inspection { .object = object } else null;
+            }
+            if (inspection) |*inspected| try inspected.advance(&context, &readback, &scene, command_buffer, frame_ticket, completed);
+            if (clicked_pixel_request) |request| if (readback.get(F32x4, request, completed)) |clicked_pixel| {
+                current_clicked_color = clicked_pixel.truncate();
+                clicked_pixel_request = null;
+            };
+        }
+
         gui.startFrame();
         imgui.setNextWindowPos(50, 50);
         imgui.setNextWindowSize(250, 350);
@@ -158,6 +188,17 @@ pub fn main() !void {
         if (imgui.collapsingHeader("Metrics")) {
             try imgui.textFmt("Last frame time: {d:.3}ms", .{display.last_frame_time_ns / std.time.ns_per_ms});
             try imgui.textFmt("Framerate: {d:.2} FPS", .{imgui.getIO().Framerate});
+            imgui.separatorText("GPU passes");
+            for (commands.profiler.results()) |pass| {
+                try imgui.textFmt("{s}: {d:.3}ms", .{ pass.name, pass.last_ns / std.time.ns_per_ms });
+            }
+            imgui.separatorText("GPU memory");
+            const budget = vk_allocator.getBudget(&context);
+            try imgui.textFmt("Usage: {d:.1}MiB of {d:.1}MiB", .{ @as(f64, @floatFromInt(budget.usage)) / (1024 * 1024), @as(f64, @floatFromInt(budget.budget)) / (1024 * 1024) });
+            const statistics = vk_allocator.getStatistics();
+            for (std.enums.values(VkAllocator.Category)) |category| {
+                try imgui.textFmt("{s}: {d:.1}MiB", .{ @tagName(category), @as(f64, @floatFromInt(statistics.categories.get(category).bytes)) / (1024 * 1024) });
+            }
         }
         if (imgui.collapsingHeader("Sensor")) {
             if (imgui.button("Reset", imgui.Vec2{ .x = imgui.getContentRegionAvail().x - imgui.getFontSize() * 10, .y = 0 })) {
@@ -191,20 +232,12 @@ pub fn main() !void {
             _ = imgui.dragScalar(u32, "Max light bounces", &pipeline_opts.max_bounces, 1.0, 0, std.math.maxInt(u32));
             _ = imgui.dragScalar(u32, "Env map samples per bounce", &pipeline_opts.env_samples_per_bounce, 1.0, 0, std.math.maxInt(u32));
             _ = imgui.dragScalar(u32, "Mesh samples per bounce", &pipeline_opts.mesh_samples_per_bounce, 1.0, 0, std.math.maxInt(u32));
+            _ = imgui.checkbox("Light tree for mesh samples", &pipeline_opts.mesh_light_tree);
             const last_rebuild_failed = rebuild_error;
             if (last_rebuild_failed) imgui.pushStyleColor(.text, F32x4.new(1.0, 0.0, 0.0, 1));
             if (imgui.button(rebuild_label, imgui.Vec2{ .x = imgui.getContentRegionAvail().x, .y = 0.0 })) {
-                const start = try std.time.Instant.now();
-                if (pipeline.recreate(&context, &vk_allocator, allocator, &commands, pipeline_opts)) |old_pipeline| {
-                    try destruction_queue.add(allocator, old_pipeline);
-                    const elapsed = (try std.time.Instant.now()).since(start) / std.time.ns_per_ms;
-                    rebuild_label = try std.fmt.bufPrintZ(&rebuild_label_buffer, "Rebuild ({d}ms)", .{elapsed});
-                    rebuild_error = false;
-                    scene.camera.sensors.items[active_sensor].clear();
-                } else |err| if (err == error.ShaderCompileFail) {
-                    rebuild_error = true;
-                    rebuild_label = try std.fmt.bufPrintZ(&rebuild_label_buffer, "Rebuild (error)", .{});
-                } else return err;
+                // done once the frame is submitted, as rebuilding submits through commands
+                rebuild_requested = true;
             }
             if (last_rebuild_failed) imgui.popStyleColor();
             imgui.popItemWidth();
@@ -217,57 +250,68 @@ pub fn main() !void {
             imgui.separatorText("pixel");
             _ = imgui.colorEdit("Pixel color", &current_clicked_color, .{ .no_inputs = true, .no_options = true, .no_picker = true });
             imgui.pushItemWidth(imgui.getFontSize() * -12);
-            if (current_clicked_object) |object| {
+            if (inspection) |*inspected| {
+                const object = inspected.object;
                 imgui.separatorText("data");
                 try imgui.textFmt("Instance index: {d}", .{object.instance_index});
                 try imgui.textFmt("Geometry index: {d}", .{object.geometry_index});
-                // TODO: all of the copying below should be done once, on object pick
-                const instance = try sync_copier.copyBufferItem(&context, vk.AccelerationStructureInstanceKHR, scene.world.accel.instances_device, object.instance_index);
-                const accel_geometry_index = instance.instance_custom_index_and_mask.instance_custom_index + object.geometry_index;
-                var geometry = try sync_copier.copyBufferItem(&context, Accel.Geometry, scene.world.accel.geometries, accel_geometry_index);
-                const material = try sync_copier.copyBufferItem(&context, MaterialManager.Material, scene.world.materials.materials, geometry.material);
-                try imgui.textFmt("Mesh index: {d}", .{geometry.mesh});
-                if (imgui.inputScalar(u32, "Material index", &geometry.material, null, null) and geometry.material < scene.world.materials.material_count) {
-                    scene.world.accel.recordUpdateSingleMaterial(&context, command_buffer, accel_geometry_index, geometry.material);
-                    scene.camera.sensors.items[active_sensor].clear();
+                if (inspected.geometry) |*geometry| {
+                    try imgui.textFmt("Mesh index: {d}", .{geometry.mesh});
+                    var material_index = geometry.material;
+                    if (imgui.inputScalar(u32, "Material index", &material_index, null, null) and material_index < scene.world.materials.material_count) {
+                        scene.world.accel.recordUpdateSingleMaterial(&context, command_buffer, inspected.geometryIndex(), material_index);
+                        scene.camera.sensors.items[active_sensor].clear();
+                        geometry.material = material_index;
+                        inspected.invalidateMaterial(&readback);
+                    }
+                    try imgui.textFmt("Sampled: {}", .{geometry.sampled});
+                    imgui.separatorText("mesh");
+                    const mesh = scene.world.meshes.meshes.get(geometry.mesh);
+                    try imgui.textFmt("Vertex count: {d}", .{mesh.vertex_count});
+                    try imgui.textFmt("Index count: {d}", .{mesh.index_count});
+                    try imgui.textFmt("Has texcoords: {}", .{!mesh.texcoord_buffer.is_null()});
+                    try imgui.textFmt("Has normals: {}", .{!mesh.normal_buffer.is_null()});
                 }
-                try imgui.textFmt("Sampled: {}", .{geometry.sampled});
-                imgui.separatorText("mesh");
-                const mesh = scene.world.meshes.meshes.get(geometry.mesh);
-                try imgui.textFmt("Vertex count: {d}", .{mesh.vertex_count});
-                try imgui.textFmt("Index count: {d}", .{mesh.index_count});
-                try imgui.textFmt("Has texcoords: {}", .{!mesh.texcoord_buffer.is_null()});
-                try imgui.textFmt("Has normals: {}", .{!mesh.normal_buffer.is_null()});
-                imgui.separatorText("material");
-                try imgui.textFmt("normal: {}", .{material.normal});
-                try imgui.textFmt("emissive: {}", .{material.emissive});
-                try imgui.textFmt("type: {s}", .{@tagName(material.type)});
-                inline for (@typeInfo(MaterialManager.MaterialType).Enum.fields, @typeInfo(MaterialManager.MaterialVariant).Union.fields) |enum_field, union_field| {
-                    const VariantType = union_field.type;
-                    if (VariantType != void and enum_field.value == @intFromEnum(material.type)) {
-                        const material_idx: u32 = @intCast((material.addr - @field(scene.world.materials.variant_buffers, enum_field.name).addr) / @sizeOf(VariantType));
-                        var material_variant = try sync_copier.copyBufferItem(&context, VariantType, @field(scene.world.materials.variant_buffers, enum_field.name).buffer, material_idx);
-                        inline for (@typeInfo(VariantType).Struct.fields) |struct_field| {
-                            switch (struct_field.type) {
-                                f32 => if (imgui.dragScalar(f32, (struct_field.name[0..struct_field.name.len].* ++ .{ 0 })[0..struct_field.name.len :0], &@field(material_variant, struct_field.name), 0.01, 0, std.math.inf(f32))) {
-                                    scene.world.materials.recordUpdateSingleVariant(&context, VariantType, command_buffer, material_idx, material_variant);
-                                    scene.camera.sensors.items[active_sensor].clear();
-                                },
-                                u32 => try imgui.textFmt("{s}: {}", .{ struct_field.name, @field(material_variant, struct_field.name) }),
-                                else => unreachable,
+                if (inspected.material) |material| if (inspected.variant) |*variant| {
+                    imgui.separatorText("material");
+                    try imgui.textFmt("normal: {}", .{material.normal});
+                    try imgui.textFmt("emissive: {}", .{material.emissive});
+                    try imgui.textFmt("type: {s}", .{@tagName(material.type)});
+                    inline for (@typeInfo(MaterialManager.MaterialType).Enum.fields, @typeInfo(MaterialManager.MaterialVariant).Union.fields) |enum_field, union_field| {
+                        const VariantType = union_field.type;
+                        if (VariantType != void and enum_field.value == @intFromEnum(material.type)) {
+                            const material_idx = Inspection.variantIndex(&scene, material, enum_field.name, VariantType);
+                            const material_variant = &@field(variant, union_field.name);
+                            inline for (@typeInfo(VariantType).Struct.fields) |struct_field| {
+                                switch (struct_field.type) {
+                                    f32 => if (imgui.dragScalar(f32, (struct_field.name[0..struct_field.name.len].* ++ .{ 0 })[0..struct_field.name.len :0], &@field(material_variant, struct_field.name), 0.01, 0, std.math.inf(f32))) {
+                                        scene.world.materials.recordUpdateSingleVariant(&context, VariantType, command_buffer, material_idx, material_variant.*);
+                                        scene.camera.sensors.items[active_sensor].clear();
+                                    },
+                                    u32 => try imgui.textFmt("{s}: {}", .{ struct_field.name, @field(material_variant, struct_field.name) }),
+                                    else => unreachable,
+                                }
                             }
                         }
                     }
+                };
+                if (inspected.instance) |*instance| {
+                    imgui.separatorText("transform");
+                    const old_transform: Mat3x4 = @bitCast(instance.transform);
+                    var translation = old_transform.extract_translation();
+                    imgui.pushItemWidth(imgui.getFontSize() * -6);
+                    if (imgui.dragVector(F32x3, "Translation", &translation, 0.1, -std.math.inf(f32), std.math.inf(f32))) {
+                        const new_transform = old_transform.with_translation(translation);
+                        scene.world.accel.recordUpdateSingleTransform(&context, command_buffer, object.instance_index, new_transform);
+                        const scope = commands.profiler.begin(&context, command_buffer, frame_ticket, "update TLAS");
+                        const scratch_buffer = try scene.world.accel.recordUpdateTlas(&context, &vk_allocator, allocator, command_buffer);
+                        if (scratch_buffer.handle != .null_handle) try destruction_queue.add(allocator, frame_ticket, scratch_buffer);
+                        commands.profiler.end(&context, command_buffer, scope);
+                        scene.camera.sensors.items[active_sensor].clear();
+                        instance.transform = @bitCast(new_transform);
+                    }
                 }
-                imgui.separatorText("transform");
-                const old_transform: Mat3x4 = @bitCast(instance.transform);
-                var translation = old_transform.extract_translation();
-                imgui.pushItemWidth(imgui.getFontSize() * -6);
-                if (imgui.dragVector(F32x3, "Translation", &translation, 0.1, -std.math.inf(f32), std.math.inf(f32))) {
-                    scene.world.accel.recordUpdateSingleTransform(&context, command_buffer, object.instance_index, old_transform.with_translation(translation));
-                    try scene.world.accel.recordRebuild(&context, command_buffer);
-                    scene.camera.sensors.items[active_sensor].clear();
-                }
+                if (inspected.pending != null) imgui.text("Reading back...");
             }
             imgui.popItemWidth();
         } else {
@@ -278,9 +322,10 @@ pub fn main() !void {
             const pos = window.getCursorPos();
             const x = @as(f32, @floatCast(pos.x)) / @as(f32, @floatFromInt(display.swapchain.extent.width));
             const y = @as(f32, @floatCast(pos.y)) / @as(f32, @floatFromInt(display.swapchain.extent.height));
-            current_clicked_object = try object_picker.getClickedObject(&context, F32x2.new(x, y), scene.camera, scene.world.accel.tlas_handle, scene.camera.sensors.items[active_sensor]);
-            const clicked_pixel = try sync_copier.copyImagePixel(&context, F32x4, scene.camera.sensors.items[active_sensor].image.handle, .transfer_src_optimal, vk.Offset3D { .x = @intFromFloat(pos.x), .y = @intFromFloat(pos.y), .z = 0 });
-            current_clicked_color = clicked_pixel.truncate();
+            // results come in a frame or two later, at the start of the loop
+            object_picker.recordPick(&context, command_buffer, frame_ticket, F32x2.new(x, y), scene.camera, scene.world.accel.tlas_handle, scene.camera.sensors.items[active_sensor]);
+            if (clicked_pixel_request) |request| readback.cancel(request);
+            clicked_pixel_request = try readback.recordCopyImagePixel(&context, command_buffer, frame_ticket, F32x4, scene.camera.sensors.items[active_sensor].image.handle, .transfer_src_optimal, vk.Offset3D { .x = @intFromFloat(pos.x), .y = @intFromFloat(pos.y), .z = 0 });
             has_clicked = true;
         }
 
@@ -298,7 +343,9 @@ pub fn main() !void {
             pipeline.recordPushConstants(&context, command_buffer, .{ .lens = scene.camera.lenses.items[0], .sample_count = scene.camera.sensors.items[active_sensor].sample_count });
 
             // trace some stuff
+            const scope = commands.profiler.begin(&context, command_buffer, frame_ticket, "trace rays");
             pipeline.recordTraceRays(&context, command_buffer, scene.camera.sensors.items[active_sensor].extent);
+            commands.profiler.end(&context, command_buffer, scope);
 
             // copy some stuff
             scene.camera.sensors.items[active_sensor].recordPrepareForCopy(&context, command_buffer, .{ .ray_tracing_shader_bit_khr = true }, .{ .blit_bit = true });
@@ -410,22 +457,52 @@ pub fn main() !void {
             .p_image_memory_barriers = &return_swap_image_memory_barriers,
         });
 
-        if (display.endFrame(&context)) |ok| {
+        if (display.endFrame(&context, &commands)) |ok| {
             // only update frame count if we presented successfully
             scene.camera.sensors.items[active_sensor].sample_count += pipeline_opts.samples_per_run;
             if (max_sample_count != 0) scene.camera.sensors.items[active_sensor].sample_count = @min(scene.camera.sensors.items[active_sensor].sample_count, max_sample_count);
             if (ok == vk.Result.suboptimal_khr) {
                 const new_extent = window.getExtent();
-                try display.recreate(&context, new_extent, &destruction_queue, allocator);
+                try display.recreate(&context, new_extent, &commands, &destruction_queue, allocator);
                 try gui.resize(&context, display.swapchain);
                 active_sensor = try scene.camera.appendSensor(&context, &vk_allocator, allocator, new_extent);
             }
         } else |err| if (err == error.OutOfDateKHR) {
             const new_extent = window.getExtent();
-            try display.recreate(&context, new_extent, &destruction_queue, allocator);
+            try display.recreate(&context, new_extent, &commands, &destruction_queue, allocator);
             try gui.resize(&context, display.swapchain);
             active_sensor = try scene.camera.appendSensor(&context, &vk_allocator, allocator, new_extent);
         } else return err;
+        std.debug.assert(commands.last_ticket == frame_ticket);
+
+        if (rebuild_requested) {
+            rebuild_requested = false;
+            const start = try std.time.Instant.now();
+            if (pipeline.recreate(&context, &vk_allocator, allocator, &commands, pipeline_opts)) |old_pipeline| {
+                // frames still in flight may be using it
+                try destruction_queue.add(allocator, frame_ticket, old_pipeline);
+                const elapsed = (try std.time.Instant.now()).since(start) / std.time.ns_per_ms;
+                rebuild_label = try std.fmt.bufPrintZ(&rebuild_label_buffer, "Rebuild ({d}ms)", .{elapsed});
+                rebuild_error = false;
+                mesh_light_tree = pipeline_opts.mesh_light_tree;
+                scene.camera.sensors.items[active_sensor].clear();
+            } else |err| if (err == error.ShaderCompileFail) {
+                rebuild_error = true;
+                rebuild_label = try std.fmt.bufPrintZ(&rebuild_label_buffer, "Rebuild (error)", .{});
+            } else return err;
+        }
+
+        // light sampling catches up with instances dragged this frame in time for the next,
+        // as it has to go through commands -- until then it's only less well importance sampled
+        //
+        // after any rebuild, so a pipeline newly sampling with the light tree never sees a stale one
+        if (scene.world.accel.needsEmitterUpdate(mesh_light_tree)) {
+            try commands.startRecording(&context);
+            const scope = commands.beginScope(&context, "update emitters");
+            try scene.world.accel.recordUpdateEmitters(&context, &vk_allocator, allocator, &commands, scene.world.meshes, mesh_light_tree);
+            commands.endScope(&context, scope);
+            _ = try commands.submit(&context);
+        }
 
         window.pollEvents();
     }
@@ -434,6 +511,78 @@ pub fn main() !void {
     std.log.info("Program completed!", .{});
 }
 
+// what's known of the clicked object, read back over a few frames
+// as each piece that the next depends on comes in
+const Inspection = struct {
+    object: ObjectPicker.ClickedObject,
+    instance: ?vk.AccelerationStructureInstanceKHR = null,
+    geometry: ?Accel.Geometry = null,
+    material: ?MaterialManager.Material = null,
+    variant: ?MaterialManager.MaterialVariant = null,
+
+    // for the first of the above that isn't known yet
+    pending: ?Readback.Request = null,
+
+    fn geometryIndex(self: *const Inspection) u32 {
+        return self.instance.?.instance_custom_index_and_mask.instance_custom_index + self.object.geometry_index;
+    }
+
+    fn variantIndex(scene: *const Scene, material: MaterialManager.Material, comptime name: []const u8, comptime VariantType: type) u32 {
+        return @intCast((material.addr - @field(scene.world.materials.variant_buffers, name).addr) / @sizeOf(VariantType));
+    }
+
+    // takes the pending readback if it's done, then records the next one
+    //
+    // command_buffer must be submitted with ticket
+    fn advance(self: *Inspection, vc: *const VulkanContext, readback: *Readback, scene: *const Scene, command_buffer: vk.CommandBuffer, ticket: Commands.Ticket, completed: Commands.Ticket) !void {
+        if (self.pending) |request| {
+            if (self.instance == null) {
+                self.instance = readback.get(vk.AccelerationStructureInstanceKHR, request, completed) orelse return;
+            } else if (self.geometry == null) {
+                self.geometry = readback.get(Accel.Geometry, request, completed) orelse return;
+            } else if (self.material == null) {
+                self.material = readback.get(MaterialManager.Material, request, completed) orelse return;
+            } else inline for (@typeInfo(MaterialManager.MaterialType).Enum.fields, @typeInfo(MaterialManager.MaterialVariant).Union.fields) |enum_field, union_field| {
+                if (union_field.type != void and enum_field.value == @intFromEnum(self.material.?.type)) {
+                    const variant = readback.get(union_field.type, request, completed) orelse return;
+                    self.variant = @unionInit(MaterialManager.MaterialVariant, union_field.name, variant);
+                }
+            }
+            self.pending = null;
+        }
+
+        if (self.instance == null) {
+            self.pending = try readback.recordCopyBufferItem(vc, command_buffer, ticket, vk.AccelerationStructureInstanceKHR, scene.world.accel.instances_device.buffer, self.object.instance_index);
+        } else if (self.geometry == null) {
+            self.pending = try readback.recordCopyBufferItem(vc, command_buffer, ticket, Accel.Geometry, scene.world.accel.geometries.buffer, self.geometryIndex());
+        } else if (self.material == null) {
+            self.pending = try readback.recordCopyBufferItem(vc, command_buffer, ticket, MaterialManager.Material, scene.world.materials.materials.buffer, self.geometry.?.material);
+        } else if (self.variant == null) inline for (@typeInfo(MaterialManager.MaterialType).Enum.fields, @typeInfo(MaterialManager.MaterialVariant).Union.fields) |enum_field, union_field| {
+            const VariantType = union_field.type;
+            if (enum_field.value == @intFromEnum(self.material.?.type)) {
+                if (VariantType == void) {
+                    self.variant = @unionInit(MaterialManager.MaterialVariant, union_field.name, {});
+                } else {
+                    const material_idx = variantIndex(scene, self.material.?, enum_field.name, VariantType);
+                    self.pending = try readback.recordCopyBufferItem(vc, command_buffer, ticket, VariantType, @field(scene.world.materials.variant_buffers, enum_field.name).buffer.buffer, material_idx);
+                }
+            }
+        };
+    }
+
+    // after the geometry's material changed, so it and its variant need reading again
+    fn invalidateMaterial(self: *Inspection, readback: *Readback) void {
+        self.cancel(readback);
+        self.material = null;
+        self.variant = null;
+    }
+
+    fn cancel(self: *Inspection, readback: *Readback) void {
+        if (self.pending) |request| readback.cancel(request);
+        self.pending = null;
+    }
+};
+
 const WindowData = struct {
     camera: *Camera,
     active_sensor: *u32,
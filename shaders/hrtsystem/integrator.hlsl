@@ -74,6 +74,8 @@ struct PathTracingIntegrator : Integrator {
         uint bounceCount = 0;
         float lastMaterialPdf;
         bool isLastMaterialDelta = false;
+        float3 lastPositionWs; // where light was sampled from, for MIS
+        float3 lastTriangleNormalDirWs;
 
         // main path tracing loop
         for (Intersection its = Intersection::find(scene.tlas, ray); its.hit(); its = Intersection::find(scene.tlas, ray)) {
@@ -114,10 +116,9 @@ struct PathTracingIntegrator : Integrator {
                 }
             } else if (geometry.sampled) {
                 // MIS emissive light if it is sampled at later bounces
-                float sum = scene.meshLights.aliasTable[0].select;
-                float lightPdf = areaMeasureToSolidAngleMeasure(attrs.position, ray.Origin, ray.Direction, attrs.triangleFrame.n) / sum;
-
-                if (lightPdf > 0.0) {
+                if (dot(outgoingDirWs, attrs.triangleFrame.n) > 0.0) {
+                    // the light tree may give zero pdf to lights that are hit, in which case MIS weight is one
+                    float lightPdf = areaMeasureToSolidAngleMeasure(attrs.position, ray.Origin, ray.Direction, attrs.triangleFrame.n) * scene.meshLights.areaPdf(lastPositionWs, lastTriangleNormalDirWs, instanceID, its.geometryIndex, its.primitiveIndex);
                     float weight = powerHeuristic(1, lastMaterialPdf, mesh_samples_per_bounce, lightPdf);
                     accumulatedColor += throughput * emissiveLight * weight;
                 }
@@ -154,6 +155,8 @@ struct PathTracingIntegrator : Integrator {
             MaterialSample sample = material.sample(outgoingDirSs, float2(rng.getFloat(), rng.getFloat()));
             if (sample.pdf == 0.0) return accumulatedColor;
             lastMaterialPdf = sample.pdf;
+            lastPositionWs = attrs.position;
+            lastTriangleNormalDirWs = attrs.triangleFrame.n;
 
             // set up info for next bounce
             ray.Direction = shadingFrame.frameToWorld(sample.dirFs);
@@ -115,18 +115,164 @@ struct LightAliasData {
     uint primitiveIndex;
 };
 
+// returns cos(a - b), clamped to 1 if a < b
+float cosSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 1.0 : cosA * cosB + sinA * sinB;
+}
+
+// returns sin(a - b), clamped to 0 if a < b
+float sinSubClamped(float sinA, float cosA, float sinB, float cosB) {
+    return cosA > cosB ? 0.0 : sinA * cosB - cosA * sinB;
+}
+
+struct LightTreeNode { // same required by host
+    float3 boundsMin;
+    float power;
+    float3 boundsMax;
+    float cosThetaO; // of cone around axis bounding normals
+    float3 axis;
+    uint link; // top bit set for leaves, rest is index of triangle if leaf, otherwise of second child
+
+    bool isLeaf() {
+        return (link >> 31) != 0;
+    }
+
+    uint index() {
+        return link & 0x7FFFFFFF;
+    }
+
+    // how much light this node might send to a point, up to a constant
+    // lights only emit from their front face, so emission is bounded by a hemisphere around the cone
+    // https://pbr-book.org/4ed/Light_Sources/Light_Sampling#CompactLightBounds::Importance
+    float importance(float3 positionWs, float3 normalWs) {
+        if (power == 0.0) return 0.0;
+
+        float3 center = (boundsMin + boundsMax) / 2.0;
+        float distanceSquared = dot(positionWs - center, positionWs - center);
+        float3 dirWs = normalize(positionWs - center);
+
+        // angle between axis and direction to point
+        float cosThetaW = dot(axis, dirWs);
+        float sinThetaW = safeSqrt(1.0 - cosThetaW * cosThetaW);
+
+        // angle subtended by bounds from point
+        float radiusSquared = dot(boundsMax - center, boundsMax - center);
+        float cosThetaB = -1.0;
+        float sinThetaB = 0.0;
+        if (distanceSquared >= radiusSquared) {
+            float sin2ThetaB = radiusSquared / distanceSquared;
+            cosThetaB = safeSqrt(1.0 - sin2ThetaB);
+            sinThetaB = sqrt(sin2ThetaB);
+        }
+
+        // smallest angle between direction to point and any normal
+        float sinThetaO = safeSqrt(1.0 - cosThetaO * cosThetaO);
+        float cosThetaX = cosSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        float sinThetaX = sinSubClamped(sinThetaW, cosThetaW, sinThetaO, cosThetaO);
+        float cosThetaP = cosSubClamped(sinThetaX, cosThetaX, sinThetaB, cosThetaB);
+        if (cosThetaP <= 0.0) return 0.0;
+
+        // smallest angle between normal at point and direction to any part of bounds
+        float cosThetaI = abs(dot(dirWs, normalWs));
+        float sinThetaI = safeSqrt(1.0 - cosThetaI * cosThetaI);
+        float cosThetaPI = cosSubClamped(sinThetaI, cosThetaI, sinThetaB, cosThetaB);
+
+        return max(power * cosThetaP * cosThetaPI / max(distanceSquared, length(boundsMax - boundsMin) / 2.0), 0.0);
+    }
+};
+
 // all mesh lights in scene
 struct MeshLights : Light {
     StructuredBuffer<AliasEntry<LightAliasData> > aliasTable;
+    StructuredBuffer<LightTreeNode> lightTree;
+    StructuredBuffer<uint> lightTreeLookup;
+    bool useLightTree;
     World world;
 
-    static MeshLights create(StructuredBuffer<AliasEntry<LightAliasData> > aliasTable, World world) {
+    static MeshLights create(StructuredBuffer<AliasEntry<LightAliasData> > aliasTable, StructuredBuffer<LightTreeNode> lightTree, StructuredBuffer<uint> lightTreeLookup, bool useLightTree, World world) {
         MeshLights lights;
         lights.aliasTable = aliasTable;
+        lights.lightTree = lightTree;
+        lights.lightTreeLookup = lightTreeLookup;
+        lights.useLightTree = useLightTree;
         lights.world = world;
         return lights;
     }
 
+    // picks a leaf by flipping a coin weighted by child importance at each node, remaps rand
+    // returns probability of picking it, zero if nothing could be picked
+    float sampleLightTree(float3 positionWs, float3 normalWs, inout float rand, out LightTreeNode leaf) {
+        LightTreeNode node = lightTree[0];
+        if (node.importance(positionWs, normalWs) == 0.0) return 0.0;
+
+        float pmf = 1.0;
+        uint nodeIndex = 0;
+        while (!node.isLeaf()) {
+            LightTreeNode first = lightTree[nodeIndex + 1];
+            LightTreeNode second = lightTree[node.index()];
+            float firstImportance = first.importance(positionWs, normalWs);
+            float secondImportance = second.importance(positionWs, normalWs);
+            if (firstImportance + secondImportance == 0.0) return 0.0;
+
+            float pSecond = secondImportance / (firstImportance + secondImportance);
+            if (coinFlipRemap(pSecond, rand)) {
+                pmf *= pSecond;
+                nodeIndex = node.index();
+                node = second;
+            } else {
+                pmf *= 1.0 - pSecond;
+                nodeIndex = nodeIndex + 1;
+                node = first;
+            }
+        }
+
+        leaf = node;
+        return pmf;
+    }
+
+    // probability of sampleLightTree picking the leaf at the end of trail
+    float lightTreePmf(float3 positionWs, float3 normalWs, uint trail, out LightTreeNode leaf) {
+        LightTreeNode node = lightTree[0];
+        if (node.importance(positionWs, normalWs) == 0.0) return 0.0;
+
+        float pmf = 1.0;
+        uint nodeIndex = 0;
+        while (!node.isLeaf()) {
+            LightTreeNode first = lightTree[nodeIndex + 1];
+            LightTreeNode second = lightTree[node.index()];
+            float firstImportance = first.importance(positionWs, normalWs);
+            float secondImportance = second.importance(positionWs, normalWs);
+            if (firstImportance + secondImportance == 0.0) return 0.0;
+
+            if ((trail & 1) != 0) {
+                pmf *= secondImportance / (firstImportance + secondImportance);
+                nodeIndex = node.index();
+                node = second;
+            } else {
+                pmf *= firstImportance / (firstImportance + secondImportance);
+                nodeIndex = nodeIndex + 1;
+                node = first;
+            }
+            trail >>= 1;
+        }
+
+        leaf = node;
+        return pmf;
+    }
+
+    // pdf with respect to area of sample picking the given point on the given triangle,
+    // which must be part of a sampled geometry
+    float areaPdf(float3 positionWs, float3 triangleNormalDirWs, uint instanceID, uint geometryIndex, uint primitiveIndex) {
+        if (useLightTree) {
+            uint trail = lightTreeLookup[lightTreeLookup[instanceID + geometryIndex] + primitiveIndex];
+            LightTreeNode leaf;
+            float pmf = lightTreePmf(positionWs, triangleNormalDirWs, trail, leaf);
+            return pmf > 0.0 ? pmf / leaf.power : 0.0;
+        } else {
+            return 1.0 / aliasTable[0].select;
+        }
+    }
+
     LightSample sample(RaytracingAccelerationStructure accel, float3 positionWs, float3 triangleNormalDirWs, float2 rand) {
         LightSample lightSample;
         lightSample.pdf = 0.0;
@@ -135,8 +281,19 @@ struct MeshLights : Light {
         float sum = aliasTable[0].select;
         if (entryCount == 0 || sum == 0) return lightSample;
 
-        uint idx;
-        LightAliasData data = sampleAlias<LightAliasData, AliasEntry<LightAliasData> >(aliasTable, entryCount, 1, rand.x, idx);
+        LightAliasData data;
+        float pdfWrtArea;
+        if (useLightTree) {
+            LightTreeNode leaf;
+            float pmf = sampleLightTree(positionWs, triangleNormalDirWs, rand.x, leaf);
+            if (pmf == 0.0) return lightSample;
+            data = aliasTable[1 + leaf.index()].data; // skip header
+            pdfWrtArea = pmf / leaf.power;
+        } else {
+            uint idx;
+            data = sampleAlias<LightAliasData, AliasEntry<LightAliasData> >(aliasTable, entryCount, 1, rand.x, idx);
+            pdfWrtArea = 1.0 / sum;
+        }
         uint instanceID = world.instances[data.instanceIndex].instanceID();
 
         float2 barycentrics = squareToTriangle(rand);
@@ -144,7 +301,7 @@ struct MeshLights : Light {
 
         lightSample.radiance = getEmissive(world, world.materialIdx(instanceID, data.geometryIndex), attrs.texcoord);
         lightSample.dirWs = normalize(attrs.position - positionWs);
-        lightSample.pdf = areaMeasureToSolidAngleMeasure(attrs.position, positionWs, lightSample.dirWs, attrs.triangleFrame.n) / sum;
+        lightSample.pdf = areaMeasureToSolidAngleMeasure(attrs.position, positionWs, lightSample.dirWs, attrs.triangleFrame.n) * pdfWrtArea;
 
         // compute precise ray endpoints
         float3 offsetLightPositionWs = offsetAlongNormal(attrs.position, attrs.triangleFrame.n);
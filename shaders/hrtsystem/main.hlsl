@@ -11,17 +11,19 @@
 [[vk::binding(1, 1)]] StructuredBuffer<Instance> dInstances;
 [[vk::binding(2, 1)]] StructuredBuffer<row_major float3x4> dWorldToInstance;
 [[vk::binding(3, 1)]] StructuredBuffer<AliasEntry<LightAliasData> > dEmitterAliasTable;
-[[vk::binding(4, 1)]] StructuredBuffer<Mesh> dMeshes;
-[[vk::binding(5, 1)]] StructuredBuffer<Geometry> dGeometries;
-[[vk::binding(6, 1)]] StructuredBuffer<MaterialVariantData> dMaterials;
+[[vk::binding(4, 1)]] StructuredBuffer<LightTreeNode> dEmitterLightTree;
+[[vk::binding(5, 1)]] StructuredBuffer<uint> dEmitterLightTreeLookup;
+[[vk::binding(6, 1)]] StructuredBuffer<Mesh> dMeshes;
+[[vk::binding(7, 1)]] StructuredBuffer<Geometry> dGeometries;
+[[vk::binding(8, 1)]] StructuredBuffer<MaterialVariantData> dMaterials;
 
 // BACKGROUND
-[[vk::combinedImageSampler]] [[vk::binding(7, 1)]] Texture2D<float3> dBackgroundRgbTexture;
-[[vk::combinedImageSampler]] [[vk::binding(7, 1)]] SamplerState dBackgroundSampler;
-[[vk::binding(8, 1)]] Texture2D<float> dBackgroundLuminanceTexture;
+[[vk::combinedImageSampler]] [[vk::binding(9, 1)]] Texture2D<float3> dBackgroundRgbTexture;
+[[vk::combinedImageSampler]] [[vk::binding(9, 1)]] SamplerState dBackgroundSampler;
+[[vk::binding(10, 1)]] Texture2D<float> dBackgroundLuminanceTexture;
 
 // OUTPUT
-[[vk::binding(9, 1)]] RWTexture2D<float4> dOutputImage;
+[[vk::binding(11, 1)]] RWTexture2D<float4> dOutputImage;
 
 // PUSH CONSTANTS
 struct PushConsts {
@@ -38,6 +40,7 @@ struct PushConsts {
 [[vk::constant_id(4)]] const bool flip_image = true;
 [[vk::constant_id(5)]] const bool indexed_attributes = true;    // whether non-position vertex attributes are indexed
 [[vk::constant_id(6)]] const bool two_component_normal_texture = true;  // whether normal textures are two or three component vectors
+[[vk::constant_id(7)]] const bool mesh_light_tree = true;       // whether emissive meshes are sampled with the light tree rather than the alias table
 
 // https://www.nu42.com/2015/03/how-you-average-numbers.html
 void storeColor(float3 sampledColor) {
@@ -75,7 +78,7 @@ void raygen() {
     scene.tlas = dTLAS;
     scene.world = world;
     scene.envMap = EnvMap::create(dBackgroundRgbTexture, dBackgroundSampler, dBackgroundLuminanceTexture);
-    scene.meshLights = MeshLights::create(dEmitterAliasTable, world);
+    scene.meshLights = MeshLights::create(dEmitterAliasTable, dEmitterLightTree, dEmitterLightTreeLookup, mesh_light_tree, world);
 
     // the result that we write to our buffer
     float3 color = float3(0.0, 0.0, 0.0);
@@ -0,0 +1,56 @@
+#include "../utils/helpers.hlsl"
+
+// must match SensorFormat in hydra.zig
+// f32x4 is copied straight from the sensor so never gets here
+static const uint FORMAT_F16X4 = 1;
+static const uint FORMAT_U8X4 = 2;
+static const uint FORMAT_U8X4_SRGB = 3;
+
+[[vk::binding(0, 0)]] RWTexture2D<float4> srcImage;
+[[vk::binding(1, 0)]] RWStructuredBuffer<uint> dstBuffer;
+
+struct PushConsts {
+	uint format;
+	float exposure; // in stops, only applied to 8 bit formats
+};
+[[vk::push_constant]] PushConsts pushConsts;
+
+// https://knarkowicz.wordpress.com/2016/01/06/aces-filmic-tone-mapping-curve/
+float3 tonemapACES(float3 x) {
+	const float a = 2.51;
+	const float b = 0.03;
+	const float c = 2.43;
+	const float d = 0.59;
+	const float e = 0.14;
+	return saturate((x * (a * x + b)) / (x * (c * x + d) + e));
+}
+
+float3 linearToSrgb(float3 x) {
+	return select(x <= 0.0031308, x * 12.92, 1.055 * pow(x, 1.0 / 2.4) - 0.055);
+}
+
+uint packUnorm4x8(float4 x) {
+	const uint4 bytes = uint4(round(saturate(x) * 255.0));
+	return bytes.x | (bytes.y << 8) | (bytes.z << 16) | (bytes.w << 24);
+}
+
+[numthreads(8, 8, 1)]
+void main(uint3 dispatchXYZ: SV_DispatchThreadID) {
+	const uint2 pixelIndex = dispatchXYZ.xy;
+	const uint2 imageSize = textureDimensions(srcImage);
+
+	if (any(pixelIndex >= imageSize)) return;
+
+	const float4 color = srcImage[pixelIndex];
+	const uint flatIndex = pixelIndex.y * imageSize.x + pixelIndex.x;
+
+	if (pushConsts.format == FORMAT_F16X4) {
+		const uint4 halves = f32tof16(color);
+		dstBuffer[flatIndex * 2 + 0] = halves.x | (halves.y << 16);
+		dstBuffer[flatIndex * 2 + 1] = halves.z | (halves.w << 16);
+	} else {
+		float3 mapped = tonemapACES(color.rgb * exp2(pushConsts.exposure));
+		if (pushConsts.format == FORMAT_U8X4_SRGB) mapped = linearToSrgb(mapped);
+		dstBuffer[flatIndex] = packUnorm4x8(float4(mapped, 1.0));
+	}
+}
@@ -20,6 +20,11 @@ float luminance(float3 color) {
            0.0722 * color.b;
 }
 
+// sqrt that tolerates slightly negative inputs from rounding
+float safeSqrt(float x) {
+    return sqrt(max(x, 0.0));
+}
+
 float3 faceForward(float3 n, float3 d) {
     return dot(n, d) > 0 ? n : -n;
 }